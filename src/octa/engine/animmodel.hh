@@ -1442,6 +1442,7 @@ struct animmodel : model
         vector<BIH::mesh> meshes;
         genBIH(meshes);
         bih = new BIH(meshes);
+        if(dbgbih) bih->printstats(name);
         return bih;
     }
 
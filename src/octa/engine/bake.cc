@@ -0,0 +1,197 @@
+// bake.cc: headless batch baking of maps, without a window, GL context or scripting
+
+#include "engine.hh"
+
+#ifndef WIN32
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#include "ostd/filesystem.hh"
+
+extern int pvsthreads;
+
+static int parsebakestages(const char *list)
+{
+    int stages = 0;
+    while(*list)
+    {
+        int len = strcspn(list, ","), stage = 0;
+        for(; stage < NUMBAKESTAGES; stage++)
+        {
+            if(int(strlen(bakestagenames[stage])) == len && !strncmp(bakestagenames[stage], list, len)) break;
+        }
+        if(stage == BAKESTAGE_LOAD || stage == BAKESTAGE_SAVE || stage >= NUMBAKESTAGES)
+        {
+            conoutf(CON_ERROR, "unknown bake stage: %.*s", len, list);
+            return -1;
+        }
+        stages |= 1<<stage;
+        list += len;
+        if(*list) list++;
+    }
+    return stages;
+}
+
+static void putjsonstring(vector<char> &buf, const char *str)
+{
+    buf.add('"');
+    for(; *str; str++)
+    {
+        uchar c = *str;
+        if(c == '"' || c == '\\') { buf.add('\\'); buf.add(c); }
+        else if(c < 0x20)
+        {
+            defformatstring(esc, "\\u%04x", c);
+            buf.put(esc, strlen(esc));
+        }
+        else buf.add(c);
+    }
+    buf.add('"');
+}
+
+static void putjsonf(vector<char> &buf, const char *fmt, ...) PRINTFARGS(2, 3);
+static void putjsonf(vector<char> &buf, const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    string field;
+    vformatstring(field, fmt, args);
+    va_end(args);
+    buf.put(field, strlen(field));
+}
+
+// timings go out as one JSON object per line, written in a single call so
+// concurrent bake workers sharing the output never interleave
+static void writebaketimes(FILE *f, const char *mname, bool ok, const int *millis, int total)
+{
+    vector<char> line;
+    putjsonf(line, "{\"map\":");
+    putjsonstring(line, mname);
+    putjsonf(line, ",\"ok\":%s", ok ? "true" : "false");
+    loopi(NUMBAKESTAGES) putjsonf(line, ",\"%s\":%d", bakestagenames[i], millis[i]);
+    putjsonf(line, ",\"total\":%d}\n", total);
+    fwrite(line.getbuf(), 1, line.length(), f);
+    fflush(f);
+}
+
+static bool bakeone(const char *mname, int stages, int viewcellsize, FILE *times)
+{
+    int millis[NUMBAKESTAGES], start = SDL_GetTicks();
+    bool ok = bakemap(mname, stages, viewcellsize, millis);
+    writebaketimes(times, mname, ok, millis, SDL_GetTicks() - start);
+    return ok;
+}
+
+int main(int argc, char **argv)
+{
+    setlogfile(NULL);
+
+    initing = INIT_RESET;
+
+    /* make sure the path is correct */
+    if (!fileexists("config", "r")) {
+        if (!ostd::directory_change("..")) fatal("unable to change directory!");
+    }
+
+    char *loglevel = (char*)"WARNING";
+    const char *stagelist = "blendmap,pvs", *timesname = NULL;
+    int jobs = 1, viewcellsize = 0;
+    vector<const char *> maps;
+    for(int i = 1; i<argc; i++)
+    {
+        if(argv[i][0]=='-') switch(argv[i][1])
+        {
+            case 'u':
+            {
+                const char *dir = sethomedir(&argv[i][2]);
+                if(dir) logoutf("Using home directory: %s", dir);
+                break;
+            }
+            case 'k':
+            {
+                const char *dir = addpackagedir(&argv[i][2]);
+                if(dir) logoutf("Adding package directory: %s", dir);
+                break;
+            }
+            case 'g': loglevel = &argv[i][2]; break;
+            case 'j': jobs = max(atoi(&argv[i][2]), 1); break;
+            case 's': stagelist = &argv[i][2]; break;
+            case 'c': viewcellsize = atoi(&argv[i][2]); break;
+            case 't': timesname = &argv[i][2]; break;
+            default: conoutf(CON_ERROR, "unknown command-line option: %s", argv[i]); break;
+        }
+        else maps.add(argv[i]);
+    }
+
+    logger::setlevel(loglevel);
+
+    int stages = parsebakestages(stagelist);
+    if(stages < 0) return EXIT_FAILURE;
+    if(maps.empty())
+    {
+        logoutf("usage: %s [-u<homedir>] [-k<packagedir>] [-j<jobs>] [-s<stage,...>] [-c<viewcellsize>] [-t<timingsfile>] map...", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    FILE *times = stdout;
+    if(timesname)
+    {
+        const char *fname = findfile(timesname, "w");
+        times = fname ? fopen(fname, "w") : NULL;
+        if(!times) fatal("could not open timings file %s", timesname);
+    }
+
+    numcpus = clamp(SDL_GetCPUCount(), 1, 64);
+    jobs = min(jobs, maps.length());
+    // split the cores between maps baked side by side
+    if(jobs > 1 && !pvsthreads) pvsthreads = max(numcpus/jobs, 1);
+
+    int failed = 0, start = SDL_GetTicks();
+#ifndef WIN32
+    if(jobs > 1)
+    {
+        // world state is global, so each map is baked in its own process
+        int next = 0, running = 0;
+        while(next < maps.length() || running > 0)
+        {
+            if(next < maps.length() && running < jobs)
+            {
+                fflush(NULL);
+                pid_t pid = fork();
+                if(!pid)
+                {
+                    if(SDL_Init(SDL_INIT_TIMER)<0) fatal("Unable to initialize SDL: %s", SDL_GetError());
+                    bool ok = bakeone(maps[next], stages, viewcellsize, times);
+                    fflush(NULL);
+                    _exit(ok ? EXIT_SUCCESS : EXIT_FAILURE);
+                }
+                if(pid < 0)
+                {
+                    conoutf(CON_ERROR, "could not start bake worker for %s", maps[next]);
+                    failed++;
+                }
+                else running++;
+                next++;
+                continue;
+            }
+            int status;
+            if(wait(&status) < 0) break;
+            running--;
+            if(!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) failed++;
+        }
+    }
+    else
+#endif
+    {
+        if(SDL_Init(SDL_INIT_TIMER)<0) fatal("Unable to initialize SDL: %s", SDL_GetError());
+        loopv(maps) if(!bakeone(maps[i], stages, viewcellsize, times)) failed++;
+        SDL_Quit();
+    }
+
+    defformatstring(summary, "{\"maps\":%d,\"failed\":%d,\"jobs\":%d,\"total\":%d}\n", maps.length(), failed, jobs, int(SDL_GetTicks() - start));
+    fputs(summary, times);
+    if(times != stdout) fclose(times);
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -1,6 +1,11 @@
 #include "engine.hh"
 
-extern vec hitsurface;
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+  #define BIHSIMD 1
+  #include <emmintrin.h>
+#endif
+
+extern thread_local vec hitsurface;
 
 bool BIH::triintersect(const mesh &m, int tidx, const vec &mo, const vec &mray, float maxdist, float &dist, int mode)
 {
@@ -31,15 +36,17 @@ bool BIH::triintersect(const mesh &m, int tidx, const vec &mo, const vec &mray,
     return true;
 }
 
+template<class N>
 struct traversestate
 {
-    BIH::node *node;
+    N *node;
     float tmin, tmax;
 };
 
-inline bool BIH::traverse(const mesh &m, const vec &o, const vec &ray, const vec &invray, float maxdist, float &dist, int mode, node *curnode, float tmin, float tmax)
+template<class N>
+inline bool BIH::traverse(const mesh &m, const vec &o, const vec &ray, const vec &invray, float maxdist, float &dist, int mode, N *curnode, float tmin, float tmax)
 {
-    traversestate stack[128];
+    traversestate<N> stack[128];
     int stacksize = 0;
     ivec order(ray.x>0 ? 0 : 1, ray.y>0 ? 0 : 1, ray.z>0 ? 0 : 1);
     vec mo = m.invxform.transform(o), mray = m.invxformnorm.transform(ray);
@@ -85,7 +92,7 @@ inline bool BIH::traverse(const mesh &m, const vec &o, const vec &ray, const vec
                 {
                     if(stacksize < int(sizeof(stack)/sizeof(stack[0])))
                     {
-                        traversestate &save = stack[stacksize++];
+                        traversestate<N> &save = stack[stacksize++];
                         save.node = curnode + curnode->childindex(faridx);
                         save.tmin = max(tmin, farsplit);
                         save.tmax = tmax;
@@ -105,7 +112,7 @@ inline bool BIH::traverse(const mesh &m, const vec &o, const vec &ray, const vec
             continue;
         }
         if(stacksize <= 0) return false;
-        traversestate &restore = stack[--stacksize];
+        traversestate<N> &restore = stack[--stacksize];
         curnode = restore.node;
         tmin = restore.tmin;
         tmax = restore.tmax;
@@ -130,20 +137,99 @@ inline bool BIH::traverse(const vec &o, const vec &ray, float maxdist, float &di
         t2 = (m.bbmax.z - o.z)*invray.z;
         if(invray.z > 0) { tmin = max(tmin, t1); tmax = min(tmax, t2); } else { tmin = max(tmin, t2); tmax = min(tmax, t1); }
         tmax = min(tmax, maxdist);
-        if(tmin < tmax && traverse(m, o, ray, invray, maxdist, dist, mode, m.nodes, tmin, tmax)) return true;
+        if(tmin >= tmax) continue;
+        if(m.widenodes ? traverse(m, o, ray, invray, maxdist, dist, mode, m.widenodes, tmin, tmax) :
+                         traverse(m, o, ray, invray, maxdist, dist, mode, m.nodes, tmin, tmax))
+            return true;
     }
     return false;
 }
 
-void BIH::build(mesh &m, ushort *indices, int numindices, const ivec &vmin, const ivec &vmax)
+// binned surface area heuristic: triangles are sorted into bins by their
+// center along each axis and the partition between two bins that minimizes
+// the area weighted triangle counts of the two children wins
+
+VAR(bihsah, 0, 1, 1);
+VAR(dbgbih, 0, 0, 1);
+
+#define BIHSAHBINS 16
+
+static inline float boxarea(const ivec &bmin, const ivec &bmax)
+{
+    vec size = vec(bmax).sub(vec(bmin));
+    return size.x*size.y + size.y*size.z + size.z*size.x;
+}
+
+struct sahbin
+{
+    ivec bmin, bmax;
+    int count;
+
+    void reset() { bmin = ivec(INT_MAX, INT_MAX, INT_MAX); bmax = ivec(INT_MIN, INT_MIN, INT_MIN); count = 0; }
+    void add(const ivec &tmin, const ivec &tmax) { bmin.min(tmin); bmax.max(tmax); count++; }
+    void add(const sahbin &b) { bmin.min(b.bmin); bmax.max(b.bmax); count += b.count; }
+    float cost() const { return count ? boxarea(bmin, bmax)*count : 0; }
+};
+
+static int sahpartition(const BIH::tribb *tribbs, uint *indices, int numindices, int &axis)
+{
+    ivec cmin(INT_MAX, INT_MAX, INT_MAX), cmax(INT_MIN, INT_MIN, INT_MIN);
+    loopi(numindices)
+    {
+        ivec c(tribbs[indices[i]].center);
+        cmin.min(c);
+        cmax.max(c);
+    }
+    int bestaxis = -1, bestbin = -1;
+    float bestcost = 1e30f;
+    loopk(3)
+    {
+        int extent = cmax[k] - cmin[k];
+        if(extent <= 0) continue;
+        sahbin bins[BIHSAHBINS], right[BIHSAHBINS];
+        loopj(BIHSAHBINS) bins[j].reset();
+        loopi(numindices)
+        {
+            const BIH::tribb &tri = tribbs[indices[i]];
+            int bin = min(int((llong(tri.center[k] - cmin[k])*BIHSAHBINS)/(extent+1)), BIHSAHBINS-1);
+            bins[bin].add(ivec(tri.center).sub(ivec(tri.radius)), ivec(tri.center).add(ivec(tri.radius)));
+        }
+        right[BIHSAHBINS-1] = bins[BIHSAHBINS-1];
+        for(int j = BIHSAHBINS-2; j > 0; j--) { right[j] = right[j+1]; right[j].add(bins[j]); }
+        sahbin left;
+        left.reset();
+        loopj(BIHSAHBINS-1)
+        {
+            left.add(bins[j]);
+            if(!left.count || !right[j+1].count) continue;
+            float cost = left.cost() + right[j+1].cost();
+            if(cost < bestcost) { bestcost = cost; bestaxis = k; bestbin = j; }
+        }
+    }
+    if(bestaxis < 0) return 0;
+
+    axis = bestaxis;
+    int extent = cmax[axis] - cmin[axis], left = 0;
+    loopi(numindices)
+    {
+        int bin = min(int((llong(tribbs[indices[i]].center[axis] - cmin[axis])*BIHSAHBINS)/(extent+1)), BIHSAHBINS-1);
+        if(bin <= bestbin) swap(indices[left++], indices[i]);
+    }
+    return left;
+}
+
+template<class N>
+void BIH::build(mesh &m, N *nodes, uint *indices, int numindices, const ivec &vmin, const ivec &vmax, int depth)
 {
     int axis = 2;
     loopk(2) if(vmax[k] - vmin[k] > vmax[axis] - vmin[axis]) axis = k;
 
     ivec leftmin, leftmax, rightmin, rightmax;
     int splitleft, splitright;
-    int left, right;
-    loopk(3)
+    int left = 0, right = numindices;
+    bool sah = bihsah && numindices > 2;
+    if(sah) left = right = sahpartition(m.tribbs, indices, numindices, axis);
+    else loopk(3)
     {
         leftmin = rightmin = ivec(INT_MAX, INT_MAX, INT_MAX);
         leftmax = rightmax = ivec(INT_MIN, INT_MIN, INT_MIN);
@@ -174,11 +260,11 @@ void BIH::build(mesh &m, ushort *indices, int numindices, const ivec &vmin, cons
         axis = (axis+1)%3;
     }
 
-    if(!left || right==numindices)
+    if(sah || !left || right==numindices)
     {
         leftmin = rightmin = ivec(INT_MAX, INT_MAX, INT_MAX);
         leftmax = rightmax = ivec(INT_MIN, INT_MIN, INT_MIN);
-        left = right = numindices/2;
+        if(!left || right==numindices) left = right = numindices/2;
         splitleft = SHRT_MIN;
         splitright = SHRT_MAX;
         loopi(numindices)
@@ -201,33 +287,41 @@ void BIH::build(mesh &m, ushort *indices, int numindices, const ivec &vmin, cons
         }
     }
 
+    // expected traversal cost: every node is visited and every triangle tested in proportion to its area
+    m.cost += boxarea(vmin, vmax);
+    if(left==1) m.cost += boxarea(leftmin, leftmax);
+    if(numindices-right==1) m.cost += boxarea(rightmin, rightmax);
+    m.maxdepth = max(m.maxdepth, depth);
+
+    const int shift = N::INDEXBITS;
     int offset = m.numnodes++;
-    node &curnode = m.nodes[offset];
-    curnode.split[0] = short(splitleft);
-    curnode.split[1] = short(splitright);
+    N &curnode = nodes[offset];
+    curnode.split[0] = splitleft;
+    curnode.split[1] = splitright;
 
-    if(left==1) curnode.child[0] = (axis<<14) | indices[0];
+    if(left==1) curnode.child[0] = (uint(axis)<<shift) | indices[0];
     else
     {
-        curnode.child[0] = (axis<<14) | (m.numnodes - offset);
-        build(m, indices, left, leftmin, leftmax);
+        curnode.child[0] = (uint(axis)<<shift) | (m.numnodes - offset);
+        build(m, nodes, indices, left, leftmin, leftmax, depth+1);
     }
 
-    if(numindices-right==1) curnode.child[1] = (1<<15) | (left==1 ? 1<<14 : 0) | indices[right];
+    if(numindices-right==1) curnode.child[1] = (1U<<(shift+1)) | (left==1 ? 1U<<shift : 0) | indices[right];
     else
     {
-        curnode.child[1] = (left==1 ? 1<<14 : 0) | (m.numnodes - offset);
-        build(m, &indices[right], numindices-right, rightmin, rightmax);
+        curnode.child[1] = (left==1 ? 1U<<shift : 0) | (m.numnodes - offset);
+        build(m, nodes, &indices[right], numindices-right, rightmin, rightmax, depth+1);
     }
 }
 
 BIH::BIH(vector<mesh> &buildmeshes)
-  : meshes(NULL), nummeshes(0), nodes(NULL), numnodes(0), tribbs(NULL), numtris(0), bbmin(1e16f, 1e16f, 1e16f), bbmax(-1e16f, -1e16f, -1e16f), center(0, 0, 0), radius(0), entradius(0)
+  : meshes(NULL), nummeshes(0), nodes(NULL), widenodes(NULL), numnodes(0), tribbs(NULL), numtris(0), bbmin(1e16f, 1e16f, 1e16f), bbmax(-1e16f, -1e16f, -1e16f), center(0, 0, 0), radius(0), entradius(0), buildmillis(0)
 {
     if(buildmeshes.empty()) return;
     loopv(buildmeshes) numtris += buildmeshes[i].numtris;
     if(!numtris) return;
 
+    Uint64 start = SDL_GetPerformanceCounter();
     nummeshes = buildmeshes.length();
     meshes = new mesh[nummeshes];
     memcpy(meshes, buildmeshes.getbuf(), sizeof(mesh)*buildmeshes.length());
@@ -270,25 +364,65 @@ BIH::BIH(vector<mesh> &buildmeshes)
     radius = vec(bbmax).sub(bbmin).mul(0.5f).magnitude();
     entradius = max(bbmin.squaredlen(), bbmax.squaredlen());
 
-    nodes = new node[numtris];
+    // meshes whose triangles can't all be addressed by a node's 14 bit indices get wide nodes
+    int numsmall = 0, numwide = 0, maxtris = 0;
+    loopi(nummeshes)
+    {
+        mesh &m = meshes[i];
+        if(m.numtris > node::MAXINDEX) numwide += m.numtris;
+        else numsmall += m.numtris;
+        maxtris = max(maxtris, m.numtris);
+    }
+    if(numsmall) nodes = new node[numsmall];
+    if(numwide) widenodes = new widenode[numwide];
     node *curnode = nodes;
-    ushort *indices = new ushort[numtris];
+    widenode *curwide = widenodes;
+    uint *indices = new uint[maxtris];
     loopi(nummeshes)
     {
         mesh &m = meshes[i];
-        m.nodes = curnode;
+        if(!m.numtris) continue;
         loopj(m.numtris) indices[j] = j;
-        build(m, indices, m.numtris, ivec::floor(m.bbmin), ivec::ceil(m.bbmax));
-        curnode += m.numnodes;
+        ivec vmin = ivec::floor(m.bbmin), vmax = ivec::ceil(m.bbmax);
+        if(m.numtris > node::MAXINDEX)
+        {
+            m.widenodes = curwide;
+            build(m, curwide, indices, m.numtris, vmin, vmax);
+            curwide += m.numnodes;
+        }
+        else
+        {
+            m.nodes = curnode;
+            build(m, curnode, indices, m.numtris, vmin, vmax);
+            curnode += m.numnodes;
+        }
+        m.cost /= max(boxarea(vmin, vmax), 1.0f);
+        numnodes += m.numnodes;
     }
     delete[] indices;
-    numnodes = int(curnode - nodes);
+
+    buildmillis = float(SDL_GetPerformanceCounter() - start)*1000.0f/SDL_GetPerformanceFrequency();
+}
+
+void BIH::printstats(const char *name)
+{
+    int maxdepth = 0;
+    float cost = 0;
+    loopi(nummeshes)
+    {
+        const mesh &m = meshes[i];
+        maxdepth = max(maxdepth, m.maxdepth);
+        cost += m.cost;
+    }
+    conoutf("bih %s: %d meshes, %d tris, %d nodes (%s), depth %d, cost %.1f, built in %.2f ms",
+        name, nummeshes, numtris, numnodes, widenodes ? (nodes ? "mixed" : "wide") : "compact", maxdepth, cost, buildmillis);
 }
 
 BIH::~BIH()
 {
     delete[] meshes;
     delete[] nodes;
+    delete[] widenodes;
     delete[] tribbs;
 }
 
@@ -340,6 +474,279 @@ bool mmintersect(const extentity &e, const vec &o, const vec &ray, float maxdist
     return false;
 }
 
+// packets of up to four coherent rays walk the BIH together: a node is
+// entered when any ray of the packet overlaps it and each triangle is tested
+// against all of the rays at once; a ray leaves the packet on its first hit,
+// exactly as the scalar traversal returns on it, and hitsurface is not set
+
+VARP(bihpackets, 0, 1, 1);
+
+#ifdef BIHSIMD
+struct raypacket
+{
+    __m128 o[3], ray[3], invray[3], mo[3], mray[3], maxdist;
+};
+
+template<class N>
+struct packetstate
+{
+    __m128 tmin, tmax;
+    N *node;
+    int mask;
+};
+
+static inline __m128 dot4(const __m128 *a, const __m128 *b)
+{
+    return _mm_add_ps(_mm_add_ps(_mm_mul_ps(a[0], b[0]), _mm_mul_ps(a[1], b[1])), _mm_mul_ps(a[2], b[2]));
+}
+
+static inline __m128 dot4(const __m128 *a, const vec &b)
+{
+    return _mm_add_ps(_mm_add_ps(_mm_mul_ps(a[0], _mm_set1_ps(b.x)), _mm_mul_ps(a[1], _mm_set1_ps(b.y))), _mm_mul_ps(a[2], _mm_set1_ps(b.z)));
+}
+
+static inline void cross4(const __m128 *a, const __m128 *b, __m128 *r)
+{
+    r[0] = _mm_sub_ps(_mm_mul_ps(a[1], b[2]), _mm_mul_ps(a[2], b[1]));
+    r[1] = _mm_sub_ps(_mm_mul_ps(a[2], b[0]), _mm_mul_ps(a[0], b[2]));
+    r[2] = _mm_sub_ps(_mm_mul_ps(a[0], b[1]), _mm_mul_ps(a[1], b[0]));
+}
+
+static inline void loadvecs(__m128 *dst, const vec *src)
+{
+    loopk(3) dst[k] = _mm_setr_ps(src[0][k], src[1][k], src[2][k], src[3][k]);
+}
+
+// the same tests as BIH::triintersect on four rays, returns the lanes hit
+static int triintersect4(const BIH::mesh &m, int tidx, const raypacket &p, int mask, float *dist, int mode)
+{
+    const BIH::tri &t = m.tris[tidx];
+    vec a = m.getpos(t.vert[0]), b = m.getpos(t.vert[1]).sub(a), c = m.getpos(t.vert[2]).sub(a),
+        n = vec().cross(b, c);
+    const __m128 zero = _mm_setzero_ps();
+    __m128 r[3], e[3];
+    r[0] = _mm_sub_ps(p.mo[0], _mm_set1_ps(a.x));
+    r[1] = _mm_sub_ps(p.mo[1], _mm_set1_ps(a.y));
+    r[2] = _mm_sub_ps(p.mo[2], _mm_set1_ps(a.z));
+    cross4(r, p.mray, e);
+    __m128 det = dot4(p.mray, n),
+           adet = _mm_andnot_ps(_mm_set1_ps(-0.0f), det),
+           v = dot4(e, c),
+           w = _mm_sub_ps(zero, dot4(e, b)),
+           f = _mm_mul_ps(dot4(r, n), _mm_set1_ps(m.scale));
+    __m128 ok = _mm_and_ps(_mm_cmpge_ps(v, zero), _mm_cmple_ps(v, adet));
+    ok = _mm_and_ps(ok, _mm_and_ps(_mm_cmpge_ps(w, zero), _mm_cmple_ps(_mm_add_ps(v, w), adet)));
+    ok = _mm_and_ps(ok, _mm_and_ps(_mm_cmpge_ps(f, zero), _mm_cmple_ps(f, _mm_mul_ps(p.maxdist, adet))));
+    ok = _mm_and_ps(ok, _mm_cmpneq_ps(adet, zero));
+    int hits = _mm_movemask_ps(ok) & mask;
+    if(!hits) return 0;
+    float fs[4], adets[4];
+    _mm_storeu_ps(fs, f);
+    _mm_storeu_ps(adets, adet);
+    bool alpha = m.flags&BIH::MESH_ALPHA && (mode&RAY_ALPHAPOLY)==RAY_ALPHAPOLY;
+    loopi(4) if(hits&(1<<i))
+    {
+        if(alpha)
+        {
+            // the alpha mask lookup is per ray, so redo the hit with the scalar test
+            vec mo(((const float *)&p.mo[0])[i], ((const float *)&p.mo[1])[i], ((const float *)&p.mo[2])[i]),
+                mray(((const float *)&p.mray[0])[i], ((const float *)&p.mray[1])[i], ((const float *)&p.mray[2])[i]);
+            float tdist;
+            if(!BIH::triintersect(m, tidx, mo, mray, ((const float *)&p.maxdist)[i], tdist, mode|RAY_SHADOW)) { hits &= ~(1<<i); continue; }
+        }
+        dist[i] = fs[i]/adets[i];
+    }
+    return hits;
+}
+
+template<class N>
+static int traversepacket(const BIH::mesh &m, N *curnode, const raypacket &p, const ivec &order, int mask, __m128 tmin, __m128 tmax, float *dist, int mode)
+{
+    packetstate<N> stack[128];
+    int stacksize = 0, start = mask, alive = mask;
+    for(;;)
+    {
+        int axis = curnode->axis();
+        int nearidx = order[axis], faridx = nearidx^1;
+        __m128 nearsplit = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(curnode->split[nearidx]), p.o[axis]), p.invray[axis]),
+               farsplit = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(curnode->split[faridx]), p.o[axis]), p.invray[axis]);
+        int nearmask = _mm_movemask_ps(_mm_cmpgt_ps(nearsplit, tmin)) & mask,
+            farmask = _mm_movemask_ps(_mm_cmplt_ps(farsplit, tmax)) & mask;
+        bool nearleaf = curnode->isleaf(nearidx), farleaf = curnode->isleaf(faridx);
+        if(nearleaf && nearmask)
+        {
+            alive &= ~triintersect4(m, curnode->childindex(nearidx), p, nearmask, dist, mode);
+            farmask &= alive;
+        }
+        if(farleaf && farmask) alive &= ~triintersect4(m, curnode->childindex(faridx), p, farmask, dist, mode);
+        nearmask &= alive;
+        farmask &= alive;
+        if(!nearleaf && nearmask)
+        {
+            if(!farleaf && farmask && stacksize < int(sizeof(stack)/sizeof(stack[0])))
+            {
+                packetstate<N> &save = stack[stacksize++];
+                save.node = curnode + curnode->childindex(faridx);
+                save.tmin = _mm_max_ps(tmin, farsplit);
+                save.tmax = tmax;
+                save.mask = farmask;
+            }
+            else if(!farleaf && farmask)
+            {
+                alive &= ~traversepacket(m, curnode + curnode->childindex(nearidx), p, order, nearmask, tmin, _mm_min_ps(tmax, nearsplit), dist, mode);
+                farmask &= alive;
+                if(!farmask) goto pop;
+                curnode += curnode->childindex(faridx);
+                tmin = _mm_max_ps(tmin, farsplit);
+                mask = farmask;
+                continue;
+            }
+            curnode += curnode->childindex(nearidx);
+            tmax = _mm_min_ps(tmax, nearsplit);
+            mask = nearmask;
+            continue;
+        }
+        if(!farleaf && farmask)
+        {
+            curnode += curnode->childindex(faridx);
+            tmin = _mm_max_ps(tmin, farsplit);
+            mask = farmask;
+            continue;
+        }
+    pop:
+        for(;;)
+        {
+            if(stacksize <= 0) return start & ~alive;
+            packetstate<N> &restore = stack[--stacksize];
+            mask = restore.mask & alive;
+            if(!mask) continue;
+            curnode = restore.node;
+            tmin = restore.tmin;
+            tmax = restore.tmax;
+            break;
+        }
+    }
+}
+#endif
+
+static inline ivec rayorder(const vec &ray)
+{
+    return ivec(ray.x>0 ? 0 : 1, ray.y>0 ? 0 : 1, ray.z>0 ? 0 : 1);
+}
+
+int BIH::traverse4(const vec *o, const vec *ray, int numrays, const float *maxdist, float *dist, int mode)
+{
+    int allrays = (1<<numrays)-1;
+#ifdef BIHSIMD
+    ivec order = rayorder(ray[0]);
+    bool coherent = bihpackets && numrays > 1;
+    // the packet shares the near/far order of the nodes, so all of its rays must point into the same octant
+    for(int i = 1; i < numrays && coherent; i++) if(rayorder(ray[i]) != order) coherent = false;
+    if(coherent)
+    {
+        vec po[4], pray[4], pinv[4], pmo[4], pmray[4];
+        float pmax[4];
+        loopi(4)
+        {
+            int j = i < numrays ? i : 0;
+            po[i] = o[j];
+            pray[i] = ray[j];
+            pinv[i] = vec(ray[j].x ? 1/ray[j].x : 1e16f, ray[j].y ? 1/ray[j].y : 1e16f, ray[j].z ? 1/ray[j].z : 1e16f);
+            pmax[i] = maxdist[j];
+        }
+        raypacket p;
+        loadvecs(p.o, po);
+        loadvecs(p.ray, pray);
+        loadvecs(p.invray, pinv);
+        p.maxdist = _mm_loadu_ps(pmax);
+        int alive = allrays;
+        loopi(nummeshes)
+        {
+            mesh &m = meshes[i];
+            if(!(m.flags&MESH_RENDER) || (!(mode&RAY_SHADOW) && m.flags&MESH_NOCLIP)) continue;
+            __m128 tmin = _mm_set1_ps(-1e16f), tmax = p.maxdist;
+            loopk(3)
+            {
+                __m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(m.bbmin[k]), p.o[k]), p.invray[k]),
+                       t2 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(m.bbmax[k]), p.o[k]), p.invray[k]);
+                tmin = _mm_max_ps(tmin, _mm_min_ps(t1, t2));
+                tmax = _mm_min_ps(tmax, _mm_max_ps(t1, t2));
+            }
+            int mask = _mm_movemask_ps(_mm_cmplt_ps(tmin, tmax)) & alive;
+            if(!mask) continue;
+            loopj(4)
+            {
+                pmo[j] = m.invxform.transform(po[j]);
+                pmray[j] = m.invxformnorm.transform(pray[j]);
+            }
+            loadvecs(p.mo, pmo);
+            loadvecs(p.mray, pmray);
+            alive &= ~(m.widenodes ? traversepacket(m, m.widenodes, p, order, mask, tmin, tmax, dist, mode) :
+                                     traversepacket(m, m.nodes, p, order, mask, tmin, tmax, dist, mode));
+            if(!alive) break;
+        }
+        return allrays & ~alive;
+    }
+#endif
+    int hits = 0;
+    loopi(numrays) if(traverse(o[i], ray[i], maxdist[i], dist[i], mode)) hits |= 1<<i;
+    return hits;
+}
+
+// mmintersect for up to four rays against one mapmodel, returns the rays hit
+int mmintersect4(const extentity &e, const vec *o, const vec *ray, int numrays, const float *maxdist, int mode, float *dist)
+{
+    model *m = entities::getmodel(e);
+    if(!m) return 0;
+    if(mode&RAY_SHADOW)
+    {
+        if(!m->shadow || e.flags&EF_NOSHADOW) return 0;
+    }
+    else if((mode&RAY_ENTS)!=RAY_ENTS && (!m->collide || e.flags&EF_NOCOLLIDE)) return 0;
+    if(!m->bih && !m->setBIH()) return 0;
+    int scale = e.attr[3], yaw = e.attr[0], pitch = e.attr[1], roll = e.attr[2]; // OF
+    vec mo[4], mray[4];
+    float mmax[4], mdist[4];
+    int lanes[4], n = 0;
+    loopi(numrays)
+    {
+        vec lo = vec(o[i]).sub(e.o), lray(ray[i]);
+        if(scale > 0) lo.mul(100.0f/scale);
+        float v = lo.dot(lray), inside = m->bih->entradius - lo.squaredlen();
+        if((inside < 0 && v > 0) || inside + v*v < 0) continue;
+        if(yaw != 0)
+        {
+            const vec2 &rot = sincosmod360(-yaw);
+            lo.rotate_around_z(rot);
+            lray.rotate_around_z(rot);
+        }
+        if(pitch != 0)
+        {
+            const vec2 &rot = sincosmod360(-pitch);
+            lo.rotate_around_x(rot);
+            lray.rotate_around_x(rot);
+        }
+        if(roll != 0)
+        {
+            const vec2 &rot = sincosmod360(roll);
+            lo.rotate_around_y(rot);
+            lray.rotate_around_y(rot);
+        }
+        mo[n] = lo;
+        mray[n] = lray;
+        mmax[n] = maxdist[i] ? maxdist[i] : 1e16f;
+        lanes[n++] = i;
+    }
+    if(!n) return 0;
+    int hits = m->bih->traverse4(mo, mray, n, mmax, mdist, mode), result = 0;
+    loopi(n) if(hits&(1<<i))
+    {
+        dist[lanes[i]] = scale > 0 ? mdist[i]*(scale/100.0f) : mdist[i];
+        result |= 1<<lanes[i];
+    }
+    return result;
+}
+
 static inline float segmentdistance(const vec &d1, const vec &d2, const vec &r)
 {
     float a = d1.squaredlen(), e = d2.squaredlen(), f = d2.dot(r), s, t;
@@ -540,10 +947,10 @@ inline void BIH::tricollide<COLLIDE_OBB>(const mesh &m, int tidx, physent *d, co
     collidewall = n;
 }
 
-template<int C>
-inline void BIH::collide(const mesh &m, physent *d, const vec &dir, float cutoff, const vec &center, const vec &radius, const matrix4x3 &orient, float &dist, node *curnode, const ivec &bo, const ivec &br)
+template<int C, class N>
+inline void BIH::collide(const mesh &m, physent *d, const vec &dir, float cutoff, const vec &center, const vec &radius, const matrix4x3 &orient, float &dist, N *curnode, const ivec &bo, const ivec &br)
 {
-    node *stack[128];
+    N *stack[128];
     int stacksize = 0;
     ivec bmin = ivec(bo).sub(br), bmax = ivec(bo).add(br);
     for(;;)
@@ -590,7 +997,7 @@ inline void BIH::collide(const mesh &m, physent *d, const vec &dir, float cutoff
                     }
                     else
                     {
-                        collide<C>(m, d, dir, cutoff, center, radius, orient, dist, &nodes[curnode->childindex(nearidx)], bo, br);
+                        collide<C>(m, d, dir, cutoff, center, radius, orient, dist, curnode + curnode->childindex(nearidx), bo, br);
                         curnode += curnode->childindex(faridx);
                         continue;
                     }
@@ -637,7 +1044,8 @@ bool BIH::ellipsecollide(physent *d, const vec &dir, float cutoff, const vec &o,
         if(!(m.flags&MESH_COLLIDE) || m.flags&MESH_NOCLIP) continue;
         matrix4x3 morient;
         morient.mul(orient, m.xform);
-        collide<COLLIDE_ELLIPSE>(m, d, dir, cutoff, m.invxform.transform(bo), radius, morient, dist, m.nodes, icenter, iradius);
+        if(m.widenodes) collide<COLLIDE_ELLIPSE>(m, d, dir, cutoff, m.invxform.transform(bo), radius, morient, dist, m.widenodes, icenter, iradius);
+        else collide<COLLIDE_ELLIPSE>(m, d, dir, cutoff, m.invxform.transform(bo), radius, morient, dist, m.nodes, icenter, iradius);
     }
     return dist > -1e9f;
 }
@@ -678,7 +1086,8 @@ bool BIH::boxcollide(physent *d, const vec &dir, float cutoff, const vec &o, int
         if(!(m.flags&MESH_COLLIDE) || m.flags&MESH_NOCLIP) continue;
         matrix4x3 morient;
         morient.mul(dorient, dcenter, m.xform);
-        collide<COLLIDE_OBB>(m, d, ddir, cutoff, center, radius, morient, dist, m.nodes, icenter, iradius);
+        if(m.widenodes) collide<COLLIDE_OBB>(m, d, ddir, cutoff, center, radius, morient, dist, m.widenodes, icenter, iradius);
+        else collide<COLLIDE_OBB>(m, d, ddir, cutoff, center, radius, morient, dist, m.nodes, icenter, iradius);
     }
     if(dist > -1e9f)
     {
@@ -703,9 +1112,10 @@ inline void BIH::genstaintris(stainrenderer *s, const mesh &m, int tidx, const v
     genstainmmtri(s, v);
 }
 
-void BIH::genstaintris(stainrenderer *s, const mesh &m, const vec &center, float radius, const matrix4x3 &orient, node *curnode, const ivec &bo, const ivec &br)
+template<class N>
+void BIH::genstaintris(stainrenderer *s, const mesh &m, const vec &center, float radius, const matrix4x3 &orient, N *curnode, const ivec &bo, const ivec &br)
 {
-    node *stack[128];
+    N *stack[128];
     int stacksize = 0;
     ivec bmin = ivec(bo).sub(br), bmax = ivec(bo).add(br);
     for(;;)
@@ -752,7 +1162,7 @@ void BIH::genstaintris(stainrenderer *s, const mesh &m, const vec &center, float
                     }
                     else
                     {
-                        genstaintris(s, m, center, radius, orient, &nodes[curnode->childindex(nearidx)], bo, br);
+                        genstaintris(s, m, center, radius, orient, curnode + curnode->childindex(nearidx), bo, br);
                         curnode += curnode->childindex(faridx);
                         continue;
                     }
@@ -798,7 +1208,8 @@ void BIH::genstaintris(stainrenderer *s, const vec &staincenter, float stainradi
         if(!(m.flags&MESH_RENDER) || m.flags&MESH_ALPHA) continue;
         matrix4x3 morient;
         morient.mul(orient, o, m.xform);
-        genstaintris(s, m, m.invxform.transform(bo), radius, morient, m.nodes, icenter, iradius);
+        if(m.widenodes) genstaintris(s, m, m.invxform.transform(bo), radius, morient, m.widenodes, icenter, iradius);
+        else genstaintris(s, m, m.invxform.transform(bo), radius, morient, m.nodes, icenter, iradius);
     }
 }
 
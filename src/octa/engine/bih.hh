@@ -4,12 +4,27 @@ struct BIH
 {
     struct node
     {
+        enum { INDEXBITS = 14, MAXINDEX = (1<<INDEXBITS)-1 };
+
         short split[2];
         ushort child[2];
 
-        int axis() const { return child[0]>>14; }
-        int childindex(int which) const { return child[which]&0x3FFF; }
-        bool isleaf(int which) const { return (child[1]&(1<<(14+which)))!=0; }
+        int axis() const { return child[0]>>INDEXBITS; }
+        int childindex(int which) const { return child[which]&MAXINDEX; }
+        bool isleaf(int which) const { return (child[1]&(1<<(INDEXBITS+which)))!=0; }
+    };
+
+    // same layout with 30 bit child and triangle indices, for meshes too big to address with a node
+    struct widenode
+    {
+        enum { INDEXBITS = 30, MAXINDEX = (1<<INDEXBITS)-1 };
+
+        int split[2];
+        uint child[2];
+
+        int axis() const { return child[0]>>INDEXBITS; }
+        int childindex(int which) const { return child[which]&MAXINDEX; }
+        bool isleaf(int which) const { return (child[1]&(1U<<(INDEXBITS+which)))!=0; }
     };
 
     struct tri
@@ -37,7 +52,9 @@ struct BIH
         matrix3 xformnorm, invxformnorm;
         float scale, invscale;
         node *nodes;
-        int numnodes;
+        widenode *widenodes;
+        int numnodes, maxdepth;
+        float cost;
         const tri *tris;
         const tribb *tribbs;
         int numtris;
@@ -47,7 +64,7 @@ struct BIH
         int flags;
         vec bbmin, bbmax;
 
-        mesh() : numnodes(0), numtris(0), tex(NULL), flags(0) {}
+        mesh() : nodes(NULL), widenodes(NULL), numnodes(0), maxdepth(0), cost(0), numtris(0), tex(NULL), flags(0) {}
 
         vec getpos(int i) const { return *(const vec *)(pos + i*posstride); }
         vec2 gettc(int i) const { return *(const vec2 *)(tc + i*tcstride); }
@@ -56,36 +73,47 @@ struct BIH
     mesh *meshes;
     int nummeshes;
     node *nodes;
+    widenode *widenodes;
     int numnodes;
     tribb *tribbs;
     int numtris;
     vec bbmin, bbmax, center;
     float radius, entradius;
+    float buildmillis;
 
     BIH(vector<mesh> &buildmeshes);
 
     ~BIH();
 
-    void build(mesh &m, ushort *indices, int numindices, const ivec &vmin, const ivec &vmax);
+    template<class N>
+    void build(mesh &m, N *nodes, uint *indices, int numindices, const ivec &vmin, const ivec &vmax, int depth = 1);
+    void printstats(const char *name);
 
     bool traverse(const vec &o, const vec &ray, float maxdist, float &dist, int mode);
-    bool traverse(const mesh &m, const vec &o, const vec &ray, const vec &invray, float maxdist, float &dist, int mode, node *curnode, float tmin, float tmax);
-    bool triintersect(const mesh &m, int tidx, const vec &mo, const vec &mray, float maxdist, float &dist, int mode);
+    int traverse4(const vec *o, const vec *ray, int numrays, const float *maxdist, float *dist, int mode);
+    template<class N>
+    bool traverse(const mesh &m, const vec &o, const vec &ray, const vec &invray, float maxdist, float &dist, int mode, N *curnode, float tmin, float tmax);
+
+    static bool triintersect(const mesh &m, int tidx, const vec &mo, const vec &mray, float maxdist, float &dist, int mode);
 
     bool boxcollide(physent *d, const vec &dir, float cutoff, const vec &o, int yaw, int pitch, int roll, float scale = 1);
     bool ellipsecollide(physent *d, const vec &dir, float cutoff, const vec &o, int yaw, int pitch, int roll, float scale = 1);
 
-    template<int C>
-    void collide(const mesh &m, physent *d, const vec &dir, float cutoff, const vec &center, const vec &radius, const matrix4x3 &orient, float &dist, node *curnode, const ivec &bo, const ivec &br);
+    template<int C, class N>
+    void collide(const mesh &m, physent *d, const vec &dir, float cutoff, const vec &center, const vec &radius, const matrix4x3 &orient, float &dist, N *curnode, const ivec &bo, const ivec &br);
     template<int C>
     void tricollide(const mesh &m, int tidx, physent *d, const vec &dir, float cutoff, const vec &center, const vec &radius, const matrix4x3 &orient, float &dist, const ivec &bo, const ivec &br);
 
     void genstaintris(stainrenderer *s, const vec &staincenter, float stainradius, const vec &o, int yaw, int pitch, int roll, float scale = 1);
-    void genstaintris(stainrenderer *s, const mesh &m, const vec &center, float radius, const matrix4x3 &orient, node *curnode, const ivec &bo, const ivec &br);
+    template<class N>
+    void genstaintris(stainrenderer *s, const mesh &m, const vec &center, float radius, const matrix4x3 &orient, N *curnode, const ivec &bo, const ivec &br);
     void genstaintris(stainrenderer *s, const mesh &m, int tidx, const vec &center, float radius, const matrix4x3 &orient, const ivec &bo, const ivec &br);
  
     void preload();
 };
 
+extern int dbgbih;
+
 extern bool mmintersect(const extentity &e, const vec &o, const vec &ray, float maxdist, int mode, float &dist);
+extern int mmintersect4(const extentity &e, const vec *o, const vec *ray, int numrays, const float *maxdist, int mode, float *dist);
 
@@ -199,6 +199,7 @@ void sendclientpacket(ENetPacket *packet, int chan)
 
 void flushclient()
 {
+    PROFILE("net send");
     if(clienthost) enet_host_flush(clienthost);
 }
 
@@ -218,6 +219,7 @@ void clientkeepalive() { if(clienthost) enet_host_service(clienthost, NULL, 0);
 
 void gets2c()           // get updates from the server
 {
+    PROFILE("net receive");
     ENetEvent event;
     if(!clienthost) return;
     if(connpeer && totalmillis/3000 > connmillis/3000)
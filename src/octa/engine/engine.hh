@@ -103,6 +103,21 @@ extern void compactvslot(VSlot &vs);
 extern int compactvslots(bool cull = false);
 extern void reloadtextures();
 extern void cleanuptextures();
+extern void starttexturebatch();
+extern void endtexturebatch();
+extern void updatetextureloads();
+extern void resettextureloads(int start);
+extern void cleanuptextureloads();
+
+// texsimd
+extern int texsimd;
+extern int texsimdlevel();
+extern const char *texsimdname(int level);
+extern bool simdhalvetexture(const uchar *src, uint sw, uint sh, uint stride, uchar *dst, uint bpp);
+extern bool simdshifttexture(const uchar *src, uint sw, uint sh, uint stride, uchar *dst, uint dw, uint dh, uint bpp);
+extern bool simdblurtexture(int n, int bpp, int w, int h, uchar *dst, const uchar *src, int margin);
+extern bool simdtexnormal(const uchar *src, int w, int h, int bpp, int pitch, uchar *dst, int emphasis);
+extern bool simdtexmad(uchar *data, int w, int h, int bpp, int pitch, const vec &mul, const vec &add);
 
 // pvs
 extern void clearpvs();
@@ -113,6 +128,8 @@ extern void setviewcell(const vec &p);
 extern void savepvs(stream *f);
 extern void loadpvs(stream *f, int numpvs);
 extern int getnumviewcells();
+typedef bool (*pvsprogressfn)(int processed, int total, int unique); // return false to abort
+extern bool buildpvs(int viewcellsize, pvsprogressfn progress = NULL);
 
 static inline bool pvsoccluded(const ivec &bborigin, int size)
 {
@@ -194,6 +211,7 @@ extern void render3dbox(vec &o, float tofloor, float toceil, float xradius, floa
 
 // octa
 extern cube *newcubes(uint face = F_EMPTY, int mat = MAT_AIR);
+extern void setnodecounter(int *counter);
 extern cubeext *growcubeext(cubeext *ext, int maxverts);
 extern void setcubeext(cube &c, cubeext *ext);
 extern cubeext *newcubeext(cube &c, int maxverts = 0, bool init = true);
@@ -208,8 +226,8 @@ extern bool isvalidcube(const cube &c);
 extern ivec lu;
 extern int lusize;
 extern cube &lookupcube(const ivec &to, int tsize = 0, ivec &ro = lu, int &rsize = lusize);
-extern const cube *neighbourstack[32];
-extern int neighbourdepth;
+extern thread_local const cube *neighbourstack[32];
+extern thread_local int neighbourdepth;
 extern const cube &neighbourcube(const cube &c, int orient, const ivec &co, int size, ivec &ro = lu, int &rsize = lusize);
 extern void resetclipplanes();
 extern int getmippedtexture(const cube &p, int orient);
@@ -307,10 +325,16 @@ extern int calcbbsidemask(const vec &bbmin, const vec &bbmax, const vec &lightpo
 extern int calcspheresidemask(const vec &p, float radius, float bias);
 extern int calctrisidemask(const vec &p1, const vec &p2, const vec &p3, float bias);
 extern int cullfrustumsides(const vec &lightpos, float lightradius, float size, float border);
+
+#define CSM_MAXSPLITS 8
+
+extern int csmsplits;
 extern int calcbbcsmsplits(const ivec &bbmin, const ivec &bbmax);
 extern int calcspherecsmsplits(const vec &center, float radius);
+extern bool getcsmcullplanes(plane *planes);
 extern int calcbbrsmsplits(const ivec &bbmin, const ivec &bbmax);
 extern int calcspherersmsplits(const vec &center, float radius);
+extern bool getrsmcullplanes(plane *planes);
 
 static inline bool sphereinsidespot(const vec &dir, int spot, const vec &center, float radius)
 {
@@ -410,6 +434,8 @@ extern void octarender();
 extern void allchanged(bool load = false);
 extern void clearvas(cube *c);
 extern void destroyva(vtxarray *va, bool reparent = true);
+extern void remeshva(cube &c, const ivec &co, int size);
+extern int remeshpatched, remeshrealloced;
 extern void updatevabb(vtxarray *va, bool force = false);
 extern void updatevabbs(bool force = false);
 
@@ -419,6 +445,7 @@ extern int oqfrags;
 extern float alphafrontsx1, alphafrontsx2, alphafrontsy1, alphafrontsy2, alphabacksx1, alphabacksx2, alphabacksy1, alphabacksy2, alpharefractsx1, alpharefractsx2, alpharefractsy1, alpharefractsy2;
 extern uint alphatiles[LIGHTTILE_MAXH];
 
+extern void clearvabounds();
 extern void visiblecubes(bool cull = true);
 extern void setvfcP(const vec &bbmin = vec(-1, -1, -1), const vec &bbmax = vec(1, 1, 1));
 extern void savevfcP();
@@ -456,6 +483,12 @@ extern void genshadowmeshes();
 extern shadowmesh *findshadowmesh(int idx, extentity &e);
 extern void rendershadowmesh(shadowmesh *m);
 
+// swocclude
+extern void genoccluders();
+extern void kickocclusion();
+extern bool swocclusionactive();
+extern bool swoccluded(const ivec &bbmin, const ivec &bbmax);
+
 // dynlight
 
 extern void updatedynlights();
@@ -651,6 +684,19 @@ extern bool pointinsel(const selinfo &sel, const vec &o);
 extern void resetmap();
 extern void startmap(const char *name);
 
+// worldio
+enum
+{
+    BAKESTAGE_LOAD = 0,
+    BAKESTAGE_REMIP,
+    BAKESTAGE_BLENDMAP,
+    BAKESTAGE_PVS,
+    BAKESTAGE_SAVE,
+    NUMBAKESTAGES
+};
+extern const char * const bakestagenames[NUMBAKESTAGES];
+extern bool bakemap(const char *mname, int stages, int viewcellsize = 0, int *millis = NULL);
+
 // rendermodel
 extern float transmdlsx1, transmdlsy1, transmdlsx2, transmdlsy2;
 extern uint transmdltiles[LIGHTTILE_MAXH];
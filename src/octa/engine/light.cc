@@ -264,6 +264,71 @@ void PackNode::reserve(ushort tx, ushort ty, ushort tw, ushort th)
     available = max(child1->available, child2->available);
 }
 
+int MaxRectsPacker::largest() const
+{
+    int best = 0;
+    loopv(rects) best = max(best, rects[i].w*rects[i].h);
+    return best;
+}
+
+// carves the rect out of every free rect it touches, keeping the biggest pieces left of,
+// right of, below and above it, then drops free rects that another one already covers
+void MaxRectsPacker::place(int tx, int ty, int tw, int th)
+{
+    int rx2 = tx + tw, ry2 = ty + th, numrects = rects.length();
+    for(int i = numrects-1; i >= 0; i--)
+    {
+        freerect r = rects[i];
+        int x2 = r.x + r.w, y2 = r.y + r.h;
+        if(tx >= x2 || rx2 <= r.x || ty >= y2 || ry2 <= r.y) continue;
+        rects.removeunordered(i);
+        if(tx > r.x) rects.add(freerect(r.x, r.y, tx - r.x, r.h));
+        if(rx2 < x2) rects.add(freerect(rx2, r.y, x2 - rx2, r.h));
+        if(ty > r.y) rects.add(freerect(r.x, r.y, r.w, ty - r.y));
+        if(ry2 < y2) rects.add(freerect(r.x, ry2, r.w, y2 - ry2));
+    }
+    loopv(rects)
+    {
+        for(int j = i+1; j < rects.length(); j++)
+        {
+            if(rects[j].contains(rects[i])) { rects.removeunordered(i--); break; }
+            if(rects[i].contains(rects[j])) rects.removeunordered(j--);
+        }
+    }
+}
+
+bool MaxRectsPacker::insert(ushort &tx, ushort &ty, ushort tw, ushort th)
+{
+    int best = -1, bestshort = INT_MAX, bestlong = INT_MAX;
+    loopv(rects)
+    {
+        const freerect &r = rects[i];
+        if(r.w < tw || r.h < th) continue;
+        int dw = r.w - tw, dh = r.h - th, shortside = min(dw, dh), longside = max(dw, dh);
+        // prefer the lowest spot on ties so space frees up at the top of the atlas
+        if(shortside < bestshort || (shortside == bestshort && (longside < bestlong || (longside == bestlong && r.y < rects[best].y))))
+        {
+            best = i;
+            bestshort = shortside;
+            bestlong = longside;
+        }
+    }
+    if(best < 0) return false;
+    tx = rects[best].x;
+    ty = rects[best].y;
+    place(tx, ty, tw, th);
+    used += tw*th;
+    return true;
+}
+
+void MaxRectsPacker::reserve(ushort tx, ushort ty, ushort tw, ushort th)
+{
+    int x1 = min(int(tx), int(w)), y1 = min(int(ty), int(h)), x2 = min(tx + tw, int(w)), y2 = min(ty + th, int(h));
+    if(x1 >= x2 || y1 >= y2) return;
+    place(x1, y1, x2 - x1, y2 - y1);
+    used += (x2 - x1)*(y2 - y1);
+}
+
 static void clearsurfaces(cube *c)
 {
     loopi(8)
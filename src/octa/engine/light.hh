@@ -43,6 +43,52 @@ struct PackNode
     void reserve(ushort tx, ushort ty, ushort tw, ushort th);
 };
 
+// maximal free rectangles with best short side fit, rects can be reserved anywhere
+// so allocations that persist across frames stay where they are
+struct MaxRectsPacker
+{
+    struct freerect
+    {
+        ushort x, y, w, h;
+
+        freerect() {}
+        freerect(ushort x, ushort y, ushort w, ushort h) : x(x), y(y), w(w), h(h) {}
+
+        bool contains(const freerect &o) const { return o.x >= x && o.y >= y && o.x + o.w <= x + w && o.y + o.h <= y + h; }
+    };
+
+    ushort w, h;
+    int used;
+    vector<freerect> rects;
+
+    MaxRectsPacker(ushort w, ushort h) : w(w), h(h), used(0) { reset(); }
+
+    void reset()
+    {
+        rects.setsize(0);
+        rects.add(freerect(0, 0, w, h));
+        used = 0;
+    }
+
+    bool resize(int nw, int nh)
+    {
+        if(w == nw && h == nh) return false;
+        w = nw;
+        h = nh;
+        reset();
+        return true;
+    }
+
+    int available() const { return w*h - used; }
+    int largest() const;
+
+    bool insert(ushort &tx, ushort &ty, ushort tw, ushort th);
+    void reserve(ushort tx, ushort ty, ushort tw, ushort th);
+
+private:
+    void place(int tx, int ty, int tw, int th);
+};
+
 extern bvec ambient, skylight, sunlight;
 extern float ambientscale, skylightscale, sunlightscale;
 extern float sunlightyaw, sunlightpitch;
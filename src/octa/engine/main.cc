@@ -25,6 +25,7 @@ void cleanup()
     if(screen) SDL_SetWindowGrab(screen, SDL_FALSE);
     cleargamma();
     freeocta(worldroot);
+    cleanuptextureloads();
     extern void clear_texpacks(int n = 0); clear_texpacks(); /* OF */
     extern void clear_command(); clear_command();
     extern void clear_console(); clear_console();
@@ -924,8 +925,9 @@ int getclockmillis()
     return max(millis, totalmillis);
 }
 
-VAR(numcpus, 1, 1, 16);
+VAR(numcpus, 1, 1, 64);
 
+#ifndef BAKE
 static const char *determinehomedir(string &hdir) {
 #ifdef WIN32
     copystring(hdir, "$HOME\\My Games\\OctaForge");
@@ -962,9 +964,11 @@ int main(int argc, char **argv)
     #endif
 
     setlogfile(NULL);
+    profthreadname("main");
 
     int dedicated = 0;
     char *load = NULL, *initscript = NULL;
+    vector<const char *> pvsmaps;
 
     #define initlog(s) logger::log(logger::INIT, "%s", s)
 
@@ -1029,6 +1033,7 @@ int main(int argc, char **argv)
                 break;
             }
             case 'x': initscript = &argv[i][2]; break;
+            case 'p': pvsmaps.add(&argv[i][2]); break;
             default: if(!serveroption(argv[i])) gameargs.add(argv[i]); break;
         }
         else gameargs.add(argv[i]);
@@ -1037,7 +1042,18 @@ int main(int argc, char **argv)
     /* Initialize logging at first, right after that lua. */
     logger::setlevel(loglevel);
 
-    numcpus = clamp(SDL_GetCPUCount(), 1, 16);
+    numcpus = clamp(SDL_GetCPUCount(), 1, 64);
+
+    if(pvsmaps.length())
+    {
+        /* headless PVS baking: only the octree is needed, no window or scripting */
+        initlog("pvs");
+        if(SDL_Init(SDL_INIT_TIMER)<0) fatal("Unable to initialize SDL: %s", SDL_GetError());
+        int failed = 0;
+        loopv(pvsmaps) if(!bakemap(pvsmaps[i], 1<<BAKESTAGE_PVS)) failed++;
+        SDL_Quit();
+        return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+    }
 
     if(dedicated <= 1)
     {
@@ -1162,11 +1178,21 @@ int main(int argc, char **argv)
         totalmillis = millis;
         updatetime();
 
-        checkinput();
-        lua::L->call_external("gui_update", "");
-        tryedit();
+        profframe();
+        PROFILE("frame");
 
-        if(lastmillis) game::updateworld();
+        {
+            PROFILE("input");
+            checkinput();
+            lua::L->call_external("gui_update", "");
+            tryedit();
+        }
+
+        if(lastmillis)
+        {
+            PROFILE("update world");
+            game::updateworld();
+        }
 
         checksleep(lastmillis);
 
@@ -1176,19 +1202,30 @@ int main(int argc, char **argv)
         frames++;
 
         // miscellaneous general game effects
-        recomputecamera();
-        updateparticles();
-        updatesounds();
+        {
+            PROFILE("effects");
+            recomputecamera();
+            updateparticles();
+            updatesounds();
+        }
 
         if(minimized) continue;
 
-        gl_setupframe(!mainmenu);
+        {
+            PROFILE("render");
+            gl_setupframe(!mainmenu);
 
-        inbetweenframes = false;
-        gl_drawframe();
-        swapbuffers();
+            inbetweenframes = false;
+            gl_drawframe();
+        }
+        {
+            PROFILE("swap");
+            swapbuffers();
+        }
         renderedframe = inbetweenframes = true;
 
+        updatetextureloads();
+
         extern void modifyedgeturn(int curtime);
         modifyedgeturn(curtime);
 
@@ -1201,4 +1238,5 @@ int main(int argc, char **argv)
     #if defined(WIN32) && !defined(_DEBUG) && !defined(__GNUC__)
     } __except(stackdumper(0, GetExceptionInformation()), EXCEPTION_CONTINUE_SEARCH) { return 0; }
     #endif
-}
\ No newline at end of file
+}
+#endif
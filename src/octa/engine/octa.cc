@@ -19,6 +19,11 @@ static struct emptycube : cube
 cube *worldroot = newcubes(F_SOLID);
 int allocnodes = 0;
 
+// map loader threads count their nodes privately and add them up when joined
+static thread_local int *nodecounter = &allocnodes;
+
+void setnodecounter(int *counter) { nodecounter = counter ? counter : &allocnodes; }
+
 cubeext *growcubeext(cubeext *old, int maxverts)
 {
     cubeext *ext = (cubeext *)new uchar[sizeof(cubeext) + maxverts*sizeof(vertinfo)];
@@ -77,7 +82,7 @@ cube *newcubes(uint face, int mat)
         c->material = mat;
         c++;
     }
-    allocnodes++;
+    (*nodecounter)++;
     return c-8;
 }
 
@@ -273,8 +278,8 @@ int lookupmaterial(const vec &v)
     return c->material;
 }
 
-const cube *neighbourstack[32];
-int neighbourdepth = -1;
+thread_local const cube *neighbourstack[32];
+thread_local int neighbourdepth = -1;
 
 const cube &neighbourcube(const cube &c, int orient, const ivec &co, int size, ivec &ro, int &rsize)
 {
@@ -128,6 +128,7 @@ struct vtxarray
     ushort voffset, eoffset, skyoffset, decaloffset; // offset into vertex data
     ushort *edata, *skydata, *decaldata; // vertex indices
     GLuint vbuf, ebuf, skybuf, decalbuf; // VBOs
+    int vcap, ecap, skycap, decalcap; // elements reserved in each VBO
     ushort minvert, maxvert; // DRE info
     elementset *texelems, *decalelems;   // List of element indices sets (range) per texture
     materialsurface *matbuf; // buffer of material surfaces
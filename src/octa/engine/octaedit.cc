@@ -553,13 +553,60 @@ void readychanges(const ivec &bbmin, const ivec &bbmax, cube *c, const ivec &cor
     }
 }
 
+VAR(printremesh, 0, 0, 1);
+
+static Uint64 remeshticks = 0;
+static int remeshedits = 0, remeshvas = 0, remeshinplace = 0, remeshgrown = 0;
+static float remeshlast = 0, remeshtotal = 0, remeshmax = 0;
+
+// only the smallest va holding the whole change is rebuilt when nothing outside it
+// depends on its faces, otherwise every va down to the change is thrown away
+static void markchanges(const ivec &bbmin, const ivec &bbmax)
+{
+    Uint64 start = SDL_GetPerformanceCounter();
+    cube *c = worldroot, *vac = NULL;
+    ivec co(0, 0, 0), vaco(0, 0, 0);
+    int size = worldsize/2, vasize = 0;
+    for(;;)
+    {
+        uchar possible = octaboxoverlap(co, size, bbmin, bbmax);
+        if(!possible || possible&(possible-1)) break;
+        int i = 0;
+        while(!(possible&(1<<i))) i++;
+        if(c[i].ext && c[i].ext->va)
+        {
+            vac = c;
+            vaco = co;
+            vasize = size;
+        }
+        if(!c[i].children) break;
+        c = c[i].children;
+        co = ivec(i, co, size);
+        size >>= 1;
+    }
+    if(vac)
+    {
+        uchar possible = octaboxoverlap(vaco, vasize, bbmin, bbmax);
+        int i = 0;
+        while(!(possible&(1<<i))) i++;
+        vtxarray *va = vac[i].ext->va;
+        if(!va->parent || va->hasmerges) vac = NULL;
+        else remeshva(vac[i], ivec(i, vaco, vasize), vasize);
+    }
+    if(vac) readychanges(bbmin, bbmax, vac, vaco, vasize);
+    else readychanges(bbmin, bbmax, worldroot, ivec(0, 0, 0), worldsize/2);
+    remeshticks += SDL_GetPerformanceCounter() - start;
+}
+
 void commitchanges(bool force)
 {
     if(!force && !haschanged) return;
     haschanged = false;
 
+    Uint64 start = SDL_GetPerformanceCounter();
     extern vector<vtxarray *> valist;
     int oldlen = valist.length();
+    remeshpatched = remeshrealloced = 0;
     resetclipplanes();
     entitiesinoctanodes();
     inbetweenframes = false;
@@ -568,11 +615,31 @@ void commitchanges(bool force)
     setupmaterials(oldlen);
     clearshadowcache();
     updatevabbs();
+    remeshticks += SDL_GetPerformanceCounter() - start;
+
+    remeshlast = remeshticks*1000.0f/SDL_GetPerformanceFrequency();
+    remeshticks = 0;
+    remeshedits++;
+    remeshtotal += remeshlast;
+    remeshmax = max(remeshmax, remeshlast);
+    remeshvas += valist.length() - oldlen;
+    remeshinplace += remeshpatched;
+    remeshgrown += remeshrealloced;
+    if(printremesh) conoutf(CON_DEBUG, "remesh: %.2f ms, %d vas built, %d rebuilt in place, %d outgrew their vbo space",
+        remeshlast, valist.length() - oldlen, remeshpatched, remeshrealloced);
+}
+
+void remeshstats()
+{
+    conoutf("remesh: %d edits, last %.2f ms, average %.2f ms, max %.2f ms", remeshedits, remeshlast, remeshtotal/max(remeshedits, 1), remeshmax);
+    conoutf("remesh: %d vas built, %d rebuilt in place, %d outgrew their vbo space", remeshvas, remeshinplace, remeshgrown);
 }
 
+COMMAND(remeshstats, "");
+
 void changed(const ivec &bbmin, const ivec &bbmax, bool commit)
 {
-    readychanges(bbmin, bbmax, worldroot, ivec(0, 0, 0), worldsize/2);
+    markchanges(bbmin, bbmax);
     haschanged = true;
 
     if(commit) commitchanges();
@@ -581,7 +648,7 @@ void changed(const ivec &bbmin, const ivec &bbmax, bool commit)
 void changed(const block3 &sel, bool commit)
 {
     if(sel.s.iszero()) return;
-    readychanges(ivec(sel.o).sub(1), ivec(sel.s).mul(sel.grid).add(sel.o).add(1), worldroot, ivec(0, 0, 0), worldsize/2);
+    markchanges(ivec(sel.o).sub(1), ivec(sel.s).mul(sel.grid).add(sel.o).add(1));
     haschanged = true;
 
     if(commit) commitchanges();
@@ -41,6 +41,29 @@ void destroyvbo(GLuint vbo)
     }
 }
 
+static void setvbo(vtxarray *va, int type, GLuint vbo, uchar *data)
+{
+    switch(type)
+    {
+        case VBO_VBUF:
+            va->vbuf = vbo;
+            va->vdata = (vertex *)data;
+            break;
+        case VBO_EBUF:
+            va->ebuf = vbo;
+            va->edata = (ushort *)data;
+            break;
+        case VBO_SKYBUF:
+            va->skybuf = vbo;
+            va->skydata = (ushort *)data;
+            break;
+        case VBO_DECALBUF:
+            va->decalbuf = vbo;
+            va->decaldata = (ushort *)data;
+            break;
+    }
+}
+
 void genvbo(int type, void *buf, int len, vtxarray **vas, int numva)
 {
     GLuint vbo;
@@ -57,29 +80,18 @@ void genvbo(int type, void *buf, int len, vtxarray **vas, int numva)
 
     if(printvbo) conoutf(CON_DEBUG, "vbo %d: type %d, size %d, %d uses", vbo, type, len, numva);
 
-    loopi(numva)
-    {
-        vtxarray *va = vas[i];
-        switch(type)
-        {
-            case VBO_VBUF:
-                va->vbuf = vbo;
-                va->vdata = (vertex *)vbi.data;
-                break;
-            case VBO_EBUF:
-                va->ebuf = vbo;
-                va->edata = (ushort *)vbi.data;
-                break;
-            case VBO_SKYBUF:
-                va->skybuf = vbo;
-                va->skydata = (ushort *)vbi.data;
-                break;
-            case VBO_DECALBUF:
-                va->decalbuf = vbo;
-                va->decaldata = (ushort *)vbi.data;
-                break;
-        }
-    }
+    loopi(numva) setvbo(vas[i], type, vbo, vbi.data);
+}
+
+static void patchvbo(int type, GLuint vbo, int offset, int len)
+{
+    vboinfo &vbi = vbos[vbo];
+    GLenum target = type==VBO_VBUF ? GL_ARRAY_BUFFER : GL_ELEMENT_ARRAY_BUFFER;
+    glBindBuffer_(target, vbo);
+    glBufferSubData_(target, offset, len, &vbi.data[offset]);
+    glBindBuffer_(target, 0);
+
+    if(printvbo) conoutf(CON_DEBUG, "vbo %d: type %d, patched %d bytes at %d", vbo, type, len, offset);
 }
 
 void flushvbo(int type = -1)
@@ -99,15 +111,20 @@ void flushvbo(int type = -1)
     vbosize[type] = 0;
 }
 
-uchar *addvbo(vtxarray *va, int type, int numelems, int elemsize)
+static void setvbooffset(vtxarray *va, int type, int offset, int cap)
 {
     switch(type)
     {
-        case VBO_VBUF: va->voffset = vbosize[type]; break;
-        case VBO_EBUF: va->eoffset = vbosize[type]; break;
-        case VBO_SKYBUF: va->skyoffset = vbosize[type]; break;
-        case VBO_DECALBUF: va->decaloffset = vbosize[type]; break;
+        case VBO_VBUF: va->voffset = offset; va->vcap = cap; break;
+        case VBO_EBUF: va->eoffset = offset; va->ecap = cap; break;
+        case VBO_SKYBUF: va->skyoffset = offset; va->skycap = cap; break;
+        case VBO_DECALBUF: va->decaloffset = offset; va->decalcap = cap; break;
     }
+}
+
+uchar *addvbo(vtxarray *va, int type, int numelems, int elemsize)
+{
+    setvbooffset(va, type, vbosize[type], numelems);
 
     vbosize[type] += numelems;
 
@@ -122,6 +139,57 @@ uchar *addvbo(vtxarray *va, int type, int numelems, int elemsize)
     return buf;
 }
 
+// the vbo ranges a va owned before it was remeshed
+struct varegion
+{
+    GLuint vbo[NUMVBO];
+    int offset[NUMVBO], cap[NUMVBO];
+};
+
+static void takevbos(vtxarray *va, varegion &r)
+{
+    r.vbo[VBO_VBUF] = va->vbuf;
+    r.offset[VBO_VBUF] = va->voffset;
+    r.cap[VBO_VBUF] = va->vcap;
+    r.vbo[VBO_EBUF] = va->ebuf;
+    r.offset[VBO_EBUF] = va->eoffset;
+    r.cap[VBO_EBUF] = va->ecap;
+    r.vbo[VBO_SKYBUF] = va->skybuf;
+    r.offset[VBO_SKYBUF] = va->skyoffset;
+    r.cap[VBO_SKYBUF] = va->skycap;
+    r.vbo[VBO_DECALBUF] = va->decalbuf;
+    r.offset[VBO_DECALBUF] = va->decaloffset;
+    r.cap[VBO_DECALBUF] = va->decalcap;
+    va->vbuf = va->ebuf = va->skybuf = va->decalbuf = 0;
+}
+
+static void releasevbos(varegion &r)
+{
+    loopi(NUMVBO) if(r.vbo[i]) destroyvbo(r.vbo[i]);
+}
+
+struct vastage
+{
+    vtxarray *va;
+    vector<uchar> data[NUMVBO];
+
+    vastage() : va(NULL) {}
+
+    uchar *add(int type, int numelems, int elemsize)
+    {
+        int len = numelems*elemsize;
+        uchar *buf = data[type].reserve(len).buf;
+        data[type].advance(len);
+        return buf;
+    }
+
+    void reset()
+    {
+        va = NULL;
+        loopi(NUMVBO) data[i].setsize(0);
+    }
+};
+
 struct verthash
 {
     static const int SIZE = 1<<13;
@@ -277,11 +345,14 @@ struct vacollect : verthash
     vector<grasstri> grasstris;
     vector<materialsurface> matsurfs;
     vector<octaentities *> mapmodels, decals, extdecals;
+    hashset<int> decalsdone;
     int worldtris, skytris, decaltris;
     vec alphamin, alphamax;
     vec refractmin, refractmax;
     ivec nogimin, nogimax;
 
+    vacollect() { clear(); }
+
     void clear()
     {
         clearverts();
@@ -293,6 +364,7 @@ struct vacollect : verthash
         mapmodels.setsize(0);
         decals.setsize(0);
         extdecals.setsize(0);
+        decalsdone.clear();
         grasstris.setsize(0);
         texs.setsize(0);
         decaltexs.setsize(0);
@@ -417,9 +489,9 @@ struct vacollect : verthash
             octaentities *oe = extdecals[i];
             loopvj(oe->decals)
             {
+                if(decalsdone.access(oe->decals[j])) continue;
+                decalsdone.add(oe->decals[j]);
                 extentity &e = *ents[oe->decals[j]];
-                if(e.flags&EF_RENDER) continue;
-                e.flags |= EF_RENDER;
                 DecalSlot &s = lookupdecalslot(e.attr[0], true);
                 if(!s.shader) continue;
                 ushort envmap = s.shader->type&SHADER_ENVMAP ? (s.texmask&(1<<TEX_ENVMAP) ? EMID_CUSTOM : closestenvmap(e.o)) : EMID_NONE;
@@ -427,15 +499,6 @@ struct vacollect : verthash
                 gendecal(e, s, k);
             }
         }
-        loopv(extdecals)
-        {
-            octaentities *oe = extdecals[i];
-            loopvj(oe->decals)
-            {
-                extentity &e = *ents[oe->decals[j]];
-                if(e.flags&EF_RENDER) e.flags &= ~EF_RENDER;
-            }
-        }
         enumeratekt(decalindices, decalkey, k, sortval, t,
         {
             if(t.tris.length()) decaltexs.add(k);
@@ -443,7 +506,7 @@ struct vacollect : verthash
         decaltexs.sort(decalkey::sort);
     }
 
-    void setupdata(vtxarray *va)
+    void setupdata(vtxarray *va, vastage &s)
     {
         optimize();
         gendecals();
@@ -455,19 +518,7 @@ struct vacollect : verthash
         va->minvert = 0;
         va->maxvert = va->verts-1;
         va->voffset = 0;
-        if(va->verts)
-        {
-            if(vbosize[VBO_VBUF] + verts.length() > maxvbosize ||
-               vbosize[VBO_EBUF] + worldtris > USHRT_MAX ||
-               vbosize[VBO_SKYBUF] + skytris > USHRT_MAX ||
-               vbosize[VBO_DECALBUF] + decaltris > USHRT_MAX)
-                flushvbo();
-
-            uchar *vdata = addvbo(va, VBO_VBUF, va->verts, sizeof(vertex));
-            genverts(vdata);
-            va->minvert += va->voffset;
-            va->maxvert += va->voffset;
-        }
+        if(va->verts) genverts(s.add(VBO_VBUF, va->verts, sizeof(vertex)));
 
         va->matbuf = NULL;
         va->matsurfs = matsurfs.length();
@@ -493,12 +544,7 @@ struct vacollect : verthash
         va->skydata = 0;
         va->skyoffset = 0;
         va->sky = skyindices.length();
-        if(va->sky)
-        {
-            ushort *skydata = (ushort *)addvbo(va, VBO_SKYBUF, va->sky, sizeof(ushort));
-            memcpy(skydata, skyindices.getbuf(), va->sky*sizeof(ushort));
-            if(va->voffset) loopi(va->sky) skydata[i] += va->voffset;
-        }
+        if(va->sky) memcpy(s.add(VBO_SKYBUF, va->sky, sizeof(ushort)), skyindices.getbuf(), va->sky*sizeof(ushort));
 
         va->texelems = NULL;
         va->texs = texs.length();
@@ -516,7 +562,7 @@ struct vacollect : verthash
         if(va->texs)
         {
             va->texelems = new elementset[va->texs];
-            ushort *edata = (ushort *)addvbo(va, VBO_EBUF, worldtris, sizeof(ushort)), *curbuf = edata;
+            ushort *edata = (ushort *)s.add(VBO_EBUF, worldtris, sizeof(ushort)), *curbuf = edata;
             loopv(texs)
             {
                 const sortkey &k = texs[i];
@@ -536,7 +582,6 @@ struct vacollect : verthash
 
                     loopvj(t.tris)
                     {
-                        curbuf[j] += va->voffset;
                         e.minvert = min(e.minvert, curbuf[j]);
                         e.maxvert = max(e.maxvert, curbuf[j]);
                     }
@@ -572,7 +617,7 @@ struct vacollect : verthash
         if(va->decaltexs)
         {
             va->decalelems = new elementset[va->decaltexs];
-            ushort *edata = (ushort *)addvbo(va, VBO_DECALBUF, decaltris, sizeof(ushort)), *curbuf = edata;
+            ushort *edata = (ushort *)s.add(VBO_DECALBUF, decaltris, sizeof(ushort)), *curbuf = edata;
             loopv(decaltexs)
             {
                 const decalkey &k = decaltexs[i];
@@ -591,7 +636,6 @@ struct vacollect : verthash
 
                     loopvj(t.tris)
                     {
-                        curbuf[j] += va->voffset;
                         e.minvert = min(e.minvert, curbuf[j]);
                         e.maxvert = max(e.maxvert, curbuf[j]);
                     }
@@ -602,11 +646,7 @@ struct vacollect : verthash
             }
         }
 
-        if(grasstris.length())
-        {
-            va->grasstris.move(grasstris);
-            loadgrassshaders();
-        }
+        if(grasstris.length()) va->grasstris.move(grasstris);
 
         if(mapmodels.length()) va->mapmodels.put(mapmodels.getbuf(), mapmodels.length());
         if(decals.length()) va->decals.put(decals.getbuf(), decals.length());
@@ -616,7 +656,9 @@ struct vacollect : verthash
     {
         return verts.empty() && matsurfs.empty() && skyindices.empty() && grasstris.empty() && mapmodels.empty() && decals.empty();
     }
-} vc;
+};
+
+static thread_local vacollect vc;
 
 int recalcprogress = 0;
 #define progress(s)     if((recalcprogress++&0xFFF)==0) renderprogress(recalcprogress/(float)allocnodes, s);
@@ -1127,7 +1169,7 @@ int allocva = 0;
 int wtris = 0, wverts = 0, vtris = 0, vverts = 0, glde = 0, gbatches = 0;
 vector<vtxarray *> valist, varoot;
 
-vtxarray *newva(const ivec &o, int size)
+vtxarray *newva(const ivec &o, int size, vastage &s)
 {
     vtxarray *va = new vtxarray;
     va->parent = NULL;
@@ -1141,7 +1183,8 @@ vtxarray *newva(const ivec &o, int size)
     va->hasmerges = 0;
     va->mergelevel = -1;
 
-    vc.setupdata(va);
+    s.va = va;
+    vc.setupdata(va, s);
 
     if(va->alphafronttris || va->alphabacktris || va->refracttris)
     {
@@ -1158,12 +1201,112 @@ vtxarray *newva(const ivec &o, int size)
     va->nogimin = vc.nogimin;
     va->nogimax = vc.nogimax;
 
+    return va;
+}
+
+static inline void offsetelems(ushort *buf, int len, int offset)
+{
+    if(offset) loopi(len) buf[i] += offset;
+}
+
+static inline void offsetelems(elementset *elems, int numelems, int offset)
+{
+    if(offset) loopi(numelems) if(elems[i].length)
+    {
+        elems[i].minvert += offset;
+        elems[i].maxvert += offset;
+    }
+}
+
+VAR(remeshslack, 0, 25, 100);
+
+int remeshpatched = 0, remeshrealloced = 0;
+
+// copies the staged buffers of a va into the shared vbos, main thread only
+// a remeshed va writes over its old vbo ranges while they are still big enough
+void commitva(vastage &s, varegion *reuse = NULL)
+{
+    static const int elemsizes[NUMVBO] = { sizeof(vertex), sizeof(ushort), sizeof(ushort), sizeof(ushort) };
+    vtxarray *va = s.va;
+    int need[NUMVBO];
+    bool patched[NUMVBO], appended = false;
+    loopi(NUMVBO)
+    {
+        int numelems = s.data[i].length()/elemsizes[i];
+        need[i] = 0;
+        patched[i] = false;
+        if(reuse && reuse->vbo[i])
+        {
+            if(numelems && numelems <= reuse->cap[i]) { patched[i] = true; continue; }
+            destroyvbo(reuse->vbo[i]);
+            reuse->vbo[i] = 0;
+        }
+        if(!numelems) continue;
+        need[i] = reuse ? max(numelems, min(numelems + numelems*remeshslack/100, int(USHRT_MAX))) : numelems;
+        appended = true;
+    }
+
+    if(appended &&
+       (vbosize[VBO_VBUF] + need[VBO_VBUF] > maxvbosize ||
+        vbosize[VBO_EBUF] + need[VBO_EBUF] > USHRT_MAX ||
+        vbosize[VBO_SKYBUF] + need[VBO_SKYBUF] > USHRT_MAX ||
+        vbosize[VBO_DECALBUF] + need[VBO_DECALBUF] > USHRT_MAX))
+        flushvbo();
+
+    uchar *dst[NUMVBO];
+    loopi(NUMVBO)
+    {
+        int len = s.data[i].length();
+        if(patched[i])
+        {
+            uchar *data = vbos[reuse->vbo[i]].data;
+            setvbo(va, i, reuse->vbo[i], data);
+            setvbooffset(va, i, reuse->offset[i], reuse->cap[i]);
+            dst[i] = &data[reuse->offset[i]*elemsizes[i]];
+        }
+        else if(need[i])
+        {
+            dst[i] = addvbo(va, i, need[i], elemsizes[i]);
+            if(need[i]*elemsizes[i] > len) memset(&dst[i][len], 0, need[i]*elemsizes[i] - len);
+        }
+        else
+        {
+            setvbooffset(va, i, 0, 0);
+            dst[i] = NULL;
+            continue;
+        }
+        memcpy(dst[i], s.data[i].getbuf(), len);
+    }
+
+    if(va->verts)
+    {
+        va->minvert += va->voffset;
+        va->maxvert += va->voffset;
+    }
+    if(dst[VBO_SKYBUF]) offsetelems((ushort *)dst[VBO_SKYBUF], va->sky, va->voffset);
+    if(dst[VBO_EBUF])
+    {
+        offsetelems((ushort *)dst[VBO_EBUF], s.data[VBO_EBUF].length()/sizeof(ushort), va->voffset);
+        offsetelems(va->texelems, va->texs+va->blends+va->alphaback+va->alphafront+va->refract, va->voffset);
+    }
+    if(dst[VBO_DECALBUF])
+    {
+        offsetelems((ushort *)dst[VBO_DECALBUF], s.data[VBO_DECALBUF].length()/sizeof(ushort), va->voffset);
+        offsetelems(va->decalelems, va->decaltexs, va->voffset);
+    }
+    loopi(NUMVBO) if(patched[i]) patchvbo(i, reuse->vbo[i], reuse->offset[i]*elemsizes[i], s.data[i].length());
+    if(reuse)
+    {
+        if(appended) remeshrealloced++;
+        else remeshpatched++;
+    }
+
+    if(va->grasstris.length()) loadgrassshaders();
+
     wverts += va->verts;
     wtris  += va->tris + va->blends + va->alphabacktris + va->alphafronttris + va->refracttris + va->decaltris;
     allocva++;
     valist.add(va);
-
-    return va;
 }
 
 void destroyva(vtxarray *va, bool reparent)
@@ -1171,6 +1314,7 @@ void destroyva(vtxarray *va, bool reparent)
     wverts -= va->verts;
     wtris -= va->tris + va->blends + va->alphabacktris + va->alphafronttris + va->refracttris + va->decaltris;
     allocva--;
+    clearvabounds();
     valist.removeobj(va);
     if(!va->parent) varoot.removeobj(va);
     if(reparent)
@@ -1213,6 +1357,8 @@ void updatevabb(vtxarray *va, bool force)
 {
     if(!force && va->bbmin.x >= 0) return;
 
+    clearvabounds();
+
     va->bbmin = va->geommin;
     va->bbmax = va->geommax;
     va->bbmin.min(va->lavamin);
@@ -1273,8 +1419,8 @@ struct mergedface
 };
 
 #define MAXMERGELEVEL 12
-static int vahasmerges = 0, vamergemax = 0;
-static vector<mergedface> vamerges[MAXMERGELEVEL+1];
+static thread_local int vahasmerges = 0, vamergemax = 0;
+static thread_local vector<mergedface> vamerges[MAXMERGELEVEL+1];
 
 int genmergedfaces(cube &c, const ivec &co, int size, int minlevel = -1)
 {
@@ -1455,8 +1601,25 @@ void calcgeombb(const ivec &co, int size, ivec &bbmin, ivec &bbmax)
     bbmax = ivec(vmax.mul(8)).add(7).shr(3);
 }
 
-static int entdepth = -1;
-static octaentities *entstack[32];
+static thread_local int entdepth = -1;
+static thread_local octaentities *entstack[32];
+
+// a subtree rooted at a forced va, built on its own by a va worker
+struct vatask
+{
+    cube *c;
+    ivec o;
+    int size, csi, root;
+    int entdepth, neighbourdepth;
+    octaentities *entstack[32];
+    const cube *neighbourstack[32];
+    vector<vastage *> vas;
+
+    ~vatask() { vas.deletecontents(); }
+};
+
+static thread_local vatask *curvatask = NULL;
+static vastage mainstage;
 
 void setva(cube &c, const ivec &co, int size, int csi)
 {
@@ -1481,15 +1644,21 @@ void setva(cube &c, const ivec &co, int size, int csi)
 
     calcgeombb(co, size, bbmin, bbmax);
 
-    if(size == min(0x1000, worldsize/2) || !vc.emptyva())
+    if(size == min(0x1000, worldsize/2) || (curvatask && curvatask->c == &c) || !vc.emptyva())
     {
-        vtxarray *va = newva(co, size);
+        vastage &s = curvatask ? *curvatask->vas.add(new vastage) : mainstage;
+        vtxarray *va = newva(co, size, s);
         ext(c).va = va;
         va->geommin = bbmin;
         va->geommax = bbmax;
         calcmatbb(va, co, size, vc.matsurfs);
         va->hasmerges = vahasmerges;
         va->mergelevel = vamergemax;
+        if(!curvatask)
+        {
+            commitva(s);
+            s.reset();
+        }
     }
     else
     {
@@ -1528,45 +1697,68 @@ VARF(vafacemax, 64, 384, 256*256, allchanged());
 VARF(vafacemin, 0, 96, 256*256, allchanged());
 VARF(vacubesize, 32, 128, 0x1000, allchanged());
 
-int updateva(cube *c, const ivec &co, int size, int csi)
+static bool collectvatasks = false;
+static vector<vatask *> vatasks;
+
+static void addvatask(cube &c, const ivec &o, int size, int csi, vector<vtxarray *> &roots)
+{
+    vatask &t = *vatasks.add(new vatask);
+    t.c = &c;
+    t.o = o;
+    t.size = size;
+    t.csi = csi;
+    t.root = roots.length();
+    roots.add(NULL);
+    t.entdepth = entdepth;
+    loopi(entdepth+1) t.entstack[i] = entstack[i];
+    t.neighbourdepth = neighbourdepth;
+    loopi(neighbourdepth+1) t.neighbourstack[i] = neighbourstack[i];
+}
+
+int updateva(cube *c, const ivec &co, int size, int csi, vector<vtxarray *> &roots)
 {
-    progress("recalculating geometry...");
+    if(!curvatask) { progress("recalculating geometry..."); }
     int ccount = 0, cmergemax = vamergemax, chasmerges = vahasmerges;
     neighbourstack[++neighbourdepth] = c;
     loopi(8)                                    // counting number of semi-solid/solid children cubes
     {
-        int count = 0, childpos = varoot.length();
+        int count = 0, childpos = roots.length();
         ivec o(i, co, size);
         vamergemax = 0;
         vahasmerges = 0;
         if(c[i].ext && c[i].ext->va)
         {
-            varoot.add(c[i].ext->va);
+            roots.add(c[i].ext->va);
             if(c[i].ext->va->hasmerges&MERGE_ORIGIN) findmergedfaces(c[i], o, size, csi, csi);
         }
+        else if(collectvatasks && size == min(0x1000, worldsize/2))
+        {
+            addvatask(c[i], o, size, csi, roots);
+            continue;
+        }
         else
         {
             if(c[i].children)
             {
                 if(c[i].ext && c[i].ext->ents) entstack[++entdepth] = c[i].ext->ents;
-                count += updateva(c[i].children, o, size/2, csi-1);
+                count += updateva(c[i].children, o, size/2, csi-1, roots);
                 if(c[i].ext && c[i].ext->ents) --entdepth;
             }
             else if(!isempty(c[i])) count += setcubevisibility(c[i], o, size);
             int tcount = count + (csi <= MAXMERGELEVEL ? vamerges[csi].length() : 0);
             if(tcount > vafacemax || (tcount >= vafacemin && size >= vacubesize) || size == min(0x1000, worldsize/2))
             {
-                loadprogress = clamp(recalcprogress/float(allocnodes), 0.0f, 1.0f);
+                if(!curvatask) loadprogress = clamp(recalcprogress/float(allocnodes), 0.0f, 1.0f);
                 setva(c[i], o, size, csi);
                 if(c[i].ext && c[i].ext->va)
                 {
-                    while(varoot.length() > childpos)
+                    while(roots.length() > childpos)
                     {
-                        vtxarray *child = varoot.pop();
+                        vtxarray *child = roots.pop();
                         c[i].ext->va->children.add(child);
                         child->parent = c[i].ext->va;
                     }
-                    varoot.add(c[i].ext->va);
+                    roots.add(c[i].ext->va);
                     if(vamergemax > size)
                     {
                         cmergemax = max(cmergemax, vamergemax);
@@ -1589,6 +1781,123 @@ int updateva(cube *c, const ivec &co, int size, int csi)
     return ccount;
 }
 
+static void runvatask(vatask &t)
+{
+    PROFILE("va task");
+    int oldentdepth = entdepth, oldneighbourdepth = neighbourdepth;
+    curvatask = &t;
+    entdepth = t.entdepth;
+    loopi(entdepth+1) entstack[i] = t.entstack[i];
+    neighbourdepth = t.neighbourdepth;
+    loopi(neighbourdepth+1) neighbourstack[i] = t.neighbourstack[i];
+    loopi(MAXMERGELEVEL+1) vamerges[i].setsize(0);
+    vamergemax = vahasmerges = 0;
+
+    cube &c = *t.c;
+    vector<vtxarray *> children;
+    if(c.children)
+    {
+        if(c.ext && c.ext->ents) entstack[++entdepth] = c.ext->ents;
+        updateva(c.children, t.o, t.size/2, t.csi-1, children);
+        if(c.ext && c.ext->ents) --entdepth;
+    }
+    else if(!isempty(c)) setcubevisibility(c, t.o, t.size);
+    setva(c, t.o, t.size, t.csi);
+    vtxarray *va = c.ext->va;
+    while(children.length())
+    {
+        vtxarray *child = children.pop();
+        if(child->parent) child->parent->children.removeobj(child);
+        va->children.add(child);
+        child->parent = va;
+    }
+
+    curvatask = NULL;
+    entdepth = oldentdepth;
+    neighbourdepth = oldneighbourdepth;
+}
+
+// workers may not load textures, so link every slot a task can reach up front
+static void linkvatextures(cube &c)
+{
+    if(c.children)
+    {
+        loopi(8) linkvatextures(c.children[i]);
+        return;
+    }
+    if(isempty(c)) return;
+    loopi(6)
+    {
+        VSlot &vslot = lookupvslot(c.texture[i], true);
+        if(vslot.layer && !(c.material&MAT_ALPHA)) lookupvslot(vslot.layer, true);
+    }
+}
+
+VARP(vathreads, 0, 0, 16);
+
+static inline int vathreadcount() { return vathreads > 0 ? vathreads : numcpus; }
+
+static SDL_mutex *vamutex = NULL;
+static SDL_cond *vacond = NULL;
+static int vataskpos = 0, vatasksdone = 0;
+
+static int vaworker(void *data)
+{
+    profthreadname("va worker");
+    SDL_LockMutex(vamutex);
+    while(vataskpos < vatasks.length())
+    {
+        vatask &t = *vatasks[vataskpos++];
+        SDL_UnlockMutex(vamutex);
+        runvatask(t);
+        SDL_LockMutex(vamutex);
+        vatasksdone++;
+        SDL_CondSignal(vacond);
+    }
+    SDL_UnlockMutex(vamutex);
+    return 0;
+}
+
+static void buildvatasks()
+{
+    starttexturebatch();
+    loopv(vatasks) linkvatextures(*vatasks[i]->c);
+    vector<extentity *> &ents = entities::getents();
+    loopv(ents) if(ents[i]->type == ET_DECAL) lookupdecalslot(ents[i]->attr[0], true);
+    endtexturebatch();
+
+    int numthreads = min(vathreadcount(), vatasks.length());
+    if(numthreads <= 1) loopv(vatasks) runvatask(*vatasks[i]);
+    else
+    {
+        if(!vamutex) vamutex = SDL_CreateMutex();
+        if(!vacond) vacond = SDL_CreateCond();
+        vataskpos = vatasksdone = 0;
+        vector<SDL_Thread *> threads;
+        loopi(numthreads) threads.add(SDL_CreateThread(vaworker, "va worker", NULL));
+        SDL_LockMutex(vamutex);
+        while(vatasksdone < vatasks.length())
+        {
+            int done = vatasksdone;
+            SDL_UnlockMutex(vamutex);
+            renderprogress(done/float(vatasks.length()), "recalculating geometry...");
+            SDL_LockMutex(vamutex);
+            if(vatasksdone == done) SDL_CondWaitTimeout(vacond, vamutex, 100);
+        }
+        SDL_UnlockMutex(vamutex);
+        loopv(threads) SDL_WaitThread(threads[i], NULL);
+    }
+
+    // upload in traversal order so the vbo layout matches a serial build
+    loopv(vatasks)
+    {
+        vatask &t = *vatasks[i];
+        loopvj(t.vas) commitva(*t.vas[j]);
+        varoot[t.root] = t.c->ext->va;
+    }
+    vatasks.deletecontents();
+}
+
 void addtjoint(const edgegroup &g, const cubeedge &e, int offset)
 {
     int vcoord = (g.slope[g.axis]*offset + g.origin[g.axis]) & 0x7FFF;
@@ -1662,14 +1971,110 @@ void findtjoints()
     edgegroups.clear();
 }
 
+struct remeshtask
+{
+    ivec o;
+    int size;
+    varegion region;
+};
+
+static vector<remeshtask> remeshtasks;
+
+// queues a va to be rebuilt on its own under its parent va, keeping its vbo ranges for reuse
+void remeshva(cube &c, const ivec &co, int size)
+{
+    vtxarray *va = c.ext->va;
+    remeshtask &r = remeshtasks.add();
+    r.o = co;
+    r.size = size;
+    takevbos(va, r.region);
+    destroyva(va);
+    c.ext->va = NULL;
+}
+
+static vtxarray *findremeshparent(const remeshtask &r, vatask &t)
+{
+    vtxarray *parent = NULL;
+    cube *c = worldroot;
+    ivec co(0, 0, 0);
+    int size = worldsize>>1, csi = worldscale-1;
+    t.entdepth = t.neighbourdepth = -1;
+    for(;;)
+    {
+        t.neighbourstack[++t.neighbourdepth] = c;
+        int i = octastep(r.o.x, r.o.y, r.o.z, csi);
+        ivec o(i, co, size);
+        cube &cur = c[i];
+        if(size <= r.size)
+        {
+            if(size < r.size || (cur.ext && cur.ext->va)) return NULL;
+            t.c = &cur;
+            t.o = o;
+            t.size = size;
+            t.csi = csi;
+            return parent;
+        }
+        if(cur.ext && cur.ext->va) parent = cur.ext->va;
+        if(!cur.children) return NULL;
+        if(cur.ext && cur.ext->ents) t.entstack[++t.entdepth] = cur.ext->ents;
+        c = cur.children;
+        co = o;
+        size >>= 1;
+        csi--;
+    }
+}
+
+static inline bool remeshcmp(const remeshtask &x, const remeshtask &y)
+{
+    return x.size < y.size;
+}
+
+static void remeshvas()
+{
+    if(remeshtasks.empty()) return;
+    // smallest first, so a va queued inside another queued va is rebuilt before its parent picks it up
+    remeshtasks.sort(remeshcmp);
+    loopv(remeshtasks)
+    {
+        remeshtask &r = remeshtasks[i];
+        vatask t;
+        vtxarray *parent = findremeshparent(r, t);
+        if(!parent)
+        {
+            // an ancestor is being rebuilt anyway, which will cover this subtree
+            releasevbos(r.region);
+            continue;
+        }
+        runvatask(t);
+        vtxarray *va = t.c->ext->va;
+        loopvj(t.vas)
+        {
+            vtxarray *tva = t.vas[j]->va;
+            commitva(*t.vas[j], tva == va ? &r.region : NULL);
+            loopvk(tva->mapmodels) parent->mapmodels.removeobj(tva->mapmodels[k]);
+            loopvk(tva->decals) parent->decals.removeobj(tva->decals[k]);
+        }
+        va->parent = parent;
+        parent->children.add(va);
+        for(vtxarray *p = parent; p; p = p->parent) p->bbmin.x = -1;
+    }
+    remeshtasks.setsize(0);
+}
+
 void octarender()                               // creates va s for all leaf cubes that don't already have them
 {
+    PROFILE("va build");
     int csi = 0;
     while(1<<csi < worldsize) csi++;
 
+    remeshvas();
+
     recalcprogress = 0;
     varoot.setsize(0);
-    updateva(worldroot, ivec(0, 0, 0), worldsize/2, csi-1);
+    collectvatasks = vathreadcount() > 1;
+    updateva(worldroot, ivec(0, 0, 0), worldsize/2, csi-1, varoot);
+    collectvatasks = false;
+    if(vatasks.length()) buildvatasks();
     loadprogress = 0;
     flushvbo();
 
@@ -1682,6 +2087,8 @@ void octarender()                               // creates va s for all leaf cub
 
     extern vtxarray *visibleva;
     visibleva = NULL;
+
+    genoccluders();
 }
 
 void precachetextures()
@@ -1703,11 +2110,13 @@ void precachetextures()
             }
         }
     }
+    starttexturebatch();
     loopv(texs)
     {
         loadprogress = float(i+1)/texs.length();
         lookupvslot(texs[i]);
     }
+    endtexturebatch();
     loadprogress = 0;
 }
 
@@ -1743,3 +2152,31 @@ void recalc()
 
 COMMAND(recalc, "");
 
+void vabench(int *numiters)
+{
+    int iters = clamp(*numiters, 1, 100), oldthreads = vathreads, threads[2] = { 1, vathreadcount() };
+    uint millis[2] = { 0, 0 };
+    loopk(threads[1] > 1 ? 2 : 1)
+    {
+        vathreads = threads[k];
+        loopi(iters)
+        {
+            clearvas(worldroot);
+            resetqueries();
+            tjoints.setsize(0);
+            if(filltjoints) findtjoints();
+            Uint32 start = SDL_GetTicks();
+            octarender();
+            millis[k] += SDL_GetTicks() - start;
+        }
+    }
+    vathreads = oldthreads;
+    allchanged();
+    if(threads[1] > 1)
+        conoutf("built %d vas: %.1f ms on 1 thread, %.1f ms on %d threads (%.2fx)",
+            valist.length(), millis[0]/float(iters), millis[1]/float(iters), threads[1], millis[0]/float(max(millis[1], 1U)));
+    else conoutf("built %d vas: %.1f ms on 1 thread", valist.length(), millis[0]/float(iters));
+}
+
+COMMAND(vabench, "i");
+
@@ -8,7 +8,10 @@
 #include "game.hh"
 
 const int MAXCLIPPLANES = 1024;
-static clipplanes clipcache[MAXCLIPPLANES];
+static clipplanes mainclipcache[MAXCLIPPLANES];
+// ray workers swap in a cache of their own, see rayworker
+static thread_local clipplanes *clipcache = mainclipcache;
+static vector<clipplanes *> rayclipcaches;
 static int clipcacheversion = -2;
 
 static inline clipplanes &getclipplanes(const cube &c, const ivec &o, int size, bool collide = true, int offset = 0)
@@ -28,7 +31,8 @@ void resetclipplanes()
     clipcacheversion += 2;
     if(!clipcacheversion)
     {
-        memset(clipcache, 0, sizeof(clipcache));
+        memset(mainclipcache, 0, sizeof(mainclipcache));
+        loopv(rayclipcaches) memset(rayclipcaches[i], 0, sizeof(clipplanes)*MAXCLIPPLANES);
         clipcacheversion = 2;
     }
 }
@@ -100,7 +104,7 @@ bool pointincube(const clipplanes &p, const vec &v)
          else if(v[i] < p.o[i]-p.r[i] || v[i] > p.o[i]+p.r[i]) exit; \
     }
 
-vec hitsurface;
+thread_local vec hitsurface;
 
 static inline bool raycubeintersect(const clipplanes &p, const cube &c, const vec &v, const vec &ray, const vec &invray, float maxdist, float &dist)
 {
@@ -118,8 +122,8 @@ static inline bool raycubeintersect(const clipplanes &p, const cube &c, const ve
 }
 
 extern void entselectionbox(const entity &e, vec &eo, vec &es);
-float hitentdist;
-int hitent, hitorient;
+thread_local float hitentdist;
+thread_local int hitent, hitorient;
 
 static float disttoent(octaentities *oc, const vec &o, const vec &ray, float radius, int mode, extentity *t)
 {
@@ -410,6 +414,276 @@ float rayfloor(const vec &o, vec &floor, int mode, float radius)
     return dist;
 }
 
+// batch form of raycube for coherent sets of rays (spreads, line of sight
+// fans, probes): the octree is walked for each ray without the mapmodels,
+// then every mapmodel some ray can reach is intersected with those rays in
+// packets of four; the distances match raycube, but hitsurface is not set
+struct raybatch
+{
+    const vec *o, *ray;
+    const float *radii;
+    float *dists;
+    float radius;
+    int mode;
+    extentity *t;
+
+    float getradius(int i) const { return radii ? radii[i] : radius; }
+};
+
+static void raycuberange(const raybatch &b, int start, int end)
+{
+    PROFILE("ray batch");
+    const vec *o = b.o, *ray = b.ray;
+    float *dists = b.dists;
+    int mode = b.mode;
+    if(mode&RAY_SHADOW)
+    {
+        for(int i = start; i < end; i++) dists[i] = shadowray(o[i], ray[i], b.getradius(i), mode, b.t);
+        return;
+    }
+    bool polys = (mode&RAY_POLY) == RAY_POLY;
+    for(int i = start; i < end; i++) dists[i] = raycube(o[i], ray[i], b.getradius(i), polys ? mode&~(RAY_POLY&~RAY_BB) : mode, 0, b.t);
+    if(!polys) return;
+
+    const vector<extentity *> &ents = entities::getents();
+    vec po[4], pray[4];
+    float pmax[4], pdist[4];
+    int lanes[4];
+    loopv(ents)
+    {
+        extentity &e = *ents[i];
+        if((e.type != ET_MAPMODEL && e.type != ET_OBSTACLE) || !(e.flags&EF_OCTA) || &e == b.t) continue;
+        model *m = entities::getmodel(e);
+        if(!m || (!m->bih && !m->setBIH())) continue;
+        float r = sqrtf(m->bih->entradius);
+        if(e.attr[3] > 0) r *= e.attr[3]/100.0f;
+        int n = 0;
+        for(int j = start; j < end; j++)
+        {
+            if(dists[j] < 0 || ray[j].iszero()) continue;
+            float maxd = dists[j];
+            vec to = vec(e.o).sub(o[j]);
+            float tc = clamp(to.dot(ray[j])/ray[j].squaredlen(), 0.0f, maxd);
+            if(to.sub(vec(ray[j]).mul(tc)).squaredlen() > r*r) continue;
+            po[n] = o[j];
+            pray[n] = ray[j];
+            pmax[n] = maxd;
+            lanes[n++] = j;
+            if(n < 4 && j < end-1) continue;
+            int hits = mmintersect4(e, po, pray, n, pmax, mode, pdist);
+            loopk(n) if(hits&(1<<k) && pdist[k] > 0 && pdist[k] < pmax[k]) dists[lanes[k]] = pdist[k];
+            n = 0;
+        }
+        if(n)
+        {
+            int hits = mmintersect4(e, po, pray, n, pmax, mode, pdist);
+            loopk(n) if(hits&(1<<k) && pdist[k] > 0 && pdist[k] < pmax[k]) dists[lanes[k]] = pdist[k];
+        }
+    }
+}
+
+// large batches are cut into chunks of rays that a pool of worker threads
+// and the calling thread pick up; each worker walks the octree with its own
+// clip plane cache and hit state, and anything the rays would otherwise load
+// lazily (mapmodel BIHs, alpha masks) is loaded up front on the main thread
+
+VARP(raythreads, 0, 0, 16);
+
+#define RAYCHUNK 64
+
+static inline int raythreadcount() { return raythreads > 0 ? raythreads : max(numcpus-1, 1); }
+
+static SDL_mutex *raymutex = NULL;
+static SDL_cond *raycond = NULL, *raydonecond = NULL;
+static vector<SDL_Thread *> raythreadpool;
+static const raybatch *raywork = NULL;
+static int raynext = 0, rayend = 0, raypending = 0, rayactive = 0;
+
+static int rayworker(void *data)
+{
+    int id = int(size_t(data));
+    profthreadname("ray worker");
+    SDL_LockMutex(raymutex);
+    clipcache = rayclipcaches[id];
+    for(;;)
+    {
+        while(!raywork || raynext >= rayend || id >= rayactive) SDL_CondWait(raycond, raymutex);
+        const raybatch &b = *raywork;
+        int start = raynext, end = min(start + RAYCHUNK, rayend);
+        raynext = end;
+        SDL_UnlockMutex(raymutex);
+        raycuberange(b, start, end);
+        SDL_LockMutex(raymutex);
+        raypending -= end - start;
+        if(raypending <= 0) SDL_CondSignal(raydonecond);
+    }
+    SDL_UnlockMutex(raymutex);
+    return 0;
+}
+
+// returns false if some alpha mask can't be loaded, as the rays would keep retrying it
+static bool prepareraybatch(const raybatch &b)
+{
+    if((b.mode&RAY_POLY) != RAY_POLY && !(b.mode&RAY_SHADOW)) return true;
+    bool alpha = (b.mode&RAY_ALPHAPOLY) == RAY_ALPHAPOLY, ok = true;
+    const vector<extentity *> &ents = entities::getents();
+    loopv(ents)
+    {
+        extentity &e = *ents[i];
+        if((e.type != ET_MAPMODEL && e.type != ET_OBSTACLE) || !(e.flags&EF_OCTA)) continue;
+        model *m = entities::getmodel(e);
+        if(!m || (!m->bih && !m->setBIH()) || !alpha) continue;
+        loopj(m->bih->nummeshes)
+        {
+            const BIH::mesh &bm = m->bih->meshes[j];
+            if(bm.flags&BIH::MESH_ALPHA && bm.tex && !loadalphamask(bm.tex)) ok = false;
+        }
+    }
+    return ok;
+}
+
+static void runraybatch(const raybatch &b, int numrays)
+{
+    int numthreads = min(raythreadcount(), (numrays + RAYCHUNK - 1)/RAYCHUNK - 1);
+    if(numthreads <= 0 || !prepareraybatch(b)) { raycuberange(b, 0, numrays); return; }
+
+    if(!raymutex)
+    {
+        raymutex = SDL_CreateMutex();
+        raycond = SDL_CreateCond();
+        raydonecond = SDL_CreateCond();
+    }
+
+    SDL_LockMutex(raymutex);
+    while(raythreadpool.length() < numthreads)
+    {
+        clipplanes *cache = new clipplanes[MAXCLIPPLANES];
+        memset(cache, 0, sizeof(clipplanes)*MAXCLIPPLANES);
+        rayclipcaches.add(cache);
+        raythreadpool.add(SDL_CreateThread(rayworker, "ray worker", (void *)size_t(raythreadpool.length())));
+    }
+    raywork = &b;
+    raynext = 0;
+    rayend = raypending = numrays;
+    rayactive = numthreads;
+    SDL_CondBroadcast(raycond);
+    while(raynext < rayend)
+    {
+        int start = raynext, end = min(start + RAYCHUNK, rayend);
+        raynext = end;
+        SDL_UnlockMutex(raymutex);
+        raycuberange(b, start, end);
+        SDL_LockMutex(raymutex);
+        raypending -= end - start;
+    }
+    while(raypending > 0) SDL_CondWait(raydonecond, raymutex);
+    raywork = NULL;
+    SDL_UnlockMutex(raymutex);
+}
+
+void raycubes(const vec *o, const vec *ray, float *dists, int numrays, float radius, int mode, extentity *t)
+{
+    raybatch b = { o, ray, NULL, dists, radius, mode, t };
+    runraybatch(b, numrays);
+}
+
+// batch form of raycubelos, returns how many of the lines are clear
+int raycubelos(const vec *o, const vec *dest, int numrays, bool *los, vec *hitpos)
+{
+    static vector<vec> rays;
+    static vector<float> radii, dists;
+    rays.setsize(0);
+    radii.setsize(0);
+    dists.setsize(0);
+    loopi(numrays)
+    {
+        vec &ray = rays.add(vec(dest[i]).sub(o[i]));
+        float mag = ray.magnitude();
+        if(mag > 0) ray.mul(1/mag);
+        radii.add(mag);
+        dists.add(0);
+    }
+    raybatch b = { o, rays.getbuf(), radii.getbuf(), dists.getbuf(), 0, RAY_CLIPMAT|RAY_POLY, NULL };
+    runraybatch(b, numrays);
+    int clear = 0;
+    loopi(numrays)
+    {
+        float dist = dists[i];
+        if(radii[i] > 0 && dist >= radii[i]) dist = radii[i];
+        bool visible = dist >= radii[i];
+        if(los) los[i] = visible;
+        if(hitpos) hitpos[i] = vec(rays[i]).mul(dist).add(o[i]);
+        if(visible) clear++;
+    }
+    return clear;
+}
+
+// casts a fan of rays from the camera against the loaded map, one at a
+// time through raycube and as a batch on this thread and on the ray
+// workers through raycubes, and the same rays
+// against every mapmodel through mmintersect and mmintersect4
+static void raybench(int *numrays, int *iters)
+{
+    int side = max(int(sqrtf(*numrays > 0 ? *numrays : 1024)), 2), n = side*side, loops = *iters > 0 ? *iters : 10;
+    vec *o = new vec[n], *rays = new vec[n];
+    float *scalar = new float[n], *batch = new float[n];
+    loopi(side) loopj(side)
+    {
+        int k = i*side + j;
+        o[k] = camera1->o;
+        vecfromyawpitch(camera1->yaw + (j - side/2)*30.0f/side, camera1->pitch + (i - side/2)*30.0f/side, 1, 0, rays[k]);
+    }
+    const int mode = RAY_CLIPMAT|RAY_POLY;
+    double freq = SDL_GetPerformanceFrequency();
+
+    Uint64 start = SDL_GetPerformanceCounter();
+    loopk(loops) loopi(n) scalar[i] = raycube(o[i], rays[i], 0, mode);
+    double scalarsecs = (SDL_GetPerformanceCounter() - start)/freq;
+    raybatch b = { o, rays, NULL, batch, 0, mode, NULL };
+    start = SDL_GetPerformanceCounter();
+    loopk(loops) raycuberange(b, 0, n);
+    double batchsecs = (SDL_GetPerformanceCounter() - start)/freq;
+    int mismatches = 0;
+    loopi(n) if(fabs(scalar[i] - batch[i]) > 0.01f) mismatches++;
+    start = SDL_GetPerformanceCounter();
+    loopk(loops) raycubes(o, rays, batch, n, 0, mode);
+    double threadsecs = (SDL_GetPerformanceCounter() - start)/freq;
+    loopi(n) if(fabs(scalar[i] - batch[i]) > 0.01f) mismatches++;
+    conoutf("raybench: %d rays, raycube %.2f Mrays/s, raycubes %.2f Mrays/s, %d threads %.2f Mrays/s, %d differ",
+        n, n*loops/(1e6*max(scalarsecs, 1e-9)), n*loops/(1e6*max(batchsecs, 1e-9)),
+        min(raythreadcount(), (n + RAYCHUNK - 1)/RAYCHUNK - 1) + 1, n*loops/(1e6*max(threadsecs, 1e-9)), mismatches);
+
+    const vector<extentity *> &ents = entities::getents();
+    int nummms = 0, scalarhits = 0, packethits = 0;
+    Uint64 scalarticks = 0, packetticks = 0;
+    loopv(ents)
+    {
+        extentity &e = *ents[i];
+        if(e.type != ET_MAPMODEL || !(e.flags&EF_OCTA)) continue;
+        nummms++;
+        float f, dist[4], maxdist[4] = { 1e16f, 1e16f, 1e16f, 1e16f };
+        start = SDL_GetPerformanceCounter();
+        loopk(loops) loopj(n) if(mmintersect(e, o[j], rays[j], 0, mode, f) && !k) scalarhits++;
+        scalarticks += SDL_GetPerformanceCounter() - start;
+        start = SDL_GetPerformanceCounter();
+        loopk(loops) for(int j = 0; j < n; j += 4)
+        {
+            int hits = mmintersect4(e, &o[j], &rays[j], min(n-j, 4), maxdist, mode, dist);
+            if(!k) for(; hits; hits &= hits-1) packethits++;
+        }
+        packetticks += SDL_GetPerformanceCounter() - start;
+    }
+    if(nummms) conoutf("raybench: %d mapmodels, mmintersect %.2f Mrays/s (%d hits), mmintersect4 %.2f Mrays/s (%d hits)",
+        nummms, double(n)*loops*nummms/(1e6*max(scalarticks/freq, 1e-9)), scalarhits,
+        double(n)*loops*nummms/(1e6*max(packetticks/freq, 1e-9)), packethits);
+
+    delete[] o;
+    delete[] rays;
+    delete[] scalar;
+    delete[] batch;
+}
+COMMAND(raybench, "ii");
+
 /////////////////////////  entity collision  ///////////////////////////////////////////////
 
 // info about collisions
@@ -516,47 +790,108 @@ bool ellipsecollide(physent *d, const vec &dir, const vec &o, const vec &center,
     return false;
 }
 
-#define DYNENTCACHESIZE 1024
+// dynamic entities are kept in a loose grid of 2D cells 1<<dynentsize wide;
+// each entity remembers the cell range it is linked into and is only moved
+// between cells when it crosses a cell border, so a frame costs one pass
+// over the entities instead of a pass per touched cell
 
-static uint dynentframe = 0;
-
-static struct dynentcacheentry
+struct dynentlink
 {
-    int x, y;
+    ivec2 bbmin, bbmax;
     uint frame;
-    vector<physent *> dynents;
-} dynentcache[DYNENTCACHESIZE];
+};
+
+static inline uint hthash(const physent *d) { return uint(size_t(d)>>4); }
+static inline bool htcmp(const physent *x, const physent *y) { return x == y; }
+
+static hashtable<ivec2, vector<physent *> > dynentcells;
+static hashtable<physent *, dynentlink> dynentlinks;
+static const vector<physent *> nodynents;
+static uint dynentframe = 0;
+static bool dynentsdirty = true;
 
 void cleardynentcache()
 {
     dynentframe++;
-    if(!dynentframe || dynentframe == 1) loopi(DYNENTCACHESIZE) dynentcache[i].frame = 0;
-    if(!dynentframe) dynentframe = 1;
+    dynentsdirty = true;
 }
 
-VARF(dynentsize, 4, 7, 12, cleardynentcache());
+static void resetdynentcells()
+{
+    dynentcells.clear();
+    dynentlinks.clear();
+    cleardynentcache();
+}
 
-#define DYNENTHASH(x, y) (((((x)^(y))<<5) + (((x)^(y))>>5)) & (DYNENTCACHESIZE - 1))
+VARF(dynentsize, 4, 7, 12, resetdynentcells());
 
-const vector<physent *> &checkdynentcache(int x, int y)
+static inline void dynentcellrange(const vec &o, float radius, ivec2 &bbmin, ivec2 &bbmax)
 {
-    dynentcacheentry &dec = dynentcache[DYNENTHASH(x, y)];
-    if(dec.x == x && dec.y == y && dec.frame == dynentframe) return dec.dynents;
-    dec.x = x;
-    dec.y = y;
-    dec.frame = dynentframe;
-    dec.dynents.shrink(0);
-    int numdyns = game::numdynents(), dsize = 1<<dynentsize, dx = x<<dynentsize, dy = y<<dynentsize;
+    bbmin = ivec2(max(int(o.x-radius), 0)>>dynentsize, max(int(o.y-radius), 0)>>dynentsize);
+    bbmax = ivec2(min(int(o.x+radius), worldsize-1)>>dynentsize, min(int(o.y+radius), worldsize-1)>>dynentsize);
+}
+
+static void unlinkdynent(physent *d, const dynentlink &l)
+{
+    for(int x = l.bbmin.x; x <= l.bbmax.x; x++) for(int y = l.bbmin.y; y <= l.bbmax.y; y++)
+    {
+        vector<physent *> *cell = dynentcells.access(ivec2(x, y));
+        if(cell) cell->removeobj(d);
+    }
+}
+
+static void linkdynent(physent *d)
+{
+    ivec2 bbmin, bbmax;
+    dynentcellrange(d->o, d->radius, bbmin, bbmax);
+    dynentlink *l = dynentlinks.access(d);
+    if(l)
+    {
+        l->frame = dynentframe;
+        if(l->bbmin == bbmin && l->bbmax == bbmax) return;
+        unlinkdynent(d, *l);
+    }
+    else l = &dynentlinks[d];
+    l->bbmin = d->cellmin = bbmin;
+    l->bbmax = d->cellmax = bbmax;
+    l->frame = dynentframe;
+    for(int x = bbmin.x; x <= bbmax.x; x++) for(int y = bbmin.y; y <= bbmax.y; y++)
+        dynentcells[ivec2(x, y)].add(d);
+}
+
+static void removedynent(physent *d)
+{
+    dynentlink *l = dynentlinks.access(d);
+    if(!l) return;
+    unlinkdynent(d, *l);
+    dynentlinks.remove(d);
+}
+
+// batch update: relinks every live entity that moved across a cell border
+// and drops the ones that died or are gone
+void updatedynents()
+{
+    dynentsdirty = false;
+    int numdyns = game::numdynents();
     loopi(numdyns)
     {
         dynent *d = game::iterdynents(i);
-        if(d->state != CS_ALIVE ||
-           d->o.x+d->radius <= dx || d->o.x-d->radius >= dx+dsize ||
-           d->o.y+d->radius <= dy || d->o.y-d->radius >= dy+dsize)
-            continue;
-        dec.dynents.add(d);
+        if(d->state == CS_ALIVE) linkdynent(d);
     }
-    return dec.dynents;
+    static vector<physent *> stale;
+    stale.setsize(0);
+    enumeratekt(dynentlinks, physent *, d, dynentlink, l,
+    {
+        if(l.frame != dynentframe) stale.add(d);
+    });
+    loopv(stale) removedynent(stale[i]);
+}
+
+const vector<physent *> &checkdynentcache(int x, int y)
+{
+    if(dynentsdirty) updatedynents();
+    const vector<physent *> *cell = dynentcells.access(ivec2(x, y));
+    return cell ? *cell : nodynents;
 }
 
 #define loopdynentcache(curx, cury, o, radius) \
@@ -565,12 +900,40 @@ const vector<physent *> &checkdynentcache(int x, int y)
 
 void updatedynentcache(physent *d)
 {
-    loopdynentcache(x, y, d->o, d->radius)
+    if(dynentsdirty) updatedynents();
+    linkdynent(d);
+}
+
+// 3D query: adds every live entity whose bounding box overlaps the given
+// box to the list once, returning the number found
+int finddynents(const vec &bbmin, const vec &bbmax, vector<physent *> &found)
+{
+    if(dynentsdirty) updatedynents();
+    vec center = vec(bbmin).add(bbmax).mul(0.5f);
+    float radius = max(bbmax.x-bbmin.x, bbmax.y-bbmin.y)*0.5f;
+    ivec2 cmin, cmax;
+    dynentcellrange(center, radius, cmin, cmax);
+    int numfound = 0;
+    for(int x = cmin.x; x <= cmax.x; x++) for(int y = cmin.y; y <= cmax.y; y++)
     {
-        dynentcacheentry &dec = dynentcache[DYNENTHASH(x, y)];
-        if(dec.x != x || dec.y != y || dec.frame != dynentframe || dec.dynents.find(d) >= 0) continue;
-        dec.dynents.add(d);
+        const vector<physent *> *cell = dynentcells.access(ivec2(x, y));
+        if(!cell) continue;
+        loopv(*cell)
+        {
+            physent *d = (*cell)[i];
+            if(d->o.x+d->radius < bbmin.x || d->o.x-d->radius > bbmax.x ||
+               d->o.y+d->radius < bbmin.y || d->o.y-d->radius > bbmax.y ||
+               d->o.z+d->aboveeye < bbmin.z || d->o.z-d->eyeheight > bbmax.z)
+                continue;
+            // entities spanning several cells are only reported from the first
+            // one in range, by the cells they are linked into rather than where
+            // they are now, since they may have moved since the last relink
+            if(x != max(d->cellmin.x, cmin.x) || y != max(d->cellmin.y, cmin.y)) continue;
+            found.add(d);
+            numfound++;
+        }
     }
+    return numfound;
 }
 
 bool overlapsdynent(const vec &o, float radius)
@@ -1939,6 +2302,73 @@ void physicsframe()          // optimally schedule physics frames inside the gra
     cleardynentcache();
 }
 
+// moves bench entities around the world, querying the broadphase for each
+// one every physics frame the way the collision code does, and checks the
+// pairs found against a brute force pass on the last frame
+static int countdynentpairs(const vector<physent *> &ents)
+{
+    static vector<physent *> found;
+    int pairs = 0;
+    loopv(ents)
+    {
+        physent *d = ents[i];
+        found.setsize(0);
+        finddynents(vec(d->o).sub(vec(d->radius, d->radius, d->eyeheight)), vec(d->o).add(vec(d->radius, d->radius, d->aboveeye)), found);
+        loopvj(found) if(found[j] != d && !d->o.reject(found[j]->o, d->radius+found[j]->radius)) pairs++;
+    }
+    return pairs;
+}
+
+static void physbench(int *numents, int *numframes)
+{
+    int n = *numents > 0 ? *numents : 1000, frames = *numframes > 0 ? *numframes : 100;
+    physent *benchents = new physent[n];
+    vector<physent *> ents;
+    loopi(n)
+    {
+        physent *d = &benchents[i];
+        d->o = vec(rndscale(worldsize), rndscale(worldsize), worldsize/2);
+        d->vel = vec(rndscale(2)-1, rndscale(2)-1, 0).rescale(25 + rndscale(75));
+        ents.add(d);
+    }
+    const float step = PHYSFRAMETIME/1000.0f;
+    int pairs = 0;
+    Uint64 start = SDL_GetPerformanceCounter();
+    loopk(frames)
+    {
+        loopv(ents)
+        {
+            physent *d = ents[i];
+            d->o.add(vec(d->vel).mul(step));
+            loopj(2) if(d->o[j] < 0 || d->o[j] > worldsize)
+            {
+                d->vel[j] = -d->vel[j];
+                d->o[j] = clamp(d->o[j], 0.0f, float(worldsize));
+            }
+            updatedynentcache(d);
+        }
+        pairs += countdynentpairs(ents);
+    }
+    Uint64 gridticks = SDL_GetPerformanceCounter() - start;
+
+    start = SDL_GetPerformanceCounter();
+    int brutepairs = 0;
+    loopv(ents) loopvj(ents) if(i != j && !ents[i]->o.reject(ents[j]->o, ents[i]->radius+ents[j]->radius) &&
+        ents[i]->o.z+ents[i]->aboveeye >= ents[j]->o.z-ents[j]->eyeheight && ents[i]->o.z-ents[i]->eyeheight <= ents[j]->o.z+ents[j]->aboveeye)
+        brutepairs++;
+    Uint64 bruteticks = SDL_GetPerformanceCounter() - start;
+    int lastpairs = countdynentpairs(ents);
+
+    loopv(ents) removedynent(ents[i]);
+    delete[] benchents;
+
+    double freq = SDL_GetPerformanceFrequency(), secs = gridticks/freq;
+    conoutf("physbench: %d ents, %d frames, %.3f ms/frame, %d collisions (%.0f/s)",
+        n, frames, secs*1000/frames, pairs/2, pairs/(2*max(secs, 1e-9)));
+    conoutf("physbench: last frame %d pairs, brute force %d pairs in %.3f ms", lastpairs/2, brutepairs/2, bruteticks*1000/freq);
+}
+COMMAND(physbench, "ii");
+
 VAR(physinterp, 0, 1, 1);
 
 void interppos(physent *pl)
@@ -1955,6 +2385,7 @@ void interppos(physent *pl)
 
 void moveplayer(physent *pl, int moveres, bool local)
 {
+    PROFILE("physics");
     if(physsteps <= 0)
     {
         if(local) interppos(pl);
@@ -1975,6 +2406,7 @@ void moveplayer(physent *pl, int moveres, bool local)
 
 bool bounce(physent *d, float elasticity, float waterfric, float grav)
 {
+    PROFILE("physics");
     if(physsteps <= 0)
     {
         interppos(d);
@@ -2254,6 +2686,20 @@ float rx, float ry, float rz, float radius), {
         radius, RAY_CLIPMAT | RAY_POLY);
 });
 
+// batched forms: positions and directions are packed as x, y, z triples
+
+CLUAICOMMAND(ray_los_batch, int, (const float *from, const float *to,
+int numrays, bool *los), {
+    return raycubelos((const vec *)from, (const vec *)to, numrays, los);
+});
+
+CLUAICOMMAND(ray_pos_batch, void, (const float *o, const float *rays,
+int numrays, float radius, float *dists), {
+    raycubes((const vec *)o, (const vec *)rays, dists, numrays, radius,
+        RAY_CLIPMAT | RAY_POLY);
+    if (radius > 0) loopi(numrays) dists[i] = min(dists[i], radius);
+});
+
 CLUAICOMMAND(ray_floor, float, (float x, float y, float z, float radius), {
     vec floor(0);
     return rayfloor(vec(x, y, z), floor, 0, radius);
@@ -0,0 +1,256 @@
+// profiler.cc: hierarchical cpu profiler, every thread records the zones it
+// enters into its own ring buffer and the last frames can be dumped as a
+// chrome/perfetto trace or summed up on the console
+
+#include "engine.hh"
+
+#include "ostd/atomic.hh"
+
+#if defined(STANDALONE) && !defined(WIN32)
+#include <time.h>
+#endif
+
+enum { PROFEVENTS = 1<<16, MAXPROFTHREADS = 64, MAXPROFFRAMES = 1024 };
+
+static int numprofframes = 0;
+static llong profframes[MAXPROFFRAMES];
+
+VARFN(profile, profiling, 0, 0, 1, numprofframes = 0);
+
+static inline llong proftime()
+{
+#ifndef STANDALONE
+    return SDL_GetPerformanceCounter();
+#elif defined(WIN32)
+    LARGE_INTEGER t;
+    QueryPerformanceCounter(&t);
+    return t.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return llong(ts.tv_sec)*1000000000LL + ts.tv_nsec;
+#endif
+}
+
+static double proffreq()
+{
+#ifndef STANDALONE
+    return SDL_GetPerformanceFrequency();
+#elif defined(WIN32)
+    LARGE_INTEGER f;
+    QueryPerformanceFrequency(&f);
+    return f.QuadPart;
+#else
+    return 1e9;
+#endif
+}
+
+// zone 0 collects call sites past the table size
+static const char *profzones[MAXPROFZONES] = { "other" };
+static int numprofzones = 1;
+static ostd::Atomic<bool> profzonelock(false);
+
+int profregister(const char *name)
+{
+    while(profzonelock.exchange(true));
+    int zone = 0;
+    for(int i = 1; i < numprofzones; i++) if(!strcmp(profzones[i], name)) { zone = i; break; }
+    if(!zone && numprofzones < MAXPROFZONES)
+    {
+        zone = numprofzones;
+        profzones[numprofzones++] = name;
+    }
+    profzonelock.store(false);
+    return zone;
+}
+
+struct profevent
+{
+    llong start, end;
+    ushort zone, depth;
+};
+
+struct profthread
+{
+    const char *name;
+    profevent *events;
+    ostd::Atomic<uint> numevents;
+    int depth;
+    uint stack[MAXPROFDEPTH];
+};
+
+static profthread *profthreads[MAXPROFTHREADS];
+static ostd::Atomic<int> numprofthreads(0);
+static thread_local profthread *curprofthread = NULL;
+static thread_local const char *curprofname = NULL;
+static thread_local bool profthreadfull = false;
+
+static profthread *getprofthread()
+{
+    if(curprofthread || profthreadfull) return curprofthread;
+    int id = numprofthreads.fetch_add(1);
+    if(id >= MAXPROFTHREADS)
+    {
+        profthreadfull = true;
+        return NULL;
+    }
+    profthread *t = new profthread;
+    t->name = curprofname;
+    t->events = new profevent[PROFEVENTS];
+    t->numevents.store(0);
+    t->depth = 0;
+    profthreads[id] = t;
+    return curprofthread = t;
+}
+
+void profthreadname(const char *name)
+{
+    curprofname = name;
+    if(curprofthread) curprofthread->name = name;
+}
+
+void profbegin(int zone)
+{
+    profthread *t = getprofthread();
+    if(!t) return;
+    if(t->depth >= MAXPROFDEPTH) { t->depth++; return; }
+    uint n = t->numevents.load(ostd::MemoryOrder::relaxed);
+    profevent &e = t->events[n&(PROFEVENTS-1)];
+    e.zone = zone;
+    e.depth = t->depth;
+    e.end = -1;
+    e.start = proftime();
+    t->stack[t->depth++] = n;
+    t->numevents.store(n+1, ostd::MemoryOrder::release);
+}
+
+void profend()
+{
+    profthread *t = curprofthread;
+    if(!t || --t->depth >= MAXPROFDEPTH) return;
+    uint n = t->stack[t->depth];
+    // the ring may have wrapped over a very long zone
+    if(t->numevents.load(ostd::MemoryOrder::relaxed) - n > PROFEVENTS) return;
+    t->events[n&(PROFEVENTS-1)].end = proftime();
+}
+
+void profframe()
+{
+    if(!profiling) return;
+    profframes[numprofframes++%MAXPROFFRAMES] = proftime();
+}
+
+// start of the window covering the last n frames, including the current one
+static bool profwindow(int frames, int &n, llong &from)
+{
+    if(!numprofframes)
+    {
+        conoutf(CON_ERROR, "no frames profiled, set profile 1 first");
+        return false;
+    }
+    n = clamp(frames > 0 ? frames : 60, 1, min(numprofframes, int(MAXPROFFRAMES)));
+    from = profframes[(numprofframes - n)%MAXPROFFRAMES];
+    return true;
+}
+
+// other threads keep recording while the rings are read, so the oldest part
+// of each ring, which is the next to be overwritten, is skipped
+#define LOOPPROFEVENTS(t, e, body) \
+{ \
+    uint endevent = (t)->numevents.load(ostd::MemoryOrder::acquire), \
+         startevent = endevent > PROFEVENTS - PROFEVENTS/8 ? endevent - (PROFEVENTS - PROFEVENTS/8) : 0; \
+    for(uint curevent = startevent; curevent < endevent; curevent++) \
+    { \
+        const profevent &e = (t)->events[curevent&(PROFEVENTS-1)]; \
+        body; \
+    } \
+}
+
+static void profiledump(int *frames, char *file)
+{
+    int n;
+    llong from;
+    if(!profwindow(*frames, n, from)) return;
+    const char *name = file[0] ? file : "profile.json";
+    stream *f = openutf8file(path(name, true), "w");
+    if(!f)
+    {
+        conoutf(CON_ERROR, "could not write profile to %s", name);
+        return;
+    }
+    double scale = 1e6/proffreq();
+    int numevents = 0, numthreads = min(numprofthreads.load(), int(MAXPROFTHREADS));
+    f->printf("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    loopi(numthreads)
+    {
+        profthread *t = profthreads[i];
+        if(!t) continue;
+        if(t->name) f->printf("{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}},\n", i, t->name);
+        else f->printf("{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"thread %d\"}},\n", i, i);
+        LOOPPROFEVENTS(t, e,
+        {
+            if(e.start < from || e.end < e.start) continue;
+            f->printf("{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f},\n",
+                profzones[e.zone], i, (e.start - from)*scale, (e.end - e.start)*scale);
+            numevents++;
+        });
+    }
+    loopi(n)
+    {
+        llong start = profframes[(numprofframes - n + i)%MAXPROFFRAMES];
+        f->printf("{\"name\":\"frame %d\",\"ph\":\"i\",\"s\":\"g\",\"pid\":1,\"tid\":0,\"ts\":%.3f}%s\n", i, (start - from)*scale, i+1 < n ? "," : "");
+    }
+    f->printf("]}\n");
+    delete f;
+    conoutf("wrote %d profile events over %d frames to %s", numevents, n, name);
+}
+COMMAND(profiledump, "is");
+
+struct profstat
+{
+    llong total, self;
+    int calls;
+};
+
+// per thread totals of every zone over the last frames, self time excludes nested zones
+static void profilestats(int *frames)
+{
+    int n;
+    llong from;
+    if(!profwindow(*frames, n, from)) return;
+    double scale = 1000/proffreq()/n;
+    int numthreads = min(numprofthreads.load(), int(MAXPROFTHREADS));
+    profstat stats[MAXPROFZONES];
+    loopi(numthreads)
+    {
+        profthread *t = profthreads[i];
+        if(!t) continue;
+        memset(stats, 0, sizeof(stats));
+        int parents[MAXPROFDEPTH];
+        loopj(MAXPROFDEPTH) parents[j] = -1;
+        LOOPPROFEVENTS(t, e,
+        {
+            if(e.depth >= MAXPROFDEPTH) continue;
+            parents[e.depth] = -1;
+            if(e.start < from || e.end < e.start) continue;
+            llong dur = e.end - e.start;
+            profstat &s = stats[e.zone];
+            s.total += dur;
+            s.self += dur;
+            s.calls++;
+            if(e.depth > 0 && parents[e.depth-1] >= 0) stats[parents[e.depth-1]].self -= dur;
+            parents[e.depth] = e.zone;
+        });
+        vector<int> zones;
+        loopj(MAXPROFZONES) if(stats[j].calls) zones.add(j);
+        if(zones.empty()) continue;
+        zones.sort([&stats](int a, int b) { return stats[a].total > stats[b].total; });
+        conoutf("%s: %d zones over %d frames", t->name ? t->name : tempformatstring("thread %d", i), zones.length(), n);
+        loopvj(zones)
+        {
+            profstat &s = stats[zones[j]];
+            conoutf("  %-24s %8.3f ms %8.3f ms self %7.1f calls", profzones[zones[j]], s.total*scale, s.self*scale, s.calls/float(n));
+        }
+    }
+}
+COMMAND(profilestats, "i");
@@ -245,33 +245,57 @@ struct pvsdata
 
 static vector<uchar> pvsbuf;
 
-static inline uint hthash(const pvsdata &k)
+// dedup key for view cells stored in either the global or a worker's buffer
+struct pvskey
 {
+    const vector<uchar> *buf;
+    int offset, len;
+
+    pvskey() {}
+    pvskey(const vector<uchar> *buf, int offset, int len) : buf(buf), offset(offset), len(len) {}
+};
+
+static inline uint hthash(const pvskey &k)
+{
+    const uchar *data = &(*k.buf)[k.offset];
     uint h = 5381;
-    loopi(k.len) h = ((h<<5)+h)^pvsbuf[k.offset+i];
+    loopi(k.len) h = ((h<<5)+h)^data[i];
     return h;
 }
 
-static inline bool htcmp(const pvsdata &x, const pvsdata &y)
+static inline bool htcmp(const pvskey &x, const pvskey &y)
 {
-    return x.len==y.len && !memcmp(&pvsbuf[x.offset], &pvsbuf[y.offset], x.len);
+    return x.len==y.len && !memcmp(&(*x.buf)[x.offset], &(*y.buf)[y.offset], x.len);
 }
 
-static SDL_mutex *pvsmutex = NULL;
-static hashtable<pvsdata, int> pvscompress;
+static hashtable<pvskey, int> pvscompress;
 static vector<pvsdata> pvs;
 
-static SDL_mutex *viewcellmutex = NULL;
+static int addpvsdata(vector<uchar> &buf, hashtable<pvskey, int> &compress, vector<pvsdata> &cells, int offset)
+{
+    pvskey key(&buf, offset, buf.length() - offset);
+    int *val = compress.access(key);
+    if(val) buf.setsize(offset);
+    else
+    {
+        val = &compress[key];
+        *val = cells.length();
+        cells.add(pvsdata(key.offset, key.len));
+    }
+    return *val;
+}
+
 struct viewcellrequest
 {
     int *result;
     ivec o;
     int size;
+    int worker, index;
 };
 static vector<viewcellrequest> viewcellrequests;
 
 static bool genpvs_canceled = false;
-static int numviewcells = 0;
+static SDL_atomic_t genpvs_abort, numviewcells;
 
 VAR(maxpvsblocker, 1, 512, 1<<16);
 VAR(pvsleafsize, 1, 64, 1024);
@@ -290,6 +314,9 @@ struct pvsworker
 {
     pvsworker() : thread(NULL), pvsnodes(new pvsnode[origpvsnodes.length()])
     {
+        SDL_AtomicSet(&head, 0);
+        SDL_AtomicSet(&tail, 0);
+        SDL_AtomicSet(&numunique, 0);
     }
     ~pvsworker()
     {
@@ -772,42 +799,60 @@ struct pvsworker
         return buf;
     }
 
-    int genviewcell(const ivec &co, int size)
+    int genviewcell(const ivec &co, int size, vector<uchar> &buf, hashtable<pvskey, int> &compress, vector<pvsdata> &cells)
     {
         calcpvs(co, size);
 
-        if(pvsmutex) SDL_LockMutex(pvsmutex);
-        numviewcells++;
-        pvsdata key(pvsbuf.length(), waterbytes + outbuf.length());
-        loopi(waterbytes) pvsbuf.add((wateroccluded>>(i*8))&0xFF);
-        pvsbuf.put(outbuf.getbuf(), outbuf.length());
-        int *val = pvscompress.access(key);
-        if(val) pvsbuf.setsize(key.offset);
-        else
+        SDL_AtomicIncRef(&numviewcells);
+        int offset = buf.length();
+        loopi(waterbytes) buf.add((wateroccluded>>(i*8))&0xFF);
+        buf.put(outbuf.getbuf(), outbuf.length());
+        return addpvsdata(buf, compress, cells, offset);
+    }
+
+    int genviewcell(const ivec &co, int size)
+    {
+        return genviewcell(co, size, pvsbuf, pvscompress, pvs);
+    }
+
+    // view cells are deduplicated per worker and merged once all workers are done
+    vector<uchar> localbuf;
+    hashtable<pvskey, int> localcompress;
+    vector<pvsdata> localpvs;
+    vector<int> remap;
+    SDL_atomic_t numunique;
+
+    // work-stealing deque over a range of viewcellrequests: the owner pops
+    // from the tail, idle workers steal from the head
+    SDL_atomic_t head, tail;
+
+    int popviewcell()
+    {
+        int t = SDL_AtomicAdd(&tail, -1) - 1, h = SDL_AtomicGet(&head);
+        if(h < t) return t;
+        if(h == t)
         {
-            val = &pvscompress[key];
-            *val = pvs.length();
-            pvs.add(key);
+            bool won = SDL_AtomicCAS(&head, h, h+1) == SDL_TRUE;
+            SDL_AtomicSet(&tail, h+1);
+            return won ? t : -1;
         }
-        if(pvsmutex) SDL_UnlockMutex(pvsmutex);
-        return *val;
+        SDL_AtomicSet(&tail, h);
+        return -1;
     }
 
-    static int run(void *data)
+    int stealviewcell()
     {
-        pvsworker *w = (pvsworker *)data;
-        SDL_LockMutex(viewcellmutex);
-        while(viewcellrequests.length())
+        for(;;)
         {
-            viewcellrequest req = viewcellrequests.pop();
-            SDL_UnlockMutex(viewcellmutex);
-            int result = w->genviewcell(req.o, req.size);
-            SDL_LockMutex(viewcellmutex);
-            *req.result = result;
+            int h = SDL_AtomicGet(&head), t = SDL_AtomicGet(&tail);
+            if(h >= t) return -1;
+            if(SDL_AtomicCAS(&head, h, h+1)) return h;
         }
-        SDL_UnlockMutex(viewcellmutex);
-        return 0;
     }
+
+    int nextviewcell(int id);
+
+    static int run(void *data);
 };
 
 struct viewcellnode
@@ -829,9 +874,62 @@ struct viewcellnode
     }
 };
 
-VARP(pvsthreads, 0, 0, 16);
+VARP(pvsthreads, 0, 0, 64);
 static vector<pvsworker *> pvsworkers;
 
+int pvsworker::nextviewcell(int id)
+{
+    int req = popviewcell();
+    if(req >= 0) return req;
+    for(int i = 1; i < pvsworkers.length(); i++)
+    {
+        req = pvsworkers[(id + i) % pvsworkers.length()]->stealviewcell();
+        if(req >= 0) return req;
+    }
+    return -1;
+}
+
+int pvsworker::run(void *data)
+{
+    pvsworker *w = (pvsworker *)data;
+    int id = pvsworkers.find(w);
+    while(!SDL_AtomicGet(&genpvs_abort))
+    {
+        int i = w->nextviewcell(id);
+        if(i < 0) break;
+        viewcellrequest &req = viewcellrequests[i];
+        req.worker = id;
+        req.index = w->genviewcell(req.o, req.size, w->localbuf, w->localcompress, w->localpvs);
+        SDL_AtomicSet(&w->numunique, w->localpvs.length());
+    }
+    return 0;
+}
+
+static void mergeviewcells()
+{
+    loopv(pvsworkers)
+    {
+        pvsworker &w = *pvsworkers[i];
+        w.remap.setsize(0);
+        loopvj(w.localpvs) w.remap.add(-1);
+    }
+    // merge in request order so the result does not depend on scheduling
+    loopv(viewcellrequests)
+    {
+        viewcellrequest &req = viewcellrequests[i];
+        pvsworker &w = *pvsworkers[req.worker];
+        int &index = w.remap[req.index];
+        if(index < 0)
+        {
+            const pvsdata &d = w.localpvs[req.index];
+            int offset = pvsbuf.length();
+            pvsbuf.put(&w.localbuf[d.offset], d.len);
+            index = addpvsdata(pvsbuf, pvscompress, pvs, offset);
+        }
+        *req.result = index;
+    }
+}
+
 static volatile bool check_genpvs_progress = false;
 
 static Uint32 genpvs_timer(Uint32 interval, void *param)
@@ -841,26 +939,64 @@ static Uint32 genpvs_timer(Uint32 interval, void *param)
 }
 
 static int totalviewcells = 0;
+static pvsprogressfn genpvs_progress = NULL;
+
+static void show_genpvs_progress(int unique = pvs.length())
+{
+    check_genpvs_progress = false;
+    if(genpvs_progress && !genpvs_progress(SDL_AtomicGet(&numviewcells), totalviewcells, unique)) genpvs_canceled = true;
+}
 
-static void show_genpvs_progress(int unique = pvs.length(), int processed = numviewcells)
+static bool render_genpvs_progress(int processed, int total, int unique)
 {
-    float bar1 = float(processed) / float(totalviewcells>0 ? totalviewcells : 1);
+    float bar1 = float(processed) / float(total>0 ? total : 1);
 
-    defformatstring(text1, "%d%% - %d of %d view cells (%d unique)", int(bar1 * 100), processed, totalviewcells, unique);
+    defformatstring(text1, "%d%% - %d of %d view cells (%d unique)", int(bar1 * 100), processed, total, unique);
 
     renderprogress(bar1, text1);
 
-    if(interceptkey(SDLK_ESCAPE)) genpvs_canceled = true;
-    check_genpvs_progress = false;
+    return !interceptkey(SDLK_ESCAPE);
 }
 
 static shaftbb pvsbounds;
+static vector<materialsurface> octamatsurfs;
+
+static void genoctapvsbounds(cube *c, const ivec &co, int size)
+{
+    neighbourstack[++neighbourdepth] = c;
+    loopi(8)
+    {
+        ivec o(i, co, size);
+        cube &h = c[i];
+        if(h.children)
+        {
+            genoctapvsbounds(h.children, o, size>>1);
+            continue;
+        }
+        if(!isempty(h)) loopk(3)
+        {
+            pvsbounds.min[k] = min(pvsbounds.min[k], (ushort)o[k]);
+            pvsbounds.max[k] = max(pvsbounds.max[k], (ushort)(o[k]+size));
+        }
+        if(h.material != MAT_AIR) genmatsurfs(h, o, size, octamatsurfs);
+    }
+    --neighbourdepth;
+}
 
 static void calcpvsbounds()
 {
     loopk(3) pvsbounds.min[k] = USHRT_MAX;
     loopk(3) pvsbounds.max[k] = 0;
     extern vector<vtxarray *> valist;
+    octamatsurfs.setsize(0);
+    if(valist.empty())
+    {
+        // no vertex arrays when baking headless, so take bounds and water surfaces from the octree
+        genoctapvsbounds(worldroot, ivec(0, 0, 0), worldsize>>1);
+        octamatsurfs.shrink(optimizematsurfs(octamatsurfs.getbuf(), octamatsurfs.length()));
+        loopv(octamatsurfs) octamatsurfs[i].skip = 0;
+        return;
+    }
     loopv(valist)
     {
         vtxarray *va = valist[i];
@@ -1019,6 +1155,32 @@ void clearpvs()
 
 COMMAND(clearpvs, "");
 
+static void addwaterplanes(materialsurface *matbuf, int matsurfs)
+{
+    loopj(matsurfs)
+    {
+        materialsurface &m = matbuf[j];
+        if((m.material&MATF_VOLUME)!=MAT_WATER || m.orient==O_BOTTOM) { j += m.skip; continue; }
+        if(m.orient!=O_TOP)
+        {
+            waterfalls.add(&m);
+            continue;
+        }
+        loopk(numwaterplanes) if(waterplanes[k].height == m.o.z)
+        {
+            waterplanes[k].matsurfs.add(&m);
+            goto nextmatsurf;
+        }
+        if(numwaterplanes < MAXWATERPVS)
+        {
+            waterplanes[numwaterplanes].height = m.o.z;
+            waterplanes[numwaterplanes].matsurfs.add(&m);
+            numwaterplanes++;
+        }
+    nextmatsurf:;
+    }
+}
+
 static void findwaterplanes()
 {
     extern vector<vtxarray *> valist;
@@ -1029,32 +1191,8 @@ static void findwaterplanes()
     }
     waterfalls.setsize(0);
     numwaterplanes = 0;
-    loopv(valist)
-    {
-        vtxarray *va = valist[i];
-        loopj(va->matsurfs)
-        {
-            materialsurface &m = va->matbuf[j];
-            if((m.material&MATF_VOLUME)!=MAT_WATER || m.orient==O_BOTTOM) { j += m.skip; continue; }
-            if(m.orient!=O_TOP)
-            {
-                waterfalls.add(&m);
-                continue;
-            }
-            loopk(numwaterplanes) if(waterplanes[k].height == m.o.z)
-            {
-                waterplanes[k].matsurfs.add(&m);
-                goto nextmatsurf;
-            }
-            if(numwaterplanes < MAXWATERPVS)
-            {
-                waterplanes[numwaterplanes].height = m.o.z;
-                waterplanes[numwaterplanes].matsurfs.add(&m);
-                numwaterplanes++;
-            }
-        nextmatsurf:;
-        }
-    }
+    if(valist.empty()) addwaterplanes(octamatsurfs.getbuf(), octamatsurfs.length());
+    else loopv(valist) addwaterplanes(valist[i]->matbuf, valist[i]->matsurfs);
     if(waterfalls.length() > 0 && numwaterplanes < MAXWATERPVS) numwaterplanes++;
 }
 
@@ -1096,16 +1234,17 @@ void testpvs(int *vcsize)
 
 COMMAND(testpvs, "i");
 
-void genpvs(int *viewcellsize)
+bool buildpvs(int viewcellsize, pvsprogressfn progress)
 {
     if(worldsize > 1<<15)
     {
         conoutf(CON_ERROR, "map is too large for PVS");
-        return;
+        return false;
     }
 
-    renderbackground("generating PVS (esc to abort)");
     genpvs_canceled = false;
+    genpvs_progress = progress;
+    SDL_AtomicSet(&genpvs_abort, 0);
     Uint32 start = SDL_GetTicks();
 
     renderprogress(0, "finding view cells");
@@ -1120,9 +1259,9 @@ void genpvs(int *viewcellsize)
     root.children = 0;
     genpvsnodes(worldroot);
 
-    totalviewcells = countviewcells(worldroot, ivec(0, 0, 0), worldsize>>1, *viewcellsize>0 ? *viewcellsize : 32);
-    numviewcells = 0;
-    genpvs_canceled = false;
+    if(viewcellsize <= 0) viewcellsize = 32;
+    totalviewcells = countviewcells(worldroot, ivec(0, 0, 0), worldsize>>1, viewcellsize);
+    SDL_AtomicSet(&numviewcells, 0);
     check_genpvs_progress = false;
     SDL_TimerID timer = 0;
     int numthreads = pvsthreads > 0 ? pvsthreads : numcpus;
@@ -1132,7 +1271,7 @@ void genpvs(int *viewcellsize)
         timer = SDL_AddTimer(500, genpvs_timer, NULL);
     }
     viewcells = new viewcellnode;
-    genviewcells(*viewcells, worldroot, ivec(0, 0, 0), worldsize>>1, *viewcellsize>0 ? *viewcellsize : 32);
+    genviewcells(*viewcells, worldroot, ivec(0, 0, 0), worldsize>>1, viewcellsize);
     if(numthreads<=1)
     {
         SDL_RemoveTimer(timer);
@@ -1140,41 +1279,51 @@ void genpvs(int *viewcellsize)
     else
     {
         renderprogress(0, "creating threads");
-        if(!pvsmutex) pvsmutex = SDL_CreateMutex();
-        if(!viewcellmutex) viewcellmutex = SDL_CreateMutex();
+        int numrequests = viewcellrequests.length();
+        numthreads = clamp(numrequests, 1, numthreads);
         loopi(numthreads)
         {
             pvsworker *w = pvsworkers.add(new pvsworker);
-            w->thread = SDL_CreateThread(pvsworker::run, "pvs worker", w);
+            SDL_AtomicSet(&w->head, (numrequests*i)/numthreads);
+            SDL_AtomicSet(&w->tail, (numrequests*(i+1))/numthreads);
         }
-        show_genpvs_progress(0, 0);
-        while(!genpvs_canceled)
+        loopv(pvsworkers) pvsworkers[i]->thread = SDL_CreateThread(pvsworker::run, "pvs worker", pvsworkers[i]);
+        show_genpvs_progress(0);
+        while(!genpvs_canceled && SDL_AtomicGet(&numviewcells) < numrequests)
         {
             SDL_Delay(500);
-            SDL_LockMutex(viewcellmutex);
-            int unique = pvs.length(), processed = numviewcells, remaining = viewcellrequests.length();
-            SDL_UnlockMutex(viewcellmutex);
-            show_genpvs_progress(unique, processed);
-            if(!remaining) break;
+            int unique = 0;
+            loopv(pvsworkers) unique += SDL_AtomicGet(&pvsworkers[i]->numunique);
+            show_genpvs_progress(unique);
         }
-        SDL_LockMutex(viewcellmutex);
-        viewcellrequests.setsize(0);
-        SDL_UnlockMutex(viewcellmutex);
+        if(genpvs_canceled) SDL_AtomicSet(&genpvs_abort, 1);
         loopv(pvsworkers) SDL_WaitThread(pvsworkers[i]->thread, NULL);
+        if(!genpvs_canceled) mergeviewcells();
+        viewcellrequests.setsize(0);
     }
+    int numworkers = pvsworkers.length();
     pvsworkers.deletecontents();
 
     origpvsnodes.setsize(0);
     pvscompress.clear();
+    genpvs_progress = NULL;
 
     Uint32 end = SDL_GetTicks();
     if(genpvs_canceled)
     {
         clearpvs();
         conoutf("genpvs aborted");
+        return false;
     }
-    else conoutf("generated %d unique view cells totaling %.1f kB and averaging %d B (%.1f seconds)",
-            pvs.length(), pvsbuf.length()/1024.0f, pvsbuf.length()/max(pvs.length(), 1), (end - start) / 1000.0f);
+    conoutf("generated %d unique view cells totaling %.1f kB and averaging %d B (%.1f seconds, %d threads)",
+            pvs.length(), pvsbuf.length()/1024.0f, pvsbuf.length()/max(pvs.length(), 1), (end - start) / 1000.0f, numworkers);
+    return true;
+}
+
+void genpvs(int *viewcellsize)
+{
+    renderbackground("generating PVS (esc to abort)");
+    buildpvs(*viewcellsize, render_genpvs_progress);
 }
 
 COMMAND(genpvs, "i");
@@ -1236,6 +1385,14 @@ bool pvsoccludedsphere(const vec &center, float radius)
     return pvsoccluded(curpvs, bbmin, bbmax);
 }
 
+bool pvsoccludedfrom(const vec &viewer, const vec &center, float radius)
+{
+    pvsdata *d = usepvs ? lookupviewcell(viewer) : NULL;
+    if(!d) return false;
+    ivec bbmin = vec(center).sub(radius), bbmax = vec(center).add(radius+1);
+    return pvsoccluded(&pvsbuf[d->offset + d->len%9], bbmin, bbmax);
+}
+
 bool waterpvsoccluded(int height)
 {
     if(!curwaterpvs) return false;
@@ -1420,17 +1420,16 @@ void fixcamerarange()
     while(camera1->yaw>=360.0f) camera1->yaw -= 360.0f;
 }
 
+static lua::External input_mouse_move("input_mouse_move");
+
 void modifyorient(float yaw, float pitch)
 {
     // OF: Let scripts customize mousemoving
     float ryaw, rpitch;
-    int n = lua::L->call_external_ret_nopop("input_mouse_move", "ff", "ff", yaw,
-        pitch, &ryaw, &rpitch);
-    if (n < 0) {
+    if (!lua::L->call_ret(input_mouse_move, lua::rets(&ryaw, &rpitch), yaw, pitch)) {
         camera1->yaw   += yaw;
         camera1->pitch += pitch;
     } else {
-        lua::L->pop_external_ret(n);
         camera1->yaw   += ryaw;
         camera1->pitch += rpitch;
     }
@@ -1445,6 +1444,8 @@ void modifyorient(float yaw, float pitch)
 extern void cursor_get_position(float &x, float &y);
 extern int cursor_exists;
 
+static lua::External entity_get_attr_dyn("entity_get_attr_dyn");
+
 void modifyedgeturn(int curtime) {
     float delta = curtime / 1000.0f;
     float x, y, fs;
@@ -1454,8 +1455,8 @@ void modifyedgeturn(int curtime) {
 
     if (cursor_exists) goto noturn;
 
-    lua::L->call_external_ret("entity_get_attr_dyn", "is", "f",
-        game::player1->clientnum, "facing_speed", &fs);
+    lua::L->call_ret(entity_get_attr_dyn, lua::rets(&fs),
+        game::player1->clientnum, "facing_speed");
 
     if (fp->turn_move || fabs(x - 0.5) > 0.495)
     {
@@ -2633,6 +2634,8 @@ void gl_drawview()
     projmatrix.perspective(fovy, aspect, nearplane, farplane);
     setcamprojmatrix();
 
+    kickocclusion();
+
     glEnable(GL_CULL_FACE);
     glEnable(GL_DEPTH_TEST);
 
@@ -1,5 +1,10 @@
 #include "engine.hh"
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+  #define LIGHTGRIDSIMD 1
+  #include <emmintrin.h>
+#endif
+
 int gw = -1, gh = -1, bloomw = -1, bloomh = -1, lasthdraccum = 0;
 GLuint gfbo = 0, gdepthtex = 0, gcolortex = 0, gnormaltex = 0, gglowtex = 0, gdepthrb = 0, gstencilrb = 0;
 bool gdepthinit = false;
@@ -1485,7 +1490,7 @@ void viewrh()
 
 #define SHADOWATLAS_SIZE 4096
 
-PackNode shadowatlaspacker(0, 0, SHADOWATLAS_SIZE, SHADOWATLAS_SIZE);
+MaxRectsPacker shadowatlaspacker(SHADOWATLAS_SIZE, SHADOWATLAS_SIZE);
 
 extern int smminradius;
 
@@ -1628,13 +1633,13 @@ struct shadowcache : hashtable<shadowcachekey, shadowcacheval>
 
 extern int smcache, smfilter, smgather;
 
-#define SHADOWCACHE_EVICT 2
-
 GLuint shadowatlastex = 0, shadowatlasfbo = 0;
 GLenum shadowatlastarget = GL_NONE;
 shadowcache shadowcache;
 bool shadowcachefull = false;
-int evictshadowcache = 0;
+int shadowcachemissarea = 0, shadowcachemisslight = INT_MAX;
+static int smstatframes = 0, smstatfailed = 0, smstatevicted = 0, smstatcompacted = 0, smstatfreerects = 0, smstatlargest = 0;
+static double smstatoccupancy = 0;
 
 static inline void setsmnoncomparemode() // use texture gather
 {
@@ -1741,6 +1746,10 @@ VAR(smminsize, 1, 96, 1024);
 VAR(smmaxsize, 1, 384, 1024);
 //VAR(smmaxsize, 1, 4096, 4096);
 VAR(smused, 1, 0, 0);
+VAR(smcompact, 0, 2, 64);
+VAR(smoccupancy, 1, 0, 0);
+VAR(smfailed, 1, 0, 0);
+VAR(smevicted, 1, 0, 0);
 VAR(smquery, 0, 1, 1);
 VARF(smcullside, 0, 1, 1, cleanupshadowatlas());
 VARF(smcache, 0, 1, 2, cleanupshadowatlas());
@@ -1859,6 +1868,364 @@ hashset<lightbatch> lightbatcher(128);
 vector<lightbatch *> lightbatches;
 vector<shadowmapinfo> shadowmaps;
 
+// clustered light grid: the view is split into the light tiles times LIGHTGRID_SLICES
+// exponential depth slices, each light is tested against the clusters under its scissor
+// so packlights only hands batchlights the tiles a light can actually reach
+enum
+{
+    LIGHTGRID_SLICES = 16,
+    LIGHTGRID_CLUSTERS = LIGHTGRID_SLICES*LIGHTTILE_MAXH*LIGHTTILE_MAXW
+};
+
+VARP(lightgrid, 0, 1, 1);
+VARP(lightgridthread, 0, 1, 1);
+
+struct lighttilemask
+{
+    ushort rows[LIGHTTILE_MAXH];
+
+    bool empty() const
+    {
+        loopi(LIGHTTILE_MAXH) if(rows[i]) return false;
+        return true;
+    }
+};
+
+struct lightgridinfo
+{
+    // view the cluster bounds were made for
+    int vieww, viewh, tilew, tileh, tilevieww, tileviewh, alignw, alignh;
+    float xscale, yscale, znear, zfar;
+
+    // view space bounds, x only varies with the tile column and y with the tile row
+    float slicez[LIGHTGRID_SLICES+1], slicescale;
+    float minx[LIGHTGRID_SLICES][LIGHTTILE_MAXW], maxx[LIGHTGRID_SLICES][LIGHTTILE_MAXW],
+          miny[LIGHTGRID_SLICES][LIGHTTILE_MAXH], maxy[LIGHTGRID_SLICES][LIGHTTILE_MAXH];
+
+    matrix4 cammatrix;
+
+    ushort counts[LIGHTGRID_CLUSTERS];  // lights per cluster, only for lightgridbench
+    int numhits;
+    vector<lighttilemask> masks;
+
+    lightgridinfo() : vieww(0), viewh(0), tilew(0), tileh(0), tilevieww(0), tileviewh(0), alignw(0), alignh(0), xscale(0), yscale(0), znear(0), zfar(0), numhits(0) {}
+
+    static int cluster(int slice, int tx, int ty) { return (slice*LIGHTTILE_MAXH + ty)*LIGHTTILE_MAXW + tx; }
+
+    // pixel edge of a tile as lightquads draws it, pushed out a pixel for jitter
+    static float tileedge(int t, int tiles, int tileview, int align, int size, int bias)
+    {
+        return (min((t*tileview)/tiles*align, size) + bias)*2.0f/size - 1;
+    }
+
+    void calcbounds()
+    {
+        slicez[0] = 0;
+        slicescale = LIGHTGRID_SLICES/log(zfar/znear);
+        for(int s = 1; s <= LIGHTGRID_SLICES; s++) slicez[s] = znear*pow(zfar/znear, float(s)/LIGHTGRID_SLICES);
+        loop(s, LIGHTGRID_SLICES)
+        {
+            float z1 = slicez[s], z2 = slicez[s+1];
+            loopi(LIGHTTILE_MAXW)
+            {
+                if(i >= tilew) { minx[s][i] = 1e16f; maxx[s][i] = -1e16f; continue; }
+                float x1 = tileedge(i, tilew, tilevieww, alignw, vieww, -1)/xscale,
+                      x2 = tileedge(i+1, tilew, tilevieww, alignw, vieww, 1)/xscale;
+                if(x1 > x2) swap(x1, x2);
+                minx[s][i] = min(x1*z1, x1*z2);
+                maxx[s][i] = max(x2*z1, x2*z2);
+            }
+            loopi(LIGHTTILE_MAXH)
+            {
+                if(i >= tileh) { miny[s][i] = 1e16f; maxy[s][i] = -1e16f; continue; }
+                float y1 = tileedge(i, tileh, tileviewh, alignh, viewh, -1)/yscale,
+                      y2 = tileedge(i+1, tileh, tileviewh, alignh, viewh, 1)/yscale;
+                if(y1 > y2) swap(y1, y2);
+                miny[s][i] = min(y1*z1, y1*z2);
+                maxy[s][i] = max(y2*z1, y2*z2);
+            }
+        }
+    }
+
+    // snapshots the current view, must run on the main thread
+    bool setup()
+    {
+        if(!lighttilew || !lighttileh || !projmatrix.a.x || !projmatrix.b.y) return false;
+        cammatrix = ::cammatrix;
+        float mindepth = max(nearplane, 1e-3f), maxdepth = max(float(farplane), mindepth*2);
+        if(vieww != ::vieww || viewh != ::viewh || tilew != lighttilew || tileh != lighttileh ||
+           tilevieww != lighttilevieww || tileviewh != lighttileviewh || alignw != lighttilealignw || alignh != lighttilealignh ||
+           xscale != projmatrix.a.x || yscale != projmatrix.b.y || znear != mindepth || zfar != maxdepth)
+        {
+            vieww = ::vieww; viewh = ::viewh;
+            tilew = lighttilew; tileh = lighttileh;
+            tilevieww = lighttilevieww; tileviewh = lighttileviewh;
+            alignw = lighttilealignw; alignh = lighttilealignh;
+            xscale = projmatrix.a.x; yscale = projmatrix.b.y;
+            znear = mindepth; zfar = maxdepth;
+            calcbounds();
+        }
+        return true;
+    }
+
+    void slicerange(float z1, float z2, int &s1, int &s2) const
+    {
+        s1 = z1 > znear ? clamp(int(log(z1/znear)*slicescale), 0, LIGHTGRID_SLICES-1) : 0;
+        s2 = z2 > znear ? clamp(int(log(z2/znear)*slicescale), 0, LIGHTGRID_SLICES-1) : 0;
+        while(s1 > 0 && slicez[s1] > z1) s1--;
+        while(s2 < LIGHTGRID_SLICES-1 && slicez[s2+1] < z2) s2++;
+    }
+
+    void addhit(lighttilemask &m, int s, int tx, int ty)
+    {
+        m.rows[ty] |= 1<<tx;
+        counts[cluster(s, tx, ty)]++;
+        numhits++;
+    }
+
+    // sphere vs cluster box, and for spot lights also cone vs the cluster's bounding sphere
+    void addlight(const lightinfo &l, lighttilemask &m)
+    {
+        vec e;
+        cammatrix.transform(l.o, e);
+        float r = l.radius, r2 = r*r;
+        if(-e.z + r <= 0) return;
+        lightrect t(l);
+        if(t.x1 >= t.x2 || t.y1 >= t.y2) return;
+        int s1, s2;
+        slicerange(-e.z - r, -e.z + r, s1, s2);
+
+        vec d(0, 0, 0);
+        float cosa = 0, sina = 0;
+        bool spot = l.spot > 0;
+        if(spot)
+        {
+            cammatrix.transformnormal(l.dir, d);
+            cosa = cos360(l.spot);
+            sina = sin360(l.spot);
+        }
+
+        uint colmask = (1<<t.x2) - (1<<t.x1);
+        for(int s = s1; s <= s2; s++)
+        {
+            float minz = -slicez[s+1], maxz = -slicez[s],
+                  dz = max(minz - e.z, 0.0f) + max(e.z - maxz, 0.0f), dz2 = dz*dz;
+            if(dz2 > r2) continue;
+            float cz = (minz + maxz)*0.5f, hz = (maxz - minz)*0.5f;
+#ifdef LIGHTGRIDSIMD
+            __m128 ex = _mm_set1_ps(e.x), radius2 = _mm_set1_ps(r2), zero = _mm_setzero_ps(), half = _mm_set1_ps(0.5f);
+            for(int g = t.x1&~3; g < t.x2; g += 4)
+            {
+                __m128 bx1 = _mm_loadu_ps(&minx[s][g]), bx2 = _mm_loadu_ps(&maxx[s][g]),
+                       dx = _mm_add_ps(_mm_max_ps(_mm_sub_ps(bx1, ex), zero), _mm_max_ps(_mm_sub_ps(ex, bx2), zero)),
+                       dxz2 = _mm_add_ps(_mm_mul_ps(dx, dx), _mm_set1_ps(dz2)),
+                       cx = _mm_mul_ps(_mm_add_ps(bx1, bx2), half), hx = _mm_mul_ps(_mm_sub_ps(bx2, bx1), half),
+                       vx = _mm_sub_ps(cx, ex), hxz2 = _mm_add_ps(_mm_mul_ps(hx, hx), _mm_set1_ps(hz*hz));
+                uint gmask = (colmask>>g)&0xF;
+                for(int ty = t.y1; ty < t.y2; ty++)
+                {
+                    float by1 = miny[s][ty], by2 = maxy[s][ty], dy = max(by1 - e.y, 0.0f) + max(e.y - by2, 0.0f), dy2 = dy*dy;
+                    if(dy2 + dz2 > r2) continue;
+                    __m128 dist2 = _mm_add_ps(dxz2, _mm_set1_ps(dy2));
+                    uint mask = _mm_movemask_ps(_mm_cmple_ps(dist2, radius2)) & gmask;
+                    if(!mask) continue;
+                    if(spot)
+                    {
+                        float cy = (by1 + by2)*0.5f, hy = (by2 - by1)*0.5f, vy = cy - e.y, vz = cz - e.z;
+                        __m128 crad = _mm_sqrt_ps(_mm_add_ps(hxz2, _mm_set1_ps(hy*hy))),
+                               v1 = _mm_add_ps(_mm_mul_ps(vx, _mm_set1_ps(d.x)), _mm_set1_ps(vy*d.y + vz*d.z)),
+                               vlen2 = _mm_add_ps(_mm_mul_ps(vx, vx), _mm_set1_ps(vy*vy + vz*vz)),
+                               perp = _mm_sqrt_ps(_mm_max_ps(_mm_sub_ps(vlen2, _mm_mul_ps(v1, v1)), zero)),
+                               closest = _mm_sub_ps(_mm_mul_ps(perp, _mm_set1_ps(cosa)), _mm_mul_ps(v1, _mm_set1_ps(sina)));
+                        mask &= _mm_movemask_ps(_mm_and_ps(_mm_cmple_ps(closest, crad), _mm_cmpge_ps(v1, _mm_sub_ps(zero, crad))));
+                    }
+                    while(mask)
+                    {
+                        int b = bitscan(mask);
+                        mask &= mask-1;
+                        addhit(m, s, g + b, ty);
+                    }
+                }
+            }
+#else
+            for(int ty = t.y1; ty < t.y2; ty++)
+            {
+                float by1 = miny[s][ty], by2 = maxy[s][ty], dy = max(by1 - e.y, 0.0f) + max(e.y - by2, 0.0f), dyz2 = dy*dy + dz2;
+                if(dyz2 > r2) continue;
+                for(int tx = t.x1; tx < t.x2; tx++)
+                {
+                    float bx1 = minx[s][tx], bx2 = maxx[s][tx], dx = max(bx1 - e.x, 0.0f) + max(e.x - bx2, 0.0f);
+                    if(dx*dx + dyz2 > r2) continue;
+                    if(spot)
+                    {
+                        float hx = (bx2 - bx1)*0.5f, hy = (by2 - by1)*0.5f,
+                              crad = sqrtf(hx*hx + hy*hy + hz*hz);
+                        vec v = vec((bx1 + bx2)*0.5f, (by1 + by2)*0.5f, cz).sub(e);
+                        float v1 = v.dot(d), closest = sqrtf(max(v.squaredlen() - v1*v1, 0.0f))*cosa - v1*sina;
+                        if(closest > crad || v1 < -crad) continue;
+                    }
+                    addhit(m, s, tx, ty);
+                }
+            }
+#endif
+        }
+    }
+
+    void build(const vector<lightinfo> &lights, const vector<int> &order)
+    {
+        memset(counts, 0, sizeof(counts));
+        numhits = 0;
+        masks.setsize(0);
+        loopv(order)
+        {
+            lighttilemask &m = masks.add();
+            memset(m.rows, 0, sizeof(m.rows));
+            addlight(lights[order[i]], m);
+        }
+    }
+};
+
+static lightgridinfo lightgridframe;
+static bool lightgridvalid = false, lightgridkicked = false, lightgridpending = false;
+static SDL_mutex *lightgridmutex = NULL;
+static SDL_cond *lightgridcond = NULL, *lightgriddonecond = NULL;
+static SDL_Thread *lightgridthreadid = NULL;
+
+static void lightgridwait()
+{
+    if(!lightgridkicked) return;
+    lightgridkicked = false;
+    SDL_LockMutex(lightgridmutex);
+    while(lightgridpending) SDL_CondWait(lightgriddonecond, lightgridmutex);
+    SDL_UnlockMutex(lightgridmutex);
+}
+
+static int lightgridworker(void *data)
+{
+    profthreadname("light grid worker");
+    SDL_LockMutex(lightgridmutex);
+    for(;;)
+    {
+        while(!lightgridpending) SDL_CondWait(lightgridcond, lightgridmutex);
+        SDL_UnlockMutex(lightgridmutex);
+        {
+            PROFILE("light grid");
+            lightgridframe.build(lights, lightorder);
+        }
+        SDL_LockMutex(lightgridmutex);
+        lightgridpending = false;
+        SDL_CondSignal(lightgriddonecond);
+    }
+    SDL_UnlockMutex(lightgridmutex);
+    return 0;
+}
+
+// the grid only reads light shapes, so it can build while the shadow maps render
+static void kicklightgrid()
+{
+    lightgridwait();
+    lightgridvalid = false;
+    if(!lightgrid || drawtex || !lighttilebatch || lightorder.empty() || !lightgridframe.setup()) return;
+    lightgridvalid = true;
+    if(lightgridthread && numcpus > 1 && !lightgridthreadid)
+    {
+        lightgridmutex = SDL_CreateMutex();
+        lightgridcond = SDL_CreateCond();
+        lightgriddonecond = SDL_CreateCond();
+        lightgridthreadid = SDL_CreateThread(lightgridworker, "light grid worker", NULL);
+    }
+    if(!lightgridthread || !lightgridthreadid)
+    {
+        PROFILE("light grid");
+        lightgridframe.build(lights, lightorder);
+        return;
+    }
+    SDL_LockMutex(lightgridmutex);
+    lightgridpending = true;
+    lightgridkicked = true;
+    SDL_CondSignal(lightgridcond);
+    SDL_UnlockMutex(lightgridmutex);
+}
+
+static int countlighttiles(const lightrect &r, const lighttilemask *m)
+{
+    int n = 0;
+    for(int y = r.y1; y < r.y2; y++)
+    {
+        if(!m) n += r.x2 - r.x1;
+        else for(uint row = m->rows[y]; row; row &= row-1) n++;
+    }
+    return n;
+}
+
+// builds the grid for random lights in front of the last frame's camera, no rendering needed
+static void lightgridbench(int *numlights, int *iterations)
+{
+    if(!lighttilew || !lighttileh)
+    {
+        conoutf(CON_ERROR, "no view set up to bench the light grid against");
+        return;
+    }
+    static lightgridinfo grid;
+    if(!grid.setup())
+    {
+        conoutf(CON_ERROR, "no view set up to bench the light grid against");
+        return;
+    }
+    int n = clamp(*numlights > 0 ? *numlights : 256, 1, int(USHRT_MAX)), iters = *iterations > 0 ? *iterations : 100;
+    vector<lightinfo> benchlights;
+    vector<int> benchorder;
+    float maxdist = min(float(farplane), 2048.0f);
+    loopi(n)
+    {
+        float d = nearplane + maxdist*rndscale(1)*rndscale(1),
+              x = (rndscale(2) - 1)*d/projmatrix.a.x, y = (rndscale(2) - 1)*d/projmatrix.b.y;
+        vec o;
+        invcammatrix.transform(vec(x, y, -d), o);
+        float radius = 16 + rndscale(240);
+        vec color(255, 255, 255);
+        if(rnd(4)) benchlights.add(lightinfo(o, color, radius));
+        else
+        {
+            vec dir(rndscale(2) - 1, rndscale(2) - 1, rndscale(2) - 1);
+            if(dir.iszero()) dir = vec(0, 0, -1);
+            benchlights.add(lightinfo(o, color, radius, 0, dir.normalize(), 20 + rnd(50)));
+        }
+        if(benchlights.last().validscissor()) benchorder.add(benchlights.length()-1);
+    }
+
+    Uint64 start = SDL_GetPerformanceCounter();
+    loopi(iters) grid.build(benchlights, benchorder);
+    double ms = (SDL_GetPerformanceCounter() - start)*1000.0/SDL_GetPerformanceFrequency()/iters;
+
+    int scissortiles = 0, gridtiles = 0, occupied = 0, maxlights = 0;
+    loopv(benchorder)
+    {
+        lightrect r(benchlights[benchorder[i]]);
+        scissortiles += countlighttiles(r, NULL);
+        gridtiles += countlighttiles(r, &grid.masks[i]);
+    }
+    loopi(LIGHTGRID_CLUSTERS) if(grid.counts[i])
+    {
+        occupied++;
+        maxlights = max(maxlights, int(grid.counts[i]));
+    }
+    conoutf("lightgrid: %d of %d lights on screen, %d x %d x %d clusters, %s",
+        benchorder.length(), n, lighttilew, lighttileh, LIGHTGRID_SLICES,
+#ifdef LIGHTGRIDSIMD
+        "simd"
+#else
+        "scalar"
+#endif
+    );
+    conoutf("lightgrid: %.3f ms per build over %d builds", ms, iters);
+    conoutf("lightgrid: %d cluster hits, %d clusters occupied, %.1f lights per occupied cluster, %d at most",
+        grid.numhits, occupied, occupied ? grid.numhits/float(occupied) : 0.0f, maxlights);
+    conoutf("lightgrid: %d light tiles instead of %d from scissors (%.1f%% saved)",
+        gridtiles, scissortiles, scissortiles ? 100.0f*(scissortiles - gridtiles)/scissortiles : 0.0f);
+}
+COMMAND(lightgridbench, "ii");
+
 void clearshadowcache()
 {
     shadowmaps.setsize(0);
@@ -1880,8 +2247,6 @@ static shadowmapinfo *addshadowmap(ushort x, ushort y, int size, int &idx, int l
     return sm;
 }
 
-#define CSM_MAXSPLITS 8
-
 VARF(csmmaxsize, 256, 768, 2048, clearshadowcache());
 VARF(csmsplits, 1, 3, CSM_MAXSPLITS, { cleardeferredlightshaders(); clearshadowcache(); });
 FVAR(csmsplitweight, 0.20f, 0.75f, 0.95f);
@@ -2074,6 +2439,14 @@ int calcbbcsmsplits(const ivec &bbmin, const ivec &bbmax)
     return mask;
 }
 
+// the four culling planes of every split, for culling many boxes against all of them at once
+bool getcsmcullplanes(plane *planes)
+{
+    if(!csmcull) return false;
+    loopi(csmsplits) memcpy(&planes[4*i], csm.splits[i].cull, sizeof(csm.splits[i].cull));
+    return true;
+}
+
 int calcspherecsmsplits(const vec &center, float radius)
 {
     int mask = (1<<csmsplits)-1;
@@ -2192,6 +2565,13 @@ int calcbbrsmsplits(const ivec &bbmin, const ivec &bbmax)
     return 1;
 }
 
+bool getrsmcullplanes(plane *planes)
+{
+    if(!rsmcull) return false;
+    memcpy(planes, rsm.cull, sizeof(rsm.cull));
+    return true;
+}
+
 int calcspherersmsplits(const vec &center, float radius)
 {
     if(!rsmcull) return 1;
@@ -2533,33 +2913,82 @@ void calctilesize()
     lighttileh = min(lighttileviewh, lighttilemaxh);
 }
 
+static inline int shadowmaparea(const shadowmapinfo &sm)
+{
+    return lights[sm.light].spot ? sm.size*sm.size : sm.size*sm.size*6;
+}
+
+// runs when a light missed out on the atlas, dropping cached maps so the next frame packs better:
+// with enough free area the atlas was only fragmented and the highest maps get moved down,
+// otherwise maps of lights ranked below the first one that missed out make room for it
+static int evictshadowcache()
+{
+    static vector<int> candidates, ranks;
+    candidates.setsize(0);
+    int avail = shadowatlaspacker.available(), evicted = 0;
+    if(avail >= shadowcachemissarea)
+    {
+        loopv(shadowmaps) if(shadowmaps[i].light >= 0) candidates.add(i);
+        candidates.sort([](int x, int y)
+        {
+            const shadowmapinfo &a = shadowmaps[x], &b = shadowmaps[y];
+            return a.y + (lights[a.light].spot ? a.size : a.size*2) > b.y + (lights[b.light].spot ? b.size : b.size*2);
+        });
+        evicted = min(smcompact, candidates.length());
+        loopi(evicted) shadowmaps[candidates[i]].light = -1;
+        smstatcompacted += evicted;
+    }
+    else
+    {
+        ranks.setsize(0);
+        ranks.pad(lights.length());
+        loopv(lightorder) ranks[lightorder[i]] = i;
+        loopv(shadowmaps)
+        {
+            const shadowmapinfo &sm = shadowmaps[i];
+            if(sm.light >= 0 && ranks[sm.light] > shadowcachemisslight) candidates.add(i);
+        }
+        candidates.sort([](int x, int y) { return ranks[shadowmaps[x].light] > ranks[shadowmaps[y].light]; });
+        loopv(candidates)
+        {
+            if(avail >= shadowcachemissarea) break;
+            shadowmapinfo &sm = shadowmaps[candidates[i]];
+            avail += shadowmaparea(sm);
+            sm.light = -1;
+            evicted++;
+        }
+    }
+    smstatevicted += evicted;
+    return evicted;
+}
+
 void resetlights()
 {
     shadowcache.reset();
+    smoccupancy = int((100.0f*shadowatlaspacker.used)/max(shadowatlaspacker.w*shadowatlaspacker.h, 1));
+    smstatoccupancy += smoccupancy;
+    smstatframes++;
+    smstatfailed += smfailed;
+    smstatfreerects = shadowatlaspacker.rects.length();
+    smstatlargest = shadowatlaspacker.largest();
+    smevicted = 0;
     if(smcache)
     {
-        int evictx = ((evictshadowcache%SHADOWCACHE_EVICT)*shadowatlaspacker.w)/SHADOWCACHE_EVICT,
-            evicty = ((evictshadowcache/SHADOWCACHE_EVICT)*shadowatlaspacker.h)/SHADOWCACHE_EVICT,
-            evictx2 = (((evictshadowcache%SHADOWCACHE_EVICT)+1)*shadowatlaspacker.w)/SHADOWCACHE_EVICT,
-            evicty2 = (((evictshadowcache/SHADOWCACHE_EVICT)+1)*shadowatlaspacker.h)/SHADOWCACHE_EVICT;
+        if(shadowcachefull) smevicted = evictshadowcache();
         loopv(shadowmaps)
         {
             shadowmapinfo &sm = shadowmaps[i];
             if(sm.light < 0) continue;
             lightinfo &l = lights[sm.light];
-            if(sm.cached && shadowcachefull)
-            {
-                int w = l.spot ? sm.size : sm.size*3, h = l.spot ? sm.size : sm.size*2;
-                if(sm.x < evictx2 && sm.x + w > evictx && sm.y < evicty2 && sm.y + h > evicty) continue;
-            }
             shadowcache[l] = sm;
         }
-        if(shadowcachefull)
-        {
-            evictshadowcache = (evictshadowcache + 1)%(SHADOWCACHE_EVICT*SHADOWCACHE_EVICT);
-            shadowcachefull = false;
-        }
     }
+    shadowcachefull = false;
+    shadowcachemissarea = 0;
+    shadowcachemisslight = INT_MAX;
+
+    lightgridwait();
+    lightgridvalid = false;
 
     lights.setsize(0);
     lightorder.setsize(0);
@@ -2570,6 +2999,24 @@ void resetlights()
     calctilesize();
 }
 
+// averages since the last call
+static void shadowatlasstats()
+{
+    if(!smstatframes)
+    {
+        conoutf(CON_ERROR, "no shadow atlas frames to report");
+        return;
+    }
+    int size = shadowatlaspacker.w*shadowatlaspacker.h;
+    conoutf("shadow atlas: %dx%d, %d%% used last frame, %d free rects, largest %.1f%%",
+        shadowatlaspacker.w, shadowatlaspacker.h, smoccupancy, smstatfreerects, (100.0f*smstatlargest)/max(size, 1));
+    conoutf("shadow atlas: %.1f%% used on average, %d lights missed out, %d cached maps evicted, %d moved to compact over %d frames",
+        smstatoccupancy/smstatframes, smstatfailed, smstatevicted, smstatcompacted, smstatframes);
+    smstatframes = smstatfailed = smstatevicted = smstatcompacted = 0;
+    smstatoccupancy = 0;
+}
+COMMAND(shadowatlasstats, "");
+
 namespace lightsphere
 {
     vec *verts = NULL;
@@ -3490,6 +3937,8 @@ void collectlights()
 
         smused += w*h;
     }
+
+    kicklightgrid();
 }
 
 static bool inoq = false;
@@ -3513,6 +3962,12 @@ struct batchrect : lightrect
         group((l.shadowmap < 0 ? BF_NOSHADOW : 0) | (l.spot > 0 ? BF_SPOTLIGHT : 0)),
         idx(idx)
     {}
+
+    batchrect(const lightinfo &l, ushort idx, const lightrect &r)
+      : lightrect(r),
+        group((l.shadowmap < 0 ? BF_NOSHADOW : 0) | (l.spot > 0 ? BF_SPOTLIGHT : 0)),
+        idx(idx)
+    {}
 };
 
 struct batchstack : lightrect
@@ -3627,17 +4082,42 @@ static void batchlights()
     lightbatchesused = lightbatches.length();
 }
 
+// splits the light's tiles into row runs, merging rows that cover the same columns
+static void addgridrects(const lightinfo &l, ushort idx, const lighttilemask &m)
+{
+    lightrect r(l);
+    for(int y = r.y1; y < r.y2;)
+    {
+        uint row = m.rows[y];
+        int y2 = y + 1;
+        while(y2 < r.y2 && m.rows[y2] == row) y2++;
+        for(int x = r.x1; x < r.x2;)
+        {
+            if(!(row&(1<<x))) { x++; continue; }
+            int x2 = x + 1;
+            while(x2 < r.x2 && row&(1<<x2)) x2++;
+            batchrects.add(batchrect(l, idx, lightrect(x, y, x2, y2)));
+            x = x2;
+        }
+        y = y2;
+    }
+}
+
 void packlights()
 {
+    lightgridwait();
+
     lightsvisible = lightsoccluded = 0;
     lightpassesused = 0;
+    smfailed = 0;
     batchrects.setsize(0);
 
     loopv(lightorder)
     {
         int idx = lightorder[i];
         lightinfo &l = lights[idx];
-        if(l.checkquery())
+        // lights that reach no cluster shade nothing, so they get no atlas space either
+        if(l.checkquery() || (lightgridvalid && lightgridframe.masks[i].empty()))
         {
             if(l.shadowmap >= 0)
             {
@@ -3664,10 +4144,20 @@ void packlights()
                 addshadowmap(x, y, size, l.shadowmap, idx);
                 smused += w*h;
             }
-            else if(smcache) shadowcachefull = true;
+            else
+            {
+                smfailed++;
+                if(smcache)
+                {
+                    shadowcachefull = true;
+                    shadowcachemissarea += w*h;
+                    shadowcachemisslight = min(shadowcachemisslight, i);
+                }
+            }
         }
 
-        batchrects.add(batchrect(l, i));
+        if(lightgridvalid) addgridrects(l, i, lightgridframe.masks[i]);
+        else batchrects.add(batchrect(l, i));
     }
 
     lightsvisible = lightorder.length() - lightsoccluded;
@@ -4093,6 +4583,7 @@ void renderradiancehints()
     if(rhinoq && !inoq && shouldworkinoq()) return;
     if(!useradiancehints()) return;
 
+    PROFILE("radiance hints");
     timer *rhcputimer = begintimer("radiance hints", false);
     timer *rhtimer = begintimer("radiance hints");
 
@@ -4422,6 +4913,7 @@ void rendershadowmaps(int offset = 0)
 
 void rendershadowatlas()
 {
+    PROFILE("shadow map");
     timer *smcputimer = begintimer("shadow map", false);
     timer *smtimer = begintimer("shadow map");
 
@@ -4759,6 +5251,7 @@ void preparegbuffer(bool depthclear)
 
 void rendergbuffer(bool depthclear)
 {
+    PROFILE("g-buffer");
     timer *gcputimer = drawtex ? NULL : begintimer("g-buffer", false);
     timer *gtimer = drawtex ? NULL : begintimer("g-buffer");
 
@@ -4864,6 +5357,7 @@ void shadegbuffer()
 {
     GLERROR;
 
+    PROFILE("deferred shading");
     timer *shcputimer = begintimer("deferred shading", false);
     timer *shtimer = begintimer("deferred shading");
 
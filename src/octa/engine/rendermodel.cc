@@ -413,6 +413,23 @@ void cleanupmodels()
     enumerate(models, model *, m, m->cleanup());
 }
 
+void bihstats()
+{
+    int num = 0, numtris = 0, numnodes = 0;
+    float millis = 0;
+    enumerate(models, model *, m,
+    {
+        if(!m->bih) continue;
+        m->bih->printstats(m->name);
+        num++;
+        numtris += m->bih->numtris;
+        numnodes += m->bih->numnodes;
+        millis += m->bih->buildmillis;
+    });
+    conoutf("%d bihs: %d tris, %d nodes, built in %.2f ms", num, numtris, numnodes, millis);
+}
+COMMAND(bihstats, "");
+
 void clearmodel(char *name)
 {
     if (!name || !name[0]) return;
@@ -438,7 +455,7 @@ COMMAND(clearmodel, "s");
 bool modeloccluded(const vec &center, float radius)
 {
     ivec bbmin = vec(center).sub(radius), bbmax = vec(center).add(radius+1);
-    return pvsoccluded(bbmin, bbmax) || bboccluded(bbmin, bbmax);
+    return pvsoccluded(bbmin, bbmax) || bboccluded(bbmin, bbmax) || swoccluded(bbmin, bbmax);
 }
 
 struct batchedmodel
@@ -903,7 +903,11 @@ struct varenderer : partrenderer
     void render()
     {
         genvbo();
+        drawverts();
+    }
 
+    void drawverts()
+    {
         glBindTexture(GL_TEXTURE_2D, tex->id);
 
         glBindBuffer_(GL_ARRAY_BUFFER, vbo);
@@ -933,6 +937,7 @@ typedef varenderer<PT_TRAIL> trailrenderer;
 #include "explosion.hh"
 #include "lensflare.hh"
 #include "lightning.hh"
+#include "soaparticles.hh"
 
 static vector<partrenderer*> parts;
 static hashtable<const char*, int> partmap;
@@ -967,8 +972,8 @@ LUAICOMMAND(particle_register_renderer_##name, { \
     const char *path = luaL_checkstring(L, 2); \
     int flags = luaL_optinteger(L, 3, 0) & (~PT_CLEARMASK); \
     int stain = luaL_optinteger(L, 4, 0); \
-    register_renderer(L, newstring(name), new name##renderer(newstring(path), \
-        flags, stain)); \
+    register_renderer(L, newstring(name), newvarenderer<name##renderer>( \
+        newstring(path), flags, stain)); \
     return 2; \
 })
 
@@ -1517,6 +1522,7 @@ FVARFP(editpartsize, 0.0f, 4.0f, 100.0f, initparticles());
 
 void updateparticles()
 {
+    PROFILE("particles");
     if(regenemitters) addparticleemitters();
 
     if(minimized) { canemit = false; return; }
@@ -1559,32 +1565,42 @@ void updateparticles()
         }
         if(dbgpcull && (canemit || replayed) && addedparticles) conoutf(CON_DEBUG, "%d emitters, %d particles", emitted, addedparticles);
     }
+    kickparticles();
     if(editmode) // show sparkly thingies for map entities in edit mode
     {
         const vector<extentity *> &ents = entities::getents();
-        // note: order matters in this case as particles of the same type are drawn in the reverse order that they are added
-        loopv(entgroup)
-        {
-            extentity &e = *ents[entgroup[i]];
-            const char *cn;
-            lua::L->call_external_ret("entity_get_proto_name", "i", "s", entgroup[i], &cn);
-            if (!cn) continue;
-            particle_textcopy(e.o, cn, PART_TEXT, 1, vec(1.0f, 0.3f, 0.1f), 2.0f, 0);
-        }
-        loopv(ents)
+        // one call fetches the names, icons and colors of all entities,
+        // entity i occupying slots i*5 to i*5+4 of the returned table
+        int n = lua::L->call_external_ret_nopop("entity_get_edit_icon_infos", "i", "v", ents.length());
+        if(n <= 0) return;
+        lua_State *ls = lua::L->state;
+        int infos = lua_gettop(ls) - n + 1;
+        if(lua_istable(ls, infos))
         {
-            extentity &e = *ents[i];
-            const char *name;
-            lua::L->call_external_ret("entity_get_proto_name", "i", "s", i, &name);
-            if (!name) continue;
-
-            const char *icon;
-            float r, g, b;
-            lua::L->call_external_ret("entity_get_edit_icon_info", "i", "sfff", i, &icon, &r, &g, &b);
-
-            particle_textcopy(e.o, name, PART_TEXT, 1, vec(0.12f, 0.78f, 0.31f), 2.0f, 0);
-            ((iconparticle*)newparticle(e.o, vec(0, 0, 0), 0, PART_ICON,
-                vec(r / 255.0f, g / 255.0f, b / 255.0f), editpartsize))->tex = textureload(icon);
+            // note: order matters in this case as particles of the same type are drawn in the reverse order that they are added
+            loopv(entgroup)
+            {
+                extentity &e = *ents[entgroup[i]];
+                lua_rawgeti(ls, infos, entgroup[i]*5);
+                const char *cn = lua_tostring(ls, -1);
+                lua_pop(ls, 1);
+                if (!cn) continue;
+                particle_textcopy(e.o, cn, PART_TEXT, 1, vec(1.0f, 0.3f, 0.1f), 2.0f, 0);
+            }
+            loopv(ents)
+            {
+                extentity &e = *ents[i];
+                loopk(5) lua_rawgeti(ls, infos, i*5 + k);
+                const char *name = lua_tostring(ls, -5), *icon = lua_tostring(ls, -4);
+                float r = lua_tonumber(ls, -3), g = lua_tonumber(ls, -2), b = lua_tonumber(ls, -1);
+                lua_pop(ls, 5);
+                if (!name) continue;
+
+                particle_textcopy(e.o, name, PART_TEXT, 1, vec(0.12f, 0.78f, 0.31f), 2.0f, 0);
+                ((iconparticle*)newparticle(e.o, vec(0, 0, 0), 0, PART_ICON,
+                    vec(r / 255.0f, g / 255.0f, b / 255.0f), editpartsize))->tex = textureload(icon);
+            }
         }
+        lua::L->pop_external_ret(n);
     }
 }
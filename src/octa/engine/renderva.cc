@@ -2,6 +2,11 @@
 
 #include "engine.hh"
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+  #define VACULLSIMD 1
+  #include <emmintrin.h>
+#endif
+
 static inline void drawtris(GLsizei numindices, const GLvoid *indices, ushort minvert, ushort maxvert)
 {
     glDrawRangeElements_(GL_TRIANGLES, minvert, maxvert, numindices, GL_UNSIGNED_SHORT, indices);
@@ -162,10 +167,212 @@ static inline void findvisiblevas(vector<vtxarray *> &vas)
     }
 }
 
+///////// flattened va bounds ///////////////////////
+
+VAR(vaflatcull, 0, 1, 1);
+
+// the bounds of four vas side by side, so each plane is tested against all of them at once
+struct vabounds
+{
+    float cx[4], cy[4], cz[4], csize[4];                  // octree cube
+    float bx1[4], by1[4], bz1[4], bx2[4], by2[4], bz2[4]; // bounds with children and entities
+    float sx1[4], sy1[4], sz1[4], sx2[4], sy2[4], sz2[4]; // bounds used for shadow culling
+};
+
+// vas are kept in tree order, so every parent comes before its children and
+// a whole subtree can be skipped by jumping to the index after it
+static vector<vabounds> vaboundblocks;
+static vector<vtxarray *> vaorder;
+static vector<int> vaparents, vaskips;
+static vector<uchar> vacullresult, vacullinside, vacullstate;
+static vector<float> vaculldist;
+static bool vaboundsvalid = false;
+
+void clearvabounds()
+{
+    vaboundsvalid = false;
+}
+
+static void addvabounds(vector<vtxarray *> &vas, int parent)
+{
+    loopv(vas)
+    {
+        vtxarray &v = *vas[i];
+        int index = vaorder.length(), lane = index&3;
+        vaorder.add(&v);
+        vaparents.add(parent);
+        vaskips.add(0);
+        if(!lane) memset(&vaboundblocks.add(), 0, sizeof(vabounds));
+        vabounds &b = vaboundblocks.last();
+        b.cx[lane] = v.o.x; b.cy[lane] = v.o.y; b.cz[lane] = v.o.z; b.csize[lane] = v.size;
+        b.bx1[lane] = v.bbmin.x; b.by1[lane] = v.bbmin.y; b.bz1[lane] = v.bbmin.z;
+        b.bx2[lane] = v.bbmax.x; b.by2[lane] = v.bbmax.y; b.bz2[lane] = v.bbmax.z;
+        const ivec &smin = v.children.length() || v.mapmodels.length() ? v.bbmin : v.geommin,
+                   &smax = v.children.length() || v.mapmodels.length() ? v.bbmax : v.geommax;
+        b.sx1[lane] = smin.x; b.sy1[lane] = smin.y; b.sz1[lane] = smin.z;
+        b.sx2[lane] = smax.x; b.sy2[lane] = smax.y; b.sz2[lane] = smax.z;
+        if(v.children.length()) addvabounds(v.children, index);
+        vaskips[index] = vaorder.length();
+    }
+}
+
+static void genvabounds()
+{
+    if(vaboundsvalid) return;
+    vaboundblocks.setsize(0);
+    vaorder.setsize(0);
+    vaparents.setsize(0);
+    vaskips.setsize(0);
+    addvabounds(varoot, -1);
+    int numlanes = vaboundblocks.length()*4;
+    vacullresult.setsize(0); vacullresult.pad(numlanes);
+    vacullinside.setsize(0); vacullinside.pad(numlanes);
+    vacullstate.setsize(0); vacullstate.pad(numlanes);
+    vaculldist.setsize(0); vaculldist.pad(numlanes);
+    vaboundsvalid = true;
+}
+
+#ifdef VACULLSIMD
+// same operation order as ivec::dist so the results match the tree walk exactly
+static inline __m128 vaplanedist(const plane &p, const float *x, const float *y, const float *z)
+{
+    return _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(x), _mm_set1_ps(p.x)),
+                                            _mm_mul_ps(_mm_loadu_ps(y), _mm_set1_ps(p.y))),
+                                 _mm_mul_ps(_mm_loadu_ps(z), _mm_set1_ps(p.z))),
+                      _mm_set1_ps(p.offset));
+}
+#endif
+
+// isvisiblecube for the octree cubes of a block
+static void classifyvabounds(int block, uchar *vfc)
+{
+    vfc += block*4;
+#ifdef VACULLSIMD
+    const vabounds &b = vaboundblocks[block];
+    __m128 size = _mm_loadu_ps(b.csize), dist = _mm_setzero_ps(), hidden = dist, part = dist;
+    loopk(5)
+    {
+        dist = vaplanedist(vfcP[k], b.cx, b.cy, b.cz);
+        hidden = _mm_or_ps(hidden, _mm_cmplt_ps(dist, _mm_mul_ps(_mm_set1_ps(-vfcDfar[k]), size)));
+        part = _mm_or_ps(part, _mm_cmplt_ps(dist, _mm_mul_ps(_mm_set1_ps(-vfcDnear[k]), size)));
+    }
+    dist = _mm_sub_ps(dist, _mm_set1_ps(vfcDfog));
+    __m128 fogged = _mm_cmpgt_ps(dist, _mm_mul_ps(_mm_set1_ps(-vfcDnear[4]), size));
+    part = _mm_or_ps(part, _mm_cmpgt_ps(dist, _mm_mul_ps(_mm_set1_ps(-vfcDfar[4]), size)));
+    int hiddenmask = _mm_movemask_ps(hidden), foggedmask = _mm_movemask_ps(fogged), partmask = _mm_movemask_ps(part);
+    loopi(4) vfc[i] = hiddenmask&(1<<i) ? VFC_NOT_VISIBLE : (foggedmask&(1<<i) ? VFC_FOGGED : (partmask&(1<<i) ? VFC_PART_VISIBLE : VFC_FULL_VISIBLE));
+#else
+    for(int i = 0, n = min(4, vaorder.length() - block*4); i < n; i++) vfc[i] = isvisiblecube(vaorder[block*4 + i]->o, vaorder[block*4 + i]->size);
+#endif
+}
+
+// tests the shadow bounds of a block against several frusta of four planes at once,
+// setting bit n when outside frustum n and in inside when entirely within it
+static void cullvabounds(int block, const plane *planes, int numfrusta, uchar *outside, uchar *inside)
+{
+    outside += block*4;
+    inside += block*4;
+    memset(outside, 0, 4);
+    memset(inside, 0, 4);
+    const vabounds &b = vaboundblocks[block];
+#ifdef VACULLSIMD
+    loopj(numfrusta)
+    {
+        __m128 out = _mm_setzero_ps(), partial = out;
+        loopk(4)
+        {
+            const plane &p = planes[4*j + k];
+            // farthest and nearest corners along the plane normal
+            __m128 farthest = vaplanedist(p, p.x > 0 ? b.sx2 : b.sx1, p.y > 0 ? b.sy2 : b.sy1, p.z > 0 ? b.sz2 : b.sz1),
+                   nearest = vaplanedist(p, p.x > 0 ? b.sx1 : b.sx2, p.y > 0 ? b.sy1 : b.sy2, p.z > 0 ? b.sz1 : b.sz2);
+            out = _mm_or_ps(out, _mm_cmplt_ps(farthest, _mm_setzero_ps()));
+            partial = _mm_or_ps(partial, _mm_cmplt_ps(nearest, _mm_setzero_ps()));
+        }
+        int outmask = _mm_movemask_ps(out), partmask = _mm_movemask_ps(partial) | outmask;
+        loopi(4)
+        {
+            if(outmask&(1<<i)) outside[i] |= 1<<j;
+            else if(!(partmask&(1<<i))) inside[i] |= 1<<j;
+        }
+    }
+#else
+    loopi(4) loopj(numfrusta)
+    {
+        bool out = false, partial = false;
+        loopk(4)
+        {
+            const plane &p = planes[4*j + k];
+            ivec omin, omax;
+            if(p.x > 0) { omin.x = b.sx1[i]; omax.x = b.sx2[i]; } else { omin.x = b.sx2[i]; omax.x = b.sx1[i]; }
+            if(p.y > 0) { omin.y = b.sy1[i]; omax.y = b.sy2[i]; } else { omin.y = b.sy2[i]; omax.y = b.sy1[i]; }
+            if(p.z > 0) { omin.z = b.sz1[i]; omax.z = b.sz2[i]; } else { omin.z = b.sz2[i]; omax.z = b.sz1[i]; }
+            if(omax.dist(p) < 0) out = true;
+            if(omin.dist(p) < 0) partial = true;
+        }
+        if(out) outside[i] |= 1<<j;
+        else if(!partial) inside[i] |= 1<<j;
+    }
+#endif
+}
+
+// distance from a point to the bounds of a block
+static void vabounddists(int block, const vec &o, float *dists)
+{
+    dists += block*4;
+    const vabounds &b = vaboundblocks[block];
+#ifdef VACULLSIMD
+    __m128 ox = _mm_set1_ps(o.x), oy = _mm_set1_ps(o.y), oz = _mm_set1_ps(o.z), zero = _mm_setzero_ps(),
+           dx = _mm_add_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(b.bx1), ox), zero), _mm_max_ps(_mm_sub_ps(ox, _mm_loadu_ps(b.bx2)), zero)),
+           dy = _mm_add_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(b.by1), oy), zero), _mm_max_ps(_mm_sub_ps(oy, _mm_loadu_ps(b.by2)), zero)),
+           dz = _mm_add_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(b.bz1), oz), zero), _mm_max_ps(_mm_sub_ps(oz, _mm_loadu_ps(b.bz2)), zero));
+    _mm_storeu_ps(dists, _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz))));
+#else
+    loopi(4) dists[i] = o.dist_to_bb(vec(b.bx1[i], b.by1[i], b.bz1[i]), vec(b.bx2[i], b.by2[i], b.bz2[i]));
+#endif
+}
+
+enum { VACULL_RESET = 1<<0 };
+
+// findvisiblevas over the flattened bounds, blocks are only classified once the walk reaches them
+static void findflatvisiblevas()
+{
+    genvabounds();
+    uchar *vfc = vacullresult.getbuf(), *state = vacullstate.getbuf();
+    int classified = -1;
+    for(int i = 0; i < vaorder.length();)
+    {
+        vtxarray &v = *vaorder[i];
+        int parent = vaparents[i], prevvfc = v.curvfc;
+        if(parent >= 0 && vaorder[parent]->curvfc == VFC_FULL_VISIBLE) v.curvfc = VFC_FULL_VISIBLE;
+        else
+        {
+            if(i>>2 > classified) classifyvabounds(classified = i>>2, vfc);
+            v.curvfc = vfc[i];
+        }
+        if(v.curvfc == VFC_NOT_VISIBLE) { i = vaskips[i]; continue; }
+        if(pvsoccluded(v.o, v.size))
+        {
+            v.curvfc += PVS_FULL_VISIBLE - VFC_FULL_VISIBLE;
+            i = vaskips[i];
+            continue;
+        }
+        bool resetchildren = prevvfc >= VFC_NOT_VISIBLE || (parent >= 0 && state[parent]&VACULL_RESET);
+        if(resetchildren)
+        {
+            v.occluded = !v.texs ? OCCLUDE_GEOM : OCCLUDE_NOTHING;
+            v.query = NULL;
+        }
+        addvisibleva(&v);
+        state[i] = resetchildren ? VACULL_RESET : 0;
+        i++;
+    }
+}
+
 void findvisiblevas()
 {
     memset(vasort, 0, sizeof(vasort));
-    findvisiblevas<false, false>(varoot);
+    if(vaflatcull) findflatvisiblevas();
+    else findvisiblevas<false, false>(varoot);
     sortvisiblevas();
 }
 
@@ -428,7 +635,7 @@ void findvisiblemms(const vector<extentity *> &ents)
     for(vtxarray *va = visibleva; va; va = va->next) if(va->occluded < OCCLUDE_BB && va->curvfc < VFC_FOGGED) loopv(va->mapmodels)
     {
         octaentities *oe = va->mapmodels[i];
-        if(isfoggedcube(oe->o, oe->size) || pvsoccluded(oe->bbmin, oe->bbmax)) continue;
+        if(isfoggedcube(oe->o, oe->size) || pvsoccluded(oe->bbmin, oe->bbmax) || swoccluded(oe->bbmin, oe->bbmax)) continue;
 
         bool occluded = oe->query && oe->query->owner == oe && checkquery(oe->query);
         if(occluded)
@@ -480,7 +687,7 @@ void rendermapmodels()
     findvisiblemms(ents);
 
     static int skipoq = 0;
-    bool doquery = oqfrags && oqmm;
+    bool doquery = oqfrags && oqmm && !swocclusionactive();
 
     for(octaentities *oe = visiblemms; oe; oe = oe->next) if(oe->distance>=0)
     {
@@ -952,10 +1159,116 @@ void findspotshadowvas(vector<vtxarray *> &vas)
     }
 }
 
+// walks the flattened bounds in tree order, preparing each block once the walk
+// reaches it and skipping the subtrees of vas that weren't added
+template<class P, class T>
+static inline void addflatshadowvas(P prepare, T shadowmask)
+{
+    int prepared = -1;
+    for(int i = 0; i < vaorder.length();)
+    {
+        if(i>>2 > prepared) prepare(prepared = i>>2);
+        vtxarray &v = *vaorder[i];
+        float dist;
+        if(!shadowmask(v, i, dist)) { i = vaskips[i]; continue; }
+        addshadowva(&v, dist);
+        i++;
+    }
+}
+
+static inline void vashadowbounds(vtxarray &v, ivec &bbmin, ivec &bbmax)
+{
+    if(v.children.length() || v.mapmodels.length()) { bbmin = v.bbmin; bbmax = v.bbmax; }
+    else { bbmin = v.geommin; bbmax = v.geommax; }
+}
+
+static void findflatshadowvas()
+{
+    float *dists = vaculldist.getbuf();
+    addflatshadowvas([dists](int block) { vabounddists(block, shadoworigin, dists); },
+    [dists](vtxarray &v, int i, float &dist)
+    {
+        dist = dists[i];
+        if(dist >= shadowradius && smdistcull) return false;
+        v.shadowmask = !smbbcull ? 0x3F : (v.children.length() || v.mapmodels.length() ?
+                            calcbbsidemask(v.bbmin, v.bbmax, shadoworigin, shadowradius, shadowbias) :
+                            calcbbsidemask(v.geommin, v.geommax, shadoworigin, shadowradius, shadowbias));
+        return true;
+    });
+}
+
+// every split is culled in the same pass over the bounds
+static void findflatcsmshadowvas()
+{
+    plane planes[4*CSM_MAXSPLITS];
+    int splits = csmsplits, full = (1<<splits)-1;
+    uchar *outside = vacullresult.getbuf(), *inside = vacullinside.getbuf();
+    bool cull = getcsmcullplanes(planes);
+    addflatshadowvas([&](int block) { if(cull) cullvabounds(block, planes, splits, outside, inside); },
+    [=](vtxarray &v, int i, float &dist)
+    {
+        int mask = full;
+        if(cull) loopj(splits)
+        {
+            if(outside[i]&(1<<j)) mask &= ~(1<<j);
+            else if(inside[i]&(1<<j)) { mask &= (2<<j)-1; break; }
+        }
+        v.shadowmask = mask;
+        if(!mask) return false;
+        ivec bbmin, bbmax;
+        vashadowbounds(v, bbmin, bbmax);
+        dist = shadowdir.project_bb(bbmin, bbmax) - shadowbias;
+        return true;
+    });
+}
+
+static void findflatrsmshadowvas()
+{
+    plane planes[4];
+    uchar *outside = vacullresult.getbuf(), *inside = vacullinside.getbuf();
+    bool cull = getrsmcullplanes(planes);
+    addflatshadowvas([&](int block) { if(cull) cullvabounds(block, planes, 1, outside, inside); },
+    [=](vtxarray &v, int i, float &dist)
+    {
+        v.shadowmask = cull && outside[i] ? 0 : 1;
+        if(!v.shadowmask) return false;
+        ivec bbmin, bbmax;
+        vashadowbounds(v, bbmin, bbmax);
+        dist = shadowdir.project_bb(bbmin, bbmax) - shadowbias;
+        return true;
+    });
+}
+
+static void findflatspotshadowvas()
+{
+    float *dists = vaculldist.getbuf();
+    addflatshadowvas([dists](int block) { vabounddists(block, shadoworigin, dists); },
+    [dists](vtxarray &v, int i, float &dist)
+    {
+        dist = dists[i];
+        if(dist >= shadowradius && smdistcull) return false;
+        v.shadowmask = !smbbcull || (v.children.length() || v.mapmodels.length() ?
+                            bbinsidespot(shadoworigin, shadowdir, shadowspot, v.bbmin, v.bbmax) :
+                            bbinsidespot(shadoworigin, shadowdir, shadowspot, v.geommin, v.geommax)) ? 1 : 0;
+        return true;
+    });
+}
+
 void findshadowvas()
 {
     memset(vasort, 0, sizeof(vasort));
-    switch(shadowmapping)
+    if(vaflatcull)
+    {
+        genvabounds();
+        switch(shadowmapping)
+        {
+            case SM_REFLECT: findflatrsmshadowvas(); break;
+            case SM_CUBEMAP: findflatshadowvas(); break;
+            case SM_CASCADE: findflatcsmshadowvas(); break;
+            case SM_SPOT: findflatspotshadowvas(); break;
+        }
+    }
+    else switch(shadowmapping)
     {
         case SM_REFLECT: findrsmshadowvas(varoot); break;
         case SM_CUBEMAP: findshadowvas(varoot); break;
@@ -965,6 +1278,130 @@ void findshadowvas()
     sortshadowvas();
 }
 
+static bool samevalists(const vector<vtxarray *> &vas, vtxarray *list, bool shadow)
+{
+    int n = 0;
+    for(vtxarray *va = list; va; va = shadow ? va->rnext : va->next, n++)
+    {
+        if(n >= vas.length() || vas[n] != va) return false;
+    }
+    return n == vas.length();
+}
+
+// runs the tree walks and the flattened culling over a camera path circling the map,
+// and against the sun cascades of the last rendered frame, without touching GL
+static void vacullbench(int *numframes)
+{
+    if(varoot.empty())
+    {
+        conoutf(CON_ERROR, "no vertex arrays to cull");
+        return;
+    }
+    int frames = *numframes > 0 ? *numframes : 1000;
+
+    physent *oldcamera = camera1;
+    static physent benchcamera;
+    benchcamera = *camera1;
+    camera1 = &benchcamera;
+    matrix4 oldcammatrix = cammatrix, oldcamprojmatrix = camprojmatrix, oldprojmatrix = projmatrix;
+    float oldvfcDfog = vfcDfog, oldshadowradius = shadowradius, oldshadowbias = shadowbias;
+    vec oldshadowdir = shadowdir;
+    savevfcP();
+
+    double freq = SDL_GetPerformanceFrequency();
+    Uint64 start = SDL_GetPerformanceCounter();
+    clearvabounds();
+    genvabounds();
+    double rebuildms = 1000*(SDL_GetPerformanceCounter() - start)/freq;
+
+    projmatrix.perspective(fovy, aspect, nearplane, farplane);
+    vec center = vec(worldmin).add(vec(worldmax)).mul(0.5f);
+    float radius = max(max(worldmax.x - worldmin.x, worldmax.y - worldmin.y)*0.5f, 64.0f);
+    vector<vtxarray *> treevas;
+    Uint64 treeticks = 0, flatticks = 0;
+    int visible = 0, mismatches = 0;
+    loopi(frames)
+    {
+        float t = 2*M_PI*i/frames;
+        benchcamera.o = vec(center.x + cosf(t)*radius, center.y + sinf(t)*radius, center.z);
+        benchcamera.yaw = fmod(i*1080.0f/frames, 360.0f);
+        benchcamera.pitch = 30*sinf(3*t);
+        benchcamera.roll = 0;
+        // the camera matrix setcammatrix builds, without picking the cursor position
+        cammatrix = viewmatrix;
+        cammatrix.rotate_around_x(benchcamera.pitch*-RAD);
+        cammatrix.rotate_around_z(benchcamera.yaw*-RAD);
+        cammatrix.translate(vec(benchcamera.o).neg());
+        camprojmatrix.mul(projmatrix, cammatrix);
+        setvfcP();
+
+        start = SDL_GetPerformanceCounter();
+        memset(vasort, 0, sizeof(vasort));
+        findvisiblevas<false, false>(varoot);
+        sortvisiblevas();
+        treeticks += SDL_GetPerformanceCounter() - start;
+        treevas.setsize(0);
+        for(vtxarray *va = visibleva; va; va = va->next) treevas.add(va);
+
+        start = SDL_GetPerformanceCounter();
+        memset(vasort, 0, sizeof(vasort));
+        findflatvisiblevas();
+        sortvisiblevas();
+        flatticks += SDL_GetPerformanceCounter() - start;
+        if(!samevalists(treevas, visibleva, false)) mismatches++;
+        visible += treevas.length();
+    }
+    conoutf("vacullbench: %d vas, %d frames, %.1f visible, tree %.4f ms/frame, flat %.4f ms/frame (%.2fx, %s), rebuild %.4f ms, %d mismatches",
+        vaorder.length(), frames, visible/float(frames), 1000*treeticks/freq/frames, 1000*flatticks/freq/frames, treeticks/max(double(flatticks), 1.0),
+#ifdef VACULLSIMD
+        "sse2",
+#else
+        "scalar",
+#endif
+        rebuildms, mismatches);
+
+    if(!sunlightdir.iszero())
+    {
+        shadowdir = vec(sunlightdir).neg();
+        shadowbias = shadowdir.project_bb(worldmin, worldmax);
+        shadowradius = max(fabs(shadowdir.project_bb(worldmax, worldmin)), 1.0f);
+        treeticks = flatticks = 0;
+        int casters = 0;
+        mismatches = 0;
+        loopi(frames)
+        {
+            start = SDL_GetPerformanceCounter();
+            memset(vasort, 0, sizeof(vasort));
+            findcsmshadowvas(varoot);
+            sortshadowvas();
+            treeticks += SDL_GetPerformanceCounter() - start;
+            treevas.setsize(0);
+            for(vtxarray *va = shadowva; va; va = va->rnext) treevas.add(va);
+
+            start = SDL_GetPerformanceCounter();
+            memset(vasort, 0, sizeof(vasort));
+            findflatcsmshadowvas();
+            sortshadowvas();
+            flatticks += SDL_GetPerformanceCounter() - start;
+            if(!samevalists(treevas, shadowva, true)) mismatches++;
+            casters += treevas.length();
+        }
+        conoutf("vacullbench: %d cascades, %.1f casters, tree %.4f ms/frame, flat %.4f ms/frame (%.2fx), %d mismatches",
+            csmsplits, casters/float(frames), 1000*treeticks/freq/frames, 1000*flatticks/freq/frames, treeticks/max(double(flatticks), 1.0), mismatches);
+    }
+
+    camera1 = oldcamera;
+    cammatrix = oldcammatrix;
+    camprojmatrix = oldcamprojmatrix;
+    projmatrix = oldprojmatrix;
+    restorevfcP();
+    vfcDfog = oldvfcDfog;
+    shadowdir = oldshadowdir;
+    shadowradius = oldshadowradius;
+    shadowbias = oldshadowbias;
+}
+COMMAND(vacullbench, "i");
+
 void rendershadowmapworld()
 {
     SETSHADER(shadowmapworld);
@@ -1687,7 +2124,7 @@ VAR(oqgeom, 0, 1, 1);
 
 void rendergeom()
 {
-    bool doOQ = oqfrags && oqgeom && !drawtex, multipassing = false;
+    bool doSWOC = swocclusionactive(), doOQ = oqfrags && oqgeom && !drawtex && !doSWOC, multipassing = false;
     renderstate cur;
 
     int blends = 0;
@@ -1775,7 +2212,13 @@ void rendergeom()
         for(vtxarray *va = visibleva; va; va = va->next) if(va->texs)
         {
             va->query = NULL;
-            va->occluded = pvsoccluded(va->geommin, va->geommax) ? OCCLUDE_GEOM : OCCLUDE_NOTHING;
+            if(doSWOC && !camera1->o.insidebb(va->o, va->size, 2))
+            {
+                if(va->parent && va->parent->occluded >= OCCLUDE_BB) va->occluded = OCCLUDE_PARENT;
+                else if(swoccluded(va->bbmin, va->bbmax)) va->occluded = OCCLUDE_BB;
+                else va->occluded = pvsoccluded(va->geommin, va->geommax) || swoccluded(va->geommin, va->geommax) ? OCCLUDE_GEOM : OCCLUDE_NOTHING;
+            }
+            else va->occluded = pvsoccluded(va->geommin, va->geommax) ? OCCLUDE_GEOM : OCCLUDE_NOTHING;
             if(va->occluded >= OCCLUDE_GEOM) continue;
             blends += va->blends;
             renderva(cur, va, RENDERPASS_GBUFFER);
@@ -3,12 +3,24 @@
 
 #include "engine.hh"
 
+#include "ostd/atomic.hh"
+
+#if defined(STANDALONE) && !defined(WIN32)
+#include <pthread.h>
+#include <sys/time.h>
+#include <unistd.h>
+#endif
+
 #define LOGSTRLEN 512
 
 static FILE *logfile = NULL;
 
+static void startlogworker();
+static void stoplogworker();
+
 void closelogfile()
 {
+    stoplogworker();
     if(logfile)
     {
         fclose(logfile);
@@ -35,6 +47,7 @@ void setlogfile(const char *fname)
     }
     FILE *f = getlogfile();
     if(f) setvbuf(f, NULL, _IOLBF, BUFSIZ);
+    startlogworker();
 }
 
 void logoutf(const char *fmt, ...)
@@ -45,10 +58,49 @@ void logoutf(const char *fmt, ...)
     va_end(args);
 }
 
+// optional stamps on every line: wall clock time and a small per-thread id,
+// both taken by the caller so queued lines keep their real order and origin
+VARP(logtimestamps, 0, 0, 1);
+VARP(logthreadids, 0, 0, 1);
 
-static void writelog(FILE *file, const char *buf)
+static ostd::Atomic<int> lastlogthread(0);
+static thread_local int logthreadid = 0;
+
+static int getlogthreadid()
 {
-    static uchar ubuf[512];
+    if(!logthreadid) logthreadid = ++lastlogthread;
+    return logthreadid;
+}
+
+static ullong getlogstamp()
+{
+#ifdef WIN32
+    FILETIME ft;
+    GetSystemTimeAsFileTime(&ft);
+    // 100ns intervals since 1601
+    return ((ullong(ft.dwHighDateTime)<<32) | ft.dwLowDateTime)/10000 - 11644473600000ULL;
+#else
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return ullong(tv.tv_sec)*1000 + tv.tv_usec/1000;
+#endif
+}
+
+static void writelog(FILE *file, const char *buf, ullong stamp = 0, int tid = 0)
+{
+    if(stamp)
+    {
+        time_t secs = time_t(stamp/1000);
+        struct tm lt;
+#ifdef WIN32
+        bool valid = !localtime_s(&lt, &secs);
+#else
+        bool valid = localtime_r(&secs, &lt) != NULL;
+#endif
+        if(valid) fprintf(file, "[%02d:%02d:%02d.%03d] ", lt.tm_hour, lt.tm_min, lt.tm_sec, int(stamp%1000));
+    }
+    if(tid) fprintf(file, "[t%d] ", tid);
+    uchar ubuf[512];
     size_t len = strlen(buf), carry = 0;
     while(carry < len)
     {
@@ -58,11 +110,180 @@ static void writelog(FILE *file, const char *buf)
     }
 }
 
+// async logging: callers format straight into a slot of a bounded lock-free
+// MPSC ring and never touch the file; a background thread polls the ring and
+// encodes, writes and flushes whatever has accumulated as one batch
+
+#define LOGQUEUESIZE 1024
+
+static void logworkermain();
+
+#ifndef STANDALONE
+static SDL_Thread *logworker = NULL;
+static int logworkerproc(void *) { logworkermain(); return 0; }
+static bool createlogworker() { return (logworker = SDL_CreateThread(logworkerproc, "log", NULL)) != NULL; }
+static void joinlogworker() { SDL_WaitThread(logworker, NULL); logworker = NULL; }
+static void logsleep(int millis) { SDL_Delay(millis); }
+#elif defined(WIN32)
+static HANDLE logworker = NULL;
+static DWORD WINAPI logworkerproc(LPVOID) { logworkermain(); return 0; }
+static bool createlogworker() { return (logworker = CreateThread(NULL, 0, logworkerproc, NULL, 0, NULL)) != NULL; }
+static void joinlogworker() { WaitForSingleObject(logworker, INFINITE); CloseHandle(logworker); logworker = NULL; }
+static void logsleep(int millis) { Sleep(millis); }
+#else
+static pthread_t logworker;
+static void *logworkerproc(void *) { logworkermain(); return NULL; }
+static bool createlogworker() { return !pthread_create(&logworker, NULL, logworkerproc, NULL); }
+static void joinlogworker() { pthread_join(logworker, NULL); }
+static void logsleep(int millis) { usleep(millis*1000); }
+#endif
+
+struct logslot
+{
+    ostd::Atomic<uint> seq;
+    int tid;
+    ullong stamp;
+    char buf[LOGSTRLEN];
+};
+
+static logslot *logqueue = NULL;
+static ostd::Atomic<uint> logqueuehead(0), logdropped(0), logwriters(0);
+static uint logqueuetail = 0;
+static ostd::Atomic<bool> logworkerrunning(false), logworkerstop(false);
+static FILE *logworkerfile = NULL;
+
+VARFP(logasync, 0, 0, 1, { if(logasync) startlogworker(); else stoplogworker(); });
+// what a full queue does to the caller: 0 = drop the line, 1 = wait for room
+VARP(logoverflow, 0, 0, 1);
+
+static bool logqueueready()
+{
+    return logqueue[logqueuetail%LOGQUEUESIZE].seq.load(ostd::MemoryOrder::acquire) == logqueuetail+1;
+}
+
+// writes out up to one queue's worth of published lines, returns how many
+static int drainlogqueue()
+{
+    int batch = 0;
+    for(; batch < LOGQUEUESIZE && logqueueready(); batch++)
+    {
+        logslot &slot = logqueue[logqueuetail%LOGQUEUESIZE];
+        writelog(logworkerfile, slot.buf, slot.stamp, slot.tid);
+        slot.seq.store(logqueuetail+LOGQUEUESIZE, ostd::MemoryOrder::release);
+        logqueuetail++;
+    }
+    uint dropped = logdropped.exchange(0);
+    if(dropped)
+    {
+        defformatstring(msg, "%u log messages dropped", dropped);
+        writelog(logworkerfile, msg, logtimestamps ? getlogstamp() : 0);
+        batch++;
+    }
+    if(batch) fflush(logworkerfile);
+    return batch;
+}
+
+static void logworkermain()
+{
+    for(;;)
+    {
+        if(drainlogqueue()) continue;
+        if(logworkerstop) break;
+        logsleep(5);
+    }
+}
+
+static void startlogworker()
+{
+    if(!logasync || logworkerrunning) return;
+#ifdef STANDALONE
+    FILE *f = getlogfile();
+#else
+    FILE *f = logfile;
+#endif
+    if(!f) return;
+    if(!logqueue)
+    {
+        logqueue = new logslot[LOGQUEUESIZE];
+        loopi(LOGQUEUESIZE) logqueue[i].seq.store(uint(i), ostd::MemoryOrder::relaxed);
+        atexit(stoplogworker);
+    }
+    logworkerfile = f;
+    logworkerstop = false;
+    if(!createlogworker())
+    {
+        conoutf(CON_ERROR, "could not start log thread");
+        return;
+    }
+    logworkerrunning = true;
+}
+
+static void stoplogworker()
+{
+    if(!logworkerrunning) return;
+    logworkerrunning = false;
+    // callers that saw the worker running may still be publishing a line
+    while(logwriters) logsleep(1);
+    logworkerstop = true;
+    joinlogworker();
+    // nothing can be published any more, write whatever the last pass missed
+    while(drainlogqueue());
+}
+
+// returns false when the caller has to write the line itself
+static bool queuelogv(const char *fmt, va_list args)
+{
+    uint pos = logqueuehead.load(ostd::MemoryOrder::relaxed);
+    logslot *slot;
+    for(;;)
+    {
+        slot = &logqueue[pos%LOGQUEUESIZE];
+        int diff = int(slot->seq.load(ostd::MemoryOrder::acquire) - pos);
+        if(!diff)
+        {
+            if(logqueuehead.compare_exchange_weak(pos, pos+1, ostd::MemoryOrder::relaxed)) break;
+        }
+        else if(diff < 0)
+        {
+            if(!logoverflow)
+            {
+                logdropped++;
+                return true;
+            }
+            if(!logworkerrunning) return false;
+            logsleep(1);
+            pos = logqueuehead.load(ostd::MemoryOrder::relaxed);
+        }
+        else pos = logqueuehead.load(ostd::MemoryOrder::relaxed);
+    }
+    vformatstring(slot->buf, fmt, args, sizeof(slot->buf));
+    slot->stamp = logtimestamps ? getlogstamp() : 0;
+    slot->tid = logthreadids ? getlogthreadid() : 0;
+    slot->seq.store(pos+1, ostd::MemoryOrder::release);
+    return true;
+}
+
 static void writelogv(FILE *file, const char *fmt, va_list args)
 {
-    static char buf[LOGSTRLEN];
+    if(logworkerrunning && file == logworkerfile)
+    {
+        // the stop path waits for logwriters to drain before the final flush
+        logwriters++;
+        bool queued = logworkerrunning && queuelogv(fmt, args);
+        logwriters--;
+        if(queued) return;
+    }
+    char buf[LOGSTRLEN];
     vformatstring(buf, fmt, args, sizeof(buf));
-    writelog(file, buf);
+    writelog(file, buf, logtimestamps ? getlogstamp() : 0, logthreadids ? getlogthreadid() : 0);
+}
+
+static void writelogf(FILE *file, const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    writelogv(file, fmt, args);
+    va_end(args);
 }
 
 #ifdef STANDALONE
@@ -624,8 +845,12 @@ void updatetime()
     }
 }
 
+static lua::External frame_handle("frame_handle");
+
 void serverslice(bool dedicated, uint timeout)   // main server update, called from main loop in sp, or from below in dedicated server
 {
+    if(dedicated) profframe();
+    PROFILE("server tick");
     if(!serverhost)
     {
         server::serverupdate();
@@ -665,53 +890,59 @@ void serverslice(bool dedicated, uint timeout)   // main server update, called f
 
     ENetEvent event;
     bool serviced = false;
-    while(!serviced)
     {
-        if(enet_host_check_events(serverhost, &event) <= 0)
-        {
-            if(enet_host_service(serverhost, &event, timeout) <= 0) break;
-            serviced = true;
-        }
-        switch(event.type)
+        PROFILE("net receive");
+        while(!serviced)
         {
-            case ENET_EVENT_TYPE_CONNECT:
-            {
-                client &c = addclient(ST_TCPIP);
-                c.peer = event.peer;
-                c.peer->data = &c;
-                string hn;
-                copystring(c.hostname, (enet_address_get_host_ip(&c.peer->address, hn, sizeof(hn))==0) ? hn : "unknown");
-                logoutf("client connected (%s)", c.hostname);
-                int reason = server::clientconnect(c.num, c.peer->address.host);
-                if(reason) disconnect_client(c.num, reason);
-                break;
-            }
-            case ENET_EVENT_TYPE_RECEIVE:
+            if(enet_host_check_events(serverhost, &event) <= 0)
             {
-                client *c = (client *)event.peer->data;
-                if(c) process(event.packet, c->num, event.channelID);
-                if(event.packet->referenceCount==0) enet_packet_destroy(event.packet);
-                break;
+                if(enet_host_service(serverhost, &event, timeout) <= 0) break;
+                serviced = true;
             }
-            case ENET_EVENT_TYPE_DISCONNECT:
+            switch(event.type)
             {
-                client *c = (client *)event.peer->data;
-                if(!c) break;
-                logoutf("disconnected client (%s)", c->hostname);
-                server::clientdisconnect(c->num);
-                delclient(c);
-                break;
+                case ENET_EVENT_TYPE_CONNECT:
+                {
+                    client &c = addclient(ST_TCPIP);
+                    c.peer = event.peer;
+                    c.peer->data = &c;
+                    string hn;
+                    copystring(c.hostname, (enet_address_get_host_ip(&c.peer->address, hn, sizeof(hn))==0) ? hn : "unknown");
+                    logoutf("client connected (%s)", c.hostname);
+                    int reason = server::clientconnect(c.num, c.peer->address.host);
+                    if(reason) disconnect_client(c.num, reason);
+                    break;
+                }
+                case ENET_EVENT_TYPE_RECEIVE:
+                {
+                    client *c = (client *)event.peer->data;
+                    if(c) process(event.packet, c->num, event.channelID);
+                    if(event.packet->referenceCount==0) enet_packet_destroy(event.packet);
+                    break;
+                }
+                case ENET_EVENT_TYPE_DISCONNECT:
+                {
+                    client *c = (client *)event.peer->data;
+                    if(!c) break;
+                    logoutf("disconnected client (%s)", c->hostname);
+                    server::clientdisconnect(c->num);
+                    delclient(c);
+                    break;
+                }
+                default:
+                    break;
             }
-            default:
-                break;
         }
     }
-    if(server::sendpackets()) enet_host_flush(serverhost);
+    {
+        PROFILE("net send");
+        if(server::sendpackets()) enet_host_flush(serverhost);
+    }
 
     if (!dedicated) return;
 
     if(lastmillis)
-        lua::L->call_external("frame_handle", "ii", curtime, lastmillis);
+        lua::L->call(frame_handle, curtime, lastmillis);
 
     lua::assert_stack();
 }
@@ -999,7 +1230,7 @@ void logoutfv(const char *fmt, va_list args)
     {
         logline &line = loglines.add();
         vformatstring(line.buf, fmt, args, sizeof(line.buf));
-        if(logfile) writelog(logfile, line.buf);
+        if(logfile) writelogf(logfile, "%s", line.buf);
         line.len = min(strlen(line.buf), sizeof(line.buf)-2);
         line.buf[line.len++] = '\n';
         line.buf[line.len] = '\0';
@@ -1159,6 +1390,7 @@ vector<const char *> gameargs;
 int main(int argc, char **argv)
 {
     setlogfile(NULL);
+    profthreadname("server");
     if(enet_initialize()<0) fatal("Unable to initialize network module");
     atexit(enet_deinitialize);
     enet_time_set(0);
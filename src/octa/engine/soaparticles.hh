@@ -0,0 +1,599 @@
+// struct-of-arrays quad particles: positions, velocities and timings live in
+// separate arrays so the per frame integration and vertex generation can run
+// four particles at a time, optionally on a worker thread while the frame is
+// set up for rendering
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+  #define PARTSIMD 1
+  #include <emmintrin.h>
+#endif
+
+VARP(soaparticles, 0, 1, 1);
+VARP(asyncparticles, 0, 1, 1);
+
+struct soaquadrenderer;
+
+static vector<soaquadrenderer *> soarenderers;
+static vector<soaquadrenderer *> partqueue;
+static SDL_mutex *partmutex = NULL;
+static SDL_cond *partcond = NULL, *partdonecond = NULL;
+static SDL_Thread *partthread = NULL;
+
+struct soaquadrenderer : quadrenderer
+{
+    float *ox, *oy, *oz, *dx, *dy, *dz, *cr, *cg, *cb, *psize, *pval;
+    int *pgravity, *pfade, *pmillis;
+    uchar *pflags, *pdead;
+    physent **powner;
+    // addpart hands out a staging particle so callers can still set the
+    // owner and value, it is written back before the arrays are next used
+    particle pending;
+    int pendingpart;
+    // particles needing collision or tracking go through calc on the main thread
+    vector<int> slowparts;
+    vec right, up;
+    int genmillis, jobmillis, lastcompact;
+    bool queued;
+
+    soaquadrenderer(const char *texname, int type, int stain = -1)
+        : quadrenderer(texname, type, stain),
+          ox(NULL), oy(NULL), oz(NULL), dx(NULL), dy(NULL), dz(NULL), cr(NULL), cg(NULL), cb(NULL), psize(NULL), pval(NULL),
+          pgravity(NULL), pfade(NULL), pmillis(NULL), pflags(NULL), pdead(NULL), powner(NULL),
+          pendingpart(-1), right(0, 0, 0), up(0, 0, 0), genmillis(-1), jobmillis(-1), lastcompact(-1), queued(false)
+    {
+        soarenderers.add(this);
+    }
+
+    ~soaquadrenderer()
+    {
+        sync();
+        soarenderers.removeobj(this);
+        freearrays();
+    }
+
+    void freearrays()
+    {
+        DELETEA(ox); DELETEA(oy); DELETEA(oz);
+        DELETEA(dx); DELETEA(dy); DELETEA(dz);
+        DELETEA(cr); DELETEA(cg); DELETEA(cb);
+        DELETEA(psize); DELETEA(pval);
+        DELETEA(pgravity); DELETEA(pfade); DELETEA(pmillis);
+        DELETEA(pflags); DELETEA(pdead); DELETEA(powner);
+        DELETEA(verts);
+    }
+
+    void init(int n)
+    {
+        sync();
+        freearrays();
+        ox = new float[n]; oy = new float[n]; oz = new float[n];
+        dx = new float[n]; dy = new float[n]; dz = new float[n];
+        cr = new float[n]; cg = new float[n]; cb = new float[n];
+        psize = new float[n]; pval = new float[n];
+        pgravity = new int[n]; pfade = new int[n]; pmillis = new int[n];
+        pflags = new uchar[n]; pdead = new uchar[n];
+        powner = new physent *[n];
+        verts = new partvert[n*4];
+        maxparts = n;
+        numparts = 0;
+        pendingpart = -1;
+        invalidate();
+    }
+
+    void invalidate()
+    {
+        lastupdate = genmillis = lastcompact = -1;
+    }
+
+    void sync()
+    {
+        if(!queued) return;
+        SDL_LockMutex(partmutex);
+        while(partqueue.find(this) >= 0) SDL_CondWait(partdonecond, partmutex);
+        SDL_UnlockMutex(partmutex);
+        queued = false;
+    }
+
+    void flushpending()
+    {
+        if(pendingpart < 0) return;
+        int i = pendingpart;
+        pendingpart = -1;
+        ox[i] = pending.o.x; oy[i] = pending.o.y; oz[i] = pending.o.z;
+        dx[i] = pending.d.x; dy[i] = pending.d.y; dz[i] = pending.d.z;
+        cr[i] = pending.color.r; cg[i] = pending.color.g; cb[i] = pending.color.b;
+        psize[i] = pending.size;
+        pval[i] = pending.val;
+        pgravity[i] = pending.gravity;
+        pfade[i] = pending.fade;
+        pmillis[i] = pending.millis;
+        pflags[i] = pending.flags;
+        pdead[i] = pending.fade < 0 ? 1 : 0;
+        powner[i] = pending.owner;
+    }
+
+    void loadpart(int i, particle &p)
+    {
+        p.o = vec(ox[i], oy[i], oz[i]);
+        p.d = vec(dx[i], dy[i], dz[i]);
+        p.color = vec(cr[i], cg[i], cb[i]);
+        p.size = psize[i];
+        p.val = pval[i];
+        p.gravity = pgravity[i];
+        p.fade = pfade[i];
+        p.millis = pmillis[i];
+        p.flags = pflags[i];
+        p.owner = powner[i];
+    }
+
+    void movepart(int from, int to)
+    {
+        ox[to] = ox[from]; oy[to] = oy[from]; oz[to] = oz[from];
+        dx[to] = dx[from]; dy[to] = dy[from]; dz[to] = dz[from];
+        cr[to] = cr[from]; cg[to] = cg[from]; cb[to] = cb[from];
+        psize[to] = psize[from];
+        pval[to] = pval[from];
+        pgravity[to] = pgravity[from];
+        pfade[to] = pfade[from];
+        pmillis[to] = pmillis[from];
+        pflags[to] = pflags[from] | 0x80; // new slot, so regenerate texcoords and color
+        pdead[to] = pdead[from];
+        powner[to] = powner[from];
+    }
+
+    void reset()
+    {
+        sync();
+        numparts = 0;
+        pendingpart = -1;
+        invalidate();
+    }
+
+    void update()
+    {
+        sync();
+    }
+
+    void resettracked(physent *owner)
+    {
+        if(!(type&PT_TRACK)) return;
+        sync();
+        flushpending();
+        loopi(numparts) if(!owner || powner[i] == owner) pdead[i] = 1;
+        compact();
+        invalidate();
+    }
+
+    int count()
+    {
+        sync();
+        return numparts;
+    }
+
+    bool haswork()
+    {
+        sync();
+        return numparts > 0;
+    }
+
+    particle *addpart(const vec &o, const vec &d, int fade, const vec &color, float size, int gravity)
+    {
+        sync();
+        flushpending();
+        int i = numparts < maxparts ? numparts++ : rnd(maxparts); //next free slot, or kill a random kitten
+        particle *p = &pending;
+        p->o = o;
+        p->d = d;
+        p->gravity = gravity;
+        p->fade = fade;
+        p->millis = lastmillis + emitoffset;
+        p->color = color;
+        p->size = size;
+        p->val = 0;
+        p->owner = NULL;
+        p->flags = 0x80 | (rndmask ? rnd(0x80) & rndmask : 0);
+        pendingpart = i;
+        flushpending();
+        pendingpart = i;
+        invalidate();
+        return p;
+    }
+
+    // drops the particles marked dead by the last pass, moving particles from the end into the holes
+    void compact()
+    {
+        for(int i = 0; i < numparts; i++) if(pdead[i])
+        {
+            do
+            {
+                --numparts;
+                if(numparts <= i) return;
+            }
+            while(pdead[numparts]);
+            movepart(numparts, i);
+        }
+    }
+
+    // applies the blend, texture coordinates and color of particle i
+    void finishlane(int i, int blend)
+    {
+        if(blend <= 1 || pfade[i] <= 5) pdead[i] = 1; // removed on the next pass, after rendering
+        blend = min(blend<<2, 255);
+        float blendf = blend / 255.0f;
+        partvert *vs = &verts[i*4];
+        uchar flags = pflags[i];
+        if(flags&0x80)
+        {
+            pflags[i] = flags & ~0x80;
+            float u1 = 0, u2 = 1, v1 = 0, v2 = 1;
+            if(type&PT_RND4)
+            {
+                u1 = 0.5f*((flags>>5)&1); u2 = u1 + 0.5f;
+                v1 = 0.5f*((flags>>6)&1); v2 = v1 + 0.5f;
+                if(flags&0x01) swap(u1, u2);
+                if(flags&0x02) swap(v1, v2);
+            }
+            else if(type&PT_ICONGRID)
+            {
+                u1 = 0.25f*(flags&3); u2 = u1 + 0.25f;
+                v1 = 0.25f*((flags>>2)&3); v2 = v1 + 0.25f;
+            }
+            vs[0].u = u1; vs[0].v = v1;
+            vs[1].u = u2; vs[1].v = v1;
+            vs[2].u = u2; vs[2].v = v2;
+            vs[3].u = u1; vs[3].v = v2;
+            vec4 col = type&PT_MOD ? vec4(cr[i]*blendf, cg[i]*blendf, cb[i]*blendf, 1.0f) : vec4(cr[i], cg[i], cb[i], blendf);
+            loopk(4) vs[k].color = col;
+        }
+        else if(type&PT_MOD)
+        {
+            vec4 col(cr[i]*blendf, cg[i]*blendf, cb[i]*blendf, 1.0f);
+            loopk(4) vs[k].color = col;
+        }
+        else loopk(4) vs[k].color.a = blendf;
+    }
+
+    void genquad(int i, const vec &o, float size)
+    {
+        partvert *vs = &verts[i*4];
+        if(type&PT_ROT)
+        {
+            const vec2 *coeffs = rotcoeffs[(pflags[i]>>2)&0x1F];
+            loopk(4) vs[k].pos = vec(o).madd(right, coeffs[k].x*size).madd(up, coeffs[k].y*size);
+        }
+        else
+        {
+            vec udir = vec(up).sub(right).mul(size), vdir = vec(up).add(right).mul(size);
+            vs[0].pos = vec(o.x + udir.x, o.y + udir.y, o.z + udir.z);
+            vs[1].pos = vec(o.x + vdir.x, o.y + vdir.y, o.z + vdir.z);
+            vs[2].pos = vec(o.x - udir.x, o.y - udir.y, o.z - udir.z);
+            vs[3].pos = vec(o.x - vdir.x, o.y - vdir.y, o.z - vdir.z);
+        }
+    }
+
+    // scalar version of calc, returns false if the particle needs the full calc
+    bool genlane(int i, int millis)
+    {
+        if(type&PT_TRACK && powner[i]) return false;
+        vec o(ox[i], oy[i], oz[i]);
+        int fade = pfade[i], blend;
+        float size;
+        if(fade <= 5)
+        {
+            blend = 255;
+            size = psize[i];
+        }
+        else
+        {
+            int ts = millis - pmillis[i];
+            float tsf = ts, fadef = fade;
+            blend = max(255 - int(tsf*256.0f/fadef), 0);
+            int weight = pgravity[i];
+            if(type&(PT_SHRINK|PT_GROW) && fade >= 50)
+            {
+                float amt = clamp(tsf/fadef, 0.0f, 1.0f);
+                if(type&PT_SHRINK)
+                {
+                    if(type&PT_GROW) { if((amt *= 2) > 1) amt = 2 - amt; amt *= amt; }
+                    else amt = 1 - (amt * amt);
+                }
+                else amt *= amt;
+                size = psize[i] * amt;
+                if(weight) weight += weight * (psize[i] - size);
+            }
+            else size = psize[i];
+            if(weight)
+            {
+                if(ts > fade) ts = fade;
+                float t = ts;
+                o.add(vec(dx[i], dy[i], dz[i]).mul(t/5000.0f));
+                o.z -= t*t/(2.0f * 5000.0f * weight);
+            }
+            if(type&PT_COLLIDE && o.z < pval[i]) return false;
+        }
+        finishlane(i, blend);
+        genquad(i, o, size);
+        return true;
+    }
+
+#ifdef PARTSIMD
+    static inline __m128 select(__m128 mask, __m128 a, __m128 b) { return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b)); }
+    static inline __m128i select(__m128i mask, __m128i a, __m128i b) { return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b)); }
+
+    // genlane on particles i to i+3, lanes needing the full calc are returned as a mask
+    int gengroup(int i, int millis)
+    {
+        int slow = 0;
+        if(type&PT_TRACK) loopk(4) if(powner[i+k]) slow |= 1<<k;
+
+        __m128i fade = _mm_loadu_si128((const __m128i *)&pfade[i]),
+                ts = _mm_sub_epi32(_mm_set1_epi32(millis), _mm_loadu_si128((const __m128i *)&pmillis[i])),
+                weight = _mm_loadu_si128((const __m128i *)&pgravity[i]),
+                live = _mm_cmpgt_epi32(fade, _mm_set1_epi32(5));
+        __m128 fadef = _mm_cvtepi32_ps(fade), tsf = _mm_cvtepi32_ps(ts),
+               basesize = _mm_loadu_ps(&psize[i]), size = basesize;
+
+        __m128i blend = _mm_sub_epi32(_mm_set1_epi32(255), _mm_cvttps_epi32(_mm_div_ps(_mm_mul_ps(tsf, _mm_set1_ps(256.0f)), fadef)));
+        blend = _mm_and_si128(blend, _mm_cmpgt_epi32(blend, _mm_setzero_si128()));
+        blend = select(live, blend, _mm_set1_epi32(255));
+
+        if(type&(PT_SHRINK|PT_GROW))
+        {
+            __m128 amt = _mm_min_ps(_mm_max_ps(_mm_div_ps(tsf, fadef), _mm_setzero_ps()), _mm_set1_ps(1.0f));
+            if(type&PT_SHRINK)
+            {
+                if(type&PT_GROW)
+                {
+                    amt = _mm_add_ps(amt, amt);
+                    amt = select(_mm_cmpgt_ps(amt, _mm_set1_ps(1.0f)), _mm_sub_ps(_mm_set1_ps(2.0f), amt), amt);
+                    amt = _mm_mul_ps(amt, amt);
+                }
+                else amt = _mm_sub_ps(_mm_set1_ps(1.0f), _mm_mul_ps(amt, amt));
+            }
+            else amt = _mm_mul_ps(amt, amt);
+            __m128i scaled = _mm_cmpgt_epi32(fade, _mm_set1_epi32(49));
+            size = select(_mm_castsi128_ps(scaled), _mm_mul_ps(basesize, amt), basesize);
+            __m128 weightf = _mm_cvtepi32_ps(weight);
+            weight = select(scaled, _mm_cvttps_epi32(_mm_add_ps(weightf, _mm_mul_ps(weightf, _mm_sub_ps(basesize, size)))), weight);
+        }
+
+        __m128 x = _mm_loadu_ps(&ox[i]), y = _mm_loadu_ps(&oy[i]), z = _mm_loadu_ps(&oz[i]);
+        __m128i fall = _mm_andnot_si128(_mm_cmpeq_epi32(weight, _mm_setzero_si128()), live);
+        if(_mm_movemask_ps(_mm_castsi128_ps(fall)))
+        {
+            __m128 t = _mm_cvtepi32_ps(select(_mm_cmpgt_epi32(ts, fade), fade, ts)),
+                   k = _mm_div_ps(t, _mm_set1_ps(5000.0f)),
+                   drop = _mm_div_ps(_mm_mul_ps(t, t), _mm_mul_ps(_mm_set1_ps(2.0f * 5000.0f), _mm_cvtepi32_ps(weight))),
+                   fallmask = _mm_castsi128_ps(fall);
+            x = select(fallmask, _mm_add_ps(x, _mm_mul_ps(_mm_loadu_ps(&dx[i]), k)), x);
+            y = select(fallmask, _mm_add_ps(y, _mm_mul_ps(_mm_loadu_ps(&dy[i]), k)), y);
+            z = select(fallmask, _mm_sub_ps(_mm_add_ps(z, _mm_mul_ps(_mm_loadu_ps(&dz[i]), k)), drop), z);
+        }
+        if(type&PT_COLLIDE) slow |= _mm_movemask_ps(_mm_and_ps(_mm_castsi128_ps(live), _mm_cmplt_ps(z, _mm_loadu_ps(&pval[i]))));
+
+        int blends[4];
+        _mm_storeu_si128((__m128i *)blends, blend);
+        if(type&PT_ROT)
+        {
+            float xs[4], ys[4], zs[4], sizes[4];
+            _mm_storeu_ps(xs, x); _mm_storeu_ps(ys, y); _mm_storeu_ps(zs, z); _mm_storeu_ps(sizes, size);
+            loopk(4) if(!(slow&(1<<k)))
+            {
+                finishlane(i+k, blends[k]);
+                genquad(i+k, vec(xs[k], ys[k], zs[k]), sizes[k]);
+            }
+            return slow;
+        }
+
+        // corners o+u, o+v, o-u, o-v with u = (up-right)*size and v = (up+right)*size
+        __m128 ux = _mm_mul_ps(_mm_set1_ps(up.x - right.x), size), uy = _mm_mul_ps(_mm_set1_ps(up.y - right.y), size), uz = _mm_mul_ps(_mm_set1_ps(up.z - right.z), size),
+               vx = _mm_mul_ps(_mm_set1_ps(up.x + right.x), size), vy = _mm_mul_ps(_mm_set1_ps(up.y + right.y), size), vz = _mm_mul_ps(_mm_set1_ps(up.z + right.z), size);
+        float corners[12][4];
+        _mm_storeu_ps(corners[0], _mm_add_ps(x, ux)); _mm_storeu_ps(corners[1], _mm_add_ps(y, uy)); _mm_storeu_ps(corners[2], _mm_add_ps(z, uz));
+        _mm_storeu_ps(corners[3], _mm_add_ps(x, vx)); _mm_storeu_ps(corners[4], _mm_add_ps(y, vy)); _mm_storeu_ps(corners[5], _mm_add_ps(z, vz));
+        _mm_storeu_ps(corners[6], _mm_sub_ps(x, ux)); _mm_storeu_ps(corners[7], _mm_sub_ps(y, uy)); _mm_storeu_ps(corners[8], _mm_sub_ps(z, uz));
+        _mm_storeu_ps(corners[9], _mm_sub_ps(x, vx)); _mm_storeu_ps(corners[10], _mm_sub_ps(y, vy)); _mm_storeu_ps(corners[11], _mm_sub_ps(z, vz));
+        loopk(4) if(!(slow&(1<<k)))
+        {
+            finishlane(i+k, blends[k]);
+            partvert *vs = &verts[(i+k)*4];
+            loopj(4) vs[j].pos = vec(corners[j*3][k], corners[j*3+1][k], corners[j*3+2][k]);
+        }
+        return slow;
+    }
+#endif
+
+    // integrates every particle to millis and fills in its vertices
+    void genlanes(int millis)
+    {
+        PROFILE("particle verts");
+        if(millis != lastcompact)
+        {
+            compact();
+            lastcompact = millis;
+        }
+        slowparts.setsize(0);
+        int i = 0;
+#ifdef PARTSIMD
+        for(; i + 4 <= numparts; i += 4)
+        {
+            int slow = gengroup(i, millis);
+            if(slow) loopk(4) if(slow&(1<<k)) slowparts.add(i+k);
+        }
+#endif
+        for(; i < numparts; i++) if(!genlane(i, millis)) slowparts.add(i);
+        genmillis = millis;
+    }
+
+    // runs the particles left by genlanes through calc, on the main thread
+    void finishslow()
+    {
+        loopv(slowparts)
+        {
+            int j = slowparts[i];
+            particle p;
+            loadpart(j, p);
+            quadrenderer::genverts(&p, &verts[j*4], (p.flags&0x80)!=0);
+            if(p.fade < 0) pdead[j] = 1;
+            pval[j] = p.val;
+            pflags[j] = p.flags;
+        }
+        slowparts.setsize(0);
+    }
+
+    void kick(const vec &camr, const vec &camu)
+    {
+        if(queued || !numparts) return;
+        flushpending();
+        right = camr;
+        up = camu;
+        jobmillis = lastmillis;
+        queued = true;
+        SDL_LockMutex(partmutex);
+        partqueue.add(this);
+        SDL_CondSignal(partcond);
+        SDL_UnlockMutex(partmutex);
+    }
+
+    void genvbo()
+    {
+        if(lastmillis == lastupdate && vbo) return;
+        sync();
+        flushpending();
+        if(genmillis != lastmillis || right != camright || up != camup)
+        {
+            right = camright;
+            up = camup;
+            genlanes(lastmillis);
+        }
+        finishslow();
+        lastupdate = lastmillis;
+
+        if(!vbo) glGenBuffers_(1, &vbo);
+        glBindBuffer_(GL_ARRAY_BUFFER, vbo);
+        glBufferData_(GL_ARRAY_BUFFER, maxparts*4*sizeof(partvert), NULL, GL_STREAM_DRAW);
+        glBufferSubData_(GL_ARRAY_BUFFER, 0, numparts*4*sizeof(partvert), verts);
+        glBindBuffer_(GL_ARRAY_BUFFER, 0);
+    }
+
+    void render()
+    {
+        genvbo();
+        drawverts();
+    }
+};
+
+template<class T>
+static partrenderer *newvarenderer(const char *texname, int type, int stain)
+{
+    return new T(texname, type, stain);
+}
+
+template<>
+partrenderer *newvarenderer<quadrenderer>(const char *texname, int type, int stain)
+{
+    if(soaparticles) return new soaquadrenderer(texname, type, stain);
+    return new quadrenderer(texname, type, stain);
+}
+
+static int particleworker(void *data)
+{
+    profthreadname("particle worker");
+    SDL_LockMutex(partmutex);
+    for(;;)
+    {
+        while(partqueue.empty()) SDL_CondWait(partcond, partmutex);
+        soaquadrenderer *r = partqueue[0];
+        SDL_UnlockMutex(partmutex);
+        r->genlanes(r->jobmillis);
+        SDL_LockMutex(partmutex);
+        partqueue.remove(0);
+        SDL_CondBroadcast(partdonecond);
+    }
+    SDL_UnlockMutex(partmutex);
+    return 0;
+}
+
+// the camera vectors setcammatrix will derive for this frame
+static void particlecamera(vec &right, vec &up)
+{
+    matrix4 m = viewmatrix;
+    m.rotate_around_y(camera1->roll*RAD);
+    m.rotate_around_x(camera1->pitch*-RAD);
+    m.rotate_around_z(camera1->yaw*-RAD);
+    m.transposedtransformnormal(vec(viewmatrix.a).neg(), right);
+    m.transposedtransformnormal(vec(viewmatrix.c), up);
+}
+
+// hands this frame's particles to the worker, to overlap the rest of the frame setup
+static void kickparticles()
+{
+    if(!asyncparticles || numcpus <= 1 || soarenderers.empty()) return;
+    if(!partthread)
+    {
+        partmutex = SDL_CreateMutex();
+        partcond = SDL_CreateCond();
+        partdonecond = SDL_CreateCond();
+        partthread = SDL_CreateThread(particleworker, "particle worker", NULL);
+        if(!partthread) return;
+    }
+    vec right, up;
+    particlecamera(right, up);
+    loopv(soarenderers) soarenderers[i]->kick(right, up);
+}
+
+// integrates and generates vertices for falling, shrinking particles with
+// the regular and the struct-of-arrays quad renderer, without touching GL
+static void particlebench(int *num, int *frames)
+{
+    int n = *num > 0 ? *num : 100000, loops = *frames > 0 ? *frames : 100;
+    quadrenderer aos(NULL, PT_SHRINK);
+    soaquadrenderer soa(NULL, PT_SHRINK);
+    aos.init(n);
+    soa.init(n);
+    loopi(n)
+    {
+        vec o(rndscale(1024), rndscale(1024), rndscale(1024)), d(rndscale(200) - 100, rndscale(200) - 100, rndscale(200)),
+            color(rndscale(1), rndscale(1), rndscale(1));
+        int fade = loops*16 + 500 + rnd(2000), gravity = rnd(4) ? 20 + rnd(200) : 0;
+        float size = 0.5f + rndscale(4);
+        aos.addpart(o, d, fade, color, size, gravity);
+        soa.addpart(o, d, fade, color, size, gravity);
+    }
+    soa.flushpending();
+    soa.right = camright;
+    soa.up = camup;
+
+    int oldmillis = lastmillis;
+    double freq = SDL_GetPerformanceFrequency();
+    Uint64 aosticks = 0, soaticks = 0;
+    float maxerr = 0;
+    loopi(loops)
+    {
+        lastmillis += 16;
+        Uint64 start = SDL_GetPerformanceCounter();
+        aos.genverts();
+        aosticks += SDL_GetPerformanceCounter() - start;
+        start = SDL_GetPerformanceCounter();
+        soa.genlanes(lastmillis);
+        soa.finishslow();
+        soaticks += SDL_GetPerformanceCounter() - start;
+        if(!i) loopj(n*4)
+        {
+            maxerr = max(maxerr, aos.verts[j].pos.dist(soa.verts[j].pos));
+            maxerr = max(maxerr, fabs(aos.verts[j].color.a - soa.verts[j].color.a));
+        }
+    }
+    lastmillis = oldmillis;
+
+    double aosms = 1000*aosticks/freq/loops, soams = 1000*soaticks/freq/loops;
+    conoutf("particlebench: %d particles, %d frames, aos %.3f ms/frame, soa %.3f ms/frame (%.2fx, %s), max vertex error %f",
+        n, loops, aosms, soams, aosms/max(soams, 1e-9),
+#ifdef PARTSIMD
+        "sse2",
+#else
+        "scalar",
+#endif
+        maxerr);
+}
+COMMAND(particlebench, "ii");
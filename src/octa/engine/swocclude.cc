@@ -0,0 +1,418 @@
+// swocclude.cc: software occlusion culling, the biggest solid boxes of the octree
+// are rasterized into a small depth buffer on a worker thread while the frame
+// is culled, then va and mapmodel bounds are tested against its hierarchical
+// depth instead of waiting a frame on hardware occlusion queries
+
+#include "engine.hh"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+  #define SWOCCSIMD 1
+  #include <emmintrin.h>
+#endif
+
+// depth is stored as 1/w, so bigger is closer and 0 is nothing drawn
+enum
+{
+    SWOCCW = 256, SWOCCH = 128,
+    SWOCCTILE = 8, SWOCCTILESW = SWOCCW/SWOCCTILE, SWOCCTILESH = SWOCCH/SWOCCTILE,
+    MAXOCCLUDERVERTS = 8
+};
+
+// occluders are only gathered while this is on, so edits don't pay for it otherwise
+VARFP(swocclusion, 0, 0, 1, genoccluders());
+VARP(swoccmax, 16, 256, 4096);
+VARFP(swoccminsize, 1, 4, 1024, genoccluders());
+
+struct occluderbox
+{
+    ivec o, size;
+};
+
+struct occludercandidate
+{
+    float score;
+    int index;
+};
+
+static vector<occluderbox> occluders;
+static vector<occludercandidate> candidates;
+static float swoccdepth[SWOCCW*SWOCCH], swocchiz[SWOCCTILESW*SWOCCTILESH];
+
+static matrix4 swoccmatrix;
+static vec swocccamera;
+static bool swoccvalid = false, swocckicked = false, swoccpending = false;
+static SDL_mutex *swoccmutex = NULL;
+static SDL_cond *swocccond = NULL, *swoccdonecond = NULL;
+static SDL_Thread *swoccthread = NULL;
+
+static int swoccframes = 0, swocctests = 0, swoccculled = 0, swoccdrawn = 0;
+static Uint64 swoccrasterticks = 0, swocctestticks = 0, swoccwaitticks = 0;
+
+// joins boxes that line up along dim and share the same cross section
+static void mergeoccluders(int dim)
+{
+    int d1 = (dim+1)%3, d2 = (dim+2)%3;
+    occluders.sort([dim, d1, d2](const occluderbox &a, const occluderbox &b)
+    {
+        if(a.o[d1] != b.o[d1]) return a.o[d1] < b.o[d1];
+        if(a.o[d2] != b.o[d2]) return a.o[d2] < b.o[d2];
+        if(a.size[d1] != b.size[d1]) return a.size[d1] < b.size[d1];
+        if(a.size[d2] != b.size[d2]) return a.size[d2] < b.size[d2];
+        return a.o[dim] < b.o[dim];
+    });
+    int n = 0;
+    loopv(occluders)
+    {
+        occluderbox &b = occluders[i];
+        if(n)
+        {
+            occluderbox &p = occluders[n-1];
+            if(p.o[d1] == b.o[d1] && p.o[d2] == b.o[d2] && p.size[d1] == b.size[d1] && p.size[d2] == b.size[d2] &&
+               p.o[dim] + p.size[dim] == b.o[dim])
+            {
+                p.size[dim] += b.size[dim];
+                continue;
+            }
+        }
+        occluders[n++] = b;
+    }
+    occluders.setsize(n);
+}
+
+// returns whether all children are solid, so only the biggest solid nodes become boxes
+static bool findoccluders(cube *c, const ivec &o, int size)
+{
+    bool solid[8];
+    int numsolid = 0;
+    loopi(8)
+    {
+        if(c[i].children) solid[i] = findoccluders(c[i].children, ivec(i, o, size), size>>1);
+        else solid[i] = isentirelysolid(c[i]) && !(c[i].material&MAT_ALPHA);
+        if(solid[i]) numsolid++;
+    }
+    if(numsolid == 8) return true;
+    if(size >= swoccminsize) loopi(8) if(solid[i])
+    {
+        occluderbox &b = occluders.add();
+        b.o = ivec(i, o, size);
+        b.size = ivec(size, size, size);
+    }
+    return false;
+}
+
+static void swoccwait()
+{
+    if(!swocckicked) return;
+    swocckicked = false;
+    Uint64 start = SDL_GetPerformanceCounter();
+    SDL_LockMutex(swoccmutex);
+    while(swoccpending) SDL_CondWait(swoccdonecond, swoccmutex);
+    SDL_UnlockMutex(swoccmutex);
+    swoccwaitticks += SDL_GetPerformanceCounter() - start;
+}
+
+void genoccluders()
+{
+    swoccwait();
+    swoccvalid = false;
+    occluders.setsize(0);
+    if(!swocclusion || !worldroot) return;
+    if(findoccluders(worldroot, ivec(0, 0, 0), worldsize>>1) && worldsize>>1 >= swoccminsize)
+    {
+        occluderbox &b = occluders.add();
+        b.o = ivec(0, 0, 0);
+        b.size = ivec(worldsize, worldsize, worldsize);
+    }
+    loopi(3) mergeoccluders(i);
+}
+
+static inline int clipcode(const vec4 &v)
+{
+    return (v.x < -v.w ? 0x01 : 0) | (v.x > v.w ? 0x02 : 0) |
+           (v.y < -v.w ? 0x04 : 0) | (v.y > v.w ? 0x08 : 0) |
+           (v.z < -v.w ? 0x10 : 0) | (v.z > v.w ? 0x20 : 0);
+}
+
+static inline void occludercorners(const occluderbox &b, vec4 *v)
+{
+    loopi(8) swoccmatrix.transform(vec(b.o.x + (i&1 ? b.size.x : 0), b.o.y + (i&2 ? b.size.y : 0), b.o.z + (i&4 ? b.size.z : 0)), v[i]);
+}
+
+// fills a convex polygon, clipped against the near plane, keeping the closest
+// depth; rasterization is conservative, a pixel is only covered when all of it
+// is inside the polygon and gets the depth of its farthest corner, so nothing
+// peeking past an occluder edge within a pixel is ever reported hidden
+static void rasterizepoly(const vec4 *in, int n)
+{
+    vec4 clipped[MAXOCCLUDERVERTS];
+    int numclipped = 0;
+    loopi(n)
+    {
+        const vec4 &a = in[i], &b = in[(i+1)%n];
+        float da = a.z + a.w, db = b.z + b.w;
+        if(da >= 0) clipped[numclipped++] = a;
+        if((da >= 0) != (db >= 0)) clipped[numclipped++].lerp(a, b, da/(da - db));
+    }
+    if(numclipped < 3) return;
+
+    float sx[MAXOCCLUDERVERTS], sy[MAXOCCLUDERVERTS], sz[MAXOCCLUDERVERTS],
+          minx = 1e16f, maxx = -1e16f, miny = 1e16f, maxy = -1e16f, maxz = 0, area = 0;
+    loopi(numclipped)
+    {
+        float iw = 1/clipped[i].w;
+        sx[i] = (clipped[i].x*iw*0.5f + 0.5f)*SWOCCW;
+        sy[i] = (clipped[i].y*iw*0.5f + 0.5f)*SWOCCH;
+        sz[i] = iw;
+        minx = min(minx, sx[i]); maxx = max(maxx, sx[i]);
+        miny = min(miny, sy[i]); maxy = max(maxy, sy[i]);
+        maxz = max(maxz, iw);
+    }
+    int x1 = max(int(floor(minx)), 0)&~3, x2 = min(int(ceil(maxx)), int(SWOCCW)),
+        y1 = max(int(floor(miny)), 0), y2 = min(int(ceil(maxy)), int(SWOCCH));
+    if(x1 >= x2 || y1 >= y2) return;
+
+    // depth is affine in screen space, take the plane from the largest fan triangle
+    // and offset it to the farthest pixel corner, minus a little for float rounding
+    int best = 1;
+    float bestarea = 0;
+    for(int i = 1; i+1 < numclipped; i++)
+    {
+        float tri = (sx[i] - sx[0])*(sy[i+1] - sy[0]) - (sx[i+1] - sx[0])*(sy[i] - sy[0]);
+        area += tri;
+        if(fabs(tri) > fabs(bestarea)) { bestarea = tri; best = i; }
+    }
+    if(fabs(area) < 1e-3f) return;
+    float e1x = sx[best] - sx[0], e1y = sy[best] - sy[0], e1z = sz[best] - sz[0],
+          e2x = sx[best+1] - sx[0], e2y = sy[best+1] - sy[0], e2z = sz[best+1] - sz[0],
+          dzdx = (e1z*e2y - e2z*e1y)/bestarea, dzdy = (e2z*e1x - e1z*e2x)/bestarea,
+          zc = sz[0] - dzdx*sx[0] - dzdy*sy[0] - 0.5f*(fabs(dzdx) + fabs(dzdy)) - maxz*1e-5f;
+
+    float ex[MAXOCCLUDERVERTS], ey[MAXOCCLUDERVERTS], ec[MAXOCCLUDERVERTS], orient = area > 0 ? 1 : -1;
+    loopi(numclipped)
+    {
+        int j = (i+1)%numclipped;
+        ex[i] = (sy[i] - sy[j])*orient;
+        ey[i] = (sx[j] - sx[i])*orient;
+        // pulled in by half a pixel, so testing the centre tests all four corners
+        ec[i] = -(ex[i]*sx[i] + ey[i]*sy[i]) - 0.5f*(fabs(ex[i]) + fabs(ey[i]));
+    }
+
+#ifdef SWOCCSIMD
+    __m128 offset = _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f), zero = _mm_setzero_ps(),
+           dzdx4 = _mm_set1_ps(dzdx), maxz4 = _mm_set1_ps(maxz), ex4[MAXOCCLUDERVERTS], rowe[MAXOCCLUDERVERTS];
+    loopi(numclipped) ex4[i] = _mm_set1_ps(ex[i]);
+    for(int y = y1; y < y2; y++)
+    {
+        float py = y + 0.5f;
+        __m128 rowz = _mm_set1_ps(dzdy*py + zc);
+        loopi(numclipped) rowe[i] = _mm_set1_ps(ey[i]*py + ec[i]);
+        float *row = &swoccdepth[y*SWOCCW];
+        for(int x = x1; x < x2; x += 4)
+        {
+            __m128 px = _mm_add_ps(_mm_set1_ps(float(x)), offset),
+                   inside = _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(ex4[0], px), rowe[0]), zero);
+            for(int i = 1; i < numclipped; i++) inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(ex4[i], px), rowe[i]), zero));
+            if(!_mm_movemask_ps(inside)) continue;
+            __m128 z = _mm_min_ps(_mm_add_ps(_mm_mul_ps(dzdx4, px), rowz), maxz4),
+                   d = _mm_loadu_ps(&row[x]);
+            _mm_storeu_ps(&row[x], _mm_or_ps(_mm_and_ps(inside, _mm_max_ps(d, z)), _mm_andnot_ps(inside, d)));
+        }
+    }
+#else
+    for(int y = y1; y < y2; y++)
+    {
+        float py = y + 0.5f, *row = &swoccdepth[y*SWOCCW];
+        for(int x = x1; x < x2; x++)
+        {
+            float px = x + 0.5f;
+            bool inside = true;
+            loopi(numclipped) if(ex[i]*px + ey[i]*py + ec[i] < 0) { inside = false; break; }
+            if(inside) row[x] = max(row[x], min(dzdx*px + dzdy*py + zc, maxz));
+        }
+    }
+#endif
+}
+
+// the front faces of a box, corners are indexed by their x, y and z bits
+static void rasterizebox(const occluderbox &b)
+{
+    static const uchar faces[6][4] =
+    {
+        { 0, 4, 6, 2 }, { 1, 3, 7, 5 },
+        { 0, 1, 5, 4 }, { 2, 6, 7, 3 },
+        { 0, 2, 3, 1 }, { 4, 5, 7, 6 }
+    };
+    vec4 v[8];
+    occludercorners(b, v);
+    loopi(6)
+    {
+        int dim = i>>1;
+        if(i&1 ? swocccamera[dim] <= b.o[dim] + b.size[dim] : swocccamera[dim] >= b.o[dim]) continue;
+        vec4 face[4] = { v[faces[i][0]], v[faces[i][1]], v[faces[i][2]], v[faces[i][3]] };
+        rasterizepoly(face, 4);
+    }
+}
+
+// every tile keeps the farthest depth of its pixels
+static void buildhiz()
+{
+    loop(ty, SWOCCTILESH) loop(tx, SWOCCTILESW)
+    {
+        const float *src = &swoccdepth[ty*SWOCCTILE*SWOCCW + tx*SWOCCTILE];
+#ifdef SWOCCSIMD
+        __m128 m = _mm_min_ps(_mm_loadu_ps(src), _mm_loadu_ps(src + 4));
+        for(int y = 1; y < SWOCCTILE; y++) m = _mm_min_ps(m, _mm_min_ps(_mm_loadu_ps(src + y*SWOCCW), _mm_loadu_ps(src + y*SWOCCW + 4)));
+        m = _mm_min_ps(m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(1, 0, 3, 2)));
+        m = _mm_min_ps(m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(2, 3, 0, 1)));
+        _mm_store_ss(&swocchiz[ty*SWOCCTILESW + tx], m);
+#else
+        float m = src[0];
+        loop(y, SWOCCTILE) loop(x, SWOCCTILE) m = min(m, src[y*SWOCCW + x]);
+        swocchiz[ty*SWOCCTILESW + tx] = m;
+#endif
+    }
+}
+
+// picks the boxes covering the most of the screen and draws them
+static void rasterizeoccluders()
+{
+    PROFILE("software occlusion");
+    Uint64 start = SDL_GetPerformanceCounter();
+    memset(swoccdepth, 0, sizeof(swoccdepth));
+    candidates.setsize(0);
+    loopv(occluders)
+    {
+        const occluderbox &b = occluders[i];
+        vec bbmin(b.o), bbmax = vec(b.o).add(vec(b.size));
+        if(swocccamera.insidebb(bbmin, bbmax)) continue;
+        vec4 v[8];
+        occludercorners(b, v);
+        int outside = 0x3F;
+        loopj(8) outside &= clipcode(v[j]);
+        if(outside) continue;
+        float dist = max(swocccamera.dist_to_bb(bbmin, bbmax), 1.0f);
+        occludercandidate &c = candidates.add();
+        c.score = (float(b.size.x)*b.size.y + float(b.size.x)*b.size.z + float(b.size.y)*b.size.z)/(dist*dist);
+        c.index = i;
+    }
+    candidates.sort([](const occludercandidate &a, const occludercandidate &b) { return a.score > b.score; });
+    int numdrawn = min(candidates.length(), swoccmax);
+    loopi(numdrawn) rasterizebox(occluders[candidates[i].index]);
+    buildhiz();
+    swoccdrawn += numdrawn;
+    swoccrasterticks += SDL_GetPerformanceCounter() - start;
+}
+
+static int swoccworker(void *data)
+{
+    profthreadname("occlusion worker");
+    SDL_LockMutex(swoccmutex);
+    for(;;)
+    {
+        while(!swoccpending) SDL_CondWait(swocccond, swoccmutex);
+        SDL_UnlockMutex(swoccmutex);
+        rasterizeoccluders();
+        SDL_LockMutex(swoccmutex);
+        swoccpending = false;
+        SDL_CondSignal(swoccdonecond);
+    }
+    SDL_UnlockMutex(swoccmutex);
+    return 0;
+}
+
+// starts rasterizing the occluders for the camera just set up, overlapping visiblecubes
+void kickocclusion()
+{
+    swoccwait();
+    swoccvalid = false;
+    if(!swocclusion || drawtex || occluders.empty()) return;
+    swoccmatrix = camprojmatrix;
+    swocccamera = camera1->o;
+    swoccvalid = true;
+    swoccframes++;
+    if(numcpus > 1 && !swoccthread)
+    {
+        swoccmutex = SDL_CreateMutex();
+        swocccond = SDL_CreateCond();
+        swoccdonecond = SDL_CreateCond();
+        swoccthread = SDL_CreateThread(swoccworker, "occlusion worker", NULL);
+    }
+    if(!swoccthread)
+    {
+        rasterizeoccluders();
+        return;
+    }
+    SDL_LockMutex(swoccmutex);
+    swoccpending = true;
+    swocckicked = true;
+    SDL_CondSignal(swocccond);
+    SDL_UnlockMutex(swoccmutex);
+}
+
+bool swocclusionactive()
+{
+    return swoccvalid && !drawtex;
+}
+
+static bool testocclusion(const ivec &bbmin, const ivec &bbmax)
+{
+    float minx = 1e16f, maxx = -1e16f, miny = 1e16f, maxy = -1e16f, maxz = 0;
+    loopi(8)
+    {
+        vec4 v;
+        swoccmatrix.transform(vec(i&1 ? bbmax.x : bbmin.x, i&2 ? bbmax.y : bbmin.y, i&4 ? bbmax.z : bbmin.z), v);
+        if(v.z + v.w <= 0) return false;
+        float iw = 1/v.w, x = (v.x*iw*0.5f + 0.5f)*SWOCCW, y = (v.y*iw*0.5f + 0.5f)*SWOCCH;
+        minx = min(minx, x); maxx = max(maxx, x);
+        miny = min(miny, y); maxy = max(maxy, y);
+        maxz = max(maxz, iw);
+    }
+    int x1 = max(int(floor(minx)), 0), x2 = min(int(ceil(maxx)), int(SWOCCW)),
+        y1 = max(int(floor(miny)), 0), y2 = min(int(ceil(maxy)), int(SWOCCH));
+    if(x1 >= x2 || y1 >= y2) return false;
+    for(int ty = y1/SWOCCTILE; ty <= (y2-1)/SWOCCTILE; ty++)
+    for(int tx = x1/SWOCCTILE; tx <= (x2-1)/SWOCCTILE; tx++)
+    {
+        if(swocchiz[ty*SWOCCTILESW + tx] > maxz) continue;
+        int px1 = max(x1, tx*SWOCCTILE), px2 = min(x2, (tx+1)*SWOCCTILE),
+            py1 = max(y1, ty*SWOCCTILE), py2 = min(y2, (ty+1)*SWOCCTILE);
+        for(int y = py1; y < py2; y++)
+        {
+            const float *row = &swoccdepth[y*SWOCCW];
+            for(int x = px1; x < px2; x++) if(row[x] <= maxz) return false;
+        }
+    }
+    return true;
+}
+
+bool swoccluded(const ivec &bbmin, const ivec &bbmax)
+{
+    if(!swocclusionactive()) return false;
+    swoccwait();
+    Uint64 start = SDL_GetPerformanceCounter();
+    bool occluded = testocclusion(bbmin, bbmax);
+    swocctestticks += SDL_GetPerformanceCounter() - start;
+    swocctests++;
+    if(occluded) swoccculled++;
+    return occluded;
+}
+
+// averages since the last call
+static void swoccstats()
+{
+    swoccwait();
+    if(!swoccframes)
+    {
+        conoutf(CON_ERROR, "no frames culled in software, set swocclusion 1 first");
+        return;
+    }
+    double scale = 1000.0/SDL_GetPerformanceFrequency()/swoccframes;
+    conoutf("swocclusion: %d occluder boxes, %.1f drawn per frame, %s", occluders.length(), swoccdrawn/float(swoccframes), swoccthread ? "async" : "sync");
+    conoutf("swocclusion: %.1f tests per frame, %.1f culled per frame (%.1f%%)",
+        swocctests/float(swoccframes), swoccculled/float(swoccframes), swocctests ? 100.0f*swoccculled/swocctests : 0.0f);
+    conoutf("swocclusion: raster %.3f ms, test %.3f ms, wait %.3f ms per frame over %d frames",
+        swoccrasterticks*scale, swocctestticks*scale, swoccwaitticks*scale, swoccframes);
+    swoccframes = swocctests = swoccculled = swoccdrawn = 0;
+    swoccrasterticks = swocctestticks = swoccwaitticks = 0;
+}
+COMMAND(swoccstats, "");
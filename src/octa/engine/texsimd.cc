@@ -0,0 +1,479 @@
+// texsimd.cc: SIMD versions of the texture kernels in texture.cc
+// every kernel here must produce exactly the same bytes as its scalar counterpart
+
+#include "engine.hh"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+  #define TEXSIMD_X86 1
+  #define TARGET_SSE2 __attribute__((target("sse2")))
+  #define TARGET_AVX2 __attribute__((target("avx2")))
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+  #define TEXSIMD_X86 1
+  #define TARGET_SSE2
+  #define TARGET_AVX2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+  #define TEXSIMD_NEON 1
+#endif
+
+#if defined(TEXSIMD_X86)
+  #include <immintrin.h>
+  #ifdef _MSC_VER
+    #include <intrin.h>
+  #endif
+#elif defined(TEXSIMD_NEON)
+  #include <arm_neon.h>
+#endif
+
+enum { TEXSIMD_SCALAR = 0, TEXSIMD_SSE2, TEXSIMD_AVX2 };
+
+static int detecttexsimd()
+{
+#if defined(TEXSIMD_X86) && defined(__GNUC__)
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2")) return TEXSIMD_AVX2;
+    if(__builtin_cpu_supports("sse2")) return TEXSIMD_SSE2;
+    return TEXSIMD_SCALAR;
+#elif defined(TEXSIMD_X86)
+    int info[4];
+    __cpuid(info, 0);
+    int maxleaf = info[0];
+    __cpuid(info, 1);
+    if(!(info[3]&(1<<26))) return TEXSIMD_SCALAR;
+    if(maxleaf >= 7 && (info[2]&(1<<27)) && (_xgetbv(0)&6) == 6)
+    {
+        __cpuidex(info, 7, 0);
+        if(info[1]&(1<<5)) return TEXSIMD_AVX2;
+    }
+    return TEXSIMD_SSE2;
+#elif defined(TEXSIMD_NEON)
+    return TEXSIMD_SSE2;
+#else
+    return TEXSIMD_SCALAR;
+#endif
+}
+
+// 0 forces the scalar kernels, 1 allows SSE2/NEON, 2 also AVX2
+VARP(texsimd, 0, 2, 2);
+
+int texsimdlevel()
+{
+    static const int detected = detecttexsimd();
+    return min(texsimd, detected);
+}
+
+const char *texsimdname(int level)
+{
+    switch(level)
+    {
+#ifdef TEXSIMD_NEON
+        case TEXSIMD_SSE2: return "neon";
+#else
+        case TEXSIMD_SSE2: return "sse2";
+#endif
+        case TEXSIMD_AVX2: return "avx2";
+        default: return "scalar";
+    }
+}
+
+static const int blurweights3x3[9] =
+{
+    0x10, 0x20, 0x10,
+    0x20, 0x40, 0x20,
+    0x10, 0x20, 0x10
+};
+static const int blurweights5x5[25] =
+{
+    0x05, 0x05, 0x09, 0x05, 0x05,
+    0x05, 0x0A, 0x14, 0x0A, 0x05,
+    0x09, 0x14, 0x28, 0x14, 0x09,
+    0x05, 0x0A, 0x14, 0x0A, 0x05,
+    0x05, 0x05, 0x09, 0x05, 0x05
+};
+
+// away from the borders every output byte of the blur is the same weighted sum
+static inline uchar blurbyte(const uchar *src, int n, int bpp, int stride, const int *mat)
+{
+    int sum = 0, mstride = 2*n + 1;
+    for(int dy = -n; dy <= n; dy++) for(int dx = -n; dx <= n; dx++)
+        sum += src[dy*stride + dx*bpp] * mat[(dy+n)*mstride + dx+n];
+    return sum>>8;
+}
+
+static inline void halvepixels(const uchar *src, uint stride, uchar *dst, uint bpp, uint bytes)
+{
+    for(uint i = 0; i < bytes; i += 2*bpp, dst += bpp)
+    {
+        loopk(bpp) dst[k] = (uint(src[i+k]) + uint(src[i+k+bpp]) + uint(src[stride+i+k]) + uint(src[stride+i+k+bpp]))>>2;
+    }
+}
+
+static inline void madbytes(uchar *dst, uint start, uint end, const float *mulpat, const float *addpat)
+{
+    for(uint i = start; i < end; i++) dst[i] = uchar(clamp(dst[i]*mulpat[i%12] + addpat[i%12], 0.0f, 255.0f));
+}
+
+static inline void normalpixel(const uchar *src, int x, int y, int w, int h, int bpp, int pitch, double z, uchar *dst)
+{
+    int dx = int(src[y*pitch + ((x+w-1)%w)*bpp]) - int(src[y*pitch + ((x+1)%w)*bpp]),
+        dy = int(src[((y+h-1)%h)*pitch + x*bpp]) - int(src[((y+1)%h)*pitch + x*bpp]);
+    double k = 1/sqrt(double(dx*dx + dy*dy) + z*z);
+    dst[0] = uchar(127.5 + dx*k*127.5);
+    dst[1] = uchar(127.5 + dy*k*127.5);
+    dst[2] = uchar(127.5 + z*k*127.5);
+}
+
+#ifdef TEXSIMD_X86
+TARGET_SSE2 static void halvesse2(const uchar *src, uint sw, uint sh, uint stride, uchar *dst, uint bpp)
+{
+    const __m128i zero = _mm_setzero_si128(), lowords = _mm_set1_epi32(0xFFFF);
+    uint bytes = sw*bpp, simdbytes = bytes&~15U;
+    for(const uchar *yend = &src[sh*stride]; src < yend; src += 2*stride)
+    {
+        for(uint i = 0; i < simdbytes; i += 16, dst += 8)
+        {
+            __m128i a = _mm_loadu_si128((const __m128i *)&src[i]), b = _mm_loadu_si128((const __m128i *)&src[stride+i]),
+                    lo = _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero)),
+                    hi = _mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero)),
+                    sum;
+            switch(bpp)
+            {
+                case 1:
+                    sum = _mm_packs_epi32(_mm_add_epi32(_mm_and_si128(lo, lowords), _mm_srli_epi32(lo, 16)),
+                                          _mm_add_epi32(_mm_and_si128(hi, lowords), _mm_srli_epi32(hi, 16)));
+                    break;
+                case 2:
+                    sum = _mm_add_epi16(_mm_castps_si128(_mm_shuffle_ps(_mm_castsi128_ps(lo), _mm_castsi128_ps(hi), _MM_SHUFFLE(2, 0, 2, 0))),
+                                        _mm_castps_si128(_mm_shuffle_ps(_mm_castsi128_ps(lo), _mm_castsi128_ps(hi), _MM_SHUFFLE(3, 1, 3, 1))));
+                    break;
+                default:
+                    sum = _mm_add_epi16(_mm_unpacklo_epi64(lo, hi), _mm_unpackhi_epi64(lo, hi));
+                    break;
+            }
+            sum = _mm_srli_epi16(sum, 2);
+            _mm_storel_epi64((__m128i *)dst, _mm_packus_epi16(sum, sum));
+        }
+        halvepixels(&src[simdbytes], stride, dst, bpp, bytes - simdbytes);
+        dst += (bytes - simdbytes)/2;
+    }
+}
+
+TARGET_SSE2 static void sumrowssse2(uint *acc, const uchar *src, uint bytes)
+{
+    const __m128i zero = _mm_setzero_si128();
+    uint i = 0;
+    for(; i + 16 <= bytes; i += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)&src[i]),
+                lo = _mm_unpacklo_epi8(v, zero), hi = _mm_unpackhi_epi8(v, zero);
+        __m128i *a = (__m128i *)&acc[i];
+        _mm_storeu_si128(&a[0], _mm_add_epi32(_mm_loadu_si128(&a[0]), _mm_unpacklo_epi16(lo, zero)));
+        _mm_storeu_si128(&a[1], _mm_add_epi32(_mm_loadu_si128(&a[1]), _mm_unpackhi_epi16(lo, zero)));
+        _mm_storeu_si128(&a[2], _mm_add_epi32(_mm_loadu_si128(&a[2]), _mm_unpacklo_epi16(hi, zero)));
+        _mm_storeu_si128(&a[3], _mm_add_epi32(_mm_loadu_si128(&a[3]), _mm_unpackhi_epi16(hi, zero)));
+    }
+    for(; i < bytes; i++) acc[i] += src[i];
+}
+
+TARGET_SSE2 static void blurrowsse2(const uchar *src, uchar *dst, int bytes, int n, int bpp, int stride, const int *mat)
+{
+    const __m128i zero = _mm_setzero_si128();
+    int mstride = 2*n + 1, i = 0;
+    for(; i + 8 <= bytes; i += 8)
+    {
+        __m128i sum = zero;
+        for(int dy = -n; dy <= n; dy++) for(int dx = -n; dx <= n; dx++)
+        {
+            __m128i p = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)&src[i + dy*stride + dx*bpp]), zero);
+            sum = _mm_add_epi16(sum, _mm_mullo_epi16(p, _mm_set1_epi16(mat[(dy+n)*mstride + dx+n])));
+        }
+        sum = _mm_srli_epi16(sum, 8);
+        _mm_storel_epi64((__m128i *)&dst[i], _mm_packus_epi16(sum, sum));
+    }
+    for(; i < bytes; i++) dst[i] = blurbyte(&src[i], n, bpp, stride, mat);
+}
+
+TARGET_AVX2 static void blurrowavx2(const uchar *src, uchar *dst, int bytes, int n, int bpp, int stride, const int *mat)
+{
+    int mstride = 2*n + 1, i = 0;
+    for(; i + 16 <= bytes; i += 16)
+    {
+        __m256i sum = _mm256_setzero_si256();
+        for(int dy = -n; dy <= n; dy++) for(int dx = -n; dx <= n; dx++)
+        {
+            __m256i p = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)&src[i + dy*stride + dx*bpp]));
+            sum = _mm256_add_epi16(sum, _mm256_mullo_epi16(p, _mm256_set1_epi16(mat[(dy+n)*mstride + dx+n])));
+        }
+        sum = _mm256_srli_epi16(sum, 8);
+        _mm_storeu_si128((__m128i *)&dst[i], _mm_packus_epi16(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1)));
+    }
+    blurrowsse2(&src[i], &dst[i], bytes - i, n, bpp, stride, mat);
+}
+
+TARGET_SSE2 static void madrowsse2(uchar *dst, uint bytes, const float *mulpat, const float *addpat)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128 lo = _mm_setzero_ps(), hi = _mm_set1_ps(255.0f);
+    uint i = 0;
+    for(; i + 12 <= bytes; i += 12)
+    {
+        loopk(3)
+        {
+            int bits;
+            memcpy(&bits, &dst[i + 4*k], 4);
+            __m128 v = _mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(bits), zero), zero));
+            v = _mm_add_ps(_mm_mul_ps(v, _mm_loadu_ps(&mulpat[4*k])), _mm_loadu_ps(&addpat[4*k]));
+            __m128i r = _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(v, lo), hi));
+            r = _mm_packs_epi32(r, r);
+            bits = _mm_cvtsi128_si32(_mm_packus_epi16(r, r));
+            memcpy(&dst[i + 4*k], &bits, 4);
+        }
+    }
+    madbytes(dst, i, bytes, mulpat, addpat);
+}
+
+TARGET_AVX2 static void madrowavx2(uchar *dst, uint bytes, const float *mulpat, const float *addpat)
+{
+    const __m256 lo = _mm256_setzero_ps(), hi = _mm256_set1_ps(255.0f);
+    uint i = 0;
+    for(; i + 24 <= bytes; i += 24)
+    {
+        loopk(3)
+        {
+            __m256 v = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)&dst[i + 8*k])));
+            v = _mm256_add_ps(_mm256_mul_ps(v, _mm256_loadu_ps(&mulpat[(8*k)%12])), _mm256_loadu_ps(&addpat[(8*k)%12]));
+            __m256i r = _mm256_cvttps_epi32(_mm256_min_ps(_mm256_max_ps(v, lo), hi));
+            __m128i r16 = _mm_packus_epi32(_mm256_castsi256_si128(r), _mm256_extracti128_si256(r, 1));
+            _mm_storel_epi64((__m128i *)&dst[i + 8*k], _mm_packus_epi16(r16, r16));
+        }
+    }
+    madbytes(dst, i, bytes, mulpat, addpat);
+}
+
+// the normals are worked out in double precision, which the compiler may not
+// approximate behind our backs the way it does float reciprocal square roots;
+// two lanes of SSE2 doubles are no faster than scalar code, so only AVX2 is used
+TARGET_AVX2 static void normalrowavx2(const uchar *src, int y, int w, int h, int bpp, int pitch, double z, uchar *dst)
+{
+    const __m256d zz = _mm256_set1_pd(z*z), zv = _mm256_set1_pd(z), half = _mm256_set1_pd(127.5), one = _mm256_set1_pd(1.0);
+    const __m128i lobytes = _mm_set1_epi32(0xFF);
+    const uchar *row = &src[y*pitch], *up = &src[((y+h-1)%h)*pitch], *down = &src[((y+1)%h)*pitch];
+    normalpixel(src, 0, y, w, h, bpp, pitch, z, dst);
+    dst += 3;
+    int x = 1;
+    for(; x + 4 < w; x += 4)
+    {
+        __m128i l, r, u, d;
+        if(bpp == 4)
+        {
+            l = _mm_and_si128(_mm_loadu_si128((const __m128i *)&row[(x-1)*4]), lobytes);
+            r = _mm_and_si128(_mm_loadu_si128((const __m128i *)&row[(x+1)*4]), lobytes);
+            u = _mm_and_si128(_mm_loadu_si128((const __m128i *)&up[x*4]), lobytes);
+            d = _mm_and_si128(_mm_loadu_si128((const __m128i *)&down[x*4]), lobytes);
+        }
+        else
+        {
+            l = _mm_setr_epi32(row[(x-1)*bpp], row[x*bpp], row[(x+1)*bpp], row[(x+2)*bpp]);
+            r = _mm_setr_epi32(row[(x+1)*bpp], row[(x+2)*bpp], row[(x+3)*bpp], row[(x+4)*bpp]);
+            u = _mm_setr_epi32(up[x*bpp], up[(x+1)*bpp], up[(x+2)*bpp], up[(x+3)*bpp]);
+            d = _mm_setr_epi32(down[x*bpp], down[(x+1)*bpp], down[(x+2)*bpp], down[(x+3)*bpp]);
+        }
+        __m128i dx = _mm_sub_epi32(l, r), dy = _mm_sub_epi32(u, d),
+                len = _mm_add_epi32(_mm_mullo_epi32(dx, dx), _mm_mullo_epi32(dy, dy));
+        __m256d k = _mm256_div_pd(one, _mm256_sqrt_pd(_mm256_add_pd(_mm256_cvtepi32_pd(len), zz)));
+        __m128i ox = _mm256_cvttpd_epi32(_mm256_add_pd(half, _mm256_mul_pd(_mm256_mul_pd(_mm256_cvtepi32_pd(dx), k), half))),
+                oy = _mm256_cvttpd_epi32(_mm256_add_pd(half, _mm256_mul_pd(_mm256_mul_pd(_mm256_cvtepi32_pd(dy), k), half))),
+                oz = _mm256_cvttpd_epi32(_mm256_add_pd(half, _mm256_mul_pd(_mm256_mul_pd(zv, k), half)));
+        // interleave the three channels into 12 bytes
+        __m128i xy = _mm_or_si128(ox, _mm_slli_epi32(oy, 8)), xyz = _mm_or_si128(xy, _mm_slli_epi32(oz, 16));
+        xyz = _mm_shuffle_epi8(xyz, _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1));
+        _mm_storel_epi64((__m128i *)dst, xyz);
+        int tail = _mm_extract_epi32(xyz, 2);
+        memcpy(&dst[8], &tail, 4);
+        dst += 12;
+    }
+    for(; x < w; x++, dst += 3) normalpixel(src, x, y, w, h, bpp, pitch, z, dst);
+}
+#endif
+
+#ifdef TEXSIMD_NEON
+static void halveneon(const uchar *src, uint sw, uint sh, uint stride, uchar *dst, uint bpp)
+{
+    uint bytes = sw*bpp, simdbytes = bytes&~15U;
+    for(const uchar *yend = &src[sh*stride]; src < yend; src += 2*stride)
+    {
+        for(uint i = 0; i < simdbytes; i += 16, dst += 8)
+        {
+            uint16x8_t sum;
+            switch(bpp)
+            {
+                case 1:
+                {
+                    uint8x8x2_t a = vld2_u8(&src[i]), b = vld2_u8(&src[stride+i]);
+                    sum = vaddq_u16(vaddl_u8(a.val[0], a.val[1]), vaddl_u8(b.val[0], b.val[1]));
+                    break;
+                }
+                case 2:
+                {
+                    uint16x4x2_t a = vld2_u16((const uint16_t *)&src[i]), b = vld2_u16((const uint16_t *)&src[stride+i]);
+                    sum = vaddq_u16(vaddl_u8(vreinterpret_u8_u16(a.val[0]), vreinterpret_u8_u16(a.val[1])),
+                                    vaddl_u8(vreinterpret_u8_u16(b.val[0]), vreinterpret_u8_u16(b.val[1])));
+                    break;
+                }
+                default:
+                {
+                    uint32x2x2_t a = vld2_u32((const uint32_t *)&src[i]), b = vld2_u32((const uint32_t *)&src[stride+i]);
+                    sum = vaddq_u16(vaddl_u8(vreinterpret_u8_u32(a.val[0]), vreinterpret_u8_u32(a.val[1])),
+                                    vaddl_u8(vreinterpret_u8_u32(b.val[0]), vreinterpret_u8_u32(b.val[1])));
+                    break;
+                }
+            }
+            vst1_u8(dst, vshrn_n_u16(sum, 2));
+        }
+        halvepixels(&src[simdbytes], stride, dst, bpp, bytes - simdbytes);
+        dst += (bytes - simdbytes)/2;
+    }
+}
+
+static void sumrowsneon(uint *acc, const uchar *src, uint bytes)
+{
+    uint i = 0;
+    for(; i + 8 <= bytes; i += 8)
+    {
+        uint16x8_t v = vmovl_u8(vld1_u8(&src[i]));
+        vst1q_u32(&acc[i], vaddw_u16(vld1q_u32(&acc[i]), vget_low_u16(v)));
+        vst1q_u32(&acc[i+4], vaddw_u16(vld1q_u32(&acc[i+4]), vget_high_u16(v)));
+    }
+    for(; i < bytes; i++) acc[i] += src[i];
+}
+
+static void blurrowneon(const uchar *src, uchar *dst, int bytes, int n, int bpp, int stride, const int *mat)
+{
+    int mstride = 2*n + 1, i = 0;
+    for(; i + 8 <= bytes; i += 8)
+    {
+        uint16x8_t sum = vdupq_n_u16(0);
+        for(int dy = -n; dy <= n; dy++) for(int dx = -n; dx <= n; dx++)
+            sum = vmlal_u8(sum, vld1_u8(&src[i + dy*stride + dx*bpp]), vdup_n_u8(mat[(dy+n)*mstride + dx+n]));
+        vst1_u8(&dst[i], vshrn_n_u16(sum, 8));
+    }
+    for(; i < bytes; i++) dst[i] = blurbyte(&src[i], n, bpp, stride, mat);
+}
+#endif
+
+bool simdhalvetexture(const uchar *src, uint sw, uint sh, uint stride, uchar *dst, uint bpp)
+{
+    if(bpp == 3 || !texsimdlevel()) return false;
+#if defined(TEXSIMD_X86)
+    halvesse2(src, sw, sh, stride, dst, bpp);
+    return true;
+#elif defined(TEXSIMD_NEON)
+    halveneon(src, sw, sh, stride, dst, bpp);
+    return true;
+#else
+    return false;
+#endif
+}
+
+// sums each block of rows into a column accumulator, so only the horizontal
+// pass is left per output pixel
+bool simdshifttexture(const uchar *src, uint sw, uint sh, uint stride, uchar *dst, uint dw, uint dh, uint bpp)
+{
+#if defined(TEXSIMD_X86) || defined(TEXSIMD_NEON)
+    if(!texsimdlevel()) return false;
+    uint wfrac = sw/dw, hfrac = sh/dh, wshift = 0, hshift = 0;
+    while(dw<<wshift < sw) wshift++;
+    while(dh<<hshift < sh) hshift++;
+    uint tshift = wshift + hshift, bytes = sw*bpp;
+    uint *acc = new uint[bytes];
+    for(const uchar *yend = &src[sh*stride]; src < yend; src += hfrac*stride)
+    {
+        memset(acc, 0, bytes*sizeof(uint));
+        loopi(hfrac)
+        {
+#ifdef TEXSIMD_X86
+            sumrowssse2(acc, &src[i*stride], bytes);
+#else
+            sumrowsneon(acc, &src[i*stride], bytes);
+#endif
+        }
+        for(const uint *xsrc = acc, *xend = &acc[bytes]; xsrc < xend; xsrc += wfrac*bpp, dst += bpp)
+        {
+            uint r[4] = { 0, 0, 0, 0 };
+            for(const uint *xcur = xsrc, *xstop = &xsrc[wfrac*bpp]; xcur < xstop; xcur += bpp)
+            {
+                loopk(bpp) r[k] += xcur[k];
+            }
+            loopk(bpp) dst[k] = r[k] >> tshift;
+        }
+    }
+    delete[] acc;
+    return true;
+#else
+    return false;
+#endif
+}
+
+// only fills in the pixels at least max(n, margin) away from every border
+bool simdblurtexture(int n, int bpp, int w, int h, uchar *dst, const uchar *src, int margin)
+{
+#if defined(TEXSIMD_X86) || defined(TEXSIMD_NEON)
+    int level = texsimdlevel(), lo = max(n, margin);
+    if(!level || w - 2*lo <= 0 || h - 2*lo <= 0) return false;
+    const int *mat = n > 1 ? blurweights5x5 : blurweights3x3;
+    int stride = w*bpp, dstride = (w - 2*margin)*bpp, bytes = (w - 2*lo)*bpp;
+    for(int y = lo; y < h-lo; y++)
+    {
+        const uchar *s = &src[y*stride + lo*bpp];
+        uchar *d = &dst[(y-margin)*dstride + (lo-margin)*bpp];
+#if defined(TEXSIMD_X86)
+        if(level >= TEXSIMD_AVX2) blurrowavx2(s, d, bytes, n, bpp, stride, mat);
+        else blurrowsse2(s, d, bytes, n, bpp, stride, mat);
+#else
+        blurrowneon(s, d, bytes, n, bpp, stride, mat);
+#endif
+        if(bpp > 3) for(int i = 3; i < bytes; i += 4) d[i] = s[i];
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+
+// the floating point kernels are left to the compiler on NEON, where it may
+// fuse the scalar multiply-adds and the results would no longer match
+bool simdtexnormal(const uchar *src, int w, int h, int bpp, int pitch, uchar *dst, int emphasis)
+{
+#ifdef TEXSIMD_X86
+    if(texsimdlevel() < TEXSIMD_AVX2) return false;
+    double z = 255.0/emphasis;
+    loop(y, h) normalrowavx2(src, y, w, h, bpp, pitch, z, &dst[y*w*3]);
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool simdtexmad(uchar *data, int w, int h, int bpp, int pitch, const vec &mul, const vec &add)
+{
+#ifdef TEXSIMD_X86
+    int level = texsimdlevel();
+    if(!level) return false;
+    // the per channel factors repeat every 12 bytes for any bpp up to 4
+    float mulpat[12+8], addpat[12+8];
+    int maxk = min(bpp, 3);
+    loopi(12+8)
+    {
+        int k = (i%12)%bpp;
+        mulpat[i] = k < maxk ? mul[k] : 1.0f;
+        addpat[i] = k < maxk ? 255*add[k] : 0.0f;
+    }
+    loop(y, h)
+    {
+        if(level >= TEXSIMD_AVX2) madrowavx2(&data[y*pitch], w*bpp, mulpat, addpat);
+        else madrowsse2(&data[y*pitch], w*bpp, mulpat, addpat);
+    }
+    return true;
+#else
+    return false;
+#endif
+}
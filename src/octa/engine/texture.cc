@@ -99,6 +99,7 @@ static void scaletexture(uchar *src, uint sw, uint sh, uint bpp, uint pitch, uch
 {
     if(sw == dw*2 && sh == dh*2)
     {
+        if(simdhalvetexture(src, sw, sh, pitch, dst, bpp)) return;
         switch(bpp)
         {
             case 1: halvetexture<1>(src, sw, sh, pitch, dst); return;
@@ -119,6 +120,7 @@ static void scaletexture(uchar *src, uint sw, uint sh, uint bpp, uint pitch, uch
     }
     else
     {
+        if(simdshifttexture(src, sw, sh, pitch, dst, dw, dh, bpp)) return;
         switch(bpp)
         {
             case 1: shifttexture<1>(src, sw, sh, pitch, dst, dw, dh); return;
@@ -470,6 +472,7 @@ void texmad(ImageData &s, const vec &mul, const vec &add)
 {
     if(s.bpp < 3 && (mul.x != mul.y || mul.y != mul.z || add.x != add.y || add.y != add.z))
         swizzleimage(s);
+    if(simdtexmad(s.data, s.w, s.h, s.bpp, s.pitch, mul, add)) return;
     int maxk = min(int(s.bpp), 3);
     writetex(s,
         loopk(maxk) dst[k] = uchar(clamp(dst[k]*mul[k] + 255*add[k], 0.0f, 255.0f));
@@ -1277,23 +1280,23 @@ void texnormal(ImageData &s, int emphasis)
 {
     ImageData d(s.w, s.h, 3);
     uchar *src = s.data, *dst = d.data;
+    if(simdtexnormal(src, s.w, s.h, s.bpp, s.pitch, dst, emphasis)) { s.replace(d); return; }
+    // in double precision so that every CPU and the SIMD path agree exactly
+    double z = 255.0/emphasis;
     loop(y, s.h) loop(x, s.w)
     {
-        vec normal(0.0f, 0.0f, 255.0f/emphasis);
-        normal.x += src[y*s.pitch + ((x+s.w-1)%s.w)*s.bpp];
-        normal.x -= src[y*s.pitch + ((x+1)%s.w)*s.bpp];
-        normal.y += src[((y+s.h-1)%s.h)*s.pitch + x*s.bpp];
-        normal.y -= src[((y+1)%s.h)*s.pitch + x*s.bpp];
-        normal.normalize();
-        *dst++ = uchar(127.5f + normal.x*127.5f);
-        *dst++ = uchar(127.5f + normal.y*127.5f);
-        *dst++ = uchar(127.5f + normal.z*127.5f);
+        int dx = int(src[y*s.pitch + ((x+s.w-1)%s.w)*s.bpp]) - int(src[y*s.pitch + ((x+1)%s.w)*s.bpp]),
+            dy = int(src[((y+s.h-1)%s.h)*s.pitch + x*s.bpp]) - int(src[((y+1)%s.h)*s.pitch + x*s.bpp]);
+        double k = 1/sqrt(double(dx*dx + dy*dy) + z*z);
+        *dst++ = uchar(127.5 + dx*k*127.5);
+        *dst++ = uchar(127.5 + dy*k*127.5);
+        *dst++ = uchar(127.5 + z*k*127.5);
     }
     s.replace(d);
 }
 
 template<int n, int bpp, bool normals>
-static void blurtexture(int w, int h, uchar *dst, const uchar *src, int margin)
+static void blurtexture(int w, int h, uchar *dst, const uchar *src, int margin, bool skipinterior = false)
 {
     static const int weights3x3[9] =
     {
@@ -1317,10 +1320,19 @@ static void blurtexture(int w, int h, uchar *dst, const uchar *src, int margin)
         nextoffset1 = stride + mstride*bpp,
         nextoffset2 = stride - mstride*bpp;
     src += margin*(stride + bpp);
+    int lo = max(n, margin);
     for(int y = margin; y < h-margin; y++)
     {
         for(int x = margin; x < w-margin; x++)
         {
+            if(skipinterior && x == lo && y >= lo && y < h-lo)
+            {
+                int skip = w - 2*lo;
+                x += skip - 1;
+                dst += skip*bpp;
+                src += skip*bpp;
+                continue;
+            }
             int dr = 0, dg = 0, db = 0;
             const uchar *p = src - startoffset;
             const int *m = mat + mstartoffset;
@@ -1370,12 +1382,14 @@ static void blurtexture(int w, int h, uchar *dst, const uchar *src, int margin)
 
 void blurtexture(int n, int bpp, int w, int h, uchar *dst, const uchar *src, int margin)
 {
-    switch((clamp(n, 1, 2)<<4) | bpp)
+    n = clamp(n, 1, 2);
+    bool simd = (bpp == 3 || bpp == 4) && simdblurtexture(n, bpp, w, h, dst, src, margin);
+    switch((n<<4) | bpp)
     {
-        case 0x13: blurtexture<1, 3, false>(w, h, dst, src, margin); break;
-        case 0x23: blurtexture<2, 3, false>(w, h, dst, src, margin); break;
-        case 0x14: blurtexture<1, 4, false>(w, h, dst, src, margin); break;
-        case 0x24: blurtexture<2, 4, false>(w, h, dst, src, margin); break;
+        case 0x13: blurtexture<1, 3, false>(w, h, dst, src, margin, simd); break;
+        case 0x23: blurtexture<2, 3, false>(w, h, dst, src, margin, simd); break;
+        case 0x14: blurtexture<1, 4, false>(w, h, dst, src, margin, simd); break;
+        case 0x24: blurtexture<2, 4, false>(w, h, dst, src, margin, simd); break;
     }
 }
 
@@ -1399,6 +1413,67 @@ void texblur(ImageData &s, int n, int r)
     }
 }
 
+enum { TEXBENCH_HALVE = 0, TEXBENCH_SHIFT, TEXBENCH_BLUR3, TEXBENCH_BLUR5, TEXBENCH_NORMAL, TEXBENCH_MAD, NUMTEXBENCH };
+
+static const char * const texbenchnames[NUMTEXBENCH] = { "halve", "shift", "blur3x3", "blur5x5", "normal", "mad" };
+
+static void runtexbench(int kernel, const ImageData &src, ImageData &dst)
+{
+    switch(kernel)
+    {
+        case TEXBENCH_HALVE: scaletexture(src.data, src.w, src.h, src.bpp, src.pitch, dst.data, src.w/2, src.h/2); break;
+        case TEXBENCH_SHIFT: scaletexture(src.data, src.w, src.h, src.bpp, src.pitch, dst.data, src.w/4, src.h/4); break;
+        case TEXBENCH_BLUR3: blurtexture(1, src.bpp, src.w, src.h, dst.data, src.data); break;
+        case TEXBENCH_BLUR5: blurtexture(2, src.bpp, src.w, src.h, dst.data, src.data); break;
+        case TEXBENCH_NORMAL:
+        {
+            ImageData s(src.w, src.h, src.bpp);
+            memcpy(s.data, src.data, src.h*src.pitch);
+            texnormal(s, 3);
+            memcpy(dst.data, s.data, s.h*s.pitch);
+            break;
+        }
+        case TEXBENCH_MAD:
+            memcpy(dst.data, src.data, src.h*src.pitch);
+            dst.w = src.w; dst.h = src.h; dst.bpp = src.bpp; dst.pitch = src.pitch;
+            texmad(dst, vec(0.75f, 1.25f, 0.5f), vec(0.1f, -0.05f, 0.2f));
+            break;
+    }
+}
+
+// times each texture kernel at every available SIMD level against the
+// scalar path, and checks the results are byte for byte the same
+void texkernelbench(int *size, int *bpp, int *iters)
+{
+    int w = *size > 0 ? clamp(*size, 16, 1<<12) : 1024, b = *bpp > 0 ? clamp(*bpp, 1, 4) : 4, n = *iters > 0 ? *iters : 10,
+        maxlevel = texsimdlevel(), oldsimd = texsimd;
+    w &= ~15;
+    ImageData src(w, w, b), ref(w, w, 4), out(w, w, 4);
+    uint seed = 0x12345678;
+    loopi(w*w*b) { seed = seed*1664525 + 1013904223; src.data[i] = seed>>24; }
+    loopk(NUMTEXBENCH)
+    {
+        if((k == TEXBENCH_BLUR3 || k == TEXBENCH_BLUR5) && b < 3) continue;
+        defformatstring(line, "%s %dx%dx%d:", texbenchnames[k], w, w, b);
+        for(int level = 0; level <= maxlevel; level++)
+        {
+            texsimd = level;
+            ImageData &dst = level ? out : ref;
+            memset(dst.data, 0, w*w*4);
+            runtexbench(k, src, dst);
+            bool same = !level || !memcmp(ref.data, out.data, w*w*4);
+            Uint64 start = SDL_GetPerformanceCounter();
+            loopi(n) runtexbench(k, src, dst);
+            double secs = double(SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency();
+            concformatstring(line, " %s %.1f MB/s%s", texsimdname(level), double(w)*w*b*n/(1024.0*1024.0)/max(secs, 1e-9), same ? "" : " (MISMATCH)");
+        }
+        conoutf("%s", line);
+    }
+    texsimd = oldsimd;
+}
+
+COMMAND(texkernelbench, "iii");
+
 bool canloadsurface(const char *name)
 {
     stream *f = openfile(name, "rb");
@@ -1511,8 +1586,8 @@ static bool texturedata(ImageData &d, const char *tname, bool msg = true, int *c
         SDL_Surface *s = loadsurface(file);
         if(!s) { if(msg) conoutf(CON_ERROR, "could not load texture %s", file); return false; }
         int bpp = s->format->BitsPerPixel;
-        if(bpp%8 || !texformat(bpp/8)) { SDL_FreeSurface(s); conoutf(CON_ERROR, "texture must be 8, 16, 24, or 32 bpp: %s", file); return false; }
-        if(max(s->w, s->h) > (1<<12)) { SDL_FreeSurface(s); conoutf(CON_ERROR, "texture size exceeded %dx%d pixels: %s", 1<<12, 1<<12, file); return false; }
+        if(bpp%8 || !texformat(bpp/8)) { SDL_FreeSurface(s); if(msg) conoutf(CON_ERROR, "texture must be 8, 16, 24, or 32 bpp: %s", file); return false; }
+        if(max(s->w, s->h) > (1<<12)) { SDL_FreeSurface(s); if(msg) conoutf(CON_ERROR, "texture size exceeded %dx%d pixels: %s", 1<<12, 1<<12, file); return false; }
         d.wrap(s);
     }
 
@@ -3039,28 +3114,10 @@ static void addname(vector<char> &key, Slot &slot, Slot::Tex &t, bool combined =
     for(const char *s = path(tname); *s; key.add(*s++));
 }
 
-void Slot::load(int index, Slot::Tex &t)
+static bool loadslottexture(ImageData &ts, const char *name, const char *dir, int type, const char *cname, int ctype, bool msg, int &compress, int &wrap)
 {
-    vector<char> key;
-    addname(key, *this, t);
-    Slot::Tex *combine = NULL;
-    loopv(sts)
-    {
-        Slot::Tex &c = sts[i];
-        if(c.combined == index)
-        {
-            combine = &c;
-            addname(key, *this, c, true);
-            break;
-        }
-    }
-    key.add('\0');
-    t.t = textures.access(key.getbuf());
-    if(t.t) return;
-    int compress = 0, wrap = 0;
-    ImageData ts;
-    if(!texturedata(ts, *this, t, true, &compress, &wrap)) { t.t = notexture; return; }
-    if(!ts.compressed) switch(t.type)
+    if(!texturedata(ts, name, msg, &compress, &wrap, dir, type)) return false;
+    if(!ts.compressed) switch(type)
     {
         case TEX_SPEC:
             if(ts.bpp > 1) collapsespec(ts);
@@ -3068,13 +3125,13 @@ void Slot::load(int index, Slot::Tex &t)
         case TEX_GLOW:
         case TEX_DIFFUSE:
         case TEX_NORMAL:
-            if(combine)
+            if(cname)
             {
                 ImageData cs;
-                if(texturedata(cs, *this, *combine))
+                if(texturedata(cs, cname, msg, NULL, NULL, dir, ctype))
                 {
                     if(cs.w!=ts.w || cs.h!=ts.h) scaleimage(cs, ts.w, ts.h);
-                    switch(combine->type)
+                    switch(ctype)
                     {
                         case TEX_SPEC: mergespec(ts, cs); break;
                         case TEX_DEPTH: mergedepth(ts, cs); break;
@@ -3084,6 +3141,284 @@ void Slot::load(int index, Slot::Tex &t)
             if(ts.bpp < 3) swizzleimage(ts);
             break;
     }
+    return true;
+}
+
+// slot textures are decoded and run through their texture commands on worker
+// threads; the main thread only creates the GL textures. Until then a slot
+// texture shares a 1x1 placeholder of its type. The first texture of a slot
+// determines texture coordinates, so it is never left as a placeholder.
+VARP(asynctextures, 0, 1, 1);
+VARP(texthreads, 0, 0, 16);
+VARP(texuploadmillis, 0, 4, 1000);
+VAR(texqueue, 1, 0, 0);
+VAR(texfirstframe, 1, 0, 0);
+VAR(texloadtime, 1, 0, 0);
+
+struct texloadjob
+{
+    Texture *t;
+    char *name, *dir, *cname;
+    int type, ctype, compress, wrap;
+    bool ok, done, needed;
+    ImageData d;
+
+    texloadjob(Texture *t, const char *name, const char *dir, int type, const char *cname, int ctype)
+        : t(t), name(newstring(name)), dir(newstring(dir)), cname(cname ? newstring(cname) : NULL), type(type), ctype(ctype), compress(0), wrap(0), ok(false), done(false), needed(false)
+    {
+    }
+    ~texloadjob()
+    {
+        DELETEA(name);
+        DELETEA(dir);
+        DELETEA(cname);
+    }
+
+    void run()
+    {
+        ok = loadslottexture(d, name, dir, type, cname, ctype, false, compress, wrap);
+    }
+};
+
+static SDL_mutex *texloadmutex = NULL;
+static SDL_cond *texloadcond = NULL, *texdonecond = NULL;
+static vector<SDL_Thread *> texloadthreads;
+// queued and decoded jobs are shared with the workers, pending is main thread only
+static vector<texloadjob *> texloadqueue, texloaddone, texloadpending;
+static int texloadbatch = 0, texloadstart = 0;
+static Texture texplaceholders[TEX_UNKNOWN];
+
+static int texloadworker(void *data)
+{
+    SDL_LockMutex(texloadmutex);
+    for(;;)
+    {
+        while(texloadqueue.empty()) SDL_CondWait(texloadcond, texloadmutex);
+        texloadjob *j = texloadqueue.remove(0);
+        if(!j) break;
+        SDL_UnlockMutex(texloadmutex);
+        j->run();
+        SDL_LockMutex(texloadmutex);
+        j->done = true;
+        texloaddone.add(j);
+        SDL_CondSignal(texdonecond);
+    }
+    SDL_UnlockMutex(texloadmutex);
+    return 0;
+}
+
+static void placeholderimage(ImageData &d, int type)
+{
+    d.setdata(NULL, 1, 1, 3);
+    switch(type)
+    {
+        case TEX_NORMAL: d.data[0] = d.data[1] = 128; d.data[2] = 255; break;
+        case TEX_DIFFUSE: d.data[0] = d.data[1] = d.data[2] = 128; break;
+        default: d.data[0] = d.data[1] = d.data[2] = 0; break;
+    }
+}
+
+static Texture *texplaceholder(int type)
+{
+    Texture &p = texplaceholders[type >= 0 && type < TEX_UNKNOWN ? type : TEX_DIFFUSE];
+    if(!p.id)
+    {
+        ImageData d;
+        placeholderimage(d, type);
+        newtexture(&p, NULL, d, 0, false);
+    }
+    return &p;
+}
+
+static Texture *queuetextureload(const char *key, Slot &slot, Slot::Tex &t, Slot::Tex *combine)
+{
+    if(!texloadmutex)
+    {
+        texloadmutex = SDL_CreateMutex();
+        texloadcond = SDL_CreateCond();
+        texdonecond = SDL_CreateCond();
+    }
+    if(texloadthreads.empty())
+    {
+        int numthreads = texthreads > 0 ? texthreads : max(numcpus-1, 1);
+        loopi(numthreads) texloadthreads.add(SDL_CreateThread(texloadworker, "texture loader", NULL));
+    }
+
+    Texture *p = texplaceholder(t.type);
+    char *name = newstring(key);
+    Texture *tex = &textures[name];
+    *tex = *p;
+    tex->name = name;
+    tex->type = Texture::IMAGE | Texture::TRANSIENT | Texture::PENDING;
+    tex->alphamask = NULL;
+
+    texloadjob *j = new texloadjob(tex, t.name, slot.texturedir(), t.type, combine ? combine->name : NULL, combine ? combine->type : TEX_UNKNOWN);
+    texloadpending.add(j);
+    texqueue = texloadpending.length();
+    SDL_LockMutex(texloadmutex);
+    texloadqueue.add(j);
+    SDL_CondSignal(texloadcond);
+    SDL_UnlockMutex(texloadmutex);
+    return tex;
+}
+
+static texloadjob *findtextureload(Texture *t)
+{
+    loopv(texloadpending) if(texloadpending[i]->t == t) return texloadpending[i];
+    return NULL;
+}
+
+static void finishtextureload(texloadjob *j)
+{
+    texloadpending.removeobj(j);
+    texqueue = texloadpending.length();
+    if(j->t)
+    {
+        if(!j->ok)
+        {
+            conoutf(CON_ERROR, "could not load texture %s", j->t->name);
+            placeholderimage(j->d, j->type);
+        }
+        newtexture(j->t, NULL, j->d, j->wrap, true, true, true, j->compress);
+    }
+    delete j;
+}
+
+static void finishtextureloads(bool progress)
+{
+    int total = 0, finished = 0;
+    loopv(texloadpending) if(texloadpending[i]->needed) total++;
+    while(finished < total)
+    {
+        vector<texloadjob *> done;
+        texloadjob *run = NULL;
+        SDL_LockMutex(texloadmutex);
+        // help decode needed textures rather than sit idle
+        if(texloaddone.empty())
+        {
+            loopv(texloadqueue) if(texloadqueue[i]->needed) { run = texloadqueue.remove(i); break; }
+            if(!run) SDL_CondWaitTimeout(texdonecond, texloadmutex, 100);
+        }
+        done.put(texloaddone.getbuf(), texloaddone.length());
+        texloaddone.setsize(0);
+        SDL_UnlockMutex(texloadmutex);
+        if(run)
+        {
+            run->run();
+            run->done = true;
+            done.add(run);
+        }
+        loopv(done)
+        {
+            if(done[i]->needed) finished++;
+            finishtextureload(done[i]);
+        }
+        if(progress) renderprogress(float(finished)/total, "loading textures...");
+    }
+}
+
+static void waittextureload(Texture *t)
+{
+    texloadjob *j = findtextureload(t);
+    if(!j) return;
+    j->needed = true;
+    if(!texloadbatch) finishtextureloads(false);
+}
+
+static void canceltextureload(Texture *t)
+{
+    texloadjob *j = findtextureload(t);
+    if(j) j->t = NULL;
+}
+
+void starttexturebatch()
+{
+    texloadbatch++;
+}
+
+void endtexturebatch()
+{
+    if(texloadbatch > 0 && !--texloadbatch && texloadpending.length()) finishtextureloads(true);
+}
+
+void updatetextureloads()
+{
+    if(texloadstart && !texfirstframe) texfirstframe = max(int(SDL_GetTicks() - texloadstart), 1);
+    if(texloadpending.empty())
+    {
+        if(texloadstart) { texloadtime = max(int(SDL_GetTicks() - texloadstart), 1); texloadstart = 0; }
+        return;
+    }
+    uint start = SDL_GetTicks();
+    for(;;)
+    {
+        SDL_LockMutex(texloadmutex);
+        texloadjob *j = texloaddone.empty() ? NULL : texloaddone.remove(0);
+        SDL_UnlockMutex(texloadmutex);
+        if(!j) break;
+        finishtextureload(j);
+        if(int(SDL_GetTicks() - start) >= texuploadmillis) break;
+    }
+}
+
+void resettextureloads(int start)
+{
+    texloadstart = start;
+    texfirstframe = texloadtime = 0;
+}
+
+void cleanuptextureloads()
+{
+    if(!texloadmutex) return;
+    SDL_LockMutex(texloadmutex);
+    loopv(texloadqueue) texloadpending.removeobj(texloadqueue[i]);
+    texloadqueue.deletecontents();
+    loopv(texloadthreads) texloadqueue.add(NULL);
+    SDL_CondBroadcast(texloadcond);
+    SDL_UnlockMutex(texloadmutex);
+    loopv(texloadthreads) SDL_WaitThread(texloadthreads[i], NULL);
+    texloadthreads.setsize(0);
+    texloadqueue.setsize(0);
+    // every job left has been decoded by now
+    texloaddone.setsize(0);
+    texloadpending.deletecontents();
+    texqueue = 0;
+}
+
+ICOMMAND(texloadstats, "", (),
+    conoutf("texture loads: %d pending, first frame %d ms, complete %d ms", texloadpending.length(), texfirstframe, texloadtime));
+
+void Slot::load(int index, Slot::Tex &t)
+{
+    vector<char> key;
+    addname(key, *this, t);
+    Slot::Tex *combine = NULL;
+    loopv(sts)
+    {
+        Slot::Tex &c = sts[i];
+        if(c.combined == index)
+        {
+            combine = &c;
+            addname(key, *this, c, true);
+            break;
+        }
+    }
+    key.add('\0');
+    t.t = textures.access(key.getbuf());
+    if(t.t)
+    {
+        if(!index && t.t->type&Texture::PENDING) waittextureload(t.t);
+        return;
+    }
+    if(asynctextures)
+    {
+        t.t = queuetextureload(key.getbuf(), *this, t, combine);
+        if(!index) waittextureload(t.t);
+        return;
+    }
+    int compress = 0, wrap = 0;
+    ImageData ts;
+    if(!loadslottexture(ts, t.name, texturedir(), t.type, combine ? combine->name : NULL, combine ? combine->type : TEX_UNKNOWN, true, compress, wrap)) { t.t = notexture; return; }
     t.t = newtexture(NULL, key.getbuf(), ts, wrap, true, true, true, compress);
 }
 
@@ -3638,6 +3973,8 @@ GLuint lookupenvmap(ushort emid)
 void cleanuptexture(Texture *t)
 {
     DELETEA(t->alphamask);
+    // pending textures only borrow their placeholder
+    if(t->type&Texture::PENDING) { canceltextureload(t); t->id = 0; }
     if(t->id) { glDeleteTextures(1, &t->id); t->id = 0; }
     if(t->type&Texture::TRANSIENT) textures.remove(t->name);
 }
@@ -3650,6 +3987,7 @@ void cleanuptextures()
     loopi((MATF_VOLUME|MATF_INDEX)+1) materialslots[i].cleanup();
     loopv(decalslots) decalslots[i]->cleanup();
     enumerate(textures, Texture, tex, cleanuptexture(&tex));
+    loopi(TEX_UNKNOWN) cleanuptexture(&texplaceholders[i]);
 }
 
 bool reloadtexture(const char *name)
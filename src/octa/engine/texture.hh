@@ -572,6 +572,7 @@ struct Texture
         COMPRESSED = 1<<10,
         ALPHA      = 1<<11,
         MIRROR     = 1<<12,
+        PENDING    = 1<<13,
         FLAGS      = 0xFF00
     };
 
@@ -3,7 +3,7 @@
 #include "engine.hh"
 
 #ifndef STANDALONE
-string ofmname, ogzname, bakname, picname, entcfgname, entbakname, mediacfgname, mediabakname;
+string ofmname, ogzname, bakname, picname, entcfgname, entbakname, entbinname, entbinbakname, mediacfgname, mediabakname;
 
 VARP(savebak, 0, 2, 2);
 
@@ -14,6 +14,7 @@ void setmapfilenames(const char *fname, const char *cname = NULL)
     if(savebak==1) {
         formatstring(mediabakname, "media/map/%s/media.cfg.BAK", fname);
         formatstring(entbakname, "media/map/%s/entities.oct.BAK", fname);
+        formatstring(entbinbakname, "media/map/%s/entities.bin.BAK", fname);
         formatstring(bakname, "media/map/%s/map.BAK", fname);
     } else
     {
@@ -23,10 +24,12 @@ void setmapfilenames(const char *fname, const char *cname = NULL)
         baktime[min(len, sizeof(baktime)-1)] = '\0';
         formatstring(mediabakname, "media/map/%s/media.cfg_%s.BAK", fname, baktime);
         formatstring(entbakname, "media/map/%s/entities.oct_%s.BAK", fname, baktime);
+        formatstring(entbinbakname, "media/map/%s/entities.bin_%s.BAK", fname, baktime);
         formatstring(bakname, "media/map/%s/map_%s.BAK", fname, baktime);
     }
     formatstring(picname, "media/map/%s/preview.png", fname);
     formatstring(entcfgname, "media/map/%s/entities.oct", fname);
+    formatstring(entbinname, "media/map/%s/entities.bin", fname);
     formatstring(mediacfgname, "media/map/%s/media.cfg", fname);
 
     path(ofmname);
@@ -34,6 +37,7 @@ void setmapfilenames(const char *fname, const char *cname = NULL)
     path(bakname);
     path(picname);
     path(entcfgname);
+    path(entbinname);
     path(mediacfgname);
     path(mediabakname);
 }
@@ -60,125 +64,128 @@ struct polysurfacecompat
 
 static int savemapprogress = 0;
 
-void savec(cube *c, const ivec &o, int size, stream *f, bool nolms)
-{
-    if((savemapprogress++&0xFFF)==0) renderprogress(float(savemapprogress)/allocnodes, "saving octree...");
+void savec(cube *c, const ivec &o, int size, stream *f, bool nolms);
 
-    loopi(8)
+static void savecube(cube &c, const ivec &co, int size, stream *f, bool nolms)
+{
+    if(c.children)
     {
-        ivec co(i, o, size);
-        if(c[i].children)
-        {
-            f->putchar(OCTSAV_CHILDREN);
-            savec(c[i].children, co, size>>1, f, nolms);
-        }
+        f->putchar(OCTSAV_CHILDREN);
+        savec(c.children, co, size>>1, f, nolms);
+    }
+    else
+    {
+        int oflags = 0, surfmask = 0, totalverts = 0;
+        if(c.material!=MAT_AIR) oflags |= 0x40;
+        if(isempty(c)) f->putchar(oflags | OCTSAV_EMPTY);
         else
         {
-            int oflags = 0, surfmask = 0, totalverts = 0;
-            if(c[i].material!=MAT_AIR) oflags |= 0x40;
-            if(isempty(c[i])) f->putchar(oflags | OCTSAV_EMPTY);
-            else
+            if(!nolms)
             {
-                if(!nolms)
+                if(c.merged) oflags |= 0x80;
+                if(c.ext) loopj(6)
                 {
-                    if(c[i].merged) oflags |= 0x80;
-                    if(c[i].ext) loopj(6)
-                    {
-                        const surfaceinfo &surf = c[i].ext->surfaces[j];
-                        if(!surf.used()) continue;
-                        oflags |= 0x20;
-                        surfmask |= 1<<j;
-                        totalverts += surf.totalverts();
-                    }
+                    const surfaceinfo &surf = c.ext->surfaces[j];
+                    if(!surf.used()) continue;
+                    oflags |= 0x20;
+                    surfmask |= 1<<j;
+                    totalverts += surf.totalverts();
                 }
+            }
 
-                if(isentirelysolid(c[i])) f->putchar(oflags | OCTSAV_SOLID);
-                else
-                {
-                    f->putchar(oflags | OCTSAV_NORMAL);
-                    f->write(c[i].edges, 12);
-                }
+            if(isentirelysolid(c)) f->putchar(oflags | OCTSAV_SOLID);
+            else
+            {
+                f->putchar(oflags | OCTSAV_NORMAL);
+                f->write(c.edges, 12);
             }
+        }
 
-            loopj(6) f->putlil<ushort>(c[i].texture[j]);
+        loopj(6) f->putlil<ushort>(c.texture[j]);
 
-            if(oflags&0x40) f->putlil<ushort>(c[i].material);
-            if(oflags&0x80) f->putchar(c[i].merged);
-            if(oflags&0x20)
+        if(oflags&0x40) f->putlil<ushort>(c.material);
+        if(oflags&0x80) f->putchar(c.merged);
+        if(oflags&0x20)
+        {
+            f->putchar(surfmask);
+            f->putchar(totalverts);
+            loopj(6) if(surfmask&(1<<j))
             {
-                f->putchar(surfmask);
-                f->putchar(totalverts);
-                loopj(6) if(surfmask&(1<<j))
+                surfaceinfo surf = c.ext->surfaces[j];
+                vertinfo *verts = c.ext->verts() + surf.verts;
+                int layerverts = surf.numverts&MAXFACEVERTS, numverts = surf.totalverts(),
+                    vertmask = 0, vertorder = 0,
+                    dim = dimension(j), vc = C[dim], vr = R[dim];
+                if(numverts)
                 {
-                    surfaceinfo surf = c[i].ext->surfaces[j];
-                    vertinfo *verts = c[i].ext->verts() + surf.verts;
-                    int layerverts = surf.numverts&MAXFACEVERTS, numverts = surf.totalverts(),
-                        vertmask = 0, vertorder = 0,
-                        dim = dimension(j), vc = C[dim], vr = R[dim];
-                    if(numverts)
+                    if(c.merged&(1<<j))
                     {
-                        if(c[i].merged&(1<<j))
+                        vertmask |= 0x04;
+                        if(layerverts == 4)
                         {
-                            vertmask |= 0x04;
-                            if(layerverts == 4)
+                            ivec v[4] = { verts[0].getxyz(), verts[1].getxyz(), verts[2].getxyz(), verts[3].getxyz() };
+                            loopk(4)
                             {
-                                ivec v[4] = { verts[0].getxyz(), verts[1].getxyz(), verts[2].getxyz(), verts[3].getxyz() };
-                                loopk(4)
+                                const ivec &v0 = v[k], &v1 = v[(k+1)&3], &v2 = v[(k+2)&3], &v3 = v[(k+3)&3];
+                                if(v1[vc] == v0[vc] && v1[vr] == v2[vr] && v3[vc] == v2[vc] && v3[vr] == v0[vr])
                                 {
-                                    const ivec &v0 = v[k], &v1 = v[(k+1)&3], &v2 = v[(k+2)&3], &v3 = v[(k+3)&3];
-                                    if(v1[vc] == v0[vc] && v1[vr] == v2[vr] && v3[vc] == v2[vc] && v3[vr] == v0[vr])
-                                    {
-                                        vertmask |= 0x01;
-                                        vertorder = k;
-                                        break;
-                                    }
+                                    vertmask |= 0x01;
+                                    vertorder = k;
+                                    break;
                                 }
                             }
                         }
-                        else
-                        {
-                            int vis = visibletris(c[i], j, co, size);
-                            if(vis&4 || faceconvexity(c[i], j) < 0) vertmask |= 0x01;
-                            if(layerverts < 4 && vis&2) vertmask |= 0x02;
-                        }
-                        bool matchnorm = true;
-                        loopk(numverts)
-                        {
-                            const vertinfo &v = verts[k];
-                            if(v.norm) { vertmask |= 0x80; if(v.norm != verts[0].norm) matchnorm = false; }
-                        }
-                        if(matchnorm) vertmask |= 0x08;
                     }
-                    surf.verts = vertmask;
-                    f->write(&surf, sizeof(surf));
-                    bool hasxyz = (vertmask&0x04)!=0, hasnorm = (vertmask&0x80)!=0;
-                    if(layerverts == 4)
+                    else
                     {
-                        if(hasxyz && vertmask&0x01)
-                        {
-                            ivec v0 = verts[vertorder].getxyz(), v2 = verts[(vertorder+2)&3].getxyz();
-                            f->putlil<ushort>(v0[vc]); f->putlil<ushort>(v0[vr]);
-                            f->putlil<ushort>(v2[vc]); f->putlil<ushort>(v2[vr]);
-                            hasxyz = false;
-                        }
+                        int vis = visibletris(c, j, co, size);
+                        if(vis&4 || faceconvexity(c, j) < 0) vertmask |= 0x01;
+                        if(layerverts < 4 && vis&2) vertmask |= 0x02;
                     }
-                    if(hasnorm && vertmask&0x08) { f->putlil<ushort>(verts[0].norm); hasnorm = false; }
-                    if(hasxyz || hasnorm) loopk(layerverts)
+                    bool matchnorm = true;
+                    loopk(numverts)
                     {
-                        const vertinfo &v = verts[(k+vertorder)%layerverts];
-                        if(hasxyz)
-                        {
-                            ivec xyz = v.getxyz();
-                            f->putlil<ushort>(xyz[vc]); f->putlil<ushort>(xyz[vr]);
-                        }
-                        if(hasnorm) f->putlil<ushort>(v.norm);
+                        const vertinfo &v = verts[k];
+                        if(v.norm) { vertmask |= 0x80; if(v.norm != verts[0].norm) matchnorm = false; }
+                    }
+                    if(matchnorm) vertmask |= 0x08;
+                }
+                surf.verts = vertmask;
+                f->write(&surf, sizeof(surf));
+                bool hasxyz = (vertmask&0x04)!=0, hasnorm = (vertmask&0x80)!=0;
+                if(layerverts == 4)
+                {
+                    if(hasxyz && vertmask&0x01)
+                    {
+                        ivec v0 = verts[vertorder].getxyz(), v2 = verts[(vertorder+2)&3].getxyz();
+                        f->putlil<ushort>(v0[vc]); f->putlil<ushort>(v0[vr]);
+                        f->putlil<ushort>(v2[vc]); f->putlil<ushort>(v2[vr]);
+                        hasxyz = false;
                     }
                 }
+                if(hasnorm && vertmask&0x08) { f->putlil<ushort>(verts[0].norm); hasnorm = false; }
+                if(hasxyz || hasnorm) loopk(layerverts)
+                {
+                    const vertinfo &v = verts[(k+vertorder)%layerverts];
+                    if(hasxyz)
+                    {
+                        ivec xyz = v.getxyz();
+                        f->putlil<ushort>(xyz[vc]); f->putlil<ushort>(xyz[vr]);
+                    }
+                    if(hasnorm) f->putlil<ushort>(v.norm);
+                }
             }
         }
     }
 }
 
+void savec(cube *c, const ivec &o, int size, stream *f, bool nolms)
+{
+    if((savemapprogress++&0xFFF)==0) renderprogress(float(savemapprogress)/allocnodes, "saving octree...");
+
+    loopi(8) savecube(c[i], ivec(i, o, size), size, f, nolms);
+}
+
 cube *loadchildren(stream *f, const ivec &co, int size, bool &failed);
 
 void loadc(stream *f, cube &c, const ivec &co, int size, bool &failed)
@@ -445,12 +452,364 @@ void loadvslots(stream *f, int numvslots)
     delete[] prev;
 }
 
-static void export_ents() {
-    if(savebak) backup(entcfgname, entbakname);
-    stream *f = openutf8file(entcfgname, "w");
+// chunked maps: the octree is cut into subtrees at mapchunkdepth, each compressed
+// on its own behind an offset table so that loading can inflate and parse them
+// on several threads; the first chunk holds everything the old format keeps
+// ahead of the octree plus the split bits of the top levels, the last one the
+// pvs and blendmap
+
+#define MAPCHUNKVERSION 1
+#define MAXMAPCHUNKDEPTH 4
+#define MAXMAPCHUNKRAW (1<<28)  // largest inflated chunk a map may claim
+#define MAXMAPCHUNKRATIO 16     // log2 of the best ratio either codec can reach, zstd RLE included
+
+// 0 keeps saving the plain format older builds can read, chunked maps are opt-in
+VARP(mapchunkdepth, 0, 0, MAXMAPCHUNKDEPTH);
+VARP(mapthreads, 0, 0, 16);
+
+struct mapchunkheader
+{
+    char magic[4];              // "OFMC"
+    int version;
+    int depth;
+    int numchunks;
+};
+
+struct mapchunk
+{
+    uint offset, size, rawsize; // offset is from the end of the chunk table
+
+    // the table comes straight from the file, never allocate what it claims blindly
+    bool valid() const
+    {
+        if(!rawsize) return true;
+        return rawsize <= MAXMAPCHUNKRAW && size && rawsize <= (ullong(size)<<MAXMAPCHUNKRATIO);
+    }
+};
+
+struct mapchunks
+{
+    int depth;
+    vector<mapchunk> chunks;
+    vector<uchar> data;
+    uint crc;
+
+    mapchunks() : depth(0), crc(0) {}
+
+    bool inflate(int i, memstream &buf)
+    {
+        const mapchunk &c = chunks[i];
+        buf.reset();
+        if(!c.rawsize) return true;
+        if(!c.valid()) return false;
+        if(!uncompressbuf(buf.data.reserve(c.rawsize).buf, c.rawsize, &data[c.offset], c.size)) return false;
+        buf.data.advance(c.rawsize);
+        return true;
+    }
+};
+
+static void putmapchunk(vector<uchar> &data, vector<mapchunk> &chunks, const memstream &buf)
+{
+    mapchunk &c = chunks.add();
+    c.offset = data.length();
+    c.rawsize = buf.data.length();
+    compressbuf(data, buf.data.getbuf(), buf.data.length());
+    c.size = data.length() - c.offset;
+}
+
+struct mapchunkroot
+{
+    cube *c;
+    ivec o;
+    int size, nodes;
+    uint crc;
+    bool failed;
+};
+
+static void splitmapchunks(cube *c, const ivec &o, int size, int depth, memstream &head, vector<mapchunkroot> &roots)
+{
+    loopi(8)
+    {
+        ivec co(i, o, size);
+        if(c[i].children && depth > 1)
+        {
+            head.putchar(1);
+            splitmapchunks(c[i].children, co, size>>1, depth-1, head, roots);
+        }
+        else
+        {
+            head.putchar(0);
+            mapchunkroot &r = roots.add();
+            r.c = &c[i];
+            r.o = co;
+            r.size = size;
+        }
+    }
+}
+
+static bool savemapchunks(stream *f, const uchar *head, int headlen, bool nolms, int depth)
+{
+    vector<uchar> data;
+    vector<mapchunk> chunks;
+    vector<mapchunkroot> roots;
+    memstream buf;
+    if(headlen) buf.write(head, headlen);
+    splitmapchunks(worldroot, ivec(0, 0, 0), worldsize>>1, depth, buf, roots);
+    putmapchunk(data, chunks, buf);
+
+    renderprogress(0, "saving octree...");
+    loopv(roots)
+    {
+        buf.reset();
+        savecube(*roots[i].c, roots[i].o, roots[i].size, &buf, nolms);
+        putmapchunk(data, chunks, buf);
+    }
+
+    buf.reset();
+    if(!nolms && getnumviewcells()>0) { renderprogress(0, "saving pvs..."); savepvs(&buf); }
+    if(shouldsaveblendmap()) { renderprogress(0, "saving blendmap..."); saveblendmap(&buf); }
+    putmapchunk(data, chunks, buf);
+
+    mapchunkheader hdr;
+    memcpy(hdr.magic, "OFMC", 4);
+    hdr.version = MAPCHUNKVERSION;
+    hdr.depth = depth;
+    hdr.numchunks = chunks.length();
+    lilswap(&hdr.version, 3);
+    f->write(&hdr, sizeof(hdr));
+    loopv(chunks)
+    {
+        f->putlil<uint>(chunks[i].offset);
+        f->putlil<uint>(chunks[i].size);
+        f->putlil<uint>(chunks[i].rawsize);
+    }
+    return f->write(data.getbuf(), data.length()) == size_t(data.length());
+}
+
+// writes the octree, pvs and blendmap after an already serialized header, vars and slots
+static bool writemapfile(const char *fname, const uchar *head, int headlen, bool nolms)
+{
+    if(mapchunkdepth)
+    {
+        stream *f = openfile(fname, "wb");
+        if(!f) return false;
+        bool ok = savemapchunks(f, head, headlen, nolms, mapchunkdepth);
+        delete f;
+        return ok;
+    }
+    stream *f = opencompressedfile(fname, "wb");
+    if(!f) return false;
+    f->write(head, headlen);
+    renderprogress(0, "saving octree...");
+    savec(worldroot, ivec(0, 0, 0), worldsize>>1, f, nolms);
+    if(!nolms && getnumviewcells()>0) { renderprogress(0, "saving pvs..."); savepvs(f); }
+    if(shouldsaveblendmap()) { renderprogress(0, "saving blendmap..."); saveblendmap(f); }
+    delete f;
+    return true;
+}
+
+static bool readmapchunks(stream *f, mapchunks &mc, memstream &head)
+{
+    mapchunkheader hdr;
+    if(f->read(&hdr.version, 3*sizeof(int)) != 3*sizeof(int)) return false;
+    lilswap(&hdr.version, 3);
+    if(hdr.version != MAPCHUNKVERSION || hdr.depth < 1 || hdr.depth > MAXMAPCHUNKDEPTH ||
+       hdr.numchunks < 2 || hdr.numchunks > (1<<(3*hdr.depth)) + 2)
+        return false;
+    mc.depth = hdr.depth;
+    mc.chunks.setsize(0);
+    loopi(hdr.numchunks)
+    {
+        mapchunk &c = mc.chunks.add();
+        c.offset = f->getlil<uint>();
+        c.size = f->getlil<uint>();
+        c.rawsize = f->getlil<uint>();
+    }
+    mc.data.setsize(0);
+    for(;;)
+    {
+        databuf<uchar> buf = mc.data.reserve(1<<16);
+        size_t len = f->read(buf.buf, buf.maxlen);
+        if(!len) break;
+        mc.data.advance(int(len));
+    }
+    loopv(mc.chunks)
+    {
+        const mapchunk &c = mc.chunks[i];
+        if(c.offset > uint(mc.data.length()) || c.size > uint(mc.data.length()) - c.offset || !c.valid()) return false;
+    }
+    if(!mc.inflate(0, head)) return false;
+    mc.crc = crc32(0, head.data.getbuf(), head.data.length());
+    return true;
+}
+
+// opens either format and hands back a stream positioned at the map header;
+// for chunked maps that is the inflated first chunk and the rest stays in mc
+static stream *openmap(const char *mapname, mapchunks &mc)
+{
+    stream *f = openfile(mapname, "rb");
+    if(!f) return NULL;
+    char magic[4];
+    if(f->read(magic, 4) != 4 || memcmp(magic, "OFMC", 4))
+    {
+        delete f;
+        mc.depth = 0;
+        return opencompressedfile(mapname, "rb");
+    }
+    memstream *head = new memstream;
+    bool ok = readmapchunks(f, mc, *head);
+    delete f;
+    if(!ok)
+    {
+        conoutf(CON_ERROR, "map %s has malformatted chunks", mapname);
+        delete head;
+        return NULL;
+    }
+    return head;
+}
+
+static cube *loadmapsplits(stream *f, const ivec &co, int size, int depth, vector<mapchunkroot> &roots, bool &failed)
+{
+    cube *c = newcubes();
+    loopi(8)
+    {
+        ivec o(i, co, size);
+        int split = f->getchar();
+        if(split == 1 && depth > 1) c[i].children = loadmapsplits(f, o, size>>1, depth-1, roots, failed);
+        else if(!split)
+        {
+            mapchunkroot &r = roots.add();
+            r.c = &c[i];
+            r.o = o;
+            r.size = size;
+            r.nodes = 0;
+            r.crc = 0;
+            r.failed = false;
+        }
+        else failed = true;
+        if(failed) break;
+    }
+    return c;
+}
+
+static mapchunks *loadingchunks = NULL;
+static vector<mapchunkroot> *loadingroots = NULL;
+static SDL_mutex *mapchunkmutex = NULL;
+static SDL_cond *mapchunkcond = NULL;
+static int mapchunkpos = 0, mapchunksdone = 0;
+
+static void loadmapchunk(int i)
+{
+    mapchunkroot &r = (*loadingroots)[i];
+    memstream buf;
+    if(!loadingchunks->inflate(i+1, buf)) { r.failed = true; return; }
+    r.crc = crc32(0, buf.data.getbuf(), buf.data.length());
+    setnodecounter(&r.nodes);
+    loadc(&buf, *r.c, r.o, r.size, r.failed);
+    setnodecounter(NULL);
+    if(!buf.end()) r.failed = true;
+}
+
+static int mapchunkworker(void *data)
+{
+    SDL_LockMutex(mapchunkmutex);
+    while(mapchunkpos < loadingroots->length())
+    {
+        int i = mapchunkpos++;
+        SDL_UnlockMutex(mapchunkmutex);
+        loadmapchunk(i);
+        SDL_LockMutex(mapchunkmutex);
+        mapchunksdone++;
+        SDL_CondSignal(mapchunkcond);
+    }
+    SDL_UnlockMutex(mapchunkmutex);
+    return 0;
+}
+
+static cube *loadmapoctree(stream *f, mapchunks &mc, int worldsize, bool &failed, bool progress = true)
+{
+    if(!mc.depth) return loadchildren(f, ivec(0, 0, 0), worldsize>>1, failed);
+
+    vector<mapchunkroot> roots;
+    cube *root = loadmapsplits(f, ivec(0, 0, 0), worldsize>>1, mc.depth, roots, failed);
+    if(failed || roots.length() != mc.chunks.length()-2) { failed = true; return root; }
+
+    loadingchunks = &mc;
+    loadingroots = &roots;
+    int numthreads = min(mapthreads > 0 ? mapthreads : numcpus, roots.length());
+    if(numthreads <= 1) loopv(roots) loadmapchunk(i);
+    else
+    {
+        if(!mapchunkmutex) mapchunkmutex = SDL_CreateMutex();
+        if(!mapchunkcond) mapchunkcond = SDL_CreateCond();
+        mapchunkpos = mapchunksdone = 0;
+        vector<SDL_Thread *> threads;
+        loopi(numthreads) threads.add(SDL_CreateThread(mapchunkworker, "map chunk loader", NULL));
+        SDL_LockMutex(mapchunkmutex);
+        while(mapchunksdone < roots.length())
+        {
+            int done = mapchunksdone;
+            SDL_UnlockMutex(mapchunkmutex);
+            if(progress) renderprogress(done/float(roots.length()), "loading octree...");
+            SDL_LockMutex(mapchunkmutex);
+            if(mapchunksdone == done) SDL_CondWaitTimeout(mapchunkcond, mapchunkmutex, 100);
+        }
+        SDL_UnlockMutex(mapchunkmutex);
+        loopv(threads) SDL_WaitThread(threads[i], NULL);
+    }
+    loadingchunks = NULL;
+    loadingroots = NULL;
+
+    // merge in chunk order so the crc matches the inflated map as a whole
+    loopv(roots)
+    {
+        const mapchunkroot &r = roots[i];
+        allocnodes += r.nodes;
+        mc.crc = crc32_combine(mc.crc, r.crc, mc.chunks[i+1].rawsize);
+        if(r.failed) failed = true;
+    }
+    return root;
+}
+
+// pvs and blendmap follow the octree in the old format and get their own chunk otherwise
+static stream *openmaptail(stream *f, mapchunks &mc)
+{
+    if(!mc.depth) return f;
+    memstream *tail = new memstream;
+    if(!mc.inflate(mc.chunks.length()-1, *tail)) { delete tail; return NULL; }
+    mc.crc = crc32_combine(mc.crc, crc32(0, tail->data.getbuf(), tail->data.length()), tail->data.length());
+    return tail;
+}
+
+// entities go out as a binary store next to the map: one record per entity,
+// its class name followed by its state data packed as MessagePack by the
+// scripts, streamed through entity_store_put so no single big string is built;
+// an empty name ends the records and is followed by their count
+
+#define ENTSTOREVERSION 2
+
+VARP(saveentitiestext, 0, 0, 1);
+
+static stream *entstore = NULL;
+static int entstorecount = 0;
+
+CLUAICOMMAND(entity_store_put, bool, (const char *name, const char *data, int len), {
+    if(!entstore) return false;
+    int nlen = strlen(name);
+    if(!nlen || nlen >= MAXSTRLEN || len < 0) return false;
+    entstore->putlil<ushort>(nlen);
+    entstore->write(name, nlen);
+    entstore->putlil<uint>(len);
+    if(entstore->write(data, len) != size_t(len)) return false;
+    entstorecount++;
+    return true;
+});
+
+static void export_ents_text(const char *fname) {
+    stream *f = openutf8file(fname, "w");
     if  (!f) {
         logger::log(logger::ERROR, "Cannot open file %s for writing.",
-            entcfgname);
+            fname);
         return;
     }
     const char *data;
@@ -460,13 +819,94 @@ static void export_ents() {
     delete f;
 }
 
+static void export_ents() {
+    if(savebak) backup(entbinname, entbinbakname);
+    stream *f = opencompressedfile(entbinname, "wb");
+    if  (!f) {
+        logger::log(logger::ERROR, "Cannot open file %s for writing.",
+            entbinname);
+        return;
+    }
+    f->write("OFEB", 4);
+    f->putlil<int>(ENTSTOREVERSION);
+    entstore = f;
+    entstorecount = 0;
+    lua::L->call_external("entities_save_binary", "");
+    entstore = NULL;
+    f->putlil<ushort>(0);
+    f->putlil<int>(entstorecount);
+    delete f;
+
+    if(saveentitiestext) {
+        if(savebak) backup(entcfgname, entbakname);
+        export_ents_text(entcfgname);
+    }
+}
+
+static bool import_ents(const char *fname) {
+    stream *f = opencompressedfile(fname, "rb");
+    if  (!f) return false;
+    char magic[4];
+    if(f->read(magic, 4) != 4 || memcmp(magic, "OFEB", 4) || f->getlil<int>() != ENTSTOREVERSION) {
+        conoutf(CON_ERROR, "entity store %s has an unsupported format", fname);
+        delete f;
+        return false;
+    }
+    // the whole store is read and checked before any entity is created, so a
+    // damaged one makes load_world fall back to the text entities cleanly
+    struct entrecord { int name, data, len; };
+    vector<entrecord> records;
+    vector<char> names, data;
+    bool ok = false;
+    for(;;) {
+        ushort nlen;
+        if(f->read(&nlen, sizeof(nlen)) != sizeof(nlen)) break;
+        nlen = lilswap(nlen);
+        if(!nlen) {
+            int count;
+            ok = f->read(&count, sizeof(count)) == sizeof(count) &&
+                 lilswap(count) == records.length();
+            break;
+        }
+        uint len;
+        if(nlen >= MAXSTRLEN || f->read(names.reserve(nlen + 1).buf, nlen) != size_t(nlen) ||
+           f->read(&len, sizeof(len)) != sizeof(len) || (len = lilswap(len)) > (1U<<30))
+            break;
+        entrecord &r = records.add();
+        r.name = names.length();
+        names.advance(nlen);
+        names.add('\0');
+        r.data = data.length();
+        r.len = int(len);
+        if(f->read(data.reserve(len).buf, len) != len) break;
+        data.advance(len);
+    }
+    delete f;
+    if(!ok) {
+        conoutf(CON_ERROR, "garbage in entity store %s", fname);
+        return false;
+    }
+    loopv(records) {
+        const entrecord &r = records[i];
+        lua::L->call_external("entity_load_packed", "sS", names.getbuf() + r.name, data.getbuf() + r.data, r.len);
+    }
+    logger::log(logger::DEBUG, "loaded %d entities from %s", records.length(), fname);
+    return true;
+}
+
+void exportentities(const char *fname) {
+    if(!*fname) fname = entcfgname;
+    export_ents_text(fname);
+}
+COMMAND(exportentities, "s");
+
 bool save_world(const char *mname, bool nolms)
 {
     if(!*mname) mname = game::getclientmap();
     setmapfilenames(*mname ? mname : "untitled");
     if(savebak) backup(ofmname, bakname);
-    stream *f = opengzfile(ofmname, "wb");
-    if(!f) { conoutf(CON_WARN, "could not write map to %s", ofmname); return false; }
+    memstream head;
+    stream *f = &head;
 
     int numvslots = vslots.length();
     if(!nolms && !multiplayer(false))
@@ -527,16 +967,7 @@ bool save_world(const char *mname, bool nolms)
 
     savevslots(f, numvslots);
 
-    renderprogress(0, "saving octree...");
-    savec(worldroot, ivec(0, 0, 0), worldsize>>1, f, nolms);
-
-    if(!nolms)
-    {
-        if(getnumviewcells()>0) { renderprogress(0, "saving pvs..."); savepvs(f); }
-    }
-    if(shouldsaveblendmap()) { renderprogress(0, "saving blendmap..."); saveblendmap(f); }
-
-    delete f;
+    if(!writemapfile(ofmname, head.data.getbuf(), head.data.length(), nolms)) { conoutf(CON_WARN, "could not write map to %s", ofmname); return false; }
     extern void writemediacfg(int level);
     writemediacfg(0);
     export_ents();
@@ -597,10 +1028,12 @@ struct tessentity
 bool load_world(const char *mname, const char *cname)        // still supports all map formats that have existed since the earliest cube betas!
 {
     int loadingstart = SDL_GetTicks();
+    resettextureloads(loadingstart);
     setmapfilenames(mname, cname);
     const char *mapname = ofmname;
-    stream *f = opengzfile(mapname, "rb");
-    if(!f) { mapname = ogzname; f = opengzfile(mapname, "rb"); }
+    mapchunks mc;
+    stream *f = openmap(mapname, mc);
+    if(!f) { mapname = ogzname; f = openmap(mapname, mc); }
     if(!f) { conoutf(CON_ERROR, "could not read map %s", ofmname); return false; }
 
     mapheader hdr;
@@ -801,7 +1234,7 @@ bool load_world(const char *mname, const char *cname)        // still supports a
 
     renderprogress(0, "loading octree...");
     bool failed = false;
-    worldroot = loadchildren(f, ivec(0, 0, 0), hdr.worldsize>>1, failed);
+    worldroot = loadmapoctree(f, mc, hdr.worldsize, failed);
     if(failed) conoutf(CON_ERROR, "garbage in map");
 
     renderprogress(0, "validating...");
@@ -809,11 +1242,17 @@ bool load_world(const char *mname, const char *cname)        // still supports a
 
     if(!failed)
     {
-        if(hdr.numpvs > 0) loadpvs(f, hdr.numpvs);
-        if(hdr.blendmap) loadblendmap(f, hdr.blendmap);
+        stream *t = openmaptail(f, mc);
+        if(!t) conoutf(CON_ERROR, "garbage in map");
+        else
+        {
+            if(hdr.numpvs > 0) loadpvs(t, hdr.numpvs);
+            if(hdr.blendmap) loadblendmap(t, hdr.blendmap);
+            if(t != f) delete t;
+        }
     }
 
-    mapcrc = f->getcrc();
+    mapcrc = mc.depth ? mc.crc : f->getcrc();
     delete f;
 
     extern void clear_texpacks(int n = 0); clear_texpacks();
@@ -823,10 +1262,12 @@ bool load_world(const char *mname, const char *cname)        // still supports a
     execfile(mediacfgname, false);
     identflags &= ~IDF_OVERRIDDEN;
 
-    char *eloaded = loadfile(entcfgname, NULL);
-    if (eloaded) {
-        lua::L->call_external("entities_load", "s", eloaded);
-        delete[] eloaded;
+    if (!import_ents(entbinname)) {
+        char *eloaded = loadfile(entcfgname, NULL);
+        if (eloaded) {
+            lua::L->call_external("entities_load", "s", eloaded);
+            delete[] eloaded;
+        }
     }
 
     renderprogress(0, "requesting entities...");
@@ -851,12 +1292,174 @@ bool load_world(const char *mname, const char *cname)        // still supports a
     return true;
 }
 
+// parses the current octree from memory in both formats, the way load_world would
+static void maploadbench(int *depth, int *iters)
+{
+    int chunkdepth = clamp(*depth > 0 ? *depth : (mapchunkdepth ? mapchunkdepth : 2), 1, MAXMAPCHUNKDEPTH), n = max(*iters, 1);
+    memstream legacy, chunked;
+    stream *gz = opengzfile(NULL, "wb", &legacy);
+    if(!gz) return;
+    savemapprogress = 0;
+    savec(worldroot, ivec(0, 0, 0), worldsize>>1, gz, false);
+    delete gz;
+    savemapchunks(&chunked, NULL, 0, false, chunkdepth);
+
+    int legacymillis = 0, chunkedmillis = 0, numchunks = 0;
+    bool failed = false;
+    loopi(n)
+    {
+        legacy.pos = 0;
+        int start = SDL_GetTicks();
+        stream *f = opengzfile(NULL, "rb", &legacy);
+        cube *c = f ? loadchildren(f, ivec(0, 0, 0), worldsize>>1, failed) : NULL;
+        delete f;
+        legacymillis += SDL_GetTicks() - start;
+        if(!c) failed = true;
+        freeocta(c);
+
+        chunked.pos = 4;
+        start = SDL_GetTicks();
+        mapchunks mc;
+        memstream head;
+        c = readmapchunks(&chunked, mc, head) ? loadmapoctree(&head, mc, worldsize, failed, false) : NULL;
+        chunkedmillis += SDL_GetTicks() - start;
+        if(!c) failed = true;
+        numchunks = mc.chunks.length();
+        freeocta(c);
+    }
+    if(failed) conoutf(CON_ERROR, "maploadbench: garbage in map");
+    int numthreads = min(mapthreads > 0 ? mapthreads : numcpus, max(numchunks-2, 1));
+    conoutf("maploadbench: %d nodes, legacy %d KB %.1f ms, chunked (depth %d, %d chunks, %d threads) %d KB %.1f ms, %.2fx",
+        allocnodes, legacy.data.length()>>10, legacymillis/float(n),
+        chunkdepth, numchunks, numthreads, chunked.data.length()>>10, chunkedmillis/float(n),
+        chunkedmillis ? legacymillis/float(chunkedmillis) : 0.0f);
+}
+COMMAND(maploadbench, "ii");
+
 void savecurrentmap() { save_world(game::getclientmap()); }
 void savemap(char *mname) { save_world(mname); }
 
 COMMAND(savemap, "s");
 COMMAND(savecurrentmap, "");
 
+static bool printpvsprogress(int processed, int total, int unique)
+{
+    static int lastpercent = -1;
+    int percent = total > 0 ? int(processed*100LL/total) : 100;
+    if(!processed) lastpercent = -1;
+    if(percent/10 != lastpercent/10)
+    {
+        logoutf("pvs: %d%% - %d of %d view cells (%d unique)", percent, processed, total, unique);
+        lastpercent = percent;
+    }
+    return true;
+}
+
+const char * const bakestagenames[NUMBAKESTAGES] = { "load", "remip", "blendmap", "pvs", "save" };
+
+// bakes a map straight from its octree without a window, GL context or
+// scripting; vars, texture MRU and vslots are copied through untouched
+bool bakemap(const char *mname, int stages, int viewcellsize, int *millis)
+{
+    int stagemillis[NUMBAKESTAGES];
+    memset(stagemillis, 0, sizeof(stagemillis));
+    if(!millis) millis = stagemillis;
+    else memset(millis, 0, NUMBAKESTAGES*sizeof(int));
+    int stagestart = SDL_GetTicks();
+    #define ENDBAKESTAGE(stage) do { int now = SDL_GetTicks(); millis[stage] = now - stagestart; stagestart = now; } while(0)
+
+    setmapfilenames(mname);
+    const char *mapname = ofmname;
+    mapchunks mc;
+    stream *f = openmap(mapname, mc);
+    if(!f) { mapname = ogzname; f = openmap(mapname, mc); }
+    if(!f) { conoutf(CON_ERROR, "could not read map %s", ofmname); return false; }
+
+    mapheader hdr;
+    tmapheader thdr;
+    int numents;
+    bool foreign;
+    if(!loadmapheader(f, mapname, hdr, thdr, numents, foreign)) { delete f; return false; }
+    if(foreign) { conoutf(CON_ERROR, "map %s must be saved by OctaForge before baking", mapname); delete f; return false; }
+
+    freeocta(worldroot);
+    worldroot = NULL;
+    clearpvs();
+    resetblendmap();
+
+    setvar("mapsize", hdr.worldsize, true, false);
+    int worldscale = 0;
+    while(1<<worldscale < hdr.worldsize) worldscale++;
+    setvar("mapscale", worldscale, true, false);
+
+    loopi(hdr.numvars)
+    {
+        int type = f->getchar(), ilen = f->getlil<ushort>();
+        f->seek(ilen, SEEK_CUR);
+        switch(type)
+        {
+            case ID_VAR: f->getlil<int>(); break;
+            case ID_FVAR: f->getlil<float>(); break;
+            case ID_SVAR: f->seek(f->getlil<ushort>(), SEEK_CUR); break;
+        }
+    }
+    ushort nummru = f->getlil<ushort>();
+    loopi(nummru) f->getlil<ushort>();
+
+    vslots.deletecontents();
+    loadvslots(f, hdr.numvslots);
+    int headlen = int(f->tell());
+
+    bool failed = false;
+    worldroot = loadmapoctree(f, mc, hdr.worldsize, failed);
+    stream *t = failed ? NULL : openmaptail(f, mc);
+    if(!t) { conoutf(CON_ERROR, "garbage in map %s", mapname); delete f; return false; }
+    validatec(worldroot, hdr.worldsize>>1);
+    if(hdr.numpvs > 0) loadpvs(t, hdr.numpvs);
+    if(hdr.blendmap) loadblendmap(t, hdr.blendmap);
+    if(t != f) delete t;
+    delete f;
+
+    f = openmap(mapname, mc);
+    if(!f) { conoutf(CON_ERROR, "could not read map %s", mapname); return false; }
+    vector<uchar> head;
+    head.advance(int(f->read(head.reserve(headlen).buf, headlen)));
+    delete f;
+    if(head.length() != headlen) { conoutf(CON_ERROR, "map %s changed while baking", mapname); return false; }
+    ENDBAKESTAGE(BAKESTAGE_LOAD);
+
+    if(stages&(1<<BAKESTAGE_REMIP))
+    {
+        remip();
+        ENDBAKESTAGE(BAKESTAGE_REMIP);
+    }
+    if(stages&(1<<BAKESTAGE_BLENDMAP))
+    {
+        optimizeblendmap();
+        ENDBAKESTAGE(BAKESTAGE_BLENDMAP);
+    }
+    if(stages&(1<<BAKESTAGE_PVS))
+    {
+        if(!buildpvs(viewcellsize, printpvsprogress)) return false;
+        ENDBAKESTAGE(BAKESTAGE_PVS);
+    }
+
+    int numpvs = getnumviewcells(), blendmap = shouldsaveblendmap();
+    lilswap(&numpvs, 1);
+    lilswap(&blendmap, 1);
+    memcpy(&head[offsetof(mapheader, numpvs)], &numpvs, sizeof(numpvs));
+    memcpy(&head[offsetof(mapheader, blendmap)], &blendmap, sizeof(blendmap));
+
+    if(savebak) backup(mapname, bakname);
+    savemapprogress = 0;
+    if(!writemapfile(mapname, head.getbuf(), head.length(), false)) { conoutf(CON_WARN, "could not write map to %s", mapname); return false; }
+    ENDBAKESTAGE(BAKESTAGE_SAVE);
+    #undef ENDBAKESTAGE
+
+    conoutf("wrote map file %s", mapname);
+    return true;
+}
+
 void writeobj(char *name)
 {
     defformatstring(fname, "%s.obj", name);
@@ -1,6 +1,6 @@
 #include "game.hh"
 
-extern int cursor_exists;
+extern int cursor_exists, saveentitiestext;
 extern void clearshadowcache();
 
 namespace game
@@ -713,6 +713,17 @@ namespace game
         return true;
     }
 
+    int posproto = POSPROTO_LEGACY, posacked = -1;
+    poshistory posin, posout;
+
+    void resetposproto(int proto = POSPROTO_LEGACY)
+    {
+        posproto = proto;
+        posacked = -1;
+        posin.reset();
+        posout.reset();
+    }
+
     void connectattempt(const char *name, const char *password, const ENetAddress &address)
     {
         copystring(connectpass, password);
@@ -732,6 +743,7 @@ namespace game
     {
         if(remote) stopfollowing();
         ignores.setsize(0);
+        resetposproto();
         connected = remote = false;
         player1->clientnum = -1;
         if(editmode) toggleedit();
@@ -819,6 +831,42 @@ namespace game
         }
     }
 
+    static void getposstate(gameent *d, posstate &s)
+    {
+        s.physstate = d->physstate | ((d->lifesequence&1)<<3) | ((d->move&3)<<4) | ((d->strafe&3)<<6);
+        s.seto(vec(d->o.x, d->o.y, d->o.z-d->eyeheight));
+        s.setvel(d->vel);
+        s.setfalling(d->falling);
+        s.setyaw(d->yaw);
+        s.setpitch(d->pitch);
+        s.setroll(d->roll);
+        s.flags = 0;
+        if((lookupmaterial(d->feetpos())&MATF_CLIP) == MAT_GAMECLIP) s.flags |= POSF_GAMECLIP;
+        if(d->crouching < 0) s.flags |= POSF_CROUCH;
+    }
+
+    static void sendposdelta()
+    {
+        vector<posentry> ents;
+        loopv(players)
+        {
+            gameent *d = players[i];
+            if((d == player1 || d->ai) && (d->state == CS_ALIVE || d->state == CS_EDITING))
+            {
+                posentry &e = ents.add();
+                e.cn = d->clientnum;
+                getposstate(d, e.s);
+            }
+        }
+        // an empty snapshot still carries the ack for the server's snapshots
+        if(ents.empty() && posacked == posin.seq) return;
+        packetbuf q(100);
+        putint(q, N_POSDELTA);
+        putpossnapshot(q, posout, posin.seq, ents, NULL, player1->clientnum);
+        posacked = posin.seq;
+        sendclientpacket(q.finalize(), 0);
+    }
+
     void sendposition(gameent *d, bool reliable)
     {
         if(d->state != CS_ALIVE && d->state != CS_EDITING) return;
@@ -829,6 +877,7 @@ namespace game
 
     void sendpositions()
     {
+        if(posproto == POSPROTO_DELTA) { sendposdelta(); return; }
         loopv(players)
         {
             gameent *d = players[i];
@@ -916,6 +965,7 @@ namespace game
             sendstring("", p);
             sendstring("", p);
         }
+        putint(p, POSPROTO_MAX);
         sendclientpacket(p.finalize(), 1);
     }
 
@@ -944,6 +994,53 @@ namespace game
         }
     }
 
+    static gameent *positiontarget(int cn, int physstate)
+    {
+        int seqcolor = (physstate>>3)&1;
+        gameent *d = getclient(cn);
+        if(!d || d->lifesequence < 0 || seqcolor!=(d->lifesequence&1) || d->state==CS_DEAD) return NULL;
+        return d;
+    }
+
+    static void setposition(gameent *d, int physstate, bool crouching, const vec &o, const vec &vel, const vec &falling, float yaw, float pitch, float roll)
+    {
+        float oldyaw = d->yaw, oldpitch = d->pitch, oldroll = d->roll;
+        d->yaw = yaw;
+        d->pitch = pitch;
+        d->roll = roll;
+        d->move = (physstate>>4)&2 ? -1 : (physstate>>4)&1;
+        d->strafe = (physstate>>6)&2 ? -1 : (physstate>>6)&1;
+        d->crouching = crouching ? -1 : abs(d->crouching);
+        vec oldpos(d->o);
+        d->o = o;
+        d->o.z += d->eyeheight;
+        d->vel = vel;
+        d->falling = falling;
+        d->physstate = physstate&7;
+        updatephysstate(d);
+        updatepos(d);
+        if(smoothmove && d->smoothmillis>=0 && oldpos.dist(d->o) < smoothdist)
+        {
+            d->newpos = d->o;
+            d->newyaw = d->yaw;
+            d->newpitch = d->pitch;
+            d->newroll = d->roll;
+            d->o = oldpos;
+            d->yaw = oldyaw;
+            d->pitch = oldpitch;
+            d->roll = oldroll;
+            (d->deltapos = oldpos).sub(d->newpos);
+            d->deltayaw = oldyaw - d->newyaw;
+            if(d->deltayaw > 180) d->deltayaw -= 360;
+            else if(d->deltayaw < -180) d->deltayaw += 360;
+            d->deltapitch = oldpitch - d->newpitch;
+            d->deltaroll = oldroll - d->newroll;
+            d->smoothmillis = lastmillis;
+        }
+        else d->smoothmillis = 0;
+        if(d->state==CS_LAGGED || d->state==CS_SPAWNING) d->state = CS_ALIVE;
+    }
+
     void parsepositions(ucharbuf &p)
     {
         int type;
@@ -980,44 +1077,24 @@ namespace game
                     falling.mul(mag/DVELF);
                 }
                 else falling = vec(0, 0, 0);
-                int seqcolor = (physstate>>3)&1;
-                gameent *d = getclient(cn);
-                if(!d || d->lifesequence < 0 || seqcolor!=(d->lifesequence&1) || d->state==CS_DEAD) continue;
-                float oldyaw = d->yaw, oldpitch = d->pitch, oldroll = d->roll;
-                d->yaw = yaw;
-                d->pitch = pitch;
-                d->roll = roll;
-                d->move = (physstate>>4)&2 ? -1 : (physstate>>4)&1;
-                d->strafe = (physstate>>6)&2 ? -1 : (physstate>>6)&1;
-                d->crouching = (flags&(1<<8))!=0 ? -1 : abs(d->crouching);
-                vec oldpos(d->o);
-                d->o = o;
-                d->o.z += d->eyeheight;
-                d->vel = vel;
-                d->falling = falling;
-                d->physstate = physstate&7;
-                updatephysstate(d);
-                updatepos(d);
-                if(smoothmove && d->smoothmillis>=0 && oldpos.dist(d->o) < smoothdist)
+                gameent *d = positiontarget(cn, physstate);
+                if(!d) continue;
+                setposition(d, physstate, (flags&(1<<8))!=0, o, vel, falling, yaw, pitch, roll);
+                break;
+            }
+
+            case N_POSDELTA:
+            {
+                vector<posentry> ents;
+                int ack = getpossnapshot(p, posin, ents);
+                if(ack >= 0) posout.ack(ack);
+                loopv(ents)
                 {
-                    d->newpos = d->o;
-                    d->newyaw = d->yaw;
-                    d->newpitch = d->pitch;
-                    d->newroll = d->roll;
-                    d->o = oldpos;
-                    d->yaw = oldyaw;
-                    d->pitch = oldpitch;
-                    d->roll = oldroll;
-                    (d->deltapos = oldpos).sub(d->newpos);
-                    d->deltayaw = oldyaw - d->newyaw;
-                    if(d->deltayaw > 180) d->deltayaw -= 360;
-                    else if(d->deltayaw < -180) d->deltayaw += 360;
-                    d->deltapitch = oldpitch - d->newpitch;
-                    d->deltaroll = oldroll - d->newroll;
-                    d->smoothmillis = lastmillis;
+                    const posstate &s = ents[i].s;
+                    gameent *d = positiontarget(ents[i].cn, s.physstate);
+                    if(!d) continue;
+                    setposition(d, s.physstate, (s.flags&POSF_CROUCH)!=0, s.geto(), s.getvel(), s.getfalling(), s.getyaw(), s.getpitch(), s.getroll());
                 }
-                else d->smoothmillis = 0;
-                if(d->state==CS_LAGGED || d->state==CS_SPAWNING) d->state = CS_ALIVE;
                 break;
             }
 
@@ -1087,6 +1164,10 @@ namespace game
                 break;
             }
 
+            case N_POSPROTO:
+                resetposproto(clamp(getint(p), int(POSPROTO_LEGACY), int(POSPROTO_MAX)));
+                break;
+
             case N_PAUSEGAME:
             {
                 bool val = getint(p) > 0;
@@ -1575,7 +1656,7 @@ namespace game
 
                 defformatstring(dirname, "media/map/%s", mname);
                 defformatstring(mapfname, "%s/map.ofm", dirname);
-                defformatstring(entfname, "%s/entities.oct", dirname);
+                defformatstring(entfname, "%s/entities.bin", dirname);
                 defformatstring(medfname, "%s/media.cfg", dirname);
 
                 stream *mapf = openrawfile(path(mapfname), "wb");
@@ -1704,11 +1785,15 @@ endread:
         if(!m_edit || (player1->state==CS_SPECTATOR && remote && !player1->privilege)) { conoutf(CON_ERROR, "\"sendmap\" only works in coop edit mode"); return; }
         conoutf("sending map...");
         defformatstring(mname, "sendmap_%d", lastmillis);
+        // only the binary store is sent, a text export would be left behind in the directory
+        int oldsavetext = saveentitiestext;
+        saveentitiestext = 0;
         save_world(mname, true);
+        saveentitiestext = oldsavetext;
 
         defformatstring(dirname, "media/map/%s", mname);
         defformatstring(mapfname, "%s/map.ofm", dirname);
-        defformatstring(entfname, "%s/entities.oct", dirname);
+        defformatstring(entfname, "%s/entities.bin", dirname);
         defformatstring(medfname, "%s/media.cfg", dirname);
 
         stream::offset mapflen = 0;
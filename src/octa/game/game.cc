@@ -231,6 +231,56 @@ namespace game
         ecolcache.add(extentcollision(pl, uid));
     }
 
+    // physics events are queued during the frame and handed over to the
+    // scripts in one call, which drain them through physics_get_events;
+    // the layout must match physevent in the FFI definitions
+    enum
+    {
+        PHYSEVENT_COLLIDE_CLIENT = 0, // cn1, cn2, cont, dir
+        PHYSEVENT_COLLIDE_AREA,       // cn, uid, cont
+        PHYSEVENT_COLLIDE_MAPMODEL,   // cn, uid, cont
+        PHYSEVENT_STATE_CHANGE        // type, cn, local, floorlevel, waterlevel, material
+    };
+
+    struct physevent
+    {
+        int type, args[6];
+        float dir[3];
+    };
+
+    static vector<physevent> physevents, physdrain;
+
+    static physevent &addphysevent(int type, int a0, int a1, int a2, const vec &dir = vec(0, 0, 0))
+    {
+        physevent &ev = physevents.add();
+        ev.type = type;
+        ev.args[0] = a0;
+        ev.args[1] = a1;
+        ev.args[2] = a2;
+        ev.args[3] = ev.args[4] = ev.args[5] = 0;
+        ev.dir[0] = dir.x;
+        ev.dir[1] = dir.y;
+        ev.dir[2] = dir.z;
+        return ev;
+    }
+
+    CLUAICOMMAND(physics_get_events, const physevent *, (), {
+        return physdrain.getbuf();
+    });
+
+    static lua::External physics_events("physics_events"),
+                         frame_handle("frame_handle"),
+                         entity_is_initialized("entity_is_initialized");
+
+    static void flushphysevents()
+    {
+        if(physevents.empty()) return;
+        // handlers may queue new events, so drain from a separate buffer
+        physdrain.move(physevents);
+        lua::L->call(physics_events, physdrain.length());
+        physdrain.setsize(0);
+    }
+
     void updateworld()        // main game update loop
     {
         if(!maptime) { maptime = lastmillis; maprealtime = totalmillis; return; }
@@ -243,34 +293,27 @@ namespace game
             loopv(dcolcache) {
                 const dynentcollision &c = dcolcache[i];
                 int cont = checkdynentcolcache(prevdcolcache, c.pl, c.cn, true);
-                lua::L->call_external("physics_collide_client", "iiifff",
-                    c.pl, c.cn, cont, c.wall.x, c.wall.y, c.wall.z);
+                addphysevent(PHYSEVENT_COLLIDE_CLIENT, c.pl, c.cn, cont, c.wall);
             }
             loopv(ecolcache) {
                 const extentcollision &e = ecolcache[i];
                 int cont = checkextentcolcache(prevecolcache, e.pl, e.uid, true);
-                if ((entities::getents()[e.uid])->type == ET_OBSTACLE) {
-                    lua::L->call_external("physics_collide_area", "iii", e.pl, e.uid, cont);
-                } else {
-                    lua::L->call_external("physics_collide_mapmodel", "iii", e.pl, e.uid, cont);
-                }
+                addphysevent((entities::getents()[e.uid])->type == ET_OBSTACLE
+                    ? PHYSEVENT_COLLIDE_AREA : PHYSEVENT_COLLIDE_MAPMODEL, e.pl, e.uid, cont);
             }
             loopv(prevdcolcache) {
                 const dynentcollision &c = prevdcolcache[i];
                 if (c.pl < 0) continue;
-                lua::L->call_external("physics_collide_client", "iiifff",
-                    c.pl, c.cn, -1, c.wall.x, c.wall.y, c.wall.z);
+                addphysevent(PHYSEVENT_COLLIDE_CLIENT, c.pl, c.cn, -1, c.wall);
             }
             loopv(prevecolcache) {
                 const extentcollision &e = prevecolcache[i];
                 if (e.pl < 0) continue;
-                if ((entities::getents()[e.uid])->type == ET_OBSTACLE) {
-                    lua::L->call_external("physics_collide_area", "iii", e.pl, e.uid, -1);
-                } else {
-                    lua::L->call_external("physics_collide_mapmodel", "iii", e.pl, e.uid, -1);
-                }
+                addphysevent((entities::getents()[e.uid])->type == ET_OBSTACLE
+                    ? PHYSEVENT_COLLIDE_AREA : PHYSEVENT_COLLIDE_MAPMODEL, e.pl, e.uid, -1);
             }
-            lua::L->call_external("frame_handle", "ii", curtime, lastmillis);
+            flushphysevents();
+            lua::L->call(frame_handle, curtime, lastmillis);
         }
         prevdcolcache.setsize(0);
         prevecolcache.setsize(0);
@@ -278,8 +321,8 @@ namespace game
         prevecolcache.move(ecolcache);
         gets2c();
         bool b = false;
-        if (connected) lua::L->call_external_ret("entity_is_initialized", "i", "b",
-            player1->clientnum, &b);
+        if (connected) lua::L->call_ret(entity_is_initialized, lua::rets(&b),
+            player1->clientnum);
         if (b) {
             if(player1->state == CS_DEAD)
             {
@@ -297,6 +340,7 @@ namespace game
                 moveplayer(player1, 10, true);
             }
         }
+        flushphysevents();
         if(player1->clientnum>=0) c2sinfo();   // do this last, to reduce the effective frame lag
     }
 
@@ -419,8 +463,10 @@ namespace game
 
     void physicstrigger(physent *d, bool local, int floorlevel, int waterlevel, int material)
     {
-        lua::L->call_external("physics_state_change", "iibiii", d->type, ((gameent *)d)->clientnum,
-            local, floorlevel, waterlevel, material);
+        physevent &ev = addphysevent(PHYSEVENT_STATE_CHANGE, d->type, ((gameent *)d)->clientnum, local);
+        ev.args[3] = floorlevel;
+        ev.args[4] = waterlevel;
+        ev.args[5] = material;
     }
 
     void dynentcollide(physent *d, physent *o, const vec &dir)
@@ -82,6 +82,8 @@ enum
     N_TEXPACKLOAD, N_TEXPACKUNLOAD, N_TEXPACKRELOAD,
     N_MATPACKLOAD, N_DECALPACKLOAD,
 
+    N_POSDELTA, N_POSPROTO,
+
     NUMMSG
 };
 
@@ -110,13 +112,15 @@ static const int msgsizes[] =               // size inclusive message token, 0 f
     N_TEXPACKLOAD, 0, N_TEXPACKUNLOAD, 0, N_TEXPACKRELOAD, 0,
     N_MATPACKLOAD, 0, N_DECALPACKLOAD, 0,
 
+    N_POSDELTA, 0, N_POSPROTO, 2,
+
     -1
 };
 
 #define OCTAFORGE_SERVER_PORT 46000
 #define OCTAFORGE_LANINFO_PORT 45998
 #define OCTAFORGE_MASTER_PORT 45999
-#define PROTOCOL_VERSION 1              // bump when protocol changes
+#define PROTOCOL_VERSION 2              // bump when protocol changes
 #define DEMO_VERSION 1                  // bump when demo format changes
 #define DEMO_MAGIC "OCTAFORGE_DEMO\0\0"
 
@@ -128,6 +132,8 @@ struct demoheader
 
 #define MAXNAMELEN 15
 
+#include "posdelta.hh"
+
 struct gameent : dynent
 {
     int weight;                         // affects the effectiveness of hitpush
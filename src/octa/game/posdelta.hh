@@ -0,0 +1,491 @@
+// posdelta.hh: quantized, delta compressed position snapshots (N_POSDELTA)
+//
+// Every N_POSDELTA message is a snapshot: a set of entity states that are
+// bit packed as deltas against an older snapshot the receiving side has
+// acknowledged. Both sides keep a small history of snapshots; a snapshot is
+// the base snapshot's entries plus the entries updated in the message, so
+// entities that are not sent in a tick are carried forward. Positions are
+// predicted from the base velocity before the residual is encoded.
+
+#ifndef __POSDELTA_H__
+#define __POSDELTA_H__
+
+enum { POSPROTO_LEGACY = 0, POSPROTO_DELTA, POSPROTO_MAX = POSPROTO_DELTA };
+
+#define POSSNAPSHOTS 32     // snapshot history size, must be a power of two <= 256
+#define POSTICKMILLIS 40    // nominal time between two snapshots, used for prediction
+
+enum
+{
+    POSF_GAMECLIP = 1<<0,
+    POSF_CROUCH   = 1<<1
+};
+
+struct posstate
+{
+    int o[3], vel[3], falling[3];   // o in DMF units, vel and falling in DVELF units
+    int yaw, pitch, roll;           // yaw in 0..359, pitch and roll offset by 90 into 0..180
+    int physstate, flags;           // physstate as packed in N_POS, POSF_* flags
+    int stamp;                      // sequence of the snapshot this state was last sent in
+
+    posstate() { reset(); }
+
+    void reset() { memset(this, 0, sizeof(posstate)); }
+
+    static int quantangle(float angle, int offset, int range)
+    {
+        return clamp(int(angle + offset), 0, range);
+    }
+
+    void setyaw(float angle)
+    {
+        yaw = angle < 0 ? 360 + int(angle)%360 : int(angle)%360;
+        if(yaw >= 360) yaw -= 360;
+    }
+
+    void setpitch(float angle) { pitch = quantangle(angle, 90, 180); }
+    void setroll(float angle) { roll = quantangle(angle, 90, 180); }
+
+    void seto(const vec &v) { loopk(3) o[k] = int(v[k]*DMF); }
+    void setvel(const vec &v) { loopk(3) vel[k] = int(v[k]*DVELF); }
+    void setfalling(const vec &v) { loopk(3) falling[k] = int(v[k]*DVELF); }
+
+    vec geto() const { return vec(o[0]/DMF, o[1]/DMF, o[2]/DMF); }
+    vec getvel() const { return vec(vel[0]/DVELF, vel[1]/DVELF, vel[2]/DVELF); }
+    vec getfalling() const { return vec(falling[0]/DVELF, falling[1]/DVELF, falling[2]/DVELF); }
+
+    float getyaw() const { return yaw; }
+    float getpitch() const { return pitch - 90; }
+    float getroll() const { return roll - 90; }
+};
+
+// values are sent as zigzag coded integers with a 2 bit size class
+static inline int posclassbits(int c)
+{
+    static const int bits[4] = { 3, 6, 12, 24 };
+    return bits[c];
+}
+
+static inline uint poszigzag(int n) { return (uint(n)<<1) ^ uint(n>>31); }
+static inline int posunzigzag(uint n) { return int(n>>1) ^ -int(n&1); }
+
+template<class T>
+struct posbitwriter
+{
+    T &buf;
+    uint acc;
+    int bits;
+
+    posbitwriter(T &buf) : buf(buf), acc(0), bits(0) {}
+
+    void put(uint val, int n)
+    {
+        while(n > 0)
+        {
+            int take = min(n, 8 - bits);
+            acc |= (val & ((1<<take)-1)) << bits;
+            val >>= take;
+            n -= take;
+            bits += take;
+            if(bits >= 8) { buf.put(uchar(acc)); acc = 0; bits = 0; }
+        }
+    }
+
+    void putuint(uint val)
+    {
+        if(!val) { put(0, 1); return; }
+        int c = 0;
+        while(c < 3 && val >= (1u<<posclassbits(c))) c++;
+        put(1, 1);
+        put(c, 2);
+        put(val, posclassbits(c));
+    }
+
+    void putint(int val) { putuint(poszigzag(val)); }
+
+    void flush()
+    {
+        if(bits > 0) { buf.put(uchar(acc)); acc = 0; bits = 0; }
+    }
+};
+
+struct posbitreader
+{
+    ucharbuf &buf;
+    uint acc;
+    int bits;
+
+    posbitreader(ucharbuf &buf) : buf(buf), acc(0), bits(0) {}
+
+    uint get(int n)
+    {
+        uint val = 0;
+        int shift = 0;
+        while(n > 0)
+        {
+            if(!bits) { acc = buf.get(); bits = 8; }
+            int take = min(n, bits);
+            val |= (acc & ((1<<take)-1)) << shift;
+            acc >>= take;
+            bits -= take;
+            n -= take;
+            shift += take;
+        }
+        return val;
+    }
+
+    uint getuint()
+    {
+        if(!get(1)) return 0;
+        return get(posclassbits(get(2)));
+    }
+
+    int getint() { return posunzigzag(getuint()); }
+
+    // discard the rest of the current byte
+    void align() { acc = 0; bits = 0; }
+};
+
+struct posentry
+{
+    int cn;
+    posstate s;
+};
+
+struct possnapshot
+{
+    int seq;
+    vector<posentry> ents;
+
+    possnapshot() : seq(-1) {}
+
+    posstate *find(int cn)
+    {
+        loopv(ents) if(ents[i].cn == cn) return &ents[i].s;
+        return NULL;
+    }
+
+    posstate &update(int cn)
+    {
+        posstate *s = find(cn);
+        if(s) return *s;
+        posentry &e = ents.add();
+        e.cn = cn;
+        return e.s;
+    }
+};
+
+struct poshistory
+{
+    possnapshot snaps[POSSNAPSHOTS];
+    int seq, acked;     // newest snapshot written or stored, newest acknowledged by the peer
+
+    poshistory() { reset(); }
+
+    void reset()
+    {
+        seq = acked = -1;
+        loopi(POSSNAPSHOTS) { snaps[i].seq = -1; snaps[i].ents.setsize(0); }
+    }
+
+    possnapshot *get(int n)
+    {
+        if(n < 0) return NULL;
+        possnapshot &s = snaps[n&(POSSNAPSHOTS-1)];
+        return s.seq == n ? &s : NULL;
+    }
+
+    // maps an 8 bit sequence number sent over the wire back to a snapshot
+    possnapshot *getwire(int wire)
+    {
+        possnapshot &s = snaps[wire&(POSSNAPSHOTS-1)];
+        return s.seq >= 0 && (s.seq&0xFF) == wire && seq - s.seq < POSSNAPSHOTS ? &s : NULL;
+    }
+
+    void ack(int wire)
+    {
+        possnapshot *s = getwire(wire);
+        if(s && s->seq > acked) acked = s->seq;
+    }
+
+    // base snapshot for the next outgoing snapshot, if the peer acked a recent enough one
+    possnapshot *outbase()
+    {
+        return acked >= 0 && seq+1 - acked < POSSNAPSHOTS ? get(acked) : NULL;
+    }
+
+    possnapshot &next(int n)
+    {
+        possnapshot &s = snaps[n&(POSSNAPSHOTS-1)];
+        s.seq = n;
+        return s;
+    }
+};
+
+enum
+{
+    POSD_O       = 1<<0,
+    POSD_VEL     = 1<<1,
+    POSD_FALLING = 1<<2,
+    POSD_DIR     = 1<<3,
+    POSD_PHYS    = 1<<4,
+    POSD_BITS    = 5
+};
+
+static inline void predictpos(const posstate &base, int seq, int *pred)
+{
+    int millis = (seq - base.stamp)*POSTICKMILLIS;
+    loopk(3) pred[k] = base.o[k] + base.vel[k]*int(DMF)*millis/(int(DVELF)*1000);
+}
+
+template<class T>
+static inline void putposdelta(posbitwriter<T> &w, const posstate &s, const posstate *base, int seq)
+{
+    static const posstate zero;
+    const posstate &b = base ? *base : zero;
+    int pred[3];
+    if(base) predictpos(b, seq, pred);
+    else loopk(3) pred[k] = 0;
+    int mask = 0;
+    if(s.o[0] != pred[0] || s.o[1] != pred[1] || s.o[2] != pred[2]) mask |= POSD_O;
+    if(memcmp(s.vel, b.vel, sizeof(s.vel))) mask |= POSD_VEL;
+    if(memcmp(s.falling, b.falling, sizeof(s.falling))) mask |= POSD_FALLING;
+    if(s.yaw != b.yaw || s.pitch != b.pitch || s.roll != b.roll) mask |= POSD_DIR;
+    if(s.physstate != b.physstate || s.flags != b.flags) mask |= POSD_PHYS;
+    w.put(base ? 1 : 0, 1);
+    w.put(mask, POSD_BITS);
+    if(mask&POSD_O) loopk(3) w.putint(s.o[k] - pred[k]);
+    if(mask&POSD_VEL) loopk(3) w.putint(s.vel[k] - b.vel[k]);
+    if(mask&POSD_FALLING) loopk(3) w.putint(s.falling[k] - b.falling[k]);
+    if(mask&POSD_DIR)
+    {
+        int dyaw = s.yaw - b.yaw;
+        if(dyaw >= 180) dyaw -= 360;
+        else if(dyaw < -180) dyaw += 360;
+        w.putint(dyaw);
+        w.putint(s.pitch - b.pitch);
+        w.putint(s.roll - b.roll);
+    }
+    if(mask&POSD_PHYS)
+    {
+        w.put(s.physstate, 8);
+        w.put(s.flags, 2);
+    }
+}
+
+// returns false if the delta refers to a base state that is not available,
+// the record is still consumed so the rest of the message stays readable
+static inline bool getposdelta(posbitreader &r, posstate &s, const posstate *base, int seq)
+{
+    bool hasbase = r.get(1) != 0;
+    bool valid = !hasbase || base;
+    posstate b;
+    if(hasbase && base) b = *base;
+    int pred[3];
+    if(hasbase && base) predictpos(b, seq, pred);
+    else loopk(3) pred[k] = 0;
+    int mask = r.get(POSD_BITS);
+    s = b;
+    loopk(3) s.o[k] = pred[k];
+    if(mask&POSD_O) loopk(3) s.o[k] += r.getint();
+    if(mask&POSD_VEL) loopk(3) s.vel[k] += r.getint();
+    if(mask&POSD_FALLING) loopk(3) s.falling[k] += r.getint();
+    if(mask&POSD_DIR)
+    {
+        s.yaw = (s.yaw + r.getint() + 360)%360;
+        s.pitch += r.getint();
+        s.roll += r.getint();
+    }
+    if(mask&POSD_PHYS)
+    {
+        s.physstate = r.get(8);
+        s.flags = r.get(2);
+    }
+    s.stamp = seq;
+    return valid;
+}
+
+// writes the N_POSDELTA payload following the message type: the sequence
+// of this snapshot, the newest snapshot acknowledged from the other side
+// and the entities; states are stamped and recorded in the history. Each
+// entity is preceded by a continuation bit and its client number relative
+// to the previous one, starting from cnhint, so a client sending its own
+// state and a run of consecutive client numbers cost a bit per entity
+template<class T>
+static inline void putpossnapshot(T &buf, poshistory &out, int ack, const vector<posentry> &ents, vector<int> *keep = NULL, int cnhint = 0)
+{
+    possnapshot *base = out.outbase();
+    int seq = out.seq + 1;
+    posbitwriter<T> w(buf);
+    w.put(seq&0xFF, 8);
+    w.put(ack >= 0 ? 1 : 0, 1);
+    if(ack >= 0) w.put(ack&0xFF, 8);
+    w.put(base ? seq - base->seq : 0, 5);
+    possnapshot &snap = out.next(seq);
+    if(base && base != &snap)
+    {
+        snap.ents.setsize(0);
+        loopv(base->ents) if(!keep || keep->find(base->ents[i].cn) >= 0) snap.ents.add(base->ents[i]);
+    }
+    else snap.ents.setsize(0);
+    loopv(ents)
+    {
+        const posentry &e = ents[i];
+        w.put(1, 1);
+        w.putint(e.cn - cnhint);
+        cnhint = e.cn + 1;
+        posstate *b = base ? base->find(e.cn) : NULL;
+        putposdelta(w, e.s, b, seq);
+        posstate &s = snap.update(e.cn);
+        s = e.s;
+        s.stamp = seq;
+    }
+    w.put(0, 1);
+    w.flush();
+    out.seq = seq;
+}
+
+// reads an N_POSDELTA payload, decoded entities are appended to ents;
+// cnhint must match the one the sender used, returns the sequence
+// acknowledged by the sender or -1
+static inline int getpossnapshot(ucharbuf &p, poshistory &in, vector<posentry> &ents, int cnhint = 0)
+{
+    posbitreader r(p);
+    int wire = r.get(8);
+    int ack = r.get(1) ? int(r.get(8)) : -1;
+    int dist = r.get(5);
+    // reconstruct the full sequence number from the 8 bits on the wire
+    int seq = wire;
+    if(in.seq >= 0)
+    {
+        int diff = (wire - in.seq)&0xFF;
+        seq = in.seq + (diff >= 0x80 ? diff - 0x100 : diff);
+    }
+    possnapshot *base = dist ? in.get(seq - dist) : NULL;
+    bool complete = !dist || base;
+    vector<posentry> decoded;
+    while(r.get(1))
+    {
+        posentry &e = decoded.add();
+        e.cn = cnhint + r.getint();
+        cnhint = e.cn + 1;
+        bool valid = getposdelta(r, e.s, base ? base->find(e.cn) : NULL, seq);
+        if(p.overread()) { decoded.drop(); complete = false; break; }
+        if(!valid)
+        {
+            decoded.drop();
+            complete = false;
+        }
+    }
+    if(p.overread()) complete = false;
+    r.align();
+    loopv(decoded) ents.add(decoded[i]);
+    // only store snapshots that can serve as a base later, i.e. newer ones
+    // that were fully decoded against a base we have ourselves
+    if(complete && seq > in.seq && seq >= 0)
+    {
+        possnapshot &snap = in.next(seq);
+        if(base && base != &snap) snap.ents = base->ents;
+        else snap.ents.setsize(0);
+        loopv(decoded) { posstate &s = snap.update(decoded[i].cn); s = decoded[i].s; }
+        in.seq = seq;
+    }
+    return ack;
+}
+
+// direction of a vector packed as in N_POS, the server has no vectoyawpitch
+static inline uint putlegacydir(const vec &v)
+{
+    float yaw = 0, pitch = 0;
+    if(!v.iszero())
+    {
+        yaw = -atan2(v.x, v.y)/RAD;
+        pitch = asin(v.z/v.magnitude())/RAD;
+    }
+    return (yaw < 0 ? 360 + int(yaw)%360 : int(yaw)%360) + clamp(int(pitch+90), 0, 180)*360;
+}
+
+// writes a state as a legacy N_POS message, for demos and old receivers
+template<class T>
+static inline void putlegacypos(T &q, int cn, const posstate &s)
+{
+    putint(q, N_POS);
+    putuint(q, cn);
+    q.put(s.physstate);
+    vec vel = s.getvel(), falling = s.getfalling();
+    uint mag = min(int(vel.magnitude()*DVELF), 0xFFFF), fall = min(int(falling.magnitude()*DVELF), 0xFFFF);
+    uint flags = 0;
+    loopk(3) if(s.o[k] < 0 || s.o[k] > 0xFFFF) flags |= 1<<k;
+    if(mag > 0xFF) flags |= 1<<3;
+    if(fall > 0)
+    {
+        flags |= 1<<4;
+        if(fall > 0xFF) flags |= 1<<5;
+        if(falling.x || falling.y || falling.z > 0) flags |= 1<<6;
+    }
+    if(s.flags&POSF_GAMECLIP) flags |= 1<<7;
+    if(s.flags&POSF_CROUCH) flags |= 1<<8;
+    putuint(q, flags);
+    loopk(3)
+    {
+        q.put(s.o[k]&0xFF);
+        q.put((s.o[k]>>8)&0xFF);
+        if(s.o[k] < 0 || s.o[k] > 0xFFFF) q.put((s.o[k]>>16)&0xFF);
+    }
+    uint dir = s.yaw + s.pitch*360;
+    q.put(dir&0xFF);
+    q.put((dir>>8)&0xFF);
+    q.put(s.roll);
+    q.put(mag&0xFF);
+    if(mag > 0xFF) q.put((mag>>8)&0xFF);
+    uint veldir = putlegacydir(vel);
+    q.put(veldir&0xFF);
+    q.put((veldir>>8)&0xFF);
+    if(fall > 0)
+    {
+        q.put(fall&0xFF);
+        if(fall > 0xFF) q.put((fall>>8)&0xFF);
+        if(falling.x || falling.y || falling.z > 0)
+        {
+            uint falldir = putlegacydir(falling);
+            q.put(falldir&0xFF);
+            q.put((falldir>>8)&0xFF);
+        }
+    }
+}
+
+// reads the body of a legacy N_POS message following the client number
+static inline void getlegacypos(ucharbuf &p, posstate &s)
+{
+    s.physstate = p.get();
+    uint flags = getuint(p);
+    loopk(3)
+    {
+        int n = p.get(); n |= p.get()<<8; if(flags&(1<<k)) { n |= p.get()<<16; if(n&0x800000) n |= -1<<24; }
+        s.o[k] = n;
+    }
+    int dir = p.get(); dir |= p.get()<<8;
+    s.yaw = dir%360;
+    s.pitch = clamp(dir/360, 0, 180);
+    s.roll = clamp(int(p.get()), 0, 180);
+    int mag = p.get(); if(flags&(1<<3)) mag |= p.get()<<8;
+    dir = p.get(); dir |= p.get()<<8;
+    vec vel = vec((dir%360)*RAD, (clamp(dir/360, 0, 180)-90)*RAD);
+    s.setvel(vel.mul(mag/DVELF));
+    vec falling(0, 0, 0);
+    if(flags&(1<<4))
+    {
+        mag = p.get(); if(flags&(1<<5)) mag |= p.get()<<8;
+        if(flags&(1<<6))
+        {
+            dir = p.get(); dir |= p.get()<<8;
+            falling = vec((dir%360)*RAD, (clamp(dir/360, 0, 180)-90)*RAD);
+        }
+        else falling = vec(0, 0, -1);
+        falling.mul(mag/DVELF);
+    }
+    s.setfalling(falling);
+    s.flags = (flags&(1<<7) ? POSF_GAMECLIP : 0) | (flags&(1<<8) ? POSF_CROUCH : 0);
+}
+
+#endif
@@ -64,6 +64,11 @@ namespace server
         vector<uchar> position, messages;
         uchar *wsdata;
         int wslen;
+        vector<int> posmillis;
+        int possent, possaved;
+        int posproto, posacked;
+        posstate pos;
+        poshistory posin, posout;
         vector<clientinfo *> bots;
         int ping, aireinit;
         string clientmap;
@@ -169,6 +174,13 @@ namespace server
             connectauth = 0;
             position.setsize(0);
             messages.setsize(0);
+            posmillis.setsize(0);
+            possent = possaved = 0;
+            posproto = POSPROTO_LEGACY;
+            posacked = -1;
+            pos.reset();
+            posin.reset();
+            posout.reset();
             ping = 0;
             aireinit = 0;
             needclipboard = 0;
@@ -618,7 +630,7 @@ namespace server
         demotmp = opentempfile("demorecord", "w+b");
         if(!demotmp) return;
 
-        stream *f = opengzfile(NULL, "wb", demotmp);
+        stream *f = opencompressedfile(NULL, "wb", demotmp);
         if(!f) { DELETEP(demotmp); return; }
 
         sendservmsg("recording demo");
@@ -709,7 +721,7 @@ namespace server
         string msg;
         msg[0] = '\0';
         defformatstring(file, "%s.dmo", smapname);
-        demoplayback = opengzfile(file, "rb");
+        demoplayback = opencompressedfile(file, "rb");
         if(!demoplayback) formatstring(msg, "could not read demo \"%s\"", file);
         else if(demoplayback->read(&hdr, sizeof(demoheader))!=sizeof(demoheader) || memcmp(hdr.magic, DEMO_MAGIC, sizeof(hdr.magic)))
             formatstring(msg, "\"%s\" is not a demo file", file);
@@ -1002,7 +1014,7 @@ namespace server
         }
 
         uchar operator[](int msg) const { return msg >= 0 && msg < NUMMSG ? msgmask[msg] : 0; }
-    } msgfilter(-1, N_CONNECT, N_SERVINFO, N_INITCLIENT, N_WELCOME, N_MAPCHANGE, N_SERVMSG, N_TIMEUP, N_CDIS, N_CURRENTMASTER, N_PONG, N_RESUME, N_SENDDEMOLIST, N_SENDDEMO, N_DEMOPLAYBACK, N_SENDMAP, N_CLIENT, N_AUTHCHAL, N_DEMOPACKET, N_ENTCN, N_ENTREM, N_ENTSDATAUP, -2, N_CALCLIGHT, N_REMIP, N_NEWMAP, N_GETMAP, N_SENDMAP, N_CLIPBOARD, -3, N_EDITENT, N_ENTPOS, N_EDITF, N_EDITT, N_EDITM, N_FLIP, N_COPY, N_PASTE, N_ROTATE, N_REPLACE, N_DELCUBE, N_EDITVAR, N_EDITVSLOT, N_UNDO, N_REDO, N_TEXPACKLOAD, N_TEXPACKUNLOAD, N_TEXPACKRELOAD, N_MATPACKLOAD, N_DECALPACKLOAD, -4, N_POS, NUMMSG),
+    } msgfilter(-1, N_CONNECT, N_SERVINFO, N_INITCLIENT, N_WELCOME, N_MAPCHANGE, N_SERVMSG, N_TIMEUP, N_CDIS, N_CURRENTMASTER, N_PONG, N_RESUME, N_SENDDEMOLIST, N_SENDDEMO, N_DEMOPLAYBACK, N_SENDMAP, N_CLIENT, N_AUTHCHAL, N_DEMOPACKET, N_ENTCN, N_ENTREM, N_ENTSDATAUP, N_POSPROTO, -2, N_CALCLIGHT, N_REMIP, N_NEWMAP, N_GETMAP, N_SENDMAP, N_CLIPBOARD, -3, N_EDITENT, N_ENTPOS, N_EDITF, N_EDITT, N_EDITM, N_FLIP, N_COPY, N_PASTE, N_ROTATE, N_REPLACE, N_DELCUBE, N_EDITVAR, N_EDITVSLOT, N_UNDO, N_REDO, N_TEXPACKLOAD, N_TEXPACKUNLOAD, N_TEXPACKRELOAD, N_MATPACKLOAD, N_DECALPACKLOAD, -4, N_POS, N_POSDELTA, NUMMSG),
       connectfilter(-1, N_CONNECT, -2, N_AUTHANS, -3, N_PING, NUMMSG);
 
     int checktype(int type, clientinfo *ci)
@@ -1085,6 +1097,7 @@ namespace server
         loopv(clients)
         {
             clientinfo &ci = *clients[i];
+            if(ci.posproto != POSPROTO_LEGACY) continue;
             uchar *data = wsbuf.buf;
             int size = wslen;
             if(ci.wsdata >= wsbuf.buf) { data = ci.wsdata + ci.wslen; size -= ci.wslen; }
@@ -1145,8 +1158,272 @@ namespace server
         else ci.wslen += len;
     }
 
+    VAR(interestmanage, 0, 0, 1);
+    VAR(interestradius, 0, 512, 1<<16);
+    VAR(interestfarmillis, 40, 200, 5000);
+    VAR(interestpvs, 0, 1, 1);
+
+    static inline bool positionoccluded(clientinfo &ci, clientinfo &bi)
+    {
+#ifndef STANDALONE
+        // only a listen server has the map geometry (and its PVS) loaded
+        return interestpvs && pvsoccludedfrom(ci.state.o, bi.state.o, 16);
+#else
+        return false;
+#endif
+    }
+
+    static bool wantsposition(clientinfo &ci, clientinfo &bi)
+    {
+        // spectators and dead players may look anywhere, so they get everything at full rate
+        if(ci.state.state!=CS_ALIVE && ci.state.state!=CS_EDITING) return true;
+        if(ci.state.o.dist(bi.state.o) <= interestradius && !positionoccluded(ci, bi)) return true;
+        while(ci.posmillis.length() <= bi.clientnum) ci.posmillis.add(0);
+        int &last = ci.posmillis[bi.clientnum];
+        if(last && totalmillis - last < interestfarmillis) return false;
+        last = totalmillis;
+        return true;
+    }
+
+    // a reused clientnum must not inherit the throttle of its previous owner
+    static void clearposmillis(int cn)
+    {
+        loopv(clients) if(clients[i]->posmillis.inrange(cn)) clients[i]->posmillis[cn] = 0;
+    }
+
+    static bool flushinterestpositions(clientinfo &ci, vector<uchar> &buf)
+    {
+        if(buf.empty()) return false;
+        ENetPacket *packet = enet_packet_create(buf.getbuf(), buf.length(), 0);
+        sendpacket(ci.clientnum, 0, packet);
+        if(!packet->referenceCount) enet_packet_destroy(packet);
+        buf.setsize(0);
+        return true;
+    }
+
+    static void addinterestposition(clientinfo &ci, vector<uchar> &buf, int mtu, clientinfo &bi, bool &sent)
+    {
+        if(bi.position.empty() || bi.ownernum == ci.clientnum) return;
+        if(!wantsposition(ci, bi)) { ci.possaved += bi.position.length(); return; }
+        if(buf.length() + bi.position.length() > mtu && flushinterestpositions(ci, buf)) sent = true;
+        buf.put(bi.position.getbuf(), bi.position.length());
+        ci.possent += bi.position.length();
+    }
+
+    // positions are filtered per recipient: players within interestradius that
+    // are not PVS-occluded are sent every tick, everyone else at most once per
+    // interestfarmillis; demos still record the full unfiltered stream, returns
+    // whether any packets went out so the caller knows to flush the host
+    static bool sendinterestpositions()
+    {
+        bool sent = false;
+        int mtu = getservermtu() - 100;
+        if(mtu <= 0) mtu = MAXTRANS;
+        if(demorecord)
+        {
+            vector<uchar> all;
+            loopv(clients)
+            {
+                clientinfo &bi = *clients[i];
+                all.put(bi.position.getbuf(), bi.position.length());
+                loopvj(bi.bots) all.put(bi.bots[j]->position.getbuf(), bi.bots[j]->position.length());
+            }
+            if(all.length()) recordpacket(0, all.getbuf(), all.length());
+        }
+        vector<uchar> buf;
+        loopv(clients)
+        {
+            clientinfo &ci = *clients[i];
+            if(ci.posproto != POSPROTO_LEGACY) continue;
+            loopvj(clients)
+            {
+                clientinfo &bi = *clients[j];
+                addinterestposition(ci, buf, mtu, bi, sent);
+                loopvk(bi.bots) addinterestposition(ci, buf, mtu, *bi.bots[k], sent);
+            }
+            if(flushinterestpositions(ci, buf)) sent = true;
+        }
+        loopv(clients)
+        {
+            clientinfo &bi = *clients[i];
+            bi.position.setsize(0);
+            loopvj(bi.bots) bi.bots[j]->position.setsize(0);
+        }
+        return sent;
+    }
+
+    VAR(deltapositions, 0, 1, 1);
+
+    // worst case size of one entity in an N_POSDELTA message
+    #define MAXPOSDELTA 48
+
+    static void flushposdeltas(clientinfo &ci, vector<posentry> &ents, vector<int> &keep, int legacy, bool &sent)
+    {
+        packetbuf p(MAXTRANS, 0);
+        putint(p, N_POSDELTA);
+        putpossnapshot(p, ci.posout, ci.posin.seq, ents, &keep);
+        ci.posacked = ci.posin.seq;
+        ci.possent += p.length();
+        ci.possaved += max(legacy - p.length(), 0);
+        sendpacket(ci.clientnum, 0, p.finalize());
+        ents.setsize(0);
+        sent = true;
+    }
+
+    static void addposdelta(clientinfo &ci, vector<posentry> &ents, vector<int> &keep, int &legacy, int maxents, clientinfo &bi, bool &sent)
+    {
+        if(bi.ownernum == ci.clientnum) return;
+        keep.add(bi.clientnum);
+        if(bi.position.empty()) return;
+        if(interestmanage && !wantsposition(ci, bi)) { ci.possaved += bi.position.length(); return; }
+        if(ents.length() >= maxents) { flushposdeltas(ci, ents, keep, legacy, sent); legacy = 0; }
+        posentry &e = ents.add();
+        e.cn = bi.clientnum;
+        e.s = bi.pos;
+        legacy += bi.position.length();
+    }
+
+    // clients that negotiated POSPROTO_DELTA get their own snapshot each tick,
+    // delta coded against the last snapshot they acknowledged; returns whether
+    // any snapshots went out so the caller knows to flush the host
+    static bool sendposdeltas()
+    {
+        bool sent = false;
+        int mtu = getservermtu() - 100;
+        if(mtu <= 0) mtu = MAXTRANS;
+        int maxents = max(mtu/MAXPOSDELTA, 1);
+        vector<posentry> ents;
+        vector<int> keep;
+        loopv(clients)
+        {
+            clientinfo &ci = *clients[i];
+            if(ci.posproto != POSPROTO_DELTA) continue;
+            int legacy = 0;
+            keep.setsize(0);
+            loopvj(clients)
+            {
+                clientinfo &bi = *clients[j];
+                addposdelta(ci, ents, keep, legacy, maxents, bi, sent);
+                loopvk(bi.bots) addposdelta(ci, ents, keep, legacy, maxents, *bi.bots[k], sent);
+            }
+            if(ents.length() || ci.posacked != ci.posin.seq) flushposdeltas(ci, ents, keep, legacy, sent);
+        }
+        return sent;
+    }
+
+    ICOMMAND(intereststats, "", (), {
+        loopv(clients)
+        {
+            clientinfo &ci = *clients[i];
+            int total = ci.possent + ci.possaved;
+            conoutf("%d (%s): %d bytes sent, %d bytes saved (%.1f%%)", ci.clientnum, ci.name, ci.possent, ci.possaved, total ? ci.possaved*100.0f/total : 0.0f);
+        }
+    });
+
+    struct posbenchstream
+    {
+        poshistory enc, dec;
+        vector<int> acks;
+        int bytes, mismatches;
+
+        posbenchstream() : bytes(0), mismatches(0) {}
+
+        void encode(const vector<posentry> &ents, int acklag, int cnhint = 0)
+        {
+            vector<uchar> buf;
+            putint(buf, N_POSDELTA);
+            // live snapshots always piggyback an ack for the other direction
+            putpossnapshot(buf, enc, max(enc.seq, 0), ents, NULL, cnhint);
+            bytes += buf.length();
+            ucharbuf p(buf.getbuf(), buf.length());
+            getint(p);
+            vector<posentry> decoded;
+            getpossnapshot(p, dec, decoded, cnhint);
+            loopv(ents)
+            {
+                posstate s = ents[i].s;
+                bool found = false;
+                loopvj(decoded) if(decoded[j].cn == ents[i].cn)
+                {
+                    s.stamp = decoded[j].s.stamp;
+                    found = !memcmp(&s, &decoded[j].s, sizeof(posstate));
+                    break;
+                }
+                if(!found) mismatches++;
+            }
+            // the encoder only learns about received snapshots a round trip later
+            acks.add(dec.seq);
+            if(acks.length() > acklag) enc.ack(acks.remove(0)&0xFF);
+        }
+    };
+
+    // replays the positions recorded in a demo through the legacy N_POS and
+    // the N_POSDELTA encoders; downstream sends every recorded tick as one
+    // snapshot, upstream encodes each client's own states separately
+    void posdeltabench(char *name, int *acklag)
+    {
+        defformatstring(file, "%s.dmo", name);
+        stream *f = opencompressedfile(file, "rb");
+        if(!f) { conoutf(CON_ERROR, "could not read demo \"%s\"", file); return; }
+        demoheader hdr;
+        if(f->read(&hdr, sizeof(demoheader))!=sizeof(demoheader) || memcmp(hdr.magic, DEMO_MAGIC, sizeof(hdr.magic)))
+        {
+            conoutf(CON_ERROR, "\"%s\" is not a demo file", file);
+            delete f;
+            return;
+        }
+        int lag = *acklag > 0 ? *acklag : 3, ticks = 0, states = 0, legacy = 0;
+        posbenchstream down;
+        vector<posbenchstream *> up;
+        vector<posentry> ents, single;
+        vector<uchar> data;
+        int stamp[3];
+        while(f->read(stamp, sizeof(stamp))==sizeof(stamp))
+        {
+            lilswap(stamp, 3);
+            int chan = stamp[1], len = stamp[2];
+            if(len <= 0) continue;
+            data.setsize(0);
+            if(f->read(data.reserve(len).buf, len)!=size_t(len)) break;
+            data.advance(len);
+            if(chan != 0) continue;
+            ucharbuf p(data.getbuf(), len);
+            ents.setsize(0);
+            while(p.remaining() && getint(p) == N_POS)
+            {
+                posentry &e = ents.add();
+                e.cn = getuint(p);
+                getlegacypos(p, e.s);
+            }
+            if(p.overread() || ents.empty()) continue;
+            legacy += p.length();
+            ticks++;
+            states += ents.length();
+            down.encode(ents, lag);
+            loopv(ents)
+            {
+                int cn = ents[i].cn;
+                while(up.length() <= cn) up.add(NULL);
+                if(!up[cn]) up[cn] = new posbenchstream;
+                single.setsize(0);
+                single.add(ents[i]);
+                up[cn]->encode(single, lag, cn);
+            }
+        }
+        delete f;
+        int upbytes = 0, mismatches = down.mismatches;
+        loopv(up) if(up[i]) { upbytes += up[i]->bytes; mismatches += up[i]->mismatches; }
+        up.deletecontents();
+        if(!states) { conoutf("\"%s\" has no recorded positions", file); return; }
+        conoutf("%d ticks, %d states, ack lag %d: legacy %d bytes", ticks, states, lag, legacy);
+        conoutf("delta downstream %d bytes (%.2fx), upstream %d bytes (%.2fx), %d mismatches",
+            down.bytes, legacy/float(max(down.bytes, 1)), upbytes, legacy/float(max(upbytes, 1)), mismatches);
+    }
+    COMMAND(posdeltabench, "si");
+
     bool buildworldstate()
     {
+        bool interest = interestmanage && clients.length() > 1;
         int wsmax = 0;
         loopv(clients)
         {
@@ -1166,13 +1443,21 @@ namespace server
         int mtu = getservermtu() - 100;
         if(mtu <= 0) mtu = ws.len;
         ucharbuf wsbuf(ws.data, ws.len);
-        loopv(clients)
+        bool flush = sendposdeltas();
+        if(interest)
         {
-            clientinfo &ci = *clients[i];
-            addposition(ws, wsbuf, mtu, ci, ci);
-            loopvj(ci.bots) addposition(ws, wsbuf, mtu, *ci.bots[j], ci);
+            if(sendinterestpositions()) flush = true;
+        }
+        else
+        {
+            loopv(clients)
+            {
+                clientinfo &ci = *clients[i];
+                addposition(ws, wsbuf, mtu, ci, ci);
+                loopvj(ci.bots) addposition(ws, wsbuf, mtu, *ci.bots[j], ci);
+            }
+            sendpositions(ws, wsbuf);
         }
-        sendpositions(ws, wsbuf);
         loopv(clients)
         {
             clientinfo &ci = *clients[i];
@@ -1184,7 +1469,7 @@ namespace server
         if(ws.uses) return true;
         ws.cleanup();
         worldstates.drop();
-        return false;
+        return flush;
     }
 
     bool sendpackets(bool force)
@@ -1237,6 +1522,11 @@ namespace server
     {
         putint(p, N_WELCOME);
         sendstring(usegame, p);
+        if(ci && ci->posproto != POSPROTO_LEGACY)
+        {
+            putint(p, N_POSPROTO);
+            putint(p, ci->posproto);
+        }
         putint(p, N_MAPCHANGE);
         sendstring(smapname, p);
         putint(p, gamemode);
@@ -1588,6 +1878,7 @@ namespace server
         ci->connectmillis = totalmillis;
         ci->sessionid = (rnd(0x1000000)*((totalmillis%10000)+1))&0xFFFFFF;
         ci->local = true;
+        clearposmillis(n);
 
         connects.add(ci);
         sendservinfo(ci);
@@ -1605,6 +1896,7 @@ namespace server
         ci->clientnum = ci->ownernum = n;
         ci->connectmillis = totalmillis;
         ci->sessionid = (rnd(0x1000000)*((totalmillis%10000)+1))&0xFFFFFF;
+        clearposmillis(n);
 
         connects.add(ci);
         if(!m_mp(gamemode)) return DISC_LOCAL;
@@ -1622,6 +1914,7 @@ namespace server
             ci->state.timeplayed += lastmillis - ci->state.lasttimeplayed;
             sendf(-1, 1, "ri2", N_CDIS, n);
             clients.removeobj(ci);
+            clearposmillis(n);
             if(!numclients(-1, false, true)) noclients(); // bans clear when server empties
             if(ci->local) checkpausegame();
         }
@@ -1871,6 +2164,23 @@ namespace server
         if(servermotd[0]) sendf(ci->clientnum, 1, "ris", N_SERVMSG, servermotd);
     }
 
+    static void updateposition(clientinfo *ci, clientinfo *cp, const posstate &ps, const uchar *legacy = NULL, int len = 0)
+    {
+        if((!ci->local || demorecord || hasnonlocalclients()) && (cp->state.state==CS_ALIVE || cp->state.state==CS_EDITING))
+        {
+            vec vel = ps.getvel();
+            if(!ci->local && !m_edit && max(vel.magnitude2(), (float)fabs(vel.z)) >= 180)
+                cp->setexceeded();
+            cp->position.setsize(0);
+            // legacy receivers and demos always get plain N_POS
+            if(legacy) cp->position.put(legacy, len);
+            else putlegacypos(cp->position, cp->clientnum, ps);
+            cp->pos = ps;
+        }
+        cp->state.o = ps.geto();
+        cp->gameclip = (ps.flags&POSF_GAMECLIP)!=0;
+    }
+
     void parsepacket(int sender, int chan, packetbuf &p)     // has to parse exactly each byte of the packet
     {
         if(sender<0 || p.packet->flags&ENET_PACKET_FLAG_UNSEQUENCED || chan > 2) return;
@@ -1894,6 +2204,7 @@ namespace server
                     getstring(password, p, sizeof(password));
                     getstring(authdesc, p, sizeof(authdesc));
                     getstring(authname, p, sizeof(authname));
+                    ci->posproto = clamp(getint(p), int(POSPROTO_LEGACY), deltapositions ? int(POSPROTO_MAX) : int(POSPROTO_LEGACY));
                     int disc = allowconnect(ci, password);
                     if(disc)
                     {
@@ -1963,36 +2274,23 @@ namespace server
             case N_POS:
             {
                 int pcn = getuint(p);
-                p.get();
-                uint flags = getuint(p);
+                posstate ps;
+                getlegacypos(p, ps);
                 clientinfo *cp = getinfo(pcn);
                 if(cp && pcn != sender && cp->ownernum != sender) cp = NULL;
-                vec pos;
-                loopk(3)
-                {
-                    int n = p.get(); n |= p.get()<<8; if(flags&(1<<k)) { n |= p.get()<<16; if(n&0x800000) n |= -1<<24; }
-                    pos[k] = n/DMF;
-                }
-                loopk(3) p.get();
-                int mag = p.get(); if(flags&(1<<3)) mag |= p.get()<<8;
-                int dir = p.get(); dir |= p.get()<<8;
-                vec vel = vec((dir%360)*RAD, (clamp(dir/360, 0, 180)-90)*RAD).mul(mag/DVELF);
-                if(flags&(1<<4))
-                {
-                    p.get(); if(flags&(1<<5)) p.get();
-                    if(flags&(1<<6)) loopk(2) p.get();
-                }
-                if(cp)
+                if(cp) updateposition(ci, cp, ps, &p.buf[curmsg], p.length() - curmsg);
+                break;
+            }
+
+            case N_POSDELTA:
+            {
+                vector<posentry> ents;
+                int ack = getpossnapshot(p, ci->posin, ents, sender);
+                if(ack >= 0) ci->posout.ack(ack);
+                loopv(ents)
                 {
-                    if((!ci->local || demorecord || hasnonlocalclients()) && (cp->state.state==CS_ALIVE || cp->state.state==CS_EDITING))
-                    {
-                        if(!ci->local && !m_edit && max(vel.magnitude2(), (float)fabs(vel.z)) >= 180)
-                            cp->setexceeded();
-                        cp->position.setsize(0);
-                        while(curmsg<p.length()) cp->position.add(p.buf[curmsg++]);
-                    }
-                    cp->state.o = pos;
-                    cp->gameclip = (flags&0x80)!=0;
+                    clientinfo *cp = getinfo(ents[i].cn);
+                    if(cp && (ents[i].cn == sender || cp->ownernum == sender)) updateposition(ci, cp, ents[i].s);
                 }
                 break;
             }
@@ -8,6 +8,8 @@
 
 #include "cube.hh"
 
+extern int logasync;
+
 namespace logger
 {
     int current_indent = 0;
@@ -51,9 +53,6 @@ namespace logger
 
         const char *level_s = names[level];
 
-        for (int i = 0; i < current_indent; i++)
-            printf("    ");
-
         char sbuf[512];
         char *buf = sbuf;
         va_list ap, ap2;
@@ -67,18 +66,22 @@ namespace logger
         }
         va_end(ap2);
 
+        /* the indent goes into the same line so that queued output
+         * from other threads cannot split it */
+        int indent = current_indent * 4;
 #ifndef STANDALONE
         if (level == ERROR) {
-            conoutf(CON_ERROR, "[[%s]] - %s", level_s, buf);
+            conoutf(CON_ERROR, "%*s[[%s]] - %s", indent, "", level_s, buf);
         }
         else
 #endif
-        logoutf("[[%s]] - %s", level_s, buf);
+        logoutf("%*s[[%s]] - %s", indent, "", level_s, buf);
         if (buf != sbuf) {
             delete[] buf;
         }
 
-        fflush(stdout);
+        /* in async mode the log thread flushes once per batch */
+        if (!logasync) fflush(stdout);
     }
 
     logindent::logindent(loglevel level)
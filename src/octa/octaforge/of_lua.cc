@@ -15,6 +15,15 @@ namespace lua
     /* some initial stuff */
 
     static int externals = LUA_REFNIL;
+    static int traceback = LUA_NOREF;
+
+    /* bumped whenever the externals table may have changed, which makes
+     * every pre-bound External look its function up again */
+    static int externals_gen = 0;
+
+    static inline void push_traceback(lua_State *L) {
+        lua_rawgeti(L, LUA_REGISTRYINDEX, traceback);
+    }
 
     struct Reg {
         const char *name;
@@ -217,7 +226,7 @@ namespace lua
             file->incref();
         }
         int level = luaL_optinteger(L, 4, Z_BEST_COMPRESSION);
-        return (!(*ud = opengzfile(fname, mode, file, level)))
+        return (!(*ud = opencompressedfile(fname, mode, file, level)))
             ? s_push_ret(L, 0, fname) : 1;
     });
 
@@ -292,6 +301,8 @@ namespace lua
 
         state = luaL_newstate();
         if (!state) return;
+        externals = LUA_REFNIL;
+        externals_gen++;
         lua_atpanic(state, lua_panic);
         luaL_openlibs(state);
 
@@ -330,7 +341,11 @@ namespace lua
             "struct selinfo_t; typedef struct selinfo_t selinfo_t;\n"
             "struct vslot_t; typedef struct vslot_t vslot_t;\n"
             "struct cube_t; typedef struct cube_t cube_t;\n"
-            "struct ucharbuf; typedef struct ucharbuf ucharbuf;\n");
+            "struct ucharbuf; typedef struct ucharbuf ucharbuf;\n"
+            "typedef struct physevent {\n"
+            "    int type, args[6];\n"
+            "    float dir[3];\n"
+            "} physevent;\n");
         lua_call(L, 1, 0);
         lua_getfield(L, -1, "cast");
         lua_replace(L, -2);
@@ -386,7 +401,9 @@ namespace lua
         lua_getfield(s->state, -1, "env");
         lua_setfield(s->state, LUA_REGISTRYINDEX, "octascript_env");
         lua_getfield(s->state, -1, "traceback");
+        lua_pushvalue(s->state, -1);
         lua_setfield(s->state, LUA_REGISTRYINDEX, "octascript_traceback");
+        traceback = luaL_ref(s->state, LUA_REGISTRYINDEX);
         lua_pop(s->state, 1);
 
         s->load_module("init");
@@ -404,8 +421,47 @@ namespace lua
         return true;
     }
 
+    bool State::push_external(External &ext) {
+        if (externals == LUA_REFNIL) return false;
+        if (ext.gen != externals_gen || ext.owner != state) {
+            if (ext.owner == state) luaL_unref(state, LUA_REGISTRYINDEX, ext.ref);
+            lua_rawgeti(state, LUA_REGISTRYINDEX, externals);
+            lua_getfield(state, -1, ext.name);
+            lua_replace(state, -2);
+            /* a nil external gets LUA_REFNIL, so misses are cached too */
+            ext.ref = luaL_ref(state, LUA_REGISTRYINDEX);
+            ext.gen = externals_gen;
+            ext.owner = state;
+        }
+        if (ext.ref == LUA_REFNIL) return false;
+        lua_rawgeti(state, LUA_REGISTRYINDEX, ext.ref);
+        return true;
+    }
+
+    int State::push_call(External &ext) {
+        int top = lua_gettop(state);
+        push_traceback(state);
+        if (!push_external(ext)) {
+            lua_settop(state, top);
+            return -1;
+        }
+        return top;
+    }
+
+    bool State::finish_call(int top, int nargs, int nrets) {
+        PROFILE("lua call");
+        if (lua_pcall(state, nargs, nrets, top + 1)) {
+            logger::log(logger::ERROR, "%s", lua_tostring(state, -1));
+            lua_settop(state, top);
+            return false;
+        }
+        if (!nrets) lua_settop(state, top);
+        return true;
+    }
+
     static int vcall_external(State *s, const char *name, const char *args,
     int retn, va_ref *ar) {
+        PROFILE("lua call");
         if (!s->push_external(name)) return -1;
         int nargs = 0;
         while (*args) {
@@ -449,7 +505,7 @@ namespace lua
                     if (!s->push_external("buf_get_msgpack")) {
                         lua_pushnil(s->state);
                     } else {
-                        lua_getfield(s->state, LUA_REGISTRYINDEX, "octascript_traceback");
+                        push_traceback(s->state);
                         lua_insert(s->state, -2);
                         lua_pushlightuserdata(s->state, va_arg(ar->ap, void *));
                         if (lua_pcall(s->state, 1, 1, -3)) {
@@ -467,7 +523,7 @@ namespace lua
             }
         }
         int n1 = lua_gettop(s->state) - nargs - 1;
-        lua_getfield(s->state, LUA_REGISTRYINDEX, "octascript_traceback");
+        push_traceback(s->state);
         lua_insert(s->state, -nargs - 2);
         if (lua_pcall(s->state, nargs, retn, -nargs - 2)) {
             logger::log(logger::ERROR, "%s", lua_tostring(s->state, -1));
@@ -705,9 +761,12 @@ namespace lua
     LUAICOMMAND(external_hook, {
         lua_pushvalue(L, 1);
         externals = luaL_ref(L, LUA_REGISTRYINDEX);
+        externals_gen++;
         return 0;
     })
 
+    CLUAICOMMAND(external_changed, void, (), externals_gen++;)
+
     bool reg_fun(const char *name, lua_CFunction fun) {
         if (!funs) funs = new apifuns;
         funs->add(Reg(name, fun));
@@ -833,6 +892,43 @@ namespace lua
         }
     })
 
+#ifndef STANDALONE
+    static int bench_noop(lua_State *) { return 0; }
+
+    /* times a no-op external called through the format string path and
+     * through a pre-bound handle with the same arguments */
+    ICOMMAND(externalbench, "i", (int *iters), {
+        if (externals == LUA_REFNIL) return;
+        int n = *iters > 0 ? *iters : 1000000;
+        lua_State *ls = L->state;
+        lua_rawgeti(ls, LUA_REGISTRYINDEX, externals);
+        lua_pushcfunction(ls, bench_noop);
+        lua_setfield(ls, -2, "external_bench_noop");
+        lua_pop(ls, 1);
+        externals_gen++;
+
+        Uint64 start = SDL_GetPerformanceCounter();
+        loopi(n) L->call_external("external_bench_noop", "iifs", i, n, 0.5f, "bench");
+        Uint64 named = SDL_GetPerformanceCounter() - start;
+
+        External ext("external_bench_noop");
+        start = SDL_GetPerformanceCounter();
+        loopi(n) L->call(ext, i, n, 0.5f, "bench");
+        Uint64 bound = SDL_GetPerformanceCounter() - start;
+
+        lua_rawgeti(ls, LUA_REGISTRYINDEX, externals);
+        lua_pushnil(ls);
+        lua_setfield(ls, -2, "external_bench_noop");
+        lua_pop(ls, 1);
+        externals_gen++;
+        luaL_unref(ls, LUA_REGISTRYINDEX, ext.ref);
+
+        double freq = SDL_GetPerformanceFrequency();
+        conoutf("externalbench: %d calls, format string %.1f ns/call, pre-bound %.1f ns/call",
+            n, named*1e9/(freq*n), bound*1e9/(freq*n));
+    });
+#endif
+
     LUAICOMMAND(cubescript, {
         tagval v;
         executeret(luaL_checkstring(L, 1), v);
@@ -5,6 +5,67 @@ namespace lua
 {
     struct va_ref { va_list ap; };
 
+    /* a pre-bound external: the function is looked up by name once and
+     * kept as a registry ref, which is dropped whenever the scripts touch
+     * the externals table; declare these at file scope for hot calls
+     */
+    struct External {
+        const char *name;
+        int ref, gen;
+        lua_State *owner;
+        External(const char *n): name(n), ref(LUA_NOREF), gen(-1), owner(NULL) {}
+    };
+
+    /* a string with explicit length, the typed counterpart of 'S' */
+    struct lstr {
+        const char *str;
+        int len;
+        lstr(const char *s, int l): str(s), len(l) {}
+    };
+
+    inline void push_arg(lua_State *L, int v)          { lua_pushinteger(L, v); }
+    inline void push_arg(lua_State *L, uint v)         { lua_pushinteger(L, v); }
+    inline void push_arg(lua_State *L, float v)        { lua_pushnumber(L, v); }
+    inline void push_arg(lua_State *L, double v)       { lua_pushnumber(L, v); }
+    inline void push_arg(lua_State *L, bool v)         { lua_pushboolean(L, v); }
+    inline void push_arg(lua_State *L, const char *v)  { lua_pushstring(L, v); }
+    inline void push_arg(lua_State *L, const lstr &v)  { lua_pushlstring(L, v.str, v.len); }
+    inline void push_arg(lua_State *L, void *v)        { lua_pushlightuserdata(L, v); }
+
+    inline void push_args(lua_State *) {}
+    template<typename T, typename ...A>
+    inline void push_args(lua_State *L, const T &v, const A &...args) {
+        push_arg(L, v);
+        push_args(L, args...);
+    }
+
+    inline void get_ret(lua_State *L, int idx, int &v)    { v = lua_tointeger(L, idx); }
+    inline void get_ret(lua_State *L, int idx, float &v)  { v = lua_tonumber(L, idx); }
+    inline void get_ret(lua_State *L, int idx, double &v) { v = lua_tonumber(L, idx); }
+    inline void get_ret(lua_State *L, int idx, bool &v)   { v = lua_toboolean(L, idx); }
+
+    /* typed result slots for State::call_ret, built with lua::rets(&a, &b) */
+    template<typename ...R> struct Rets;
+
+    template<> struct Rets<> {
+        enum { count = 0 };
+        void get(lua_State *, int) const {}
+    };
+
+    template<typename T, typename ...R> struct Rets<T, R...> {
+        enum { count = 1 + sizeof...(R) };
+        T *out;
+        Rets<R...> rest;
+        Rets(T *o, R *...r): out(o), rest(r...) {}
+        void get(lua_State *L, int idx) const {
+            get_ret(L, idx, *out);
+            rest.get(L, idx + 1);
+        }
+    };
+
+    template<typename ...R>
+    inline Rets<R...> rets(R *...r) { return Rets<R...>(r...); }
+
     struct State {
         lua_State *state;
         string     mod_dir;
@@ -13,6 +74,27 @@ namespace lua
         ~State();
 
         bool push_external(const char *name);
+        bool push_external(External &ext);
+
+        /* typed calls through a pre-bound external, no format string */
+        template<typename ...A>
+        bool call(External &ext, const A &...args) {
+            int n = push_call(ext);
+            if (n < 0) return false;
+            push_args(state, args...);
+            return finish_call(n, sizeof...(A), 0);
+        }
+
+        template<typename ...R, typename ...A>
+        bool call_ret(External &ext, const Rets<R...> &r, const A &...args) {
+            int n = push_call(ext);
+            if (n < 0) return false;
+            push_args(state, args...);
+            if (!finish_call(n, sizeof...(A), Rets<R...>::count)) return false;
+            r.get(state, -Rets<R...>::count);
+            lua_settop(state, n);
+            return true;
+        }
 
         bool call_external(const char *name, const char *args, ...);
 
@@ -28,6 +110,10 @@ namespace lua
         int  load_file  (const char *fname);
         int  load_string(const char *str, const char *ch = NULL);
         bool exec_file  (const char *cfgfile, bool msg = true);
+
+    private:
+        int  push_call  (External &ext);
+        bool finish_call(int top, int nargs, int nrets);
     };
 
     extern State *L;
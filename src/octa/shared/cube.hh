@@ -81,11 +81,13 @@ extern "C" {
 #include <enet/enet.h>
 
 #include <zlib.h>
+#include <zstd.h>
 
 #include "tools.hh"
 #include "geom.hh"
 #include "ents.hh"
 #include "command.hh"
+#include "profiler.hh"
 
 #ifndef STANDALONE
 #include "glexts.hh"
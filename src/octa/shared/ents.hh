@@ -63,6 +63,7 @@ struct physent                                  // base entity type, can be affe
     float crouchheight, crouchspeed, jumpvel, gravity; // OF: crouchheight, crouchspeed, jumpvel, gravity
     float xradius, yradius, zmargin;
     vec floor;                                  // the normal of floor the dynent is on
+    ivec2 cellmin, cellmax;                     // dynent grid cells the entity is currently linked into
 
     int inwater;
     bool jumping;
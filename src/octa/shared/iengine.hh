@@ -47,8 +47,10 @@ enum { RAY_BB = 1, RAY_POLY = 3, RAY_ALPHAPOLY = 7, RAY_ENTS = 9, RAY_CLIPMAT =
 
 extern float raycube   (const vec &o, const vec &ray,     float radius = 0, int mode = RAY_CLIPMAT, int size = 0, extentity *t = 0);
 extern float raycubepos(const vec &o, const vec &ray, vec &hit, float radius = 0, int mode = RAY_CLIPMAT, int size = 0);
+extern void  raycubes  (const vec *o, const vec *ray, float *dists, int numrays, float radius = 0, int mode = RAY_CLIPMAT, extentity *t = 0);
 extern float rayfloor  (const vec &o, vec &floor, int mode = 0, float radius = 0);
 extern bool  raycubelos(const vec &o, const vec &dest, vec &hitpos);
+extern int   raycubelos(const vec *o, const vec *dest, int numrays, bool *los, vec *hitpos = NULL);
 
 extern int thirdperson;
 extern bool isthirdperson();
@@ -235,6 +237,9 @@ extern void renderentattachment(const extentity &e, extentity *ea = NULL); /* OF
 extern void renderentsphere(const extentity &e, float radius);
 extern void renderentring(const extentity &e, float radius, int axis = 0);
 
+// pvs
+extern bool pvsoccludedfrom(const vec &viewer, const vec &center, float radius);
+
 // main
 extern void fatal(const char *s, ...) PRINTFARGS(1, 2);
 
@@ -349,6 +354,8 @@ extern bool moveplatform(physent *p, const vec &dir);
 extern void updatephysstate(physent *d);
 extern void cleardynentcache();
 extern void updatedynentcache(physent *d);
+extern void updatedynents();
+extern int finddynents(const vec &bbmin, const vec &bbmax, vector<physent *> &found);
 extern bool entinmap(dynent *d, bool avoidplayers = false);
 
 // sound
@@ -0,0 +1,26 @@
+// profiler.hh: scoped, nestable cpu profiling zones recorded into per thread buffers
+
+enum { MAXPROFZONES = 512, MAXPROFDEPTH = 32 };
+
+extern int profiling;
+
+extern int profregister(const char *name);
+extern void profbegin(int zone);
+extern void profend();
+extern void profframe();
+extern void profthreadname(const char *name);
+
+struct profscope
+{
+    bool active;
+
+    profscope(int zone) : active(profiling != 0) { if(active) profbegin(zone); }
+    ~profscope() { if(active) profend(); }
+};
+
+// zone names are interned once per call site, the first time it runs
+#define PROFILEZONE(name, id) \
+    static const int profzone##id = profregister(name); \
+    profscope profscope##id(profzone##id)
+#define PROFILEZONEID(name, id) PROFILEZONE(name, id)
+#define PROFILE(name) PROFILEZONEID(name, __LINE__)
@@ -464,7 +464,7 @@ const char *addpackagedir(const char *dir)
 
 const char *findfile(const char *filename, const char *mode)
 {
-    static string s;
+    static thread_local string s;
     if(homedir[0])
     {
         formatstring(s, "%s%s", homedir, filename);
@@ -1112,6 +1112,185 @@ struct gzstream : stream
     }
 };
 
+// zstd frames in place of deflate: same interface as gzstream, much faster to
+// inflate; the crc is kept over the uncompressed data so map crcs still work
+
+VARP(zstdlevel, 1, 9, 22);
+
+struct zstdstream : stream
+{
+    enum
+    {
+        MAGIC   = 0xFD2FB528,
+        BUFSIZE = 1<<17
+    };
+
+    stream *file;
+    ZSTD_CStream *cstream;
+    ZSTD_DStream *dstream;
+    ZSTD_inBuffer in;
+    uchar *buf;
+    bool reading, writing;
+    uint crc;
+    offset start, total;
+
+    zstdstream() : file(NULL), cstream(NULL), dstream(NULL), buf(NULL), reading(false), writing(false), crc(0), start(0), total(0)
+    {
+        in.src = NULL;
+        in.size = in.pos = 0;
+    }
+
+    ~zstdstream()
+    {
+        close();
+    }
+
+    bool open(stream *f, const char *mode, bool needclose, int level)
+    {
+        if(file) return false;
+        for(; *mode; mode++)
+        {
+            if(*mode=='r') { reading = true; break; }
+            else if(*mode=='w') { writing = true; break; }
+        }
+        if(reading)
+        {
+            dstream = ZSTD_createDStream();
+            if(!dstream || ZSTD_isError(ZSTD_initDStream(dstream))) reading = false;
+        }
+        else if(writing)
+        {
+            cstream = ZSTD_createCStream();
+            if(!cstream || ZSTD_isError(ZSTD_initCStream(cstream, level > 0 ? level : zstdlevel))) writing = false;
+        }
+        if(!reading && !writing) { stopreading(); stopwriting(); return false; }
+
+        if (needclose) f->refcount = 0;
+        f->incref();
+        file = f;
+        start = max(file->tell(), offset(0));
+        crc = crc32(0, NULL, 0);
+        buf = new uchar[BUFSIZE];
+        in.src = buf;
+        return true;
+    }
+
+    uint getcrc() { return crc; }
+
+    void stopreading()
+    {
+        if(dstream) { ZSTD_freeDStream(dstream); dstream = NULL; }
+        reading = false;
+    }
+
+    bool writebuf(ZSTD_outBuffer &out)
+    {
+        if(out.pos && file->write(buf, out.pos) != out.pos) return false;
+        out.pos = 0;
+        return true;
+    }
+
+    bool flushbuf(bool end)
+    {
+        ZSTD_outBuffer out = { buf, BUFSIZE, 0 };
+        for(;;)
+        {
+            size_t left = end ? ZSTD_endStream(cstream, &out) : ZSTD_flushStream(cstream, &out);
+            if(ZSTD_isError(left) || !writebuf(out)) return false;
+            if(!left) return true;
+        }
+    }
+
+    void stopwriting()
+    {
+        if(cstream) { ZSTD_freeCStream(cstream); cstream = NULL; }
+        writing = false;
+    }
+
+    void close()
+    {
+        stopreading();
+        if(writing) flushbuf(true);
+        stopwriting();
+        DELETEA(buf);
+        if(file && file->decref()) DELETEP(file);
+        file = NULL;
+    }
+
+    bool end() { return !reading && !writing; }
+    offset tell() { return reading || writing ? total : offset(-1); }
+    offset rawtell() { return file ? file->tell() : offset(-1); }
+    offset rawsize() { return file ? file->size() : offset(-1); }
+
+    bool seek(offset pos, int whence)
+    {
+        if(writing || !reading) return false;
+
+        if(whence == SEEK_END)
+        {
+            uchar skip[512];
+            while(read(skip, sizeof(skip)) == sizeof(skip));
+            return !pos;
+        }
+        else if(whence == SEEK_CUR) pos += total;
+
+        if(pos >= total) pos -= total;
+        else if(pos < 0 || !file->seek(start, SEEK_SET)) return false;
+        else
+        {
+            ZSTD_initDStream(dstream);
+            in.size = in.pos = 0;
+            total = 0;
+            crc = crc32(0, NULL, 0);
+        }
+
+        uchar skip[512];
+        while(pos > 0)
+        {
+            size_t skipped = (size_t)min(pos, (offset)sizeof(skip));
+            if(read(skip, skipped) != skipped) { stopreading(); return false; }
+            pos -= skipped;
+        }
+
+        return true;
+    }
+
+    size_t read(void *dst, size_t len)
+    {
+        if(!reading || !dst || !len) return 0;
+        ZSTD_outBuffer out = { dst, len, 0 };
+        while(out.pos < out.size)
+        {
+            if(in.pos >= in.size)
+            {
+                in.size = file->read(buf, BUFSIZE);
+                in.pos = 0;
+                if(!in.size) { stopreading(); break; }
+            }
+            if(ZSTD_isError(ZSTD_decompressStream(dstream, &out, &in))) { stopreading(); break; }
+        }
+        crc = crc32(crc, (Bytef *)dst, out.pos);
+        total += out.pos;
+        return out.pos;
+    }
+
+    bool flush() { return writing && flushbuf(false) && file->flush(); }
+
+    size_t write(const void *src, size_t len)
+    {
+        if(!writing || !src || !len) return 0;
+        ZSTD_inBuffer data = { src, len, 0 };
+        ZSTD_outBuffer out = { buf, BUFSIZE, 0 };
+        while(data.pos < data.size)
+        {
+            if(ZSTD_isError(ZSTD_compressStream(cstream, &out, &data)) || !writebuf(out)) { stopwriting(); break; }
+        }
+        crc = crc32(crc, (Bytef *)src, data.pos);
+        total += data.pos;
+        return data.pos;
+    }
+};
+
 struct utf8stream : stream
 {
     enum
@@ -1320,6 +1499,132 @@ stream *opengzfile(const char *filename, const char *mode, stream *file, int lev
     return gz;
 }
 
+stream *openzstdfile(const char *filename, const char *mode, stream *file, int level)
+{
+    stream *source = file ? file : openfile(filename, mode);
+    if(!source) return NULL;
+    zstdstream *zs = new zstdstream;
+    if(!zs->open(source, mode, !file, level)) { if(!file) delete source; delete zs; return NULL; }
+    return zs;
+}
+
+// codec for newly written compressed files: 0 = gzip, 1 = zstd
+VARP(compresscodec, 0, 0, 1);
+
+// reads gzip or zstd depending on the magic, writes whatever compresscodec picks;
+// the level is a zlib level and only applies to gzip, zstd uses zstdlevel
+stream *opencompressedfile(const char *filename, const char *mode, stream *file, int level)
+{
+    const char *rw = mode + strcspn(mode, "rw");
+    if(*rw != 'r') return compresscodec ? openzstdfile(filename, mode, file) : opengzfile(filename, mode, file, level);
+    stream *source = file ? file : openfile(filename, mode);
+    if(!source) return NULL;
+    stream::offset pos = source->tell();
+    bool zstd = source->getlil<uint>() == zstdstream::MAGIC;
+    if(!source->seek(pos, SEEK_SET)) { if(!file) delete source; return NULL; }
+    stream *s = NULL;
+    if(zstd)
+    {
+        zstdstream *zs = new zstdstream;
+        if(zs->open(source, mode, !file, level)) s = zs;
+        else delete zs;
+    }
+    else
+    {
+        gzstream *gz = new gzstream;
+        if(gz->open(source, mode, !file, level)) s = gz;
+        else delete gz;
+    }
+    if(!s && !file) delete source;
+    return s;
+}
+
+// one-shot buffer compression for callers that chunk their own data
+void compressbuf(vector<uchar> &dst, const uchar *src, int len, int level)
+{
+    if(compresscodec)
+    {
+        size_t bound = ZSTD_compressBound(len);
+        size_t n = ZSTD_compress(dst.reserve(int(bound)).buf, bound, src, len, zstdlevel);
+        if(!ZSTD_isError(n)) { dst.advance(int(n)); return; }
+    }
+    uLongf n = compressBound(len);
+    if(compress2(dst.reserve(int(n)).buf, &n, src, len, level) == Z_OK) dst.advance(int(n));
+}
+
+bool uncompressbuf(uchar *dst, int dstlen, const uchar *src, int srclen)
+{
+    uint magic = 0;
+    if(srclen >= 4) memcpy(&magic, src, 4);
+    if(lilswap(magic) == zstdstream::MAGIC)
+    {
+        size_t n = ZSTD_decompress(dst, dstlen, src, srclen);
+        return !ZSTD_isError(n) && n == size_t(dstlen);
+    }
+    uLongf n = dstlen;
+    return uncompress(dst, &n, src, srclen) == Z_OK && n == uLongf(dstlen);
+}
+
+#ifndef STANDALONE
+static double benchcodec(memstream &src, memstream &packed, int codec, int iters, double &packsecs)
+{
+    int oldcodec = compresscodec;
+    compresscodec = codec;
+    Uint64 start = SDL_GetPerformanceCounter();
+    loopi(iters)
+    {
+        packed.reset();
+        stream *f = opencompressedfile(NULL, "wb", &packed);
+        if(f) { f->write(src.data.getbuf(), src.data.length()); delete f; }
+    }
+    packsecs = double(SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency();
+    compresscodec = oldcodec;
+
+    uchar buf[1<<16];
+    start = SDL_GetPerformanceCounter();
+    loopi(iters)
+    {
+        packed.pos = 0;
+        stream *f = opencompressedfile(NULL, "rb", &packed);
+        if(!f) break;
+        while(f->read(buf, sizeof(buf)) == sizeof(buf));
+        delete f;
+    }
+    return double(SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency();
+}
+
+// packs and unpacks a file's contents in memory with each codec
+void compressbench(const char *name, int *numiters)
+{
+    int iters = max(*numiters, 1);
+    stream *f = opencompressedfile(name, "rb");
+    if(!f) f = openfile(name, "rb");
+    if(!f) { conoutf(CON_ERROR, "could not read %s", name); return; }
+    memstream src, packed;
+    for(;;)
+    {
+        databuf<uchar> buf = src.data.reserve(1<<16);
+        size_t n = f->read(buf.buf, buf.maxlen);
+        if(!n) break;
+        src.data.advance(int(n));
+    }
+    delete f;
+    if(src.data.empty()) { conoutf(CON_ERROR, "%s is empty", name); return; }
+
+    static const char * const codecnames[2] = { "gzip", "zstd" };
+    double mb = src.data.length()*double(iters)/(1024.0*1024.0);
+    loopi(2)
+    {
+        double packsecs, unpacksecs = benchcodec(src, packed, i, iters, packsecs);
+        conoutf("compressbench %s: %.1f KB -> %.1f KB (%.1f%%), pack %.1f MB/s, unpack %.1f MB/s",
+            codecnames[i], src.data.length()/1024.0, packed.data.length()/1024.0, packed.data.length()*100.0/src.data.length(),
+            mb/max(packsecs, 1e-6), mb/max(unpacksecs, 1e-6));
+    }
+}
+
+COMMAND(compressbench, "si");
+#endif
+
 stream *openutf8file(const char *filename, const char *mode, stream *file)
 {
     stream *source = file ? file : openfile(filename, mode);
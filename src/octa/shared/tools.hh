@@ -1253,6 +1253,47 @@ struct streambuf
     size_t length() { return s->size(); }
 };
 
+// growable stream kept entirely in memory
+struct memstream : stream
+{
+    vector<uchar> data;
+    int pos;
+
+    memstream() : pos(0) {}
+
+    void close() {}
+    bool end() { return pos >= data.length(); }
+    offset tell() { return pos; }
+    offset size() { return data.length(); }
+
+    bool seek(offset off, int whence)
+    {
+        offset npos = whence == SEEK_CUR ? pos + off : (whence == SEEK_END ? data.length() + off : off);
+        if(npos < 0 || npos > data.length()) return false;
+        pos = int(npos);
+        return true;
+    }
+
+    size_t read(void *buf, size_t len)
+    {
+        int n = min(int(len), data.length() - pos);
+        if(n <= 0) return 0;
+        memcpy(buf, &data[pos], n);
+        pos += n;
+        return n;
+    }
+
+    size_t write(const void *buf, size_t len)
+    {
+        if(pos + int(len) > data.length()) data.pad(pos + int(len) - data.length());
+        memcpy(&data[pos], buf, len);
+        pos += int(len);
+        return len;
+    }
+
+    void reset() { data.setsize(0); pos = 0; }
+};
+
 enum
 {
     CT_PRINT   = 1<<0,
@@ -1317,6 +1358,10 @@ extern stream *openzipfile(const char *filename, const char *mode);
 extern stream *openfile(const char *filename, const char *mode);
 extern stream *opentempfile(const char *filename, const char *mode);
 extern stream *opengzfile(const char *filename, const char *mode, stream *file = NULL, int level = Z_BEST_COMPRESSION);
+extern stream *openzstdfile(const char *filename, const char *mode, stream *file = NULL, int level = -1);
+extern stream *opencompressedfile(const char *filename, const char *mode, stream *file = NULL, int level = Z_BEST_COMPRESSION);
+extern void compressbuf(vector<uchar> &dst, const uchar *src, int len, int level = Z_BEST_COMPRESSION);
+extern bool uncompressbuf(uchar *dst, int dstlen, const uchar *src, int srclen);
 extern stream *openutf8file(const char *filename, const char *mode, stream *file = NULL);
 extern char *loadfile(const char *fn, size_t *size, bool utf8 = true);
 extern bool listdir(const char *dir, bool rel, const char *ext, vector<char *> &files, int filter = FTYPE_FILE|FTYPE_DIR);
@@ -2,6 +2,13 @@
 
 #include "ostd/filesystem.hh"
 
+#ifdef WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#include <errno.h>
+#endif
+
 enum
 {
     ZIP_LOCAL_FILE_SIGNATURE = 0x04034B50,
@@ -37,12 +44,15 @@ struct zipdirectoryheader
     ushort commentlength;
 };
 
+struct zipcacheentry;
+
 struct zipfile
 {
     char *name;
     uint header, offset, size, compressedsize;
+    zipcacheentry *cached;
 
-    zipfile() : name(NULL), header(0), offset(~0U), size(0), compressedsize(0)
+    zipfile() : name(NULL), header(0), offset(~0U), size(0), compressedsize(0), cached(NULL)
     {
     }
     ~zipfile()
@@ -51,17 +61,16 @@ struct zipfile
     }
 };
 
-struct zipstream;
-
+// the archive handle is only ever read with positioned reads, so any
+// number of streams on any threads can read from it at once
 struct ziparchive
 {
     char *name;
     FILE *data;
     hashtable<const char *, zipfile> files;
     int openfiles;
-    zipstream *owner;
 
-    ziparchive() : name(NULL), data(NULL), files(512), openfiles(0), owner(NULL)
+    ziparchive() : name(NULL), data(NULL), files(512), openfiles(0)
     {
     }
     ~ziparchive()
@@ -71,6 +80,38 @@ struct ziparchive
     }
 };
 
+#ifndef STANDALONE
+// guards open file counts, lazily resolved data offsets and the entry cache
+static SDL_mutex *zipmutex = NULL;
+#define LOCKZIP SDL_LockMutex(zipmutex)
+#define UNLOCKZIP SDL_UnlockMutex(zipmutex)
+#else
+#define LOCKZIP
+#define UNLOCKZIP
+#endif
+
+static size_t zipread(ziparchive *a, void *buf, size_t len, uint offset)
+{
+#ifdef WIN32
+    OVERLAPPED ov;
+    memset(&ov, 0, sizeof(ov));
+    ov.Offset = offset;
+    DWORD n = 0;
+    if(!ReadFile((HANDLE)_get_osfhandle(_fileno(a->data)), buf, DWORD(len), &n, &ov)) return 0;
+    return n;
+#else
+    size_t total = 0;
+    while(total < len)
+    {
+        ssize_t n = pread(fileno(a->data), (uchar *)buf + total, len - total, off_t(offset) + off_t(total));
+        if(n < 0 && errno == EINTR) continue;
+        if(n <= 0) break;
+        total += n;
+    }
+    return total;
+#endif
+}
+
 static bool findzipdirectory(FILE *f, zipdirectoryheader &hdr)
 {
     if(fseek(f, 0, SEEK_END) < 0) return false;
@@ -172,10 +213,10 @@ static bool readzipdirectory(const char *archname, FILE *f, int entries, int off
     return files.length() > 0;
 }
 
-static bool readlocalfileheader(FILE *f, ziplocalfileheader &h, uint offset)
+static bool readlocalfileheader(ziparchive *a, ziplocalfileheader &h, uint offset)
 {
     uchar buf[ZIP_LOCAL_FILE_SIZE];
-    if(fseek(f, offset, SEEK_SET) < 0 || fread(buf, 1, ZIP_LOCAL_FILE_SIZE, f) != ZIP_LOCAL_FILE_SIZE)
+    if(zipread(a, buf, ZIP_LOCAL_FILE_SIZE, offset) != ZIP_LOCAL_FILE_SIZE)
         return false;
     uchar *src = buf;
     h.signature = lilswap(*(uint *)src); src += 4;
@@ -264,8 +305,65 @@ static void mountzip(ziparchive &arch, vector<zipfile> &files, const char *mount
     }
 }
 
+#ifndef STANDALONE
+// decompressed entries are kept around and shared between readers; an
+// evicted entry lives on until its last reader closes it
+struct zipcacheentry
+{
+    ziparchive *arch;
+    zipfile *file;
+    uchar *data;
+    uint size, lastuse;
+    int refs;
+
+    zipcacheentry(ziparchive *arch, zipfile *file, uchar *data) : arch(arch), file(file), data(data), size(file->size), lastuse(0), refs(0)
+    {
+    }
+    ~zipcacheentry()
+    {
+        DELETEA(data);
+    }
+};
+
+static vector<zipcacheentry *> zipcache;
+static uint zipcacheused = 0, zipcacheclock = 0;
+static int zipcachehits = 0, zipcachemisses = 0;
+
+static void evictzipcache(zipcacheentry *e)
+{
+    zipcache.removeobj(e);
+    zipcacheused -= e->size;
+    e->file->cached = NULL;
+    e->file = NULL;
+    if(!e->refs) delete e;
+}
+
+static void trimzipcache(uint limit)
+{
+    while(zipcacheused > limit && zipcache.length())
+    {
+        int oldest = 0;
+        loopv(zipcache) if(zipcache[i]->lastuse < zipcache[oldest]->lastuse) oldest = i;
+        evictzipcache(zipcache[oldest]);
+    }
+}
+
+static void flushzipcache(ziparchive *arch = NULL)
+{
+    LOCKZIP;
+    loopvrev(zipcache) if(!arch || zipcache[i]->arch == arch) evictzipcache(zipcache[i]);
+    UNLOCKZIP;
+}
+
+VARFP(zipcachesize, 0, 32, 1024, { LOCKZIP; trimzipcache(uint(zipcachesize)<<20); UNLOCKZIP; });
+#endif
+
 bool addzip(const char *name, const char *mount = NULL, const char *strip = NULL)
 {
+#ifndef STANDALONE
+    if(!zipmutex) zipmutex = SDL_CreateMutex();
+#endif
+
     string pname;
     copystring(pname, name);
     path(pname);
@@ -317,11 +415,17 @@ bool removezip(const char *name)
         conoutf(CON_ERROR, "zip %s is not loaded", pname);
         return false;
     }
-    if(exists->openfiles)
+    LOCKZIP;
+    int openfiles = exists->openfiles;
+    UNLOCKZIP;
+    if(openfiles)
     {
         conoutf(CON_ERROR, "zip %s has open files", pname);
         return false;
     }
+#ifndef STANDALONE
+    flushzipcache(exists);
+#endif
     conoutf("removed zip %s", exists->name);
     archives.removeobj(exists);
     delete exists;
@@ -360,31 +464,28 @@ struct zipstream : stream
     {
         if(!zfile.avail_in) zfile.next_in = (Bytef *)buf;
         size = min(size, uint(&buf[BUFSIZE] - &zfile.next_in[zfile.avail_in]));
-        if(arch->owner != this)
-        {
-            arch->owner = NULL;
-            if(fseek(arch->data, reading, SEEK_SET) >= 0) arch->owner = this;
-            else return;
-        }
         uint remaining = info->offset + info->compressedsize - reading,
-             n = arch->owner == this ? fread(zfile.next_in + zfile.avail_in, 1, min(size, remaining), arch->data) : 0U;
+             n = zipread(arch, zfile.next_in + zfile.avail_in, min(size, remaining), reading);
         zfile.avail_in += n;
         reading += n;
     }
 
     bool open(ziparchive *a, zipfile *f)
     {
+        LOCKZIP;
         if(f->offset == ~0U)
         {
             ziplocalfileheader h;
-            a->owner = NULL;
-            if(!readlocalfileheader(a->data, h, f->header)) return false;
+            if(!readlocalfileheader(a, h, f->header)) { UNLOCKZIP; return false; }
             f->offset = f->header + ZIP_LOCAL_FILE_SIZE + h.namelength + h.extralength;
         }
+        UNLOCKZIP;
 
         if(f->compressedsize && inflateInit2(&zfile, -MAX_WBITS) != Z_OK) return false;
 
+        LOCKZIP;
         a->openfiles++;
+        UNLOCKZIP;
         arch = a;
         info = f;
         reading = f->offset;
@@ -407,7 +508,13 @@ struct zipstream : stream
     {
         stopreading();
         DELETEA(buf);
-        if(arch) { arch->owner = NULL; arch->openfiles--; arch = NULL; }
+        if(arch)
+        {
+            LOCKZIP;
+            arch->openfiles--;
+            UNLOCKZIP;
+            arch = NULL;
+        }
     }
 
     offset size() { return info->size; }
@@ -427,9 +534,6 @@ struct zipstream : stream
                 default: return false;
             }
             pos = clamp(pos, offset(info->offset), offset(info->offset + info->size));
-            arch->owner = NULL;
-            if(fseek(arch->data, int(pos), SEEK_SET) < 0) return false;
-            arch->owner = this;
             reading = pos;
             ended = false;
             return true;
@@ -449,7 +553,6 @@ struct zipstream : stream
             zfile.next_in += zfile.avail_in;
             zfile.avail_in = 0;
             zfile.total_in = info->compressedsize;
-            arch->owner = NULL;
             ended = false;
             return true;
         }
@@ -465,7 +568,6 @@ struct zipstream : stream
             }
             else
             {
-                arch->owner = NULL;
                 zfile.avail_in = 0;
                 zfile.next_in = NULL;
                 reading = info->offset;
@@ -490,14 +592,7 @@ struct zipstream : stream
         if(reading == ~0U || !buf || !len) return 0;
         if(!info->compressedsize)
         {
-            if(arch->owner != this)
-            {
-                arch->owner = NULL;
-                if(fseek(arch->data, reading, SEEK_SET) < 0) { stopreading(); return 0; }
-                arch->owner = this;
-            }
-
-            size_t n = fread(buf, 1, min(len, size_t(info->size + info->offset - reading)), arch->data);
+            size_t n = zipread(arch, buf, min(len, size_t(info->size + info->offset - reading)), reading);
             reading += n;
             if(n < len) ended = true;
             return n;
@@ -526,6 +621,104 @@ struct zipstream : stream
     }
 };
 
+#ifndef STANDALONE
+struct zipcachestream : stream
+{
+    ziparchive *arch;
+    zipcacheentry *entry;
+    uint pos;
+
+    zipcachestream(ziparchive *arch, zipcacheentry *entry) : arch(arch), entry(entry), pos(0)
+    {
+    }
+
+    ~zipcachestream()
+    {
+        close();
+    }
+
+    void close()
+    {
+        if(!entry) return;
+        LOCKZIP;
+        if(!--entry->refs && !entry->file) delete entry;
+        arch->openfiles--;
+        UNLOCKZIP;
+        entry = NULL;
+    }
+
+    offset size() { return entry ? offset(entry->size) : offset(-1); }
+    bool end() { return !entry || pos >= entry->size; }
+    offset tell() { return entry ? offset(pos) : offset(-1); }
+
+    bool seek(offset off, int whence)
+    {
+        if(!entry) return false;
+        switch(whence)
+        {
+            case SEEK_END: off += entry->size; break;
+            case SEEK_CUR: off += pos; break;
+            case SEEK_SET: break;
+            default: return false;
+        }
+        if(off < 0) return false;
+        pos = uint(min(off, offset(entry->size)));
+        return true;
+    }
+
+    size_t read(void *buf, size_t len)
+    {
+        if(!entry) return 0;
+        len = min(len, size_t(entry->size - pos));
+        memcpy(buf, &entry->data[pos], len);
+        pos += len;
+        return len;
+    }
+};
+
+static stream *opencachedzip(ziparchive *arch, zipfile *f)
+{
+    uint limit = uint(zipcachesize)<<20;
+    if(f->size > limit/4) return NULL;
+
+    LOCKZIP;
+    zipcacheentry *e = f->cached;
+    if(e)
+    {
+        zipcachehits++;
+        e->refs++;
+        e->lastuse = ++zipcacheclock;
+        arch->openfiles++;
+    }
+    UNLOCKZIP;
+    if(e) return new zipcachestream(arch, e);
+
+    zipstream z;
+    if(!z.open(arch, f)) return NULL;
+    uchar *data = new uchar[f->size];
+    size_t len = z.read(data, f->size);
+    z.close();
+    if(len != f->size) { delete[] data; return NULL; }
+
+    LOCKZIP;
+    zipcachemisses++;
+    e = f->cached;
+    if(e) delete[] data;
+    else
+    {
+        e = f->cached = new zipcacheentry(arch, f, data);
+        zipcache.add(e);
+        zipcacheused += e->size;
+    }
+    e->refs++;
+    e->lastuse = ++zipcacheclock;
+    arch->openfiles++;
+    trimzipcache(limit);
+    UNLOCKZIP;
+    return new zipcachestream(arch, e);
+}
+#endif
+
 stream *openzipfile(const char *name, const char *mode)
 {
     for(; *mode; mode++) if(*mode=='w' || *mode=='a') return NULL;
@@ -534,6 +727,10 @@ stream *openzipfile(const char *name, const char *mode)
         ziparchive *arch = archives[i];
         zipfile *f = arch->files.access(name);
         if(!f) continue;
+#ifndef STANDALONE
+        stream *c = opencachedzip(arch, f);
+        if(c) return c;
+#endif
         zipstream *s = new zipstream;
         if(s->open(arch, f)) return s;
         delete s;
@@ -583,6 +780,75 @@ int listzipfiles(const char *dir, const char *ext, vector<char *> &files)
 }
 
 #ifndef STANDALONE
+struct zipbenchworker
+{
+    SDL_Thread *thread;
+    int id;
+    llong bytes;
+};
+
+static vector<const char *> zipbenchnames;
+
+static int zipbenchthread(void *data)
+{
+    zipbenchworker *w = (zipbenchworker *)data;
+    uchar buf[16384];
+    loopv(zipbenchnames)
+    {
+        stream *f = openzipfile(zipbenchnames[(i + w->id) % zipbenchnames.length()], "rb");
+        if(!f) continue;
+        for(;;)
+        {
+            size_t n = f->read(buf, sizeof(buf));
+            if(!n) break;
+            w->bytes += n;
+        }
+        delete f;
+    }
+    return 0;
+}
+
+void zipbench(int *numentries, int *numthreads)
+{
+    int maxentries = *numentries > 0 ? *numentries : 256, threads = clamp(*numthreads > 0 ? *numthreads : SDL_GetCPUCount(), 1, 64);
+    zipbenchnames.setsize(0);
+    loopv(archives)
+    {
+        enumerate(archives[i]->files, zipfile, f,
+        {
+            if(zipbenchnames.length() < maxentries) zipbenchnames.add(f.name);
+        });
+    }
+    if(zipbenchnames.empty()) { conoutf(CON_ERROR, "no zip entries to read"); return; }
+
+    zipbenchworker workers[64];
+    loop(pass, 2)
+    {
+        if(!pass) flushzipcache();
+        int hits = zipcachehits, misses = zipcachemisses;
+        Uint64 start = SDL_GetPerformanceCounter();
+        loopi(threads)
+        {
+            workers[i].id = i;
+            workers[i].bytes = 0;
+            workers[i].thread = SDL_CreateThread(zipbenchthread, "zip bench", &workers[i]);
+        }
+        llong bytes = 0;
+        loopi(threads)
+        {
+            SDL_WaitThread(workers[i].thread, NULL);
+            bytes += workers[i].bytes;
+        }
+        double secs = double(SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency();
+        conoutf("zipbench %s: %d entries x %d threads, %.1f MB in %.3f s (%.1f MB/s), cache %d hits, %d misses",
+            pass ? "warm" : "cold", zipbenchnames.length(), threads, bytes/(1024.0*1024.0), secs, bytes/(1024.0*1024.0)/max(secs, 1e-6),
+            zipcachehits - hits, zipcachemisses - misses);
+    }
+    zipbenchnames.setsize(0);
+}
+
+COMMAND(zipbench, "ii");
+
 ICOMMAND(addzip, "sss", (const char *name, const char *mount, const char *strip), addzip(name, mount[0] ? mount : NULL, strip[0] ? strip : NULL));
 ICOMMAND(removezip, "s", (const char *name), removezip(name));
 #endif